@@ -38,6 +38,8 @@
 #include <stdio.h>
 #include <OpenIPMI/ipmiif.h>
 #include <OpenIPMI/ipmi_cmdlang.h>
+#include <OpenIPMI/ipmi_mc.h>
+#include <OpenIPMI/ipmi_err.h>
 
 /* Internal includes, do not use in your programs */
 #include <OpenIPMI/internal/ipmi_malloc.h>
@@ -325,30 +327,17 @@ sensor_info(ipmi_sensor_t *sensor, void *cb_data)
 }
 
 static void
-read_sensor(ipmi_sensor_t             *sensor,
-	    int                       err,
-	    enum ipmi_value_present_e value_present,
-	    unsigned int              raw_val,
-	    double                    val,
-	    ipmi_states_t             *states,
-	    void                      *cb_data)
+sensor_out_reading(ipmi_cmd_info_t           *cmd_info,
+		   ipmi_sensor_t             *sensor,
+		   enum ipmi_value_present_e value_present,
+		   unsigned int              raw_val,
+		   double                    val,
+		   ipmi_states_t             *states)
 {
-    ipmi_cmd_info_t    *cmd_info = cb_data;
-    ipmi_cmdlang_t     *cmdlang = ipmi_cmdinfo_get_cmdlang(cmd_info);
     enum ipmi_thresh_e thresh;
     char               sensor_name[IPMI_SENSOR_NAME_LEN];
     int                rv;
 
-    ipmi_cmdlang_lock(cmd_info);
-    if (err) {
-	cmdlang->errstr = "Error reading sensor";
-	cmdlang->err = err;
-	ipmi_sensor_get_name(sensor, cmdlang->objstr,
-			     cmdlang->objstr_len);
-	cmdlang->location = "cmd_sensor.c(read_sensor)";
-	goto out;
-    }
-
     ipmi_sensor_get_name(sensor, sensor_name, sizeof(sensor_name));
 
     ipmi_cmdlang_out(cmd_info, "Sensor", NULL);
@@ -391,33 +380,16 @@ read_sensor(ipmi_sensor_t             *sensor,
 	ipmi_cmdlang_up(cmd_info);
     }
     ipmi_cmdlang_up(cmd_info);
-
- out:
-    ipmi_cmdlang_unlock(cmd_info);
-    ipmi_cmdlang_cmd_info_put(cmd_info);
 }
 
 static void
-read_sensor_states(ipmi_sensor_t *sensor,
-		   int           err,
-		   ipmi_states_t *states,
-		   void          *cb_data)
+sensor_out_states(ipmi_cmd_info_t *cmd_info,
+		  ipmi_sensor_t   *sensor,
+		  ipmi_states_t   *states)
 {
-    ipmi_cmd_info_t *cmd_info = cb_data;
-    ipmi_cmdlang_t  *cmdlang = ipmi_cmdinfo_get_cmdlang(cmd_info);
-    int             i;
-    char            sensor_name[IPMI_SENSOR_NAME_LEN];
-    int             rv;
-
-    ipmi_cmdlang_lock(cmd_info);
-    if (err) {
-	cmdlang->errstr = "Error reading sensor";
-	cmdlang->err = err;
-	ipmi_sensor_get_name(sensor, cmdlang->objstr,
-			     cmdlang->objstr_len);
-	cmdlang->location = "cmd_sensor.c(read_sensor_states)";
-	goto out;
-    }
+    int  i;
+    char sensor_name[IPMI_SENSOR_NAME_LEN];
+    int  rv;
 
     ipmi_sensor_get_name(sensor, sensor_name, sizeof(sensor_name));
 
@@ -449,6 +421,57 @@ read_sensor_states(ipmi_sensor_t *sensor,
 	ipmi_cmdlang_up(cmd_info);
     }
     ipmi_cmdlang_up(cmd_info);
+}
+
+static void
+read_sensor(ipmi_sensor_t             *sensor,
+	    int                       err,
+	    enum ipmi_value_present_e value_present,
+	    unsigned int              raw_val,
+	    double                    val,
+	    ipmi_states_t             *states,
+	    void                      *cb_data)
+{
+    ipmi_cmd_info_t *cmd_info = cb_data;
+    ipmi_cmdlang_t  *cmdlang = ipmi_cmdinfo_get_cmdlang(cmd_info);
+
+    ipmi_cmdlang_lock(cmd_info);
+    if (err) {
+	cmdlang->errstr = "Error reading sensor";
+	cmdlang->err = err;
+	ipmi_sensor_get_name(sensor, cmdlang->objstr,
+			     cmdlang->objstr_len);
+	cmdlang->location = "cmd_sensor.c(read_sensor)";
+	goto out;
+    }
+
+    sensor_out_reading(cmd_info, sensor, value_present, raw_val, val, states);
+
+ out:
+    ipmi_cmdlang_unlock(cmd_info);
+    ipmi_cmdlang_cmd_info_put(cmd_info);
+}
+
+static void
+read_sensor_states(ipmi_sensor_t *sensor,
+		   int           err,
+		   ipmi_states_t *states,
+		   void          *cb_data)
+{
+    ipmi_cmd_info_t *cmd_info = cb_data;
+    ipmi_cmdlang_t  *cmdlang = ipmi_cmdinfo_get_cmdlang(cmd_info);
+
+    ipmi_cmdlang_lock(cmd_info);
+    if (err) {
+	cmdlang->errstr = "Error reading sensor";
+	cmdlang->err = err;
+	ipmi_sensor_get_name(sensor, cmdlang->objstr,
+			     cmdlang->objstr_len);
+	cmdlang->location = "cmd_sensor.c(read_sensor_states)";
+	goto out;
+    }
+
+    sensor_out_states(cmd_info, sensor, states);
 
  out:
     ipmi_cmdlang_unlock(cmd_info);
@@ -480,6 +503,114 @@ sensor_get(ipmi_sensor_t *sensor, void *cb_data)
     }
 }
 
+typedef struct sensor_sweep_out_s
+{
+    ipmi_cmd_info_t            *cmd_info;
+    ipmi_sensor_sweep_result_t *res;
+} sensor_sweep_out_t;
+
+static void
+sensor_sweep_out(ipmi_sensor_t *sensor, void *cb_data)
+{
+    sensor_sweep_out_t         *info = cb_data;
+    ipmi_cmd_info_t            *cmd_info = info->cmd_info;
+    ipmi_sensor_sweep_result_t *res = info->res;
+    char                       sensor_name[IPMI_SENSOR_NAME_LEN];
+    char                       errval[128];
+
+    if (res->err) {
+	ipmi_sensor_get_name(sensor, sensor_name, sizeof(sensor_name));
+	ipmi_cmdlang_out(cmd_info, "Sensor", NULL);
+	ipmi_cmdlang_down(cmd_info);
+	ipmi_cmdlang_out(cmd_info, "Name", sensor_name);
+	ipmi_cmdlang_out_int(cmd_info, "Error", res->err);
+	ipmi_cmdlang_out(cmd_info, "Error String",
+			 ipmi_get_error_string(res->err, errval,
+					       sizeof(errval)));
+	ipmi_cmdlang_up(cmd_info);
+    } else if (ipmi_sensor_get_event_reading_type(sensor)
+	       == IPMI_EVENT_READING_TYPE_THRESHOLD)
+    {
+	sensor_out_reading(cmd_info, sensor, res->value_present,
+			   res->raw_value, res->val, res->states);
+    } else {
+	sensor_out_states(cmd_info, sensor, res->states);
+    }
+}
+
+static void
+sensor_sweep_done(ipmi_domain_t              *domain,
+		  int                        err,
+		  ipmi_sensor_sweep_result_t *results,
+		  unsigned int               count,
+		  void                       *cb_data)
+{
+    ipmi_cmd_info_t    *cmd_info = cb_data;
+    ipmi_cmdlang_t     *cmdlang = ipmi_cmdinfo_get_cmdlang(cmd_info);
+    sensor_sweep_out_t info;
+    unsigned int       i;
+
+    ipmi_cmdlang_lock(cmd_info);
+    if (err) {
+	cmdlang->errstr = "Error sweeping sensors";
+	cmdlang->err = err;
+	if (domain)
+	    ipmi_domain_get_name(domain, cmdlang->objstr,
+				 cmdlang->objstr_len);
+	cmdlang->location = "cmd_sensor.c(sensor_sweep_done)";
+	goto out;
+    }
+
+    info.cmd_info = cmd_info;
+    for (i=0; i<count; i++) {
+	info.res = &results[i];
+	/* If the sensor went away there is nothing to print. */
+	ipmi_sensor_pointer_cb(results[i].sensor_id, sensor_sweep_out, &info);
+    }
+
+ out:
+    ipmi_cmdlang_unlock(cmd_info);
+    ipmi_cmdlang_cmd_info_put(cmd_info);
+}
+
+static void
+sensor_sweep(ipmi_domain_t *domain, void *cb_data)
+{
+    ipmi_cmd_info_t *cmd_info = cb_data;
+    ipmi_cmdlang_t  *cmdlang = ipmi_cmdinfo_get_cmdlang(cmd_info);
+    int             rv;
+
+    ipmi_cmdlang_cmd_info_get(cmd_info);
+    rv = ipmi_domain_sweep_sensors(domain, NULL, 0, sensor_sweep_done,
+				   cmd_info);
+    if (rv) {
+	ipmi_cmdlang_cmd_info_put(cmd_info);
+	cmdlang->err = rv;
+	cmdlang->errstr = "Error sweeping sensors";
+	ipmi_domain_get_name(domain, cmdlang->objstr,
+			     cmdlang->objstr_len);
+	cmdlang->location = "cmd_sensor.c(sensor_sweep)";
+    }
+}
+
+static void
+sensor_sweep_mc(ipmi_mc_t *mc, void *cb_data)
+{
+    ipmi_cmd_info_t *cmd_info = cb_data;
+    ipmi_cmdlang_t  *cmdlang = ipmi_cmdinfo_get_cmdlang(cmd_info);
+    int             rv;
+
+    ipmi_cmdlang_cmd_info_get(cmd_info);
+    rv = ipmi_mc_sweep_sensors(mc, sensor_sweep_done, cmd_info);
+    if (rv) {
+	ipmi_cmdlang_cmd_info_put(cmd_info);
+	cmdlang->err = rv;
+	cmdlang->errstr = "Error sweeping sensors";
+	ipmi_mc_get_name(mc, cmdlang->objstr, cmdlang->objstr_len);
+	cmdlang->location = "cmd_sensor.c(sensor_sweep_mc)";
+    }
+}
+
 static void
 sensor_rearm_done(ipmi_sensor_t *sensor,
 		  int           err,
@@ -1394,6 +1525,14 @@ static ipmi_cmdlang_init_t cmds_sensor[] =
     { "get", &sensor_cmds,
       "<sensor> - Get the sensor's current reading",
       ipmi_cmdlang_sensor_handler, sensor_get, NULL },
+    { "sweep", &sensor_cmds,
+      "<domain> - Get the current reading of every sensor in the domain."
+      "  The readings are fetched together, this is much faster than"
+      " getting each sensor on its own",
+      ipmi_cmdlang_domain_handler, sensor_sweep, NULL },
+    { "sweep_mc", &sensor_cmds,
+      "<mc> - Get the current reading of every sensor on the MC",
+      ipmi_cmdlang_mc_handler, sensor_sweep_mc, NULL },
     { "rearm", &sensor_cmds,
       "<sensor> global | <thresholds> | <discrete states> - "
       " Rearm the sensor.  If global is specified, then rearm"
@@ -129,6 +129,12 @@ int ilist_delete(ilist_iter_t *iter); /* Position on next element after del */
 IPMI_UTILS_DLL_PUBLIC
 void ilist_unpositioned(ilist_iter_t *iter);
 
+/* Position the iterator on an item.  The entry must be the one that
+   was supplied when the item was added, and the item must still be
+   in the iterator's list. */
+IPMI_UTILS_DLL_PUBLIC
+void ilist_position_at(ilist_iter_t *iter, ilist_item_t *entry);
+
 /* Returns NULL if unpositioned or list empty. */
 IPMI_UTILS_DLL_PUBLIC
 void *ilist_get(ilist_iter_t *iter);
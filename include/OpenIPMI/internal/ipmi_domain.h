@@ -262,6 +262,11 @@ int i_ipmi_domain_get_connection(ipmi_domain_t *domain,
 				 int           con_num,
 				 ipmi_con_t    **con);
 
+/* Return how many commands the working connection can have
+   outstanding at once, for code that pipelines commands.  Returns 0
+   if the connection doesn't say. */
+unsigned int i_ipmi_domain_get_max_outstanding_msgs(ipmi_domain_t *domain);
+
 /* Option settings. */
 int ipmi_option_SDRs(ipmi_domain_t *domain);
 int ipmi_option_SEL(ipmi_domain_t *domain);
@@ -273,6 +278,7 @@ int ipmi_option_set_sel_time(ipmi_domain_t *domain);
 int ipmi_option_activate_if_possible(ipmi_domain_t *domain);
 int ipmi_option_local_only(ipmi_domain_t *domain);
 int ipmi_option_use_cache(ipmi_domain_t *domain);
+unsigned int ipmi_option_sel_speculate(ipmi_domain_t *domain);
 
 void i_ipmi_option_set_local_only_if_not_specified(ipmi_domain_t *domain,
 						   int           val);
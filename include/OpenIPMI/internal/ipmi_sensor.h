@@ -64,6 +64,10 @@ unsigned int ipmi_sensors_get_count(ipmi_sensor_info_t *sensors);
 /* Allocate a sensor, it will not be associated with anything yet. */
 int ipmi_sensor_alloc_nonstandard(ipmi_sensor_t **new_sensor);
 
+/* Free a sensor from ipmi_sensor_alloc_nonstandard() that has not been
+   added, if setting it up fails. */
+void ipmi_sensor_free_nonstandard(ipmi_sensor_t *sensor);
+
 typedef void (*ipmi_sensor_destroy_cb)(ipmi_sensor_t *sensor,
 				       void          *cb_data);
 
@@ -199,13 +203,16 @@ void ipmi_sensor_set_percentage(ipmi_sensor_t *sensor, int percentage);
 void ipmi_sensor_set_base_unit(ipmi_sensor_t *sensor, int base_unit);
 void ipmi_sensor_set_modifier_unit(ipmi_sensor_t *sensor, int modifier_unit);
 void ipmi_sensor_set_linearization(ipmi_sensor_t *sensor, int linearization);
-void ipmi_sensor_set_raw_m(ipmi_sensor_t *sensor, int idx, int val);
-void ipmi_sensor_set_raw_tolerance(ipmi_sensor_t *sensor, int idx, int val);
-void ipmi_sensor_set_raw_b(ipmi_sensor_t *sensor, int idx, int val);
-void ipmi_sensor_set_raw_accuracy(ipmi_sensor_t *sensor, int idx, int val);
-void ipmi_sensor_set_raw_accuracy_exp(ipmi_sensor_t *sensor, int idx, int val);
-void ipmi_sensor_set_raw_r_exp(ipmi_sensor_t *sensor, int idx, int val);
-void ipmi_sensor_set_raw_b_exp(ipmi_sensor_t *sensor, int idx, int val);
+/* The conversion factors may be shared with other sensors, so setting
+   one can require a private copy of the table.  These return ENOMEM
+   if that can't be allocated. */
+int ipmi_sensor_set_raw_m(ipmi_sensor_t *sensor, int idx, int val);
+int ipmi_sensor_set_raw_tolerance(ipmi_sensor_t *sensor, int idx, int val);
+int ipmi_sensor_set_raw_b(ipmi_sensor_t *sensor, int idx, int val);
+int ipmi_sensor_set_raw_accuracy(ipmi_sensor_t *sensor, int idx, int val);
+int ipmi_sensor_set_raw_accuracy_exp(ipmi_sensor_t *sensor, int idx, int val);
+int ipmi_sensor_set_raw_r_exp(ipmi_sensor_t *sensor, int idx, int val);
+int ipmi_sensor_set_raw_b_exp(ipmi_sensor_t *sensor, int idx, int val);
 void ipmi_sensor_set_normal_min_specified(ipmi_sensor_t *sensor,
 					  int           normal_min_specified);
 void ipmi_sensor_set_normal_max_specified(ipmi_sensor_t *sensor,
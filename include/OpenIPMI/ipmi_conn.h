@@ -432,6 +432,12 @@ struct ipmi_con_s
        in any event loop (before the fork) and there are no calls into
        the library.  After calling this you should call close. */
     void (*disable)(ipmi_con_t *ipmi);
+
+    /* Return how many commands the connection will have outstanding
+       to the BMC at once; more than this get queued in the
+       connection.  Users that pipeline commands use this to size
+       their window.  If NULL, assume 1. */
+    unsigned int (*get_max_outstanding_msgs)(ipmi_con_t *ipmi);
 };
 
 #define IPMI_CONN_NAME(c) (c->name ? c->name : "")
@@ -134,6 +134,15 @@ void ipmi_fru_iterate_frus(ipmi_domain_t   *domain,
 IPMI_DLL_PUBLIC
 unsigned int ipmi_fru_get_data_length(ipmi_fru_t *fru);
 
+/* Statistics for the last successful read of the FRU data: how long
+   it took to read the data (in microseconds) and the resulting rate
+   in bytes per second.  These are zero if the data has never been
+   read. */
+IPMI_DLL_PUBLIC
+unsigned int ipmi_fru_get_fetch_usecs(ipmi_fru_t *fru);
+IPMI_DLL_PUBLIC
+unsigned int ipmi_fru_get_fetch_bytes_per_sec(ipmi_fru_t *fru);
+
 /* Used to track references to a FRU.  You can use this instead of
    ipmi_fru_destroy, but use of the destroy function is recommended.
    This is primarily here to help reference-tracking garbage
@@ -118,6 +118,40 @@ os_handler_t *ipmi_posix_thread_setup_os_handler(int wake_sig);
 SEL_DLL_PUBLIC
 struct selector_s *ipmi_posix_thread_os_handler_get_sel(os_handler_t *os_hnd);
 
+/**********************************************************************
+ * Like ipmi_posix_thread_setup_os_handler(), but split the work over
+ * num_loops independent selectors ("loops"), each with its own epoll
+ * fd, timers and locks, using timer_type (SEL_TIMERS_xxx) for the
+ * timers.  With one selector, all threads contend on the same locks
+ * and every fd and timer is handled by whichever thread gets there
+ * first.
+ *
+ * Each thread calling perform_one_op() or operation_loop() runs a
+ * single loop.  Threads are spread over the loops round-robin the
+ * first time they do this, unless they have picked a loop with
+ * ipmi_posix_thread_os_handler_set_loop().  You must have at least
+ * one thread running each loop.
+ *
+ * A file descriptor or timer belongs to the loop of the thread that
+ * added or allocated it, and its callbacks only run in that loop.  A
+ * thread that is not running a loop and has not picked one allocates
+ * from loop 0.  Since most things are allocated from callbacks of
+ * the same object, picking a loop before creating a domain or
+ * connection keeps almost all of its work in that loop.
+ *********************************************************************/
+SEL_DLL_PUBLIC
+os_handler_t *ipmi_posix_thread_setup_os_handler_loops(int wake_sig,
+						       unsigned int num_loops,
+						       int timer_type);
+/* Get the number of loops in the OS handler, 1 for normal handlers. */
+SEL_DLL_PUBLIC
+unsigned int ipmi_posix_thread_os_handler_num_loops(os_handler_t *os_hnd);
+/* Bind the calling thread to a loop, for both running and allocating.
+   Returns EINVAL if the loop number is out of range. */
+SEL_DLL_PUBLIC
+int ipmi_posix_thread_os_handler_set_loop(os_handler_t *os_hnd,
+					  unsigned int loop);
+
 /**********************************************************************
  * Special code, like the previous non-threaded ones.  Only needed
  * if you have special selector needs.  Don't use
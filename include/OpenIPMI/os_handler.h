@@ -328,9 +328,11 @@ struct os_handler_s
     void (*database_free)(os_handler_t  *handler,
 			  unsigned char *data);
     /* Sets the filename to use for the database to the one specified.
-       The meaning is system-dependent.  On *nix systems it defaults
-       to $HOME/.OpenIPMI_db.  This is for use by the user, OpenIPMI
-       proper does not use this. */
+       The meaning is system-dependent.  For the POSIX handlers it is
+       a directory holding one file per key, defaulting to
+       $HOME/.OpenIPMI_cache; the glib and tcl handlers use a gdbm
+       file defaulting to $HOME/.OpenIPMI_db.  This is for use by the
+       user, OpenIPMI proper does not use this. */
     int (*database_set_filename)(os_handler_t *handler,
 				 char         *name);
 
@@ -348,6 +350,13 @@ struct os_handler_s
 
     int (*get_monotonic_time)(os_handler_t *handler, struct timeval *tv);
     int (*get_real_time)(os_handler_t *handler, struct timeval *tv);
+
+    /* Return a number for the event loop that fds and timers added
+       by the calling thread will be handled in.  Things in different
+       loops may be handled by different threads, so code that shares
+       an fd between objects only shares it within a loop.  This may
+       be NULL if the handler runs everything in one loop. */
+    unsigned int (*get_loop_id)(os_handler_t *handler);
 };
 
 /* Only use these to allocate/free OS handlers. */
@@ -106,6 +106,42 @@ int sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 SEL_DLL_PUBLIC
 int sel_alloc_selector_nothread(struct selector_s **new_selector);
 
+/*
+ * Like sel_alloc_selector_thread(), but choose how timers are kept.
+ * SEL_TIMERS_HEAP is what the other allocators use, timers are kept
+ * in a heap sorted by timeout and go off at exactly their time.
+ * SEL_TIMERS_WHEEL keeps them in a hierarchical timer wheel, which
+ * makes starting and stopping a timer O(1) no matter how many are
+ * running, but rounds timeouts up to the next millisecond.  The wheel
+ * is better when there are many thousands of timers, most of which
+ * are stopped before they go off.  For a single threaded selector,
+ * pass 0 and NULLs for the wake signal, lock functions and cb_data.
+ */
+#define SEL_TIMERS_HEAP		0
+#define SEL_TIMERS_WHEEL	1
+SEL_DLL_PUBLIC
+int sel_alloc_selector_timers(struct selector_s **new_selector,
+			      int timer_type, int wake_sig,
+			      sel_lock_t *(*sel_lock_alloc)(void *cb_data),
+			      void (*sel_lock_free)(sel_lock_t *),
+			      void (*sel_lock)(sel_lock_t *),
+			      void (*sel_unlock)(sel_lock_t *),
+			      void *cb_data);
+
+/*
+ * Set the maximum number of ready file descriptors the selector will
+ * pull from epoll and handle in a single wait.  The default is 1,
+ * which gives the most even spread of fds between threads waiting on
+ * the same selector.  Larger values save a system call and a pass
+ * through the timers and runners per fd, which matters when many fds
+ * are busy.  The value must be between 1 and SEL_MAX_FD_EVENTS.  This
+ * has no effect when using select(), which always handles every
+ * ready fd.
+ */
+#define SEL_MAX_FD_EVENTS 64
+SEL_DLL_PUBLIC
+int sel_set_max_fd_events(struct selector_s *sel, unsigned int count);
+
 /* Used to destroy a selector. */
 SEL_DLL_PUBLIC
 int sel_free_selector(struct selector_s *new_selector);
@@ -64,10 +64,13 @@ extern "C" {
 #endif
 
 /*
- * Restrictions: <=64 sessions
+ * A session ID is the session handle shifted up one, with a sequence
+ * number above it to make it somewhat unique.  The handle takes
+ * SESSION_BITS_REQ bits for the default MAX_SESSIONS sessions, more
+ * if max_sessions is set higher in the configuration.
  */
 #define SESSION_BITS_REQ	6 /* Bits required to hold a session. */
-#define SESSION_MASK		0x3f
+#define MAX_SESSIONS_LIMIT	65535
 
 typedef struct session_s session_t;
 typedef struct lanserv_data_s lanserv_data_t;
@@ -137,6 +140,12 @@ struct session_s
     unsigned int rmcpplus : 1;
 
     int           handle; /* My index in the table. */
+    unsigned int  allocated : 1; /* Taken from the free list. */
+
+    /* On the free list when not allocated, otherwise on the list of
+       sessions in use. */
+    session_t     *next;
+    session_t     *prev;
 
     uint32_t        recv_seq;
     uint32_t        xmit_seq;
@@ -235,6 +244,11 @@ struct lanserv_data_s
        down if there is no activity. */
     unsigned int default_session_timeout;
 
+    /* The number of sessions the channel can have, MAX_SESSIONS if
+       not set.  Only up to MAX_SESSIONS is reported to clients, the
+       session count fields are 6 bits. */
+    unsigned int max_sessions;
+
     unsigned char *bmc_key;
 
     void *user_info;
@@ -250,8 +264,14 @@ struct lanserv_data_s
 
     /* Don't fill in the below in the user code. */
 
-    /* session 0 is not used. */
-    session_t sessions[MAX_SESSIONS+1];
+    /* max_sessions+1 of them, session 0 is not used.  Free sessions
+       are kept on a list, lowest handles first, and the ones in use
+       on another so the timeout tick only looks at those. */
+    session_t *sessions;
+    session_t *free_sessions;
+    session_t *used_sessions;
+    unsigned int session_bits;
+    uint32_t session_mask;
 
     /* Used to make the sid somewhat unique. */
     uint32_t sid_seq;
@@ -66,6 +66,19 @@ int write_persist(persist_t *p);
 int write_persist_file(persist_t *p, FILE *f);
 void free_persist(persist_t *p);
 
+/*
+ * Append the items in p to the journal for its name instead of
+ * rewriting the whole file.  read_persist() replays the journal on
+ * top of the file, an item in the journal replaces one of the same
+ * name.  write_persist() compacts, writing the full file and
+ * discarding the journal, so the user should do that once the
+ * journal gets big compared to the data.
+ */
+int append_persist(persist_t *p);
+
+/* Add a record to p that removes the named item when appended. */
+int add_persist_delete(persist_t *p, const char *name, ...);
+
 int add_persist_data(persist_t *p, void *data, unsigned int len,
 		     const char *name, ...);
 int read_persist_data(persist_t *p, void **data, unsigned int *len,
@@ -97,4 +110,16 @@ void free_persist_str(char *str);
 /* Can be set to zero to disable persistence. */
 extern int persist_enable;
 
+/*
+ * How hard to push persistent data to disk.  With PERSIST_SYNC_TICK
+ * journal appends are synced in groups when persist_tick() is
+ * called, full writes are always synced unless this is
+ * PERSIST_SYNC_NONE.  The default is PERSIST_SYNC_NONE.
+ */
+#define PERSIST_SYNC_NONE	0
+#define PERSIST_SYNC_WRITE	1
+#define PERSIST_SYNC_TICK	2
+extern int persist_sync;
+void persist_tick(void);
+
 #endif /* __PERSIST_H__ */
@@ -136,7 +136,7 @@ struct channel_s
     unsigned int privilege_limit_nonv : 4;
 
 #define MAX_SESSIONS 63
-    unsigned int active_sessions : 6;
+    unsigned int active_sessions;
 
     struct {
 	unsigned char allowed_auths;
@@ -576,6 +576,8 @@ ipmi_mc_destroy(lmc_data_t *mc)
 	free(entry);
 	entry = n_entry;
     }
+    if (mc->sel.recid_hash)
+	free(mc->sel.recid_hash);
     free(mc);
 }
 
@@ -70,11 +70,17 @@ typedef struct sel_entry_s
     uint16_t           record_id;
     unsigned char      data[16];
     struct sel_entry_s *next;
+    struct sel_entry_s *prev;
+    struct sel_entry_s *hash_next;
 } sel_entry_t;
 
 typedef struct sel_s
 {
     sel_entry_t   *entries;
+    sel_entry_t   *tail;
+    /* Record id index, a power of 2 sized hash of chains. */
+    sel_entry_t   **recid_hash;
+    unsigned int  recid_hash_size;
     int           count;
     int           max_count;
     uint32_t      last_add_time;
@@ -83,6 +89,8 @@ typedef struct sel_s
     uint16_t      reservation;
     uint16_t      next_entry;
     long          time_offset;
+    /* Records appended to the persist journal since it was compacted. */
+    unsigned int  journal_count;
 } sel_t;
 
 #define MAX_SDR_LENGTH 261
@@ -106,6 +114,7 @@ typedef struct sdrs_s
     unsigned char flags;
     uint16_t      next_entry;
     unsigned int  sdrs_length;
+    unsigned int  journal_count;
 
     /* A linked list of SDR entries. */
     sdr_t         *sdrs;
@@ -152,8 +161,9 @@ struct sensor_s
     /* Called when the sensor changes values. */
     void (*sensor_update_handler)(lmc_data_t *mc, sensor_t *sensor);
 
-    ipmi_timer_t *poll_timer;
-    struct timeval poll_timer_time;
+    /* Polled sensors with the same poll rate share a timer. */
+    struct sensor_poll_group_s *poll_group;
+    sensor_t *poll_next;
     int (*poll)(void *cb_data, unsigned int *val, const char **errstr);
     void *cb_data;
 };
@@ -410,7 +410,7 @@ handle_get_channel_info(lmc_data_t    *mc,
     unsigned char medium_type;
     unsigned char protocol_type;
     unsigned char session_support;
-    unsigned char active_sessions;
+    unsigned int  active_sessions;
 
     if (msg->len < 1) {
 	rdata[0] = IPMI_REQUEST_DATA_LENGTH_INVALID_CC;
@@ -444,6 +444,9 @@ handle_get_channel_info(lmc_data_t    *mc,
 	protocol_type = mc->channels[lchan]->protocol_type;
 	session_support = mc->channels[lchan]->session_support;
 	active_sessions = mc->channels[lchan]->active_sessions;
+	if (active_sessions > 0x3f)
+	    /* The field is only 6 bits. */
+	    active_sessions = 0x3f;
     }
 
     rdata[0] = 0;
@@ -1181,6 +1181,8 @@ ipmi_mc_add_sensor(lmc_data_t    *mc,
 
 struct file_data {
     char *filename;
+    int fd;
+    int reopen;
     unsigned int offset;
     unsigned int length;
     unsigned int mask;
@@ -1204,7 +1206,6 @@ static int
 file_poll(void *cb_data, unsigned int *rval, const char **errstr)
 {
     struct file_data *f = cb_data;
-    int fd;
     int rv;
     int val;
     char *end;
@@ -1235,18 +1236,18 @@ file_poll(void *cb_data, unsigned int *rval, const char **errstr)
 	    return 0;
     }
 
-    fd = open(f->filename, O_RDONLY);
-    if (fd == -1) {
-	errv = errno;
-	*errstr = "Unable to open sensor file";
-	return errv;
-    }
-
-    if (f->offset) {
-	if (lseek(fd, f->offset, SEEK_SET) == -1) {
+    /*
+     * The file is kept open between polls and read with pread(), so a
+     * poll is one system call.  If a read fails the file is closed
+     * and opened again on the next poll, in case it was removed and
+     * came back (like a hwmon device being reloaded).  Files that
+     * get replaced by rename need the "reopen" option.
+     */
+    if (f->fd == -1) {
+	f->fd = open(f->filename, O_RDONLY);
+	if (f->fd == -1) {
 	    errv = errno;
-	    close(fd);
-	    *errstr = "Unable to seek file";
+	    *errstr = "Unable to open sensor file";
 	    return errv;
 	}
     }
@@ -1258,9 +1259,12 @@ file_poll(void *cb_data, unsigned int *rval, const char **errstr)
 
 	if (length > 4)
 	    length = 4;
-	rv = read(fd, data, length);
+	rv = pread(f->fd, data, length, f->offset);
 	errv = errno;
-	close(fd);
+	if (rv == -1 || f->reopen) {
+	    close(f->fd);
+	    f->fd = -1;
+	}
 	if (rv == -1) {
 	    *errstr = "No data read from file";
 	    return errv;
@@ -1274,9 +1278,12 @@ file_poll(void *cb_data, unsigned int *rval, const char **errstr)
     } else {
 	char data[100];
 
-	rv = read(fd, data, sizeof(data) - 1);
+	rv = pread(f->fd, data, sizeof(data) - 1, f->offset);
 	errv = errno;
-	close(fd);
+	if (rv == -1 || f->reopen) {
+	    close(f->fd);
+	    f->fd = -1;
+	}
 	if (rv == -1) {
 	    *errstr = "No data read from file";
 	    return errv;
@@ -1331,6 +1338,7 @@ file_init(lmc_data_t *mc,
 	return ENOMEM;
     }
     memset(f, 0, sizeof(*f));
+    f->fd = -1;
     f->emu = mc->emu;
     f->sensor_mc = mc;
     f->sensor_lun = lun;
@@ -1377,6 +1385,8 @@ file_init(lmc_data_t *mc,
 	    f->is_raw = 1;
 	} else if (strcmp("ascii", tok) == 0) {
 	    f->is_raw = 0;
+	} else if (strcmp("reopen", tok) == 0) {
+	    f->reopen = 1;
 	} else if (strncmp("offset=", tok, 7) == 0) {
 	    f->offset = strtoul(tok + 7, &end, 0);
 	    if (*end != '\0') {
@@ -1509,6 +1519,23 @@ free_sensor(lmc_data_t *mc, sensor_t *sensor)
     free(sensor);
 }
 
+/*
+ * All the polled sensors with the same poll rate are polled from one
+ * timer, so a large number of sensors don't each have a timer to
+ * run.  Groups are never freed, like the sensors in them.
+ */
+typedef struct sensor_poll_group_s sensor_poll_group_t;
+struct sensor_poll_group_s {
+    sys_data_t *sysinfo;
+    unsigned int poll_rate;
+    struct timeval poll_time;
+    ipmi_timer_t *timer;
+    sensor_t *sensors;
+    sensor_poll_group_t *next;
+};
+
+static sensor_poll_group_t *poll_groups;
+
 static void
 sensor_poll(void *cb_data)
 {
@@ -1526,7 +1553,7 @@ sensor_poll(void *cb_data)
 			     "Error getting sensor value (%2.2x,%d,%d): %s, %s",
 			     ipmi_mc_get_ipmb(mc), sensor->lun, sensor->num,
 			     strerror(err), errstr);
-	    goto out_restart;
+	    return;
 	}
 	
 	if (sensor->event_reading_code == IPMI_EVENT_READING_TYPE_THRESHOLD) {
@@ -1540,10 +1567,61 @@ sensor_poll(void *cb_data)
 		set_sensor_bit(mc, sensor,
 			       i, ((val >> i) & 1), 0, 0xff, 0xff, 1);
 	}
+    }
+}
+
+static void
+sensor_poll_group_timeout(void *cb_data)
+{
+    sensor_poll_group_t *group = cb_data;
+    sensor_t *sensor;
 
-      out_restart:
-	mc->sysinfo->start_timer(sensor->poll_timer, &sensor->poll_timer_time);
+    for (sensor = group->sensors; sensor; sensor = sensor->poll_next)
+	sensor_poll(sensor);
+
+    group->sysinfo->start_timer(group->timer, &group->poll_time);
+}
+
+static int
+sensor_poll_group_add(lmc_data_t *mc, sensor_t *sensor, unsigned int poll_rate)
+{
+    sensor_poll_group_t *group;
+    sensor_t **s;
+    int err;
+
+    for (group = poll_groups; group; group = group->next) {
+	if (group->sysinfo == mc->sysinfo && group->poll_rate == poll_rate)
+	    break;
+    }
+
+    if (!group) {
+	group = malloc(sizeof(*group));
+	if (!group)
+	    return ENOMEM;
+	memset(group, 0, sizeof(*group));
+	group->sysinfo = mc->sysinfo;
+	group->poll_rate = poll_rate;
+	group->poll_time.tv_sec = poll_rate / 1000;
+	group->poll_time.tv_usec = (poll_rate % 1000) * 1000;
+	err = mc->sysinfo->alloc_timer(mc->sysinfo, sensor_poll_group_timeout,
+				       group, &group->timer);
+	if (err) {
+	    free(group);
+	    return err;
+	}
+	group->next = poll_groups;
+	poll_groups = group;
+	mc->sysinfo->start_timer(group->timer, &group->poll_time);
     }
+
+    /* Keep the sensors in the order they were added. */
+    for (s = &group->sensors; *s; s = &(*s)->poll_next)
+	;
+    sensor->poll_next = NULL;
+    *s = sensor;
+    sensor->poll_group = group;
+
+    return 0;
 }
 
 int
@@ -1567,19 +1645,14 @@ ipmi_mc_add_polled_sensor(lmc_data_t    *mc,
     sensor = mc->sensors[lun][sens_num];
 
     sensor->poll = poll;
-    sensor->poll_timer_time.tv_sec = poll_rate / 1000;
-    sensor->poll_timer_time.tv_usec = (poll_rate % 1000) * 1000;
     sensor->cb_data = cb_data;
-    
-    err = mc->sysinfo->alloc_timer(mc->sysinfo, sensor_poll, sensor,
-				   &sensor->poll_timer);
+
+    err = sensor_poll_group_add(mc, sensor, poll_rate);
     if (err) {
 	free_sensor(mc, sensor);
 	return err;
     }
 
-    mc->sysinfo->start_timer(sensor->poll_timer, &sensor->poll_timer_time);
-
     return 0;
 }
 
@@ -70,30 +70,86 @@
 #define IPMI_SEL_SUPPORTS_RESERVE        (1 << 1)
 #define IPMI_SEL_SUPPORTS_GET_ALLOC_INFO (1 << 0)
 
+/*
+ * The SEL is kept as a doubly linked list in record order with a
+ * tail pointer, plus a hash on the record id.  Record ids are handed
+ * out sequentially, so the low bits make a good hash.  The hash is
+ * sized from the maximum SEL size when the SEL is enabled and does
+ * not grow.
+ */
+#define SEL_RECID_HASH_MIN_SIZE 16
+#define SEL_RECID_HASH_MAX_SIZE 65536
+
+/*
+ * SEL and SDR changes are appended to the persist journal, and the
+ * whole thing is rewritten once the journal has this many more
+ * records than there are entries.
+ */
+#define PERSIST_JOURNAL_SLACK 64
+
 static sel_entry_t *
 find_sel_event_by_recid(lmc_data_t  *mc,
-			uint16_t    record_id,
-			sel_entry_t **prev)
+			uint16_t    record_id)
 {
     sel_entry_t *entry;
-    sel_entry_t *p_entry = NULL;
 
-    entry = mc->sel.entries;
+    if (!mc->sel.recid_hash)
+	return NULL;
+
+    entry = mc->sel.recid_hash[record_id & (mc->sel.recid_hash_size - 1)];
     while (entry) {
 	if (record_id == entry->record_id)
 	    break;
-	p_entry = entry;
-	entry = entry->next;
+	entry = entry->hash_next;
     }
-    if (prev)
-	*prev = p_entry;
     return entry;
 }
 
+static void
+sel_link_entry(lmc_data_t *mc, sel_entry_t *e)
+{
+    unsigned int idx = e->record_id & (mc->sel.recid_hash_size - 1);
+
+    e->next = NULL;
+    e->prev = mc->sel.tail;
+    if (mc->sel.tail)
+	mc->sel.tail->next = e;
+    else
+	mc->sel.entries = e;
+    mc->sel.tail = e;
+
+    e->hash_next = mc->sel.recid_hash[idx];
+    mc->sel.recid_hash[idx] = e;
+
+    mc->sel.count++;
+}
+
+static void
+sel_unlink_entry(lmc_data_t *mc, sel_entry_t *e)
+{
+    sel_entry_t **p;
+
+    if (e->prev)
+	e->prev->next = e->next;
+    else
+	mc->sel.entries = e->next;
+    if (e->next)
+	e->next->prev = e->prev;
+    else
+	mc->sel.tail = e->prev;
+
+    p = &mc->sel.recid_hash[e->record_id & (mc->sel.recid_hash_size - 1)];
+    while (*p != e)
+	p = &(*p)->hash_next;
+    *p = e->hash_next;
+
+    mc->sel.count--;
+}
+
 static int
 handle_sel(const char *name, void *data, unsigned int len, void *cb_data)
 {
-    sel_entry_t *e, *n;
+    sel_entry_t *n;
     lmc_data_t *mc = cb_data;
 
     if (len != 16) {
@@ -109,17 +165,17 @@ handle_sel(const char *name, void *data, unsigned int len, void *cb_data)
 
     memcpy(n->data, data, 16);
     n->record_id = n->data[0] | (n->data[1] << 8);
-    n->next = NULL;
-
-    e = mc->sel.entries;
-    if (!e)
-	mc->sel.entries = n;
-    else {
-	while (e->next)
-	    e = e->next;
-	e->next = n;
+    if (find_sel_event_by_recid(mc, n->record_id)) {
+	mc->sysinfo->log(mc->sysinfo, INFO, NULL,
+			 "Got duplicate SEL entry %d for %2.2x, name is %s",
+			 n->record_id, ipmi_mc_get_ipmb(mc), name);
+	free(n);
+	goto out;
     }
-    mc->sel.count++;
+    sel_link_entry(mc, n);
+
+    /* Start allocating after the last persisted record. */
+    mc->sel.next_entry = n->record_id + 1;
 
   out:
     return ITER_PERSIST_CONTINUE;
@@ -142,9 +198,24 @@ ipmi_mc_enable_sel(lmc_data_t    *mc,
 		   int           max_entries,
 		   unsigned char flags)
 {
-    persist_t *p;
+    persist_t    *p;
+    sel_entry_t  **hash;
+    unsigned int size = SEL_RECID_HASH_MIN_SIZE;
+
+    while ((size < (unsigned int) max_entries)
+	   && (size < SEL_RECID_HASH_MAX_SIZE))
+	size <<= 1;
+    hash = malloc(size * sizeof(*hash));
+    if (!hash)
+	return ENOMEM;
+    memset(hash, 0, size * sizeof(*hash));
+    if (mc->sel.recid_hash)
+	free(mc->sel.recid_hash);
+    mc->sel.recid_hash = hash;
+    mc->sel.recid_hash_size = size;
 
     mc->sel.entries = NULL;
+    mc->sel.tail = NULL;
     mc->sel.count = 0;
     mc->sel.max_count = max_entries;
     mc->sel.last_add_time = 0;
@@ -169,6 +240,8 @@ rewrite_sels(lmc_data_t *mc)
     sel_entry_t *e;
     int err;
 
+    mc->sel.journal_count = 0;
+
     p = alloc_persist("sel.%2.2x", ipmi_mc_get_ipmb(mc));
     if (!p) {
 	err = ENOMEM;
@@ -203,6 +276,42 @@ rewrite_sels(lmc_data_t *mc)
 	free_persist(p);
 }
 
+/*
+ * Persist adding entry e (if e is not NULL) or deleting the entry
+ * with record id del_recid.
+ */
+static void
+journal_sel(lmc_data_t *mc, sel_entry_t *e, uint16_t del_recid)
+{
+    persist_t *p;
+    int err;
+
+    if (mc->sel.journal_count
+	>= (unsigned int) mc->sel.count + PERSIST_JOURNAL_SLACK)
+	goto rewrite;
+
+    p = alloc_persist("sel.%2.2x", ipmi_mc_get_ipmb(mc));
+    if (!p)
+	goto rewrite;
+    if (e) {
+	err = add_persist_int(p, mc->sel.last_add_time, "last_add_time");
+	if (!err)
+	    err = add_persist_data(p, e->data, 16, "%d", e->record_id);
+	mc->sel.journal_count += 2;
+    } else {
+	err = add_persist_delete(p, "%d", del_recid);
+	mc->sel.journal_count++;
+    }
+    if (!err)
+	err = append_persist(p);
+    free_persist(p);
+    if (!err)
+	return;
+
+  rewrite:
+    rewrite_sels(mc);
+}
+
 int
 ipmi_mc_add_to_sel(lmc_data_t    *mc,
 		   unsigned char record_type,
@@ -225,19 +334,22 @@ ipmi_mc_add_to_sel(lmc_data_t    *mc,
     if (!e)
 	return ENOMEM;
 
-    /* FIXME - this is inefficient, but simple */
-    e->record_id = mc->sel.next_entry;
-    mc->sel.next_entry++;
-    start_record_id = e->record_id;
-    while ((mc->sel.next_entry == 0)
-	   || find_sel_event_by_recid(mc, e->record_id, NULL))
-    {
-	e->record_id++;
-	if (e->record_id == start_record_id) {
+    /*
+     * Take the next record id, skipping the reserved 0 and 0xffff
+     * values and any id still in use after a wrap.  The SEL holds at
+     * most max_count entries, so this finds a free id quickly.
+     */
+    start_record_id = mc->sel.next_entry;
+    for (;;) {
+	e->record_id = mc->sel.next_entry;
+	mc->sel.next_entry++;
+	if ((e->record_id != 0) && (e->record_id != 0xffff)
+	    && !find_sel_event_by_recid(mc, e->record_id))
+	    break;
+	if (mc->sel.next_entry == start_record_id) {
 	    free(e);
 	    return EAGAIN;
 	}
-	mc->sel.next_entry++;
     }
 
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
@@ -251,24 +363,14 @@ ipmi_mc_add_to_sel(lmc_data_t    *mc,
 	memcpy(e->data+3, event, 13);
     }
 
-    e->next = NULL;
-    if (!mc->sel.entries) {
-	mc->sel.entries = e;
-    } else {
-	sel_entry_t *f = mc->sel.entries;
-	while (f->next)
-	    f = f->next;
-	f->next = e;
-    }
-
-    mc->sel.count++;
+    sel_link_entry(mc, e);
 
     mc->sel.last_add_time = t.tv_sec + mc->sel.time_offset;
 
     if (recid)
 	*recid = e->record_id;
 
-    rewrite_sels(mc);
+    journal_sel(mc, e, 0);
 
     return 0;
 }
@@ -417,14 +519,9 @@ handle_get_sel_entry(lmc_data_t    *mc,
     if (record_id == 0) {
 	entry = mc->sel.entries;
     } else if (record_id == 0xffff) {
-	entry = mc->sel.entries;
-	if (entry) {
-	    while (entry->next) {
-		entry = entry->next;
-	    }
-	}
+	entry = mc->sel.tail;
     } else {
-	entry = find_sel_event_by_recid(mc, record_id, NULL);
+	entry = find_sel_event_by_recid(mc, record_id);
     }
 
     if (entry == NULL) {
@@ -485,7 +582,7 @@ handle_delete_sel_entry(lmc_data_t    *mc,
 			void          *cb_data)
 {
     uint16_t    record_id;
-    sel_entry_t *entry, *p_entry;
+    sel_entry_t *entry;
 
     if (!(mc->device_support & IPMI_DEVID_SEL_DEVICE)) {
 	handle_invalid_cmd(mc, rdata, rdata_len);
@@ -514,18 +611,10 @@ handle_delete_sel_entry(lmc_data_t    *mc,
 
     if (record_id == 0) {
 	entry = mc->sel.entries;
-	p_entry = NULL;
     } else if (record_id == 0xffff) {
-	entry = mc->sel.entries;
-	p_entry = NULL;
-	if (entry) {
-	    while (entry->next) {
-		p_entry = entry;
-		entry = entry->next;
-	    }
-	}
+	entry = mc->sel.tail;
     } else {
-	entry = find_sel_event_by_recid(mc, record_id, &p_entry);
+	entry = find_sel_event_by_recid(mc, record_id);
     }
     if (!entry) {
 	rdata[0] = IPMI_NOT_PRESENT_CC;
@@ -533,10 +622,7 @@ handle_delete_sel_entry(lmc_data_t    *mc,
 	return;
     }
 
-    if (p_entry)
-	p_entry->next = entry->next;
-    else
-	mc->sel.entries = entry->next;
+    sel_unlink_entry(mc, entry);
 
     /* Clear the overflow flag. */
     mc->sel.flags &= ~0x80;
@@ -545,10 +631,8 @@ handle_delete_sel_entry(lmc_data_t    *mc,
     ipmi_set_uint16(rdata+1, entry->record_id);
     *rdata_len = 3;
 
-    mc->sel.count--;
+    journal_sel(mc, NULL, entry->record_id);
     free(entry);
-
-    rewrite_sels(mc);
 }
 
 static void
@@ -601,7 +685,11 @@ handle_clear_sel(lmc_data_t    *mc,
     if (op == 0xaa) {
 	entry = mc->sel.entries;
 	mc->sel.entries = NULL;
+	mc->sel.tail = NULL;
 	mc->sel.count = 0;
+	if (mc->sel.recid_hash)
+	    memset(mc->sel.recid_hash, 0,
+		   mc->sel.recid_hash_size * sizeof(*mc->sel.recid_hash));
 	while (entry) {
 	    n_entry = entry->next;
 	    free(entry);
@@ -739,6 +827,8 @@ rewrite_sdrs(lmc_data_t *mc, sdrs_t *sdrs)
     sdr_t *sdr;
     int err;
 
+    sdrs->journal_count = 0;
+
     p = alloc_persist("sdr.%2.2x.main", ipmi_mc_get_ipmb(mc));
     if (!p) {
 	err = ENOMEM;
@@ -774,6 +864,44 @@ rewrite_sdrs(lmc_data_t *mc, sdrs_t *sdrs)
 	free_persist(p);
 }
 
+/*
+ * Persist adding sdr (if sdr is not NULL) or deleting the SDR with
+ * record id del_recid from the main SDR repository.
+ */
+static void
+journal_sdrs(lmc_data_t *mc, sdrs_t *sdrs, sdr_t *sdr, uint16_t del_recid)
+{
+    persist_t *p;
+    int err;
+
+    if (sdrs->journal_count
+	>= (unsigned int) sdrs->sdr_count + PERSIST_JOURNAL_SLACK)
+	goto rewrite;
+
+    p = alloc_persist("sdr.%2.2x.main", ipmi_mc_get_ipmb(mc));
+    if (!p)
+	goto rewrite;
+    if (sdr) {
+	err = add_persist_int(p, sdrs->last_add_time, "last_add_time");
+	if (!err)
+	    err = add_persist_data(p, sdr->data, sdr->length, "%d",
+				   ipmi_get_uint16(sdr->data));
+    } else {
+	err = add_persist_int(p, sdrs->last_erase_time, "last_erase_time");
+	if (!err)
+	    err = add_persist_delete(p, "%d", del_recid);
+    }
+    sdrs->journal_count += 2;
+    if (!err)
+	err = append_persist(p);
+    free_persist(p);
+    if (!err)
+	return;
+
+  rewrite:
+    rewrite_sdrs(mc, sdrs);
+}
+
 void
 add_sdr_entry(lmc_data_t *mc, sdrs_t *sdrs, sdr_t *entry)
 {
@@ -794,7 +922,10 @@ add_sdr_entry(lmc_data_t *mc, sdrs_t *sdrs, sdr_t *entry)
     sdrs->last_add_time = t.tv_sec + mc->main_sdrs.time_offset;
     sdrs->sdr_count++;
 
-    rewrite_sdrs(mc, sdrs);
+    if (sdrs == &mc->main_sdrs)
+	journal_sdrs(mc, sdrs, entry, 0);
+    else
+	rewrite_sdrs(mc, sdrs);
 }
 
 static void
@@ -1306,12 +1437,12 @@ handle_delete_sdr(lmc_data_t    *mc,
     ipmi_set_uint16(rdata+1, entry->record_id);
     *rdata_len = 3;
 
-    free_sdr(entry);
-
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
     mc->main_sdrs.last_erase_time = t.tv_sec + mc->main_sdrs.time_offset;
     mc->main_sdrs.sdr_count--;
-    rewrite_sdrs(mc, &mc->main_sdrs);
+    journal_sdrs(mc, &mc->main_sdrs, NULL, ipmi_get_uint16(entry->data));
+
+    free_sdr(entry);
 }
 
 static void
@@ -1881,6 +2012,14 @@ ipmi_mc_get_fru_data(lmc_data_t    *mc,
     return rv;
 }
 
+struct fru_file_io_info;
+static void fru_file_free(struct fru_file_io_info *info);
+static int fru_file_io_cb(void *cb_data,
+			  enum fru_io_cb_op op,
+			  unsigned char *data,
+			  unsigned int offset,
+			  unsigned int length);
+
 int
 ipmi_mc_add_fru_data(lmc_data_t    *mc,
 		     unsigned char device_id,
@@ -1909,7 +2048,12 @@ ipmi_mc_add_fru_data(lmc_data_t    *mc,
 	mc->frulist = fru;
     }
 
-    if (fru->data) {
+    if (fru->fru_io_cb == fru_file_io_cb) {
+	fru_file_free((struct fru_file_io_info *) fru->data);
+	fru->data = NULL;
+	fru->fru_io_cb = NULL;
+	fru->length = 0;
+    } else if (fru->data) {
 	free(fru->data);
 	fru->length = 0;
     }
@@ -1969,13 +2113,147 @@ ipmi_mc_fru_sem_post(lmc_data_t *mc, unsigned char device_id)
     return 0;
 }
 
+/*
+ * FRU files are kept open for the life of the MC and the FRU area is
+ * read into memory, so a Read FRU Data is just a copy.  Writes go to
+ * the file and the copy, and are synced as persist_sync says.  Once a
+ * second the files are checked with stat(), if one has been modified
+ * or replaced from the outside it is read again on the next access.
+ * The file is not mmap-ed, an external truncate of a mapped file
+ * would take the whole simulator down with SIGBUS.
+ */
 struct fru_file_io_info {
     lmc_data_t   *mc;
     char         *filename;
     unsigned int file_offset;
     unsigned int length;
+
+    int           fd;
+    int           loaded;
+    int           dirty;
+    unsigned char *data;
+    unsigned int  avail; /* How much of the FRU area the file has. */
+    struct stat   st;
+
+    struct fru_file_io_info *next;
 };
 
+static struct fru_file_io_info *fru_files;
+static ipmi_tick_handler_t fru_file_tick_handler;
+
+static int
+fru_file_load(struct fru_file_io_info *info)
+{
+    struct stat  st;
+    unsigned int pos = 0;
+    int          rv;
+    int          l;
+
+    if (info->fd == -1) {
+	info->fd = open(info->filename, O_RDWR);
+	if (info->fd == -1 && (errno == EACCES || errno == EROFS))
+	    /* Writes will fail, but reads can work. */
+	    info->fd = open(info->filename, O_RDONLY);
+	if (info->fd == -1) {
+	    rv = errno;
+	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
+				   "fru_io: error on open of %s: %s",
+				   info->filename, strerror(rv));
+	    return rv;
+	}
+    }
+
+    if (fstat(info->fd, &st) == -1) {
+	rv = errno;
+	info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
+			       "fru_io: error on stat of %s: %s",
+			       info->filename, strerror(rv));
+	goto out_err;
+    }
+
+    while (pos < info->length) {
+	l = pread(info->fd, info->data + pos, info->length - pos,
+		  info->file_offset + pos);
+	if (l == -1) {
+	    if (errno == EINTR)
+		continue;
+	    rv = errno;
+	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
+				   "fru_io: error on read of %u bytes of %s"
+				   " at %u: %s",
+				   info->length - pos, info->filename,
+				   info->file_offset + pos, strerror(rv));
+	    goto out_err;
+	}
+	if (l == 0)
+	    break;
+	pos += l;
+    }
+    memset(info->data + pos, 0, info->length - pos);
+    info->avail = pos;
+    info->st = st;
+    info->loaded = 1;
+    return 0;
+
+ out_err:
+    close(info->fd);
+    info->fd = -1;
+    return rv;
+}
+
+static void
+fru_file_tick(void *cb_data, unsigned int seconds)
+{
+    struct fru_file_io_info *info;
+    struct stat st;
+
+    for (info = fru_files; info; info = info->next) {
+	if (info->dirty) {
+	    fdatasync(info->fd);
+	    info->dirty = 0;
+	}
+
+	if (!info->loaded)
+	    continue;
+
+	if (stat(info->filename, &st) == -1
+	    || st.st_dev != info->st.st_dev || st.st_ino != info->st.st_ino)
+	{
+	    /* Removed or replaced, open it again next time. */
+	    close(info->fd);
+	    info->fd = -1;
+	    info->loaded = 0;
+	} else if (st.st_size != info->st.st_size
+		   || st.st_mtim.tv_sec != info->st.st_mtim.tv_sec
+		   || st.st_mtim.tv_nsec != info->st.st_mtim.tv_nsec)
+	{
+	    /* Changed in place, read it again next time. */
+	    info->loaded = 0;
+	}
+    }
+}
+
+static void
+fru_file_free(struct fru_file_io_info *info)
+{
+    struct fru_file_io_info **p;
+
+    for (p = &fru_files; *p; p = &(*p)->next) {
+	if (*p == info) {
+	    *p = info->next;
+	    break;
+	}
+    }
+    if (info->fd != -1) {
+	if (info->dirty)
+	    fdatasync(info->fd);
+	close(info->fd);
+    }
+    free(info->data);
+    free(info->filename);
+    free(info);
+}
+
 static int fru_file_io_cb(void *cb_data,
 			  enum fru_io_cb_op op,
 			  unsigned char *data,
@@ -1983,46 +2261,22 @@ static int fru_file_io_cb(void *cb_data,
 			  unsigned int length)
 {
     struct fru_file_io_info *info = cb_data;
-    int fd;
+    unsigned int pos;
     int rv = 0;
     int l;
 
     if (offset + length > info->length)
 	return EINVAL;
 
+    if (!info->loaded) {
+	rv = fru_file_load(info);
+	if (rv)
+	    return rv;
+    }
+
     switch (op) {
     case FRU_IO_READ:
-	fd = open(info->filename, O_RDONLY);
-	if (fd == -1) {
-	    rv = errno;
-	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
-				   "fru_io: (read) error on open of %s: %s",
-				   info->filename, strerror(rv));
-	    return rv;
-	}
-	if (lseek(fd, info->file_offset + offset, SEEK_SET) == -1) {
-	    rv = errno;
-	    close(fd);
-	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
-				   "fru_io: (read) error on lseek"
-				   " of %s to %u: %s",
-				   info->filename, info->file_offset + offset,
-				   strerror(rv));
-	    return rv;
-	}
-    restart_read:
-	l = read(fd, data, length);
-	if (l == -1) {
-	    if (errno == EINTR)
-		goto restart_read;
-	    rv = errno;
-	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
-				   "fru_io: error on read of %u bytes of %s"
-				   " at %u: %s",
-				   length, info->filename,
-				   info->file_offset + offset,
-				   strerror(rv));
-	} else if (l == 0) {
+	if (offset + length > info->avail) {
 	    rv = EIO;
 	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
 				   "fru_io: end of file read of %u bytes of %s"
@@ -2030,59 +2284,54 @@ static int fru_file_io_cb(void *cb_data,
 				   length, info->filename,
 				   info->file_offset + offset,
 				   strerror(rv));
-	} else if (((unsigned int) l) != length) {
-	    length -= l;
-	    data += l;
-	    goto restart_read;
+	    break;
 	}
-	close(fd);
+	memcpy(data, info->data + offset, length);
 	break;
 
     case FRU_IO_WRITE:
-	fd = open(info->filename, O_WRONLY);
-	if (fd == -1) {
-	    rv = errno;
-	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
-				   "fru_io: (write) error on open of %s: %s",
-				   info->filename, strerror(rv));
-	    return rv;
-	}
-	if (lseek(fd, info->file_offset + offset, SEEK_SET) == -1) {
-	    rv = errno;
-	    close(fd);
-	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
-				   "fru_io: (write) error on lseek"
-				   " of %s to %u: %s",
-				   info->filename, info->file_offset + offset,
-				   strerror(rv));
-	    return rv;
-	}
-    restart_write:
-	l = write(fd, data, length);
-	if (l == -1) {
-	    if (errno == EINTR)
-		goto restart_write;
-	    rv = errno;
-	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
-				   "fru_io: error on write of %u bytes of %s"
-				   " at %u: %s",
-				   length, info->filename,
-				   info->file_offset + offset,
-				   strerror(rv));
-	} else if (l == 0) {
-	    rv = EIO;
-	    info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
-				   "fru_io: end of file write of %u bytes of %s"
-				   " at %u: %s",
-				   length, info->filename,
-				   info->file_offset + offset,
-				   strerror(rv));
-	} else if (((unsigned int) l) != length) {
-	    length -= l;
-	    data += l;
-	    goto restart_write;
+	pos = 0;
+	while (pos < length) {
+	    l = pwrite(info->fd, data + pos, length - pos,
+		       info->file_offset + offset + pos);
+	    if (l == -1) {
+		if (errno == EINTR)
+		    continue;
+		rv = errno;
+		info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
+				       "fru_io: error on write of %u bytes"
+				       " of %s at %u: %s",
+				       length - pos, info->filename,
+				       info->file_offset + offset + pos,
+				       strerror(rv));
+		break;
+	    } else if (l == 0) {
+		rv = EIO;
+		info->mc->sysinfo->log(info->mc->sysinfo, OS_ERROR, NULL,
+				       "fru_io: end of file write of %u bytes"
+				       " of %s at %u: %s",
+				       length - pos, info->filename,
+				       info->file_offset + offset + pos,
+				       strerror(rv));
+		break;
+	    }
+	    pos += l;
 	}
-	close(fd);
+
+	/* Keep the copy the same as the file, even on a partial write. */
+	memcpy(info->data + offset, data, pos);
+	if (offset + pos > info->avail)
+	    info->avail = offset + pos;
+	if (pos == 0)
+	    break;
+
+	if (persist_sync == PERSIST_SYNC_WRITE)
+	    fdatasync(info->fd);
+	else if (persist_sync == PERSIST_SYNC_TICK)
+	    info->dirty = 1;
+
+	/* Don't mistake our own change for an outside one. */
+	fstat(info->fd, &info->st);
 	break;
 
     default:
@@ -2104,22 +2353,43 @@ int ipmi_mc_add_fru_file(lmc_data_t    *mc,
     info = malloc(sizeof(*info));
     if (!info)
 	return ENOMEM;
+    memset(info, 0, sizeof(*info));
     info->filename = strdup(filename);
     if (!info->filename) {
 	free(info);
 	return ENOMEM;
     }
+    info->data = malloc(length ? length : 1);
+    if (!info->data) {
+	free(info->filename);
+	free(info);
+	return ENOMEM;
+    }
     info->mc = mc;
     info->length = length;
     info->file_offset = file_offset;
+    info->fd = -1;
 
     rv = ipmi_mc_add_fru_data(mc, device_id, length, fru_file_io_cb, info);
     if (rv) {
+	free(info->data);
 	free(info->filename);
 	free(info);
+	return rv;
     }
 
-    return rv;
+    if (!fru_file_tick_handler.handler) {
+	fru_file_tick_handler.handler = fru_file_tick;
+	fru_file_tick_handler.info = NULL;
+	ipmi_register_tick_handler(&fru_file_tick_handler);
+    }
+    info->next = fru_files;
+    fru_files = info;
+
+    /* Errors are logged and it is tried again on the first access. */
+    fru_file_load(info);
+
+    return 0;
 }
 
 /* We don't currently care about partial sel adds, since they are
@@ -54,6 +54,12 @@
  *      written permission.
  */
 
+#include <config.h>
+
+#if (defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* For recvmmsg() and sendmmsg() */
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -75,8 +81,6 @@
 #include <signal.h>
 #include <sys/wait.h>
 
-#include <config.h>
-
 #if HAVE_SYSLOG
 #include <syslog.h>
 #endif
@@ -102,6 +106,7 @@ static char *config_file = BASE_CONF_STR "/lan.conf";
 static const char *statedir = STATEDIR;
 static char *command_string = NULL;
 static char *command_file = NULL;
+static char *persist_sync_str = NULL;
 static int debug = 0;
 static int nostdio = 0;
 
@@ -207,38 +212,130 @@ smi_send(channel_t *chan, msg_t *msg)
 static int
 gen_rand(lanserv_data_t *lan, void *data, int len)
 {
-#ifdef _WIN32
-    #error gen_rand() to be defined for Windows
-#else
-    int fd = open("/dev/urandom", O_RDONLY);
-    int rv;
+    os_handler_t *os_hnd = global_misc_data->os_hnd;
 
-    if (fd == -1)
-	return errno;
+    /* The OS handler buffers this, it's called for every IV. */
+    return os_hnd->get_random(os_hnd, data, len);
+}
 
-    while (len > 0) {
-	rv = read(fd, data, len);
-	if (rv < 0) {
-	    rv = errno;
-	    goto out;
-	}
-	len -= rv;
+static int
+sys_gen_rand(sys_data_t *lan, void *data, int len)
+{
+    return gen_rand(NULL, data, len);
+}
+
+#define LAN_MAX_PKT 256
+#define LAN_BATCH 16
+
+/*
+ * A client that goes away, or a full socket buffer, can make every
+ * send fail.  Log the first failure, then at most one a second with
+ * a count of the ones that weren't logged.
+ */
+static void
+lan_send_failed(sys_data_t *sys, int err)
+{
+    static int            logged;
+    static struct timeval last;
+    static unsigned int   unlogged;
+    struct timeval        now;
+
+    sys->get_monotonic_time(sys, &now);
+    if (logged && (now.tv_sec - last.tv_sec) < 1) {
+	unlogged++;
+	return;
     }
+    logged = 1;
+    last = now;
+    if (unlogged)
+	sys->log(sys, OS_ERROR, NULL,
+		 "Unable to send LAN response: %s (%u more not logged)",
+		 strerror(err), unlogged);
+    else
+	sys->log(sys, OS_ERROR, NULL,
+		 "Unable to send LAN response: %s", strerror(err));
+    unlogged = 0;
+}
 
-    rv = 0;
+#ifdef HAVE_SENDMMSG
+/*
+ * While a batch of received packets is being handled, the responses
+ * are copied here and sent with one sendmmsg() when the batch is
+ * done.  Anything sent outside of a batch, or too big for a slot,
+ * goes straight out.
+ */
+#define LAN_XMIT_MAX_PKT 512
+
+static struct {
+    int                     active;
+    int                     fd;
+    unsigned int            count;
+    struct mmsghdr          msgs[LAN_BATCH];
+    struct iovec            iov[LAN_BATCH];
+    struct sockaddr_storage addr[LAN_BATCH];
+    unsigned char           data[LAN_BATCH][LAN_XMIT_MAX_PKT];
+} lan_xmit;
 
- out:
-    close(fd);
-    return rv;
-#endif
+static void
+lan_xmit_flush(void)
+{
+    sys_data_t   *sys = global_misc_data->sys;
+    unsigned int i = 0;
+    int          rv;
+
+    while (i < lan_xmit.count) {
+	rv = sendmmsg(lan_xmit.fd, lan_xmit.msgs + i, lan_xmit.count - i, 0);
+	if (rv < 0 && errno == EINTR)
+	    continue;
+	if (rv <= 0) {
+	    /*
+	     * sendmmsg() only fails if the first message can't be
+	     * sent, so drop that one and send the rest.
+	     */
+	    lan_send_failed(sys, rv < 0 ? errno : EIO);
+	    rv = 1;
+	}
+	i += rv;
+    }
+    lan_xmit.count = 0;
 }
 
 static int
-sys_gen_rand(sys_data_t *lan, void *data, int len)
+lan_xmit_queue(struct iovec *data, int vecs, sim_addr_t *l)
 {
-    gen_rand(NULL, data, len);
-    return 0;
+    unsigned int  len = 0, i;
+    unsigned char *d;
+
+    for (i = 0; i < (unsigned int) vecs; i++)
+	len += data[i].iov_len;
+
+    if (lan_xmit.count
+	&& (lan_xmit.fd != l->xmit_fd || lan_xmit.count == LAN_BATCH
+	    || len > LAN_XMIT_MAX_PKT))
+	lan_xmit_flush();
+
+    if (len > LAN_XMIT_MAX_PKT)
+	return 0;
+
+    i = lan_xmit.count;
+    d = lan_xmit.data[i];
+    for (vecs--; vecs >= 0; vecs--, data++) {
+	memcpy(d, data->iov_base, data->iov_len);
+	d += data->iov_len;
+    }
+    memcpy(&lan_xmit.addr[i], &l->addr, l->addr_len);
+    lan_xmit.iov[i].iov_base = lan_xmit.data[i];
+    lan_xmit.iov[i].iov_len = len;
+    memset(&lan_xmit.msgs[i], 0, sizeof(lan_xmit.msgs[i]));
+    lan_xmit.msgs[i].msg_hdr.msg_name = &lan_xmit.addr[i];
+    lan_xmit.msgs[i].msg_hdr.msg_namelen = l->addr_len;
+    lan_xmit.msgs[i].msg_hdr.msg_iov = &lan_xmit.iov[i];
+    lan_xmit.msgs[i].msg_hdr.msg_iovlen = 1;
+    lan_xmit.fd = l->xmit_fd;
+    lan_xmit.count++;
+    return 1;
 }
+#endif
 
 static void
 lan_send(lanserv_data_t *lan,
@@ -254,6 +351,11 @@ lan_send(lanserv_data_t *lan,
     if (!l)
 	return;
 
+#ifdef HAVE_SENDMMSG
+    if (lan_xmit.active && lan_xmit_queue(data, vecs, l))
+	return;
+#endif
+
     memset(&msg, 0, sizeof(msg));
     msg.msg_name = &(l->addr);
     msg.msg_namelen = l->addr_len;
@@ -261,58 +363,111 @@ lan_send(lanserv_data_t *lan,
     msg.msg_iovlen = vecs;
 
     rv = sendmsg(l->xmit_fd, &msg, 0);
-    if (rv) {
-	/* FIXME - log an error. */
-    }
+    if (rv == -1)
+	lan_send_failed(lan->sysinfo, errno);
 }
 
 static void
-lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
+lan_handle_packet(lanserv_data_t *lan, unsigned char *msgd, int len,
+		  sim_addr_t *l)
 {
-    lanserv_data_t    *lan = cb_data;
-    int           len;
-    sim_addr_t    l;
-    unsigned char msgd[256];
-
-    l.addr_len = sizeof(l.addr);
-    len = recvfrom(lan_fd, msgd, sizeof(msgd), 0,
-		   (struct sockaddr *) &(l.addr), &(l.addr_len));
-    if (len < 0) {
-	if (errno != EINTR) {
-	    perror("Error receiving message");
-	    exit(1);
-	}
-	goto out;
-    }
-    l.xmit_fd = lan_fd;
-
     if (lan->sysinfo->debug & DEBUG_RAW_MSG) {
-	debug_log_raw_msg(lan->sysinfo, (void *) &l.addr, l.addr_len,
+	debug_log_raw_msg(lan->sysinfo, (void *) &l->addr, l->addr_len,
 			  "Raw LAN receive from:");
 	debug_log_raw_msg(lan->sysinfo, msgd, len,
 			  " Receive message:");
     }
 
     if (len < 4)
-	goto out;
+	return;
 
     if (msgd[0] != 6)
-	goto out; /* Invalid version */
+	return; /* Invalid version */
 
     /* Check the message class. */
     switch (msgd[3]) {
 	case 6:
-	    handle_asf(lan, msgd, len, &l, sizeof(l));
+	    handle_asf(lan, msgd, len, l, sizeof(*l));
 	    break;
 
 	case 7:
-	    ipmi_handle_lan_msg(lan, msgd, len, &l, sizeof(l));
+	    ipmi_handle_lan_msg(lan, msgd, len, l, sizeof(*l));
 	    break;
     }
- out:
-    return;
 }
 
+#ifdef HAVE_RECVMMSG
+/*
+ * Pull in as many packets as are waiting (up to LAN_BATCH) with one
+ * system call, and send the responses to them together.
+ */
+static void
+lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    lanserv_data_t *lan = cb_data;
+    unsigned char  msgd[LAN_BATCH][LAN_MAX_PKT];
+    sim_addr_t     l[LAN_BATCH];
+    struct mmsghdr msgs[LAN_BATCH];
+    struct iovec   iov[LAN_BATCH];
+    int            i, count;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < LAN_BATCH; i++) {
+	iov[i].iov_base = msgd[i];
+	iov[i].iov_len = sizeof(msgd[i]);
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &l[i].addr;
+	msgs[i].msg_hdr.msg_namelen = sizeof(l[i].addr);
+    }
+
+    count = recvmmsg(lan_fd, msgs, LAN_BATCH, MSG_DONTWAIT, NULL);
+    if (count < 0) {
+	if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+	    perror("Error receiving message");
+	    exit(1);
+	}
+	return;
+    }
+
+#ifdef HAVE_SENDMMSG
+    lan_xmit.active = 1;
+#endif
+    for (i = 0; i < count; i++) {
+	l[i].addr_len = msgs[i].msg_hdr.msg_namelen;
+	l[i].xmit_fd = lan_fd;
+	lan_handle_packet(lan, msgd[i], msgs[i].msg_len, &l[i]);
+    }
+#ifdef HAVE_SENDMMSG
+    lan_xmit.active = 0;
+    lan_xmit_flush();
+#endif
+}
+#else
+static void
+lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    lanserv_data_t    *lan = cb_data;
+    int           len;
+    sim_addr_t    l;
+    unsigned char msgd[LAN_MAX_PKT];
+
+    l.addr_len = sizeof(l.addr);
+    len = recvfrom(lan_fd, msgd, sizeof(msgd), 0,
+		   (struct sockaddr *) &(l.addr), &(l.addr_len));
+    if (len < 0) {
+	if (errno != EINTR) {
+	    perror("Error receiving message");
+	    exit(1);
+	}
+	return;
+    }
+    l.xmit_fd = lan_fd;
+
+    lan_handle_packet(lan, msgd, len, &l);
+}
+#endif
+
 static int
 open_lan_fd(struct sockaddr *addr, socklen_t addr_len)
 {
@@ -802,6 +957,15 @@ static struct poptOption poptOpts[]=
 	"state directory",
 	""
     },
+    {
+	"persist-sync",
+	'S',
+	POPT_ARG_STRING,
+	&persist_sync_str,
+	'S',
+	"persistence sync policy: none, write, or tick",
+	""
+    },
     {
 	"debug",
 	'd',
@@ -1341,6 +1505,8 @@ tick(void *cb_data, os_hnd_timer_id_t *id)
 
     ipmi_emu_tick(data->emu, 1);
 
+    persist_tick();
+
     tv.tv_sec = 1;
     tv.tv_usec = 0;
     err = data->os_hnd->start_timer(data->os_hnd, data->timer, &tv, tick, data);
@@ -1510,6 +1676,19 @@ main(int argc, const char *argv[])
 	    case 'p':
 		persist_enable = 0;
 		break;
+	    case 'S':
+		if (strcmp(persist_sync_str, "none") == 0)
+		    persist_sync = PERSIST_SYNC_NONE;
+		else if (strcmp(persist_sync_str, "write") == 0)
+		    persist_sync = PERSIST_SYNC_WRITE;
+		else if (strcmp(persist_sync_str, "tick") == 0)
+		    persist_sync = PERSIST_SYNC_TICK;
+		else {
+		    fprintf(stderr, "Invalid persist-sync value: %s\n",
+			    persist_sync_str);
+		    exit(1);
+		}
+		break;
 	}
     }
     poptFreeContext(poptCtx);
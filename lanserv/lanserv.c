@@ -233,30 +233,11 @@ smi_send_dev(channel_t *chan, msg_t *msg)
 static int
 gen_rand(lanserv_data_t *lan, void *data, int len)
 {
-#ifdef _WIN32
-    #error gen_rand() to be defined for Windows
-#else
-    int fd = open("/dev/urandom", O_RDONLY);
-    int rv;
+    misc_data_t  *info = lan->user_info;
+    os_handler_t *os_hnd = info->os_hnd;
 
-    if (fd == -1)
-	return errno;
-
-    while (len > 0) {
-	rv = read(fd, data, len);
-	if (rv < 0) {
-	    rv = errno;
-	    goto out;
-	}
-	len -= rv;
-    }
-
-    rv = 0;
-
- out:
-    close(fd);
-    return rv;
-#endif
+    /* The OS handler buffers this, it's called for every IV. */
+    return os_hnd->get_random(os_hnd, data, len);
 }
 
 static void
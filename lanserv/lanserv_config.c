@@ -172,6 +172,20 @@ lanserv_read_config(sys_data_t    *sys,
 	    err = read_bytes(&tokptr, lan->bmc_key, &errstr, 20);
 	    if (err)
 		goto out_err;
+	} else if (strcmp(tok, "max_sessions") == 0) {
+	    err = get_uint(&tokptr, &val, &errstr);
+	    if (!err && (val == 0 || val > MAX_SESSIONS_LIMIT)) {
+		err = -1;
+		errstr = "max_sessions must be from 1 to 65535";
+	    }
+	    lan->max_sessions = val;
+	} else if (strcmp(tok, "session_timeout") == 0) {
+	    err = get_uint(&tokptr, &val, &errstr);
+	    if (!err && val == 0) {
+		err = -1;
+		errstr = "session_timeout must not be zero";
+	    }
+	    lan->default_session_timeout = val;
 	} else if (strcmp(tok, "lan_config_program") == 0) {
 	    err = get_delim_str(&tokptr, &lan->config_prog, &errstr);
 	    if (err)
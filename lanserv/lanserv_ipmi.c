@@ -60,6 +60,7 @@
 
 #ifdef HAVE_OPENSSL
 #include <openssl/hmac.h>
+#include <openssl/evp.h>
 #endif
 
 #include <OpenIPMI/ipmi_msgbits.h>
@@ -108,13 +109,13 @@ find_user(lanserv_data_t *lan, uint8_t *user, int name_only_lookup, int priv)
 static session_t *
 sid_to_session(lanserv_data_t *lan, unsigned int sid)
 {
-    int       idx;
-    session_t *session;
+    unsigned int idx;
+    session_t    *session;
 
     if (sid & 1)
 	return NULL;
-    idx = (sid >> 1) & SESSION_MASK;
-    if (idx > MAX_SESSIONS)
+    idx = (sid >> 1) & lan->session_mask;
+    if (idx > lan->max_sessions)
 	return NULL;
     session = lan->sessions + idx;
     if (!session->active)
@@ -129,6 +130,9 @@ close_session(lanserv_data_t *lan, session_t *session)
 {
     unsigned int i;
 
+    if (!session->allocated)
+	return;
+
     for (i = 0; i < LANSERV_NUM_CLOSERS; i++) {
 	if (session->closers[i].close_cb) {
 	    session->closers[i].close_cb(
@@ -139,18 +143,30 @@ close_session(lanserv_data_t *lan, session_t *session)
 	}
     }
 
-    session->active = 0;
+    if (session->active) {
+	session->active = 0;
+	lan->channel.active_sessions--;
+	if (session->next)
+	    session->next->prev = session->prev;
+	if (session->prev)
+	    session->prev->next = session->next;
+	else
+	    lan->used_sessions = session->next;
+    }
     if (session->authtype <= 4)
 	ipmi_auths[session->authtype].authcode_cleanup(session->authdata);
     if (session->integh)
 	session->integh->cleanup(lan, session);
     if (session->confh)
 	session->confh->cleanup(lan, session);
-    lan->channel.active_sessions--;
     if (session->src_addr) {
 	lan->channel.free(&lan->channel, session->src_addr);
 	session->src_addr = NULL;
     }
+
+    session->allocated = 0;
+    session->next = lan->free_sessions;
+    lan->free_sessions = session;
 }
 
 static int
@@ -664,7 +680,7 @@ handle_get_session_challenge(lanserv_data_t *lan, msg_t *msg)
 	return;
     }
 
-    if (lan->channel.active_sessions >= MAX_SESSIONS) {
+    if (lan->channel.active_sessions >= lan->max_sessions) {
 	lan->sysinfo->log(lan->sysinfo, SESSION_CHALLENGE_FAILED, msg,
 		 "Session challenge failed: To many open sessions");
 	return_err(lan, msg, NULL, IPMI_OUT_OF_SPACE_CC);
@@ -827,16 +843,51 @@ ifree(void *info, void *data)
     lan->channel.free(&lan->channel, data);
 }
 
+/*
+ * Take a session off the free list, it comes back cleared.  It must
+ * be given back with close_session(), which also closes it if
+ * open_session() was called.
+ */
 static session_t *
 find_free_session(lanserv_data_t *lan)
 {
-    int i;
-    /* Find a free session.  Session 0 is invalid. */
-    for (i=1; i<=MAX_SESSIONS; i++) {
-	if (! lan->sessions[i].active)
-	    return &(lan->sessions[i]);
-    }
-    return NULL;
+    session_t *session = lan->free_sessions;
+    int       handle;
+
+    if (!session)
+	return NULL;
+    lan->free_sessions = session->next;
+
+    handle = session->handle;
+    memset(session, 0, sizeof(*session));
+    session->handle = handle;
+    session->allocated = 1;
+    return session;
+}
+
+/* Mark the session active and count it. */
+static void
+open_session(lanserv_data_t *lan, session_t *session)
+{
+    session->active = 1;
+    lan->channel.active_sessions++;
+    session->prev = NULL;
+    session->next = lan->used_sessions;
+    if (session->next)
+	session->next->prev = session;
+    lan->used_sessions = session;
+}
+
+static uint32_t
+new_sid(lanserv_data_t *lan, session_t *session)
+{
+    uint32_t sid;
+
+    if (lan->sid_seq == 0)
+	lan->sid_seq++;
+    sid = ((lan->sid_seq << (lan->session_bits+1)) | (session->handle << 1));
+    lan->sid_seq++;
+    return sid;
 }
 
 static void
@@ -888,7 +939,7 @@ handle_temp_session(lanserv_data_t *lan, msg_t *msg)
 	return;
     }
 
-    if (lan->channel.active_sessions >= MAX_SESSIONS) {
+    if (lan->channel.active_sessions >= lan->max_sessions) {
 	lan->sysinfo->log(lan->sysinfo, NEW_SESSION_FAILED, msg,
 		 "Session challenge failed: To many open sessions");
 	return;
@@ -970,12 +1021,12 @@ handle_temp_session(lanserv_data_t *lan, msg_t *msg)
 	lan->sysinfo->log(lan->sysinfo, NEW_SESSION_FAILED, msg,
 		 "Activate session failed: out of memory");
 	return_err(lan, msg, &dummy_session, IPMI_UNKNOWN_ERR_CC);
+	close_session(lan, session);
 	goto out_free;
     }
     memcpy(session->src_addr, msg->src_addr, msg->src_len);
     session->src_len = msg->src_len;
 
-    session->active = 1;
     session->rmcpplus = 0;
     session->authtype = auth;
     session->authdata = dummy_session.authdata;
@@ -984,7 +1035,9 @@ handle_temp_session(lanserv_data_t *lan, msg_t *msg)
 	lan->sysinfo->log(lan->sysinfo, NEW_SESSION_FAILED, msg,
 		 "Activate session failed: Could not generate random number");
 	return_err(lan, msg, &dummy_session, IPMI_UNKNOWN_ERR_CC);
-	goto out_free;
+	/* The session owns the auth data now, this frees it. */
+	close_session(lan, session);
+	return;
     }
     session->recv_seq = ipmi_get_uint32(seq_data) & ~1;
     if (!session->recv_seq)
@@ -995,16 +1048,12 @@ handle_temp_session(lanserv_data_t *lan, msg_t *msg)
     session->userid = user->idx;
     session->time_left = lan->default_session_timeout;
 
-    lan->channel.active_sessions++;
+    open_session(lan, session);
     lan->sysinfo->log(lan->sysinfo, NEW_SESSION, msg,
 	     "Activate session: Session opened for user 0x%x, max priv %d",
 	     user_idx, priv);
 
-    if (lan->sid_seq == 0)
-	lan->sid_seq++;
-    session->sid = ((lan->sid_seq << (SESSION_BITS_REQ+1))
-		    | (session->handle << 1));
-    lan->sid_seq++;
+    session->sid = new_sid(lan, session);
 
     data[0] = 0;
     data[1] = auth;
@@ -1164,7 +1213,7 @@ handle_get_session_info(lanserv_data_t *lan, session_t *session, msg_t *msg)
 	sid = ipmi_get_uint32(msg->data+1);
 	nses = sid_to_session(lan, sid);
     } else if (idx == 0xfe) {
-	int handle;
+	unsigned int handle;
 
 	if (msg->len < 2) {
 	    return_err(lan, msg, session,
@@ -1173,7 +1222,7 @@ handle_get_session_info(lanserv_data_t *lan, session_t *session, msg_t *msg)
 	}
 	
 	handle = msg->data[1];
-	if (handle >= MAX_SESSIONS) {
+	if (handle == 0 || handle > lan->max_sessions) {
 	    return_err(lan, msg, session, IPMI_INVALID_DATA_FIELD_CC);
 	    return;
 	}
@@ -1182,10 +1231,12 @@ handle_get_session_info(lanserv_data_t *lan, session_t *session, msg_t *msg)
     } else if (idx == 0) {
 	nses = session;
     } else {
-	int i;
+	unsigned int i;
 
+	/* Index by handle order, not by the used list, which is kept
+	   newest first. */
 	if (idx <= lan->channel.active_sessions) {
-	    for (i=0; i<=MAX_SESSIONS; i++) {
+	    for (i = 1; i <= lan->max_sessions; i++) {
 		if (lan->sessions[i].active) {
 		    idx--;
 		    if (idx == 0) {
@@ -1197,11 +1248,14 @@ handle_get_session_info(lanserv_data_t *lan, session_t *session, msg_t *msg)
 	}
     }
 
+    /* Handles are only a byte and the counts are 6 bits, so with a
+       big session table these are clamped. */
     data[0] = 0;
-    data[2] = MAX_SESSIONS;
-    data[3] = lan->channel.active_sessions;
+    data[2] = lan->max_sessions > 0x3f ? 0x3f : lan->max_sessions;
+    data[3] = (lan->channel.active_sessions > 0x3f ? 0x3f
+	       : lan->channel.active_sessions);
     if (nses) {
-	data[1] = nses->handle;
+	data[1] = nses->handle > 0xff ? 0xff : nses->handle;
 	data[4] = nses->userid;
 	data[5] = nses->priv;
 	data[6] = lan->channel.channel_num | (session->rmcpplus << 4);
@@ -2027,30 +2081,132 @@ static auth_handlers_t rakp_hmac_md5 =
 };
 #define RAKP_INIT , &rakp_hmac_sha1, &rakp_hmac_md5
 
+/*
+ * Per-session HMAC state, kept in auth_data.idata.  HMAC is
+ * H(K^opad, H(K^ipad, data)), the digest states after the two padded
+ * keys are worked out once and each packet starts from a copy of
+ * them.  The integrity handler is set up at RAKP 1, before the keys
+ * exist, so this is keyed on first use once the session is up.
+ */
+#define HMAC_BLOCK_LEN 64 /* For both MD5 and SHA1 */
+
+typedef struct hmac_state_s
+{
+    int        keyed;
+    EVP_MD_CTX *inner;
+    EVP_MD_CTX *outer;
+    EVP_MD_CTX *work;
+} hmac_state_t;
+
+static void
+hmac_cleanup(lanserv_data_t *lan, session_t *session)
+{
+    hmac_state_t *s = session->auth_data.idata;
+
+    if (!s)
+	return;
+    /* Freeing the digest contexts cleanses the keyed state. */
+    if (s->inner)
+	EVP_MD_CTX_free(s->inner);
+    if (s->outer)
+	EVP_MD_CTX_free(s->outer);
+    if (s->work)
+	EVP_MD_CTX_free(s->work);
+    free(s);
+    session->auth_data.idata = NULL;
+}
+
+static int
+hmac_state_alloc(session_t *session)
+{
+    hmac_state_t *s;
+
+    s = malloc(sizeof(*s));
+    if (!s)
+	return ENOMEM;
+    memset(s, 0, sizeof(*s));
+    session->auth_data.idata = s;
+    s->inner = EVP_MD_CTX_new();
+    s->outer = EVP_MD_CTX_new();
+    s->work = EVP_MD_CTX_new();
+    if (!s->inner || !s->outer || !s->work)
+	return ENOMEM;
+    return 0;
+}
+
+static int
+hmac_key(auth_data_t *a, hmac_state_t *s)
+{
+    const unsigned char *k = a->ikey;
+    unsigned char       pad[HMAC_BLOCK_LEN];
+    unsigned int        i;
+    int                 rv = 0;
+
+    memset(pad, 0x36, sizeof(pad));
+    for (i = 0; i < a->ikey_len; i++)
+	pad[i] ^= k[i];
+    if (!EVP_DigestInit_ex(s->inner, a->ikey2, NULL)
+	|| !EVP_DigestUpdate(s->inner, pad, sizeof(pad)))
+	rv = EINVAL;
+    memset(pad, 0x5c, sizeof(pad));
+    for (i = 0; i < a->ikey_len; i++)
+	pad[i] ^= k[i];
+    if (!rv && (!EVP_DigestInit_ex(s->outer, a->ikey2, NULL)
+		|| !EVP_DigestUpdate(s->outer, pad, sizeof(pad))))
+	rv = EINVAL;
+    memset(pad, 0, sizeof(pad));
+    if (!rv)
+	s->keyed = 1;
+    return rv;
+}
+
+static int
+hmac_gen(session_t *session, const unsigned char *data, unsigned int len,
+	 unsigned char *integ)
+{
+    auth_data_t   *a = &session->auth_data;
+    hmac_state_t  *s = a->idata;
+    unsigned char ihash[EVP_MAX_MD_SIZE];
+    unsigned int  ihash_len, integ_len;
+
+    if (session->in_startup || !s)
+	/* No keys yet. */
+	return EINVAL;
+    if (!s->keyed && hmac_key(a, s))
+	return EINVAL;
+
+    if (!EVP_MD_CTX_copy_ex(s->work, s->inner)
+	|| !EVP_DigestUpdate(s->work, data, len)
+	|| !EVP_DigestFinal_ex(s->work, ihash, &ihash_len)
+	|| !EVP_MD_CTX_copy_ex(s->work, s->outer)
+	|| !EVP_DigestUpdate(s->work, ihash, ihash_len)
+	|| !EVP_DigestFinal_ex(s->work, integ, &integ_len))
+	return EINVAL;
+    return 0;
+}
+
 static int
 hmac_sha1_init(lanserv_data_t *lan, session_t *session)
 {
+    hmac_cleanup(lan, session);
     session->auth_data.ikey2 = EVP_sha1();
     session->auth_data.ikey = session->auth_data.k1;
     session->auth_data.ikey_len = 20;
     session->auth_data.integ_len = 12;
-    return 0;
+    return hmac_state_alloc(session);
 }
 
 static int
 hmac_md5_init(lanserv_data_t *lan, session_t *session)
 {
     user_t *user = &(lan->users[session->userid]);
+
+    hmac_cleanup(lan, session);
     session->auth_data.ikey2 = EVP_md5();
     session->auth_data.ikey = user->pw;
     session->auth_data.ikey_len = 16;
     session->auth_data.integ_len = 16;
-    return 0;
-}
-
-static void
-hmac_cleanup(lanserv_data_t *lan, session_t *session)
-{
+    return hmac_state_alloc(session);
 }
 
 static int 
@@ -2059,13 +2215,15 @@ hmac_add(lanserv_data_t *lan, session_t *session,
 	 unsigned int *data_len, unsigned int data_size)
 {
     auth_data_t   *a = &session->auth_data;
-    unsigned int  ilen;
-    unsigned char integ[20];
+    unsigned char integ[EVP_MAX_MD_SIZE];
+    int           rv;
 
     if (((*data_len) + a->ikey_len) > data_size)
 	return E2BIG;
 
-    HMAC(a->ikey2, a->ikey, a->ikey_len, pos+4, (*data_len)-4, integ, &ilen);
+    rv = hmac_gen(session, pos+4, (*data_len)-4, integ);
+    if (rv)
+	return rv;
     memcpy(pos+(*data_len), integ, a->integ_len);
     *data_len += a->integ_len;
     return 0;
@@ -2074,15 +2232,16 @@ hmac_add(lanserv_data_t *lan, session_t *session,
 static int
 hmac_check(lanserv_data_t *lan, session_t *session, msg_t *msg)
 {
-    unsigned char integ[20];
+    unsigned char integ[EVP_MAX_MD_SIZE];
     auth_data_t   *a = &session->auth_data;
-    unsigned int  ilen;
+    int           rv;
 
     if ((msg->len-5) < a->integ_len)
 	return E2BIG;
 
-    HMAC(a->ikey2, a->ikey, a->ikey_len, msg->data, msg->len-a->integ_len,
-	 integ, &ilen);
+    rv = hmac_gen(session, msg->data, msg->len-a->integ_len, integ);
+    if (rv)
+	return rv;
     if (memcmp(msg->data+msg->len-a->integ_len, integ, a->integ_len) != 0)
 	return EINVAL;
     return 0;
@@ -2172,17 +2331,75 @@ static integ_handlers_t md5_integ =
 #define HMAC_INIT , &hmac_sha1_integ, &hmac_md5_integ
 #define MD5_INIT , &md5_integ
 
+/*
+ * Per-session cipher contexts, kept in auth_data.cdata.  Like the
+ * HMAC state these are keyed on first use, each packet only sets a
+ * new IV.
+ */
+typedef struct aes_cbc_state_s
+{
+    int            keyed;
+    EVP_CIPHER_CTX *ectx;
+    EVP_CIPHER_CTX *dctx;
+} aes_cbc_state_t;
+
+static void
+aes_cbc_cleanup(lanserv_data_t *lan, session_t *session)
+{
+    aes_cbc_state_t *s = session->auth_data.cdata;
+
+    if (!s)
+	return;
+    /* Freeing the contexts cleanses the key schedules. */
+    if (s->ectx)
+	EVP_CIPHER_CTX_free(s->ectx);
+    if (s->dctx)
+	EVP_CIPHER_CTX_free(s->dctx);
+    free(s);
+    session->auth_data.cdata = NULL;
+}
+
 static int
 aes_cbc_init(lanserv_data_t *lan, session_t *session)
 {
+    aes_cbc_state_t *s;
+
+    aes_cbc_cleanup(lan, session);
     session->auth_data.ckey = session->auth_data.k2;
     session->auth_data.ckey_len = 16;
+
+    s = malloc(sizeof(*s));
+    if (!s)
+	return ENOMEM;
+    memset(s, 0, sizeof(*s));
+    session->auth_data.cdata = s;
+    s->ectx = EVP_CIPHER_CTX_new();
+    s->dctx = EVP_CIPHER_CTX_new();
+    if (!s->ectx || !s->dctx)
+	return ENOMEM;
     return 0;
 }
 
-static void
-aes_cbc_cleanup(lanserv_data_t *lan, session_t *session)
+static aes_cbc_state_t *
+aes_cbc_get_state(session_t *session)
 {
+    auth_data_t     *a = &session->auth_data;
+    aes_cbc_state_t *s = a->cdata;
+
+    if (session->in_startup || !s)
+	/* No keys yet. */
+	return NULL;
+    if (!s->keyed) {
+	if (!EVP_EncryptInit_ex(s->ectx, EVP_aes_128_cbc(), NULL, a->ckey,
+				NULL)
+	    || !EVP_DecryptInit_ex(s->dctx, EVP_aes_128_cbc(), NULL, a->ckey,
+				   NULL))
+	    return NULL;
+	EVP_CIPHER_CTX_set_padding(s->ectx, 0);
+	EVP_CIPHER_CTX_set_padding(s->dctx, 0);
+	s->keyed = 1;
+    }
+    return s;
 }
 
 static int
@@ -2190,12 +2407,10 @@ aes_cbc_encrypt(lanserv_data_t *lan, session_t *session,
 		unsigned char **pos, unsigned int *hdr_left,
 		unsigned int *data_len, unsigned int *data_size)
 {
-    auth_data_t    *a = &session->auth_data;
+    aes_cbc_state_t *s;
     unsigned int   l = *data_len;
-    unsigned char  *d;
     unsigned char  *iv;
     unsigned int   i;
-    EVP_CIPHER_CTX *ctx;
     int            rv;
     int            outlen;
     int            tmplen;
@@ -2206,6 +2421,10 @@ aes_cbc_encrypt(lanserv_data_t *lan, session_t *session,
     if (*hdr_left < 16)
 	return E2BIG;
 
+    s = aes_cbc_get_state(session);
+    if (!s)
+	return EINVAL;
+
     /* Calculate the number of padding bytes -> e.  Note that the pad
        length byte is included, thus the +1.  We don't add the pad,
        AES does, but we need to know what it is. */
@@ -2216,16 +2435,9 @@ aes_cbc_encrypt(lanserv_data_t *lan, session_t *session,
     if (l > *data_size)
 	return E2BIG;
 
-    /* We store the unencrypted data here, then crypt into the real
-       data. */
-    d = malloc(l);
-    if (!d)
-	return ENOMEM;
-
-    memcpy(d, *pos, *data_len);
-
-    /* Now add the padding. */
-    padpos = d + *data_len;
+    /* Add the padding after the data, there is room for it.  The
+       data is encrypted in place. */
+    padpos = (*pos) + *data_len;
     padval = 1;
     for (i=0; i<padlen; i++, padpos++, padval++)
 	*padpos = padval;
@@ -2234,47 +2446,31 @@ aes_cbc_encrypt(lanserv_data_t *lan, session_t *session,
     /* Now create the initialization vector, including making room for it. */
     iv = (*pos) - 16;
     rv = lan->gen_rand(lan, iv, 16);
-    if (rv) {
-	free(d);
+    if (rv)
 	return rv;
-    }
     *hdr_left -= 16;
     *data_size += 16;
 
     /* Ok, we're set to do the crypt operation. */
-    ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) {
-	    rv = ENOMEM;
-	    goto out_cleanup;
-    }
-    EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, a->ckey, iv);
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
-    if (!EVP_EncryptUpdate(ctx, *pos, &outlen, d, l)) {
-	rv = ENOMEM;
-	goto out_cleanup;
-    }
-    if (!EVP_EncryptFinal_ex(ctx, (*pos) + outlen, &tmplen)) {
-	rv = ENOMEM; /* right? */
-	goto out_cleanup;
-    }
+    if (!EVP_EncryptInit_ex(s->ectx, NULL, NULL, NULL, iv))
+	return ENOMEM;
+    if (!EVP_EncryptUpdate(s->ectx, *pos, &outlen, *pos, l))
+	return ENOMEM;
+    if (!EVP_EncryptFinal_ex(s->ectx, (*pos) + outlen, &tmplen))
+	return ENOMEM; /* right? */
     outlen += tmplen;
 
     *pos = iv;
     *data_len = outlen + 16;
 
- out_cleanup:
-    EVP_CIPHER_CTX_free(ctx);
-    free(d);
-    return rv;
+    return 0;
 }
 
 static int
 aes_cbc_decrypt(lanserv_data_t *lan, session_t *session, msg_t *msg)
 {
-    auth_data_t    *a = &session->auth_data;
+    aes_cbc_state_t *s;
     unsigned int   l = msg->len;
-    unsigned char  *d;
-    EVP_CIPHER_CTX *ctx;
     int            outlen;
     unsigned char  *pad;
     int            padlen;
@@ -2285,26 +2481,14 @@ aes_cbc_decrypt(lanserv_data_t *lan, session_t *session, msg_t *msg)
 	return EINVAL;
     l -= 16;
 
-    /* We store the encrypted data here, then decrypt into the real
-       data. */
-    d = malloc(l);
-    if (!d)
-	return ENOMEM;
-
-    memcpy(d, msg->data+16, l);
+    s = aes_cbc_get_state(session);
+    if (!s)
+	return EINVAL;
 
-    /* Ok, we're set to do the decrypt operation. */
-    ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) {
-	    rv = ENOMEM;
-	    goto out_cleanup;
-    }
-    EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, a->k2, msg->data);
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
-    if (!EVP_DecryptUpdate(ctx, msg->data+16, &outlen, d, l)) {
-	rv = EINVAL;
-	goto out_cleanup;
-    }
+    /* Ok, we're set to do the decrypt operation, in place. */
+    if (!EVP_DecryptInit_ex(s->dctx, NULL, NULL, NULL, msg->data)
+	|| !EVP_DecryptUpdate(s->dctx, msg->data+16, &outlen, msg->data+16, l))
+	return EINVAL;
 
     if (outlen < 16) {
 	rv = EINVAL;
@@ -2334,8 +2518,6 @@ aes_cbc_decrypt(lanserv_data_t *lan, session_t *session, msg_t *msg)
     msg->len = outlen;
 
  out_cleanup:
-    EVP_CIPHER_CTX_free(ctx);
-    free(d);
     return rv;
 }
 
@@ -2514,7 +2696,7 @@ handle_open_session_payload(lanserv_data_t *lan, msg_t *msg)
     memcpy(session->src_addr, msg->src_addr, msg->src_len);
     session->src_len = msg->src_len;
 
-    session->active = 1;
+    open_session(lan, session);
     session->in_startup = 1;
     session->rmcpplus = 1;
     session->authtype = IPMI_AUTHTYPE_RMCP_PLUS;
@@ -2543,9 +2725,7 @@ handle_open_session_payload(lanserv_data_t *lan, msg_t *msg)
     session->userid = 0;
     session->time_left = lan->default_session_timeout;
 
-    session->sid = ((lan->sid_seq << (SESSION_BITS_REQ+1))
-		    | (session->handle << 1));
-    lan->sid_seq++;
+    session->sid = new_sid(lan, session);
 
     lan->sysinfo->log(lan->sysinfo, NEW_SESSION, msg,
 	     "Activate session: Session started, max priv %d", priv);
@@ -2566,8 +2746,6 @@ handle_open_session_payload(lanserv_data_t *lan, msg_t *msg)
     data[31] = 8;
     data[32] = conf;
 
-    lan->channel.active_sessions++;
-
     return_rmcpp_rsp(lan, session, msg, 0x11, data, 36, NULL, 0);
     return;
  out_err:
@@ -3051,21 +3229,20 @@ static void
 ipmi_lan_tick(void *info, unsigned int time_since_last)
 {
     lanserv_data_t *lan = info;
-    int i;
-
-    for (i=1; i<=MAX_SESSIONS; i++) {
-	if (lan->sessions[i].active) {
-	    if (lan->sessions[i].time_left <= time_since_last) {
-		msg_t msg = { 0 }; /* A fake message to hold the address. */
-
-		msg.src_addr = lan->sessions[i].src_addr;
-		msg.src_len = lan->sessions[i].src_len;
-		lan->sysinfo->log(lan->sysinfo, SESSION_CLOSED, &msg,
-			 "Session closed: Closed due to timeout");
-		close_session(lan, &(lan->sessions[i]));
-	    } else {
-		lan->sessions[i].time_left -= time_since_last;
-	    }
+    session_t      *session, *next;
+
+    for (session = lan->used_sessions; session; session = next) {
+	next = session->next;
+	if (session->time_left <= time_since_last) {
+	    msg_t msg = { 0 }; /* A fake message to hold the address. */
+
+	    msg.src_addr = session->src_addr;
+	    msg.src_len = session->src_len;
+	    lan->sysinfo->log(lan->sysinfo, SESSION_CLOSED, &msg,
+		     "Session closed: Closed due to timeout");
+	    close_session(lan, session);
+	} else {
+	    session->time_left -= time_since_last;
 	}
     }
 }
@@ -3156,13 +3333,32 @@ ipmi_lan_init(lanserv_data_t *lan)
     int rv;
     uint8_t challenge_data[16];
 
-    for (i=0; i<=MAX_SESSIONS; i++) {
+    if (lan->max_sessions == 0)
+	lan->max_sessions = MAX_SESSIONS;
+    lan->session_bits = SESSION_BITS_REQ;
+    while ((1U << lan->session_bits) <= lan->max_sessions)
+	lan->session_bits++;
+    lan->session_mask = (1U << lan->session_bits) - 1;
+
+    lan->sessions = lan->sysinfo->alloc(lan->sysinfo,
+					(lan->max_sessions + 1)
+					* sizeof(session_t));
+    if (!lan->sessions)
+	return ENOMEM;
+    memset(lan->sessions, 0,
+	   (lan->max_sessions + 1) * sizeof(session_t));
+    /* Session 0 is invalid.  Hand out the lowest handles first. */
+    lan->free_sessions = NULL;
+    lan->used_sessions = NULL;
+    for (i = lan->max_sessions; i > 0; i--) {
 	lan->sessions[i].handle = i;
+	lan->sessions[i].next = lan->free_sessions;
+	lan->free_sessions = &lan->sessions[i];
     }
 
     rv = read_lan_config(lan);
     if (rv)
-	return rv;
+	goto out;
 
     lan->lanparm.num_destinations = 0; /* LAN alerts not supported */
 
@@ -3205,5 +3401,10 @@ ipmi_lan_init(lanserv_data_t *lan)
     ipmi_register_tick_handler(&lan->tick_handler);
 
  out:
+    if (rv) {
+	lan->sysinfo->free(lan->sysinfo, lan->sessions);
+	lan->sessions = NULL;
+	lan->free_sessions = NULL;
+    }
     return rv;
 }
@@ -61,12 +61,16 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <OpenIPMI/persist.h>
 
 enum pitem_type {
     PITEM_DATA = 'd',
     PITEM_INT = 'i',
-    PITEM_STR = 's'
+    PITEM_STR = 's',
+    PITEM_DEL = 'x'
 };
 
 struct pitem {
@@ -75,6 +79,9 @@ struct pitem {
     void *data;
     long dval;
     struct pitem *next;
+
+    /* Only used while replaying a journal. */
+    struct pitem *hnext;
 };
 
 struct persist_s {
@@ -84,6 +91,7 @@ struct persist_s {
 };
 
 int persist_enable = 1;
+int persist_sync = PERSIST_SYNC_NONE;
 
 static char *app = NULL;
 static const char *basedir;
@@ -271,6 +279,568 @@ write_data(void *idata, unsigned int len, FILE *f)
     }
 }
 
+/*
+ * The journal is a binary file (the persist name with ".jnl" on the
+ * end) of records appended by append_persist().  read_persist()
+ * replays it on top of the text file, and write_persist() writes a
+ * new text file and removes the journal, compacting it.  The text
+ * file format is unchanged, so files written before the journal
+ * existed still read fine.
+ *
+ * The file starts with JOURNAL_MAGIC, then each record is:
+ *   type (1 byte), name length (2 bytes), value length (4 bytes),
+ *   name, value, checksum (4 bytes)
+ * All numbers are little endian, integer values are 8 bytes.  The
+ * checksum covers the rest of the record, replay stops at the first
+ * short or bad record so a torn write at the end is dropped.
+ */
+#define JOURNAL_MAGIC "OIPMIJ1\n"
+#define JOURNAL_MAGIC_LEN 8
+#define JREC_HDR_LEN 7
+#define JREC_CSUM_LEN 4
+
+struct jrec {
+    enum pitem_type type;
+    const char *name;
+    unsigned int name_len;
+    const unsigned char *val;
+    unsigned int val_len;
+};
+
+/* An open journal, kept so appends and syncs don't have to reopen it. */
+struct pjournal {
+    char *name;
+    int fd;
+    int dirty;
+    struct pjournal *next;
+};
+
+static struct pjournal *journals;
+
+static uint32_t
+jrec_csum(const unsigned char *d, unsigned int len)
+{
+    uint32_t h = 2166136261U;
+
+    while (len--) {
+	h ^= *d++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+static void
+put_le(unsigned char *d, uint64_t v, unsigned int len)
+{
+    while (len--) {
+	*d++ = v & 0xff;
+	v >>= 8;
+    }
+}
+
+static uint64_t
+get_le(const unsigned char *d, unsigned int len)
+{
+    uint64_t v = 0;
+
+    while (len--)
+	v = (v << 8) | d[len];
+    return v;
+}
+
+/*
+ * Parse the record at the start of buf.  Returns the length of the
+ * record, or 0 if it is short or invalid.
+ */
+static unsigned long
+parse_jrec(const unsigned char *buf, unsigned long left, struct jrec *r)
+{
+    unsigned long len;
+
+    if (left < JREC_HDR_LEN + JREC_CSUM_LEN)
+	return 0;
+    r->type = buf[0];
+    r->name_len = get_le(buf + 1, 2);
+    r->val_len = get_le(buf + 3, 4);
+    len = JREC_HDR_LEN + (unsigned long) r->name_len + r->val_len;
+    if (len + JREC_CSUM_LEN > left)
+	return 0;
+    if (get_le(buf + len, JREC_CSUM_LEN) != jrec_csum(buf, len))
+	return 0;
+    if (r->name_len == 0)
+	return 0;
+    switch (r->type) {
+    case PITEM_DATA:
+    case PITEM_STR:
+	break;
+    case PITEM_INT:
+	if (r->val_len != 8)
+	    return 0;
+	break;
+    case PITEM_DEL:
+	if (r->val_len != 0)
+	    return 0;
+	break;
+    default:
+	return 0;
+    }
+    r->name = (const char *) buf + JREC_HDR_LEN;
+    r->val = buf + JREC_HDR_LEN + r->name_len;
+    return len + JREC_CSUM_LEN;
+}
+
+/*
+ * Return the length of the valid part of a journal, 0 if even the
+ * header is bad.
+ */
+static unsigned long
+journal_valid_len(const unsigned char *buf, unsigned long len)
+{
+    unsigned long pos, rlen;
+    struct jrec r;
+
+    if (len < JOURNAL_MAGIC_LEN
+	|| memcmp(buf, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0)
+	return 0;
+    pos = JOURNAL_MAGIC_LEN;
+    while ((rlen = parse_jrec(buf + pos, len - pos, &r)))
+	pos += rlen;
+    return pos;
+}
+
+static unsigned char *
+read_fd(int fd, unsigned long *rlen)
+{
+    struct stat st;
+    unsigned char *buf;
+    unsigned long pos = 0;
+    ssize_t rv;
+
+    if (fstat(fd, &st) != 0)
+	return NULL;
+    buf = malloc(st.st_size + 1);
+    if (!buf)
+	return NULL;
+    while (pos < (unsigned long) st.st_size) {
+	rv = read(fd, buf + pos, st.st_size - pos);
+	if (rv < 0 && errno == EINTR)
+	    continue;
+	if (rv <= 0)
+	    break;
+	pos += rv;
+    }
+    *rlen = pos;
+    return buf;
+}
+
+static unsigned int
+pitem_hash(const char *name, unsigned int len, unsigned int size)
+{
+    return jrec_csum((const unsigned char *) name, len) & (size - 1);
+}
+
+static struct pitem *
+find_hashed_pi(struct pitem **hash, unsigned int size,
+	       const char *name, unsigned int len)
+{
+    struct pitem *pi = hash[pitem_hash(name, len, size)];
+
+    while (pi) {
+	if (strlen(pi->iname) == len && memcmp(pi->iname, name, len) == 0)
+	    break;
+	pi = pi->hnext;
+    }
+    return pi;
+}
+
+static void
+unhash_pi(struct pitem **hash, unsigned int size, struct pitem *pi)
+{
+    struct pitem **hp = &hash[pitem_hash(pi->iname, strlen(pi->iname), size)];
+
+    while (*hp != pi)
+	hp = &(*hp)->hnext;
+    *hp = pi->hnext;
+}
+
+static int
+set_pi_val(struct pitem *pi, struct jrec *r)
+{
+    void *data = NULL;
+
+    if (r->type == PITEM_DATA || r->type == PITEM_STR) {
+	data = malloc(r->val_len + 1);
+	if (!data)
+	    return ENOMEM;
+	memcpy(data, r->val, r->val_len);
+	((char *) data)[r->val_len] = '\0';
+    }
+    if (pi->data)
+	free(pi->data);
+    pi->type = r->type;
+    pi->data = data;
+    if (r->type == PITEM_INT)
+	pi->dval = (int64_t) get_le(r->val, 8);
+    else
+	pi->dval = r->val_len;
+    return 0;
+}
+
+/*
+ * Apply the journal for p on top of the items read from the text
+ * file.  Items set in the journal replace items of the same name in
+ * place, new items go on the end so iteration order is the order
+ * they were added.  Deleted items are marked while replaying and
+ * freed at the end.  Returns ENOENT if there is no journal.
+ */
+static int
+replay_journal(persist_t *p)
+{
+    char *fname;
+    int fd;
+    unsigned char *buf;
+    unsigned long len, pos, rlen;
+    struct pitem **hash, **tail, *pi, **pp;
+    unsigned int size = 64, count = 0, idx;
+    struct jrec r;
+    int rv = 0;
+
+    fname = get_fname(p, ".jnl");
+    if (!fname)
+	return ENOMEM;
+    fd = open(fname, O_RDONLY);
+    free(fname);
+    if (fd == -1)
+	return ENOENT;
+    buf = read_fd(fd, &len);
+    close(fd);
+    if (!buf)
+	return ENOMEM;
+
+    len = journal_valid_len(buf, len);
+    if (len == 0)
+	goto out;
+
+    for (tail = &p->items; *tail; tail = &(*tail)->next)
+	count++;
+    while (size < count * 2)
+	size <<= 1;
+    hash = malloc(size * sizeof(*hash));
+    if (!hash) {
+	rv = ENOMEM;
+	goto out;
+    }
+    memset(hash, 0, size * sizeof(*hash));
+    for (pi = p->items; pi; pi = pi->next) {
+	idx = pitem_hash(pi->iname, strlen(pi->iname), size);
+	pi->hnext = hash[idx];
+	hash[idx] = pi;
+    }
+
+    for (pos = JOURNAL_MAGIC_LEN; pos < len; pos += rlen) {
+	rlen = parse_jrec(buf + pos, len - pos, &r);
+	pi = find_hashed_pi(hash, size, r.name, r.name_len);
+	if (r.type == PITEM_DEL) {
+	    if (pi) {
+		unhash_pi(hash, size, pi);
+		if (pi->data)
+		    free(pi->data);
+		pi->data = NULL;
+		pi->type = PITEM_DEL;
+	    }
+	    continue;
+	}
+	if (!pi) {
+	    pi = malloc(sizeof(*pi));
+	    if (!pi) {
+		rv = ENOMEM;
+		break;
+	    }
+	    pi->iname = malloc(r.name_len + 1);
+	    if (!pi->iname) {
+		free(pi);
+		rv = ENOMEM;
+		break;
+	    }
+	    memcpy(pi->iname, r.name, r.name_len);
+	    pi->iname[r.name_len] = '\0';
+	    pi->data = NULL;
+	    pi->next = NULL;
+	    *tail = pi;
+	    tail = &pi->next;
+	    idx = pitem_hash(r.name, r.name_len, size);
+	    pi->hnext = hash[idx];
+	    hash[idx] = pi;
+	}
+	rv = set_pi_val(pi, &r);
+	if (rv)
+	    break;
+    }
+    free(hash);
+
+    pp = &p->items;
+    while (*pp) {
+	pi = *pp;
+	if (pi->type == PITEM_DEL) {
+	    *pp = pi->next;
+	    free(pi->iname);
+	    free(pi);
+	} else {
+	    pp = &pi->next;
+	}
+    }
+
+ out:
+    free(buf);
+    return rv;
+}
+
+static struct pjournal *
+find_journal(persist_t *p, struct pjournal ***prev)
+{
+    struct pjournal **jp = &journals;
+
+    while (*jp) {
+	if (strcmp((*jp)->name, p->name) == 0)
+	    break;
+	jp = &(*jp)->next;
+    }
+    if (prev)
+	*prev = jp;
+    return *jp;
+}
+
+/*
+ * Open the journal for p for appending, creating it if necessary.
+ * Anything past the last valid record is cut off, so new records
+ * don't end up behind a torn one.
+ */
+static int
+open_journal(persist_t *p, struct pjournal **rj)
+{
+    struct pjournal *j;
+    char *fname;
+    unsigned char *buf;
+    unsigned long len, vlen;
+    int fd, rv = 0;
+
+    j = find_journal(p, NULL);
+    if (j) {
+	*rj = j;
+	return 0;
+    }
+
+    fname = get_fname(p, ".jnl");
+    if (!fname)
+	return ENOMEM;
+    fd = open(fname, O_RDWR | O_CREAT | O_APPEND, 0644);
+    free(fname);
+    if (fd == -1)
+	return errno;
+
+    buf = read_fd(fd, &len);
+    if (!buf) {
+	rv = ENOMEM;
+	goto out_err;
+    }
+    vlen = journal_valid_len(buf, len);
+    free(buf);
+    if (vlen == 0) {
+	/* New, or not a journal we can read, start it over. */
+	if (ftruncate(fd, 0) != 0) {
+	    rv = errno;
+	    goto out_err;
+	}
+	if (write(fd, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != JOURNAL_MAGIC_LEN) {
+	    rv = EIO;
+	    goto out_err;
+	}
+    } else if (vlen != len && ftruncate(fd, vlen) != 0) {
+	rv = errno;
+	goto out_err;
+    }
+
+    j = malloc(sizeof(*j));
+    if (!j) {
+	rv = ENOMEM;
+	goto out_err;
+    }
+    j->name = strdup(p->name);
+    if (!j->name) {
+	free(j);
+	rv = ENOMEM;
+	goto out_err;
+    }
+    j->fd = fd;
+    j->dirty = 0;
+    j->next = journals;
+    journals = j;
+    *rj = j;
+    return 0;
+
+ out_err:
+    close(fd);
+    return rv;
+}
+
+static void
+close_journal(persist_t *p)
+{
+    struct pjournal *j, **prev;
+
+    j = find_journal(p, &prev);
+    if (!j)
+	return;
+    *prev = j->next;
+    close(j->fd);
+    free(j->name);
+    free(j);
+}
+
+/* Make a rename or unlink in the persist directory durable. */
+static void
+sync_dir(void)
+{
+    unsigned int len = strlen(basedir) + strlen(app) + 2;
+    char *dname = malloc(len);
+    int fd;
+
+    if (!dname)
+	return;
+    strcpy(dname, basedir);
+    strcat(dname, "/");
+    strcat(dname, app);
+    fd = open(dname, O_RDONLY);
+    free(dname);
+    if (fd == -1)
+	return;
+    fsync(fd);
+    close(fd);
+}
+
+static unsigned long
+jrec_len(struct pitem *pi)
+{
+    unsigned long len = JREC_HDR_LEN + strlen(pi->iname) + JREC_CSUM_LEN;
+
+    if (pi->type == PITEM_INT)
+	len += 8;
+    else if (pi->type != PITEM_DEL)
+	len += pi->dval;
+    return len;
+}
+
+static unsigned char *
+put_jrec(unsigned char *d, struct pitem *pi)
+{
+    unsigned int name_len = strlen(pi->iname);
+    unsigned int val_len = 0;
+    unsigned char *start = d;
+
+    if (pi->type == PITEM_INT)
+	val_len = 8;
+    else if (pi->type != PITEM_DEL)
+	val_len = pi->dval;
+
+    d[0] = pi->type;
+    put_le(d + 1, name_len, 2);
+    put_le(d + 3, val_len, 4);
+    d += JREC_HDR_LEN;
+    memcpy(d, pi->iname, name_len);
+    d += name_len;
+    if (pi->type == PITEM_INT)
+	put_le(d, (int64_t) pi->dval, 8);
+    else if (val_len)
+	memcpy(d, pi->data, val_len);
+    d += val_len;
+    put_le(d, jrec_csum(start, d - start), JREC_CSUM_LEN);
+    return d + JREC_CSUM_LEN;
+}
+
+int
+append_persist(persist_t *p)
+{
+    struct pjournal *j = NULL;
+    struct pitem *pi, **items;
+    unsigned long len = 0;
+    unsigned int count = 0, i;
+    unsigned char *buf, *d;
+    ssize_t rv;
+    int err;
+
+    if (!persist_enable)
+	return 0;
+
+    for (pi = p->items; pi; pi = pi->next) {
+	if (strlen(pi->iname) > 0xffff)
+	    return EINVAL;
+	len += jrec_len(pi);
+	count++;
+    }
+    if (!count)
+	return 0;
+
+    err = open_journal(p, &j);
+    if (err)
+	return err;
+
+    /*
+     * Items are kept newest first, write them out in the order they
+     * were added.  The whole batch goes out in one write.
+     */
+    items = malloc(count * sizeof(*items));
+    buf = malloc(len);
+    if (!items || !buf) {
+	if (items)
+	    free(items);
+	if (buf)
+	    free(buf);
+	return ENOMEM;
+    }
+    for (i = count, pi = p->items; pi; pi = pi->next)
+	items[--i] = pi;
+    for (i = 0, d = buf; i < count; i++)
+	d = put_jrec(d, items[i]);
+    free(items);
+
+    d = buf;
+    while (len > 0) {
+	rv = write(j->fd, d, len);
+	if (rv < 0 && errno == EINTR)
+	    continue;
+	if (rv <= 0) {
+	    err = rv < 0 ? errno : EIO;
+	    free(buf);
+	    /* Drop it, the next append revalidates the file. */
+	    close_journal(p);
+	    return err;
+	}
+	d += rv;
+	len -= rv;
+    }
+    free(buf);
+
+    if (persist_sync == PERSIST_SYNC_WRITE)
+	fdatasync(j->fd);
+    else if (persist_sync == PERSIST_SYNC_TICK)
+	j->dirty = 1;
+
+    return 0;
+}
+
+void
+persist_tick(void)
+{
+    struct pjournal *j;
+
+    for (j = journals; j; j = j->next) {
+	if (j->dirty) {
+	    fdatasync(j->fd);
+	    j->dirty = 0;
+	}
+    }
+}
+
 persist_t *
 read_persist(const char *name, ...)
 {
@@ -281,12 +851,15 @@ read_persist(const char *name, ...)
     char *line;
     char *end;
     size_t n;
+    int found = 0;
+    int rv;
 
     if (!persist_enable)
 	return NULL;
 
     va_start(ap, name);
     p = alloc_vpersist(name, ap);
+    va_end(ap);
     if (!p)
 	return NULL;
     fname = get_fname(p, "");
@@ -296,10 +869,9 @@ read_persist(const char *name, ...)
     }
     f = fopen(fname, "r");
     free(fname);
-    if (!f) {
-	free_persist(p);
-	return NULL;
-    }
+    if (!f)
+	goto read_journal;
+    found = 1;
 
     for (line = NULL; getline(&line, &n, f) != -1; free(line), line = NULL) {
 	char *name = line;
@@ -318,6 +890,7 @@ read_persist(const char *name, ...)
 	pi = malloc(sizeof(*pi));
 	if (!pi) {
 	    free(line);
+	    fclose(f);
 	    free_persist(p);
 	    return NULL;
 	}
@@ -326,6 +899,7 @@ read_persist(const char *name, ...)
 	if (!pi->iname) {
 	    free(pi);
 	    free(line);
+	    fclose(f);
 	    free_persist(p);
 	    return NULL;
 	}
@@ -358,6 +932,17 @@ read_persist(const char *name, ...)
 	pi->next = p->items;
 	p->items = pi;
     }
+    free(line);
+    fclose(f);
+
+ read_journal:
+    rv = replay_journal(p);
+    if (rv == ENOENT && found)
+	rv = 0;
+    if (rv) {
+	free_persist(p);
+	return NULL;
+    }
 
     return p;
 }
@@ -368,6 +953,8 @@ write_persist_file(persist_t *p, FILE *f)
     struct pitem *pi;
 
     for (pi = p->items; pi; pi = pi->next) {
+	if (pi->type == PITEM_DEL)
+	    continue;
 	fprintf(f, "%s:%c:", pi->iname, pi->type);
 	switch (pi->type) {
 	case PITEM_DATA:
@@ -376,6 +963,9 @@ write_persist_file(persist_t *p, FILE *f)
 	    break;
 	case PITEM_INT:
 	    fprintf(f, "%ld", pi->dval);
+	    break;
+	case PITEM_DEL:
+	    break;
 	}
 	fputc('\n', f);
     }
@@ -411,11 +1001,38 @@ write_persist(persist_t *p)
     }
 
     write_persist_file(p, f);
+    if (persist_sync != PERSIST_SYNC_NONE) {
+	fflush(f);
+	fsync(fileno(f));
+    }
     fclose(f);
 
-    if (rename(fname, fname2) != 0)
+    if (rename(fname, fname2) != 0) {
 	rv = errno;
+	goto out;
+    }
+
+    /* The new file holds everything, so the journal is obsolete. */
+    close_journal(p);
+    free(fname);
+    fname = get_fname(p, ".jnl");
+    if (!fname) {
+	rv = ENOMEM;
+	goto out;
+    }
+    /*
+     * The rename has to be on disk before the journal goes, or a
+     * crash could lose both.  The unlink has to be on disk too, or a
+     * crash could leave the old journal to be replayed over the new
+     * file, bringing back things a clear removed.
+     */
+    if (persist_sync != PERSIST_SYNC_NONE)
+	sync_dir();
+    unlink(fname);
+    if (persist_sync != PERSIST_SYNC_NONE)
+	sync_dir();
 
+ out:
     free(fname);
     free(fname2);
 
@@ -447,6 +1064,9 @@ iterate_persist(persist_t *p,
 	    if (int_func)
 		rv = int_func(pi->iname, pi->dval, cb_data);
 	    break;
+
+	case PITEM_DEL:
+	    break;
 	}
 
 	if (rv != ITER_PERSIST_CONTINUE)
@@ -565,6 +1185,18 @@ read_persist_data(persist_t *p, void **data, unsigned int *len,
     return 0;
 }
 
+int
+add_persist_delete(persist_t *p, const char *name, ...)
+{
+    va_list ap;
+    int rv;
+
+    va_start(ap, name);
+    rv = alloc_pi(p, PITEM_DEL, NULL, 0, name, ap);
+    va_end(ap);
+    return rv;
+}
+
 int
 add_persist_int(persist_t *p, long val, const char *name, ...)
 {
@@ -40,37 +40,77 @@
 #include <openssl/evp.h>
 #include <OpenIPMI/ipmi_lan.h>
 #include <OpenIPMI/internal/ipmi_malloc.h>
+#include <OpenIPMI/internal/ipmi_locks.h>
 
+/*
+ * The cipher contexts are keyed once when the session comes up, each
+ * packet only sets a new IV.  The lock is there because more than one
+ * thread may be sending or receiving on the connection.
+ */
 typedef struct aes_cbc_info_s
 {
-    unsigned char k2[16];
+    ipmi_lock_t    *lock;
+    EVP_CIPHER_CTX *ectx;
+    EVP_CIPHER_CTX *dctx;
 } aes_cbc_info_t;
 
+static void
+aes_cbc_free(ipmi_con_t *ipmi, void *conf_data)
+{
+    aes_cbc_info_t *info = conf_data;
+
+    /* Freeing the contexts cleanses the key schedules. */
+    if (info->ectx)
+	EVP_CIPHER_CTX_free(info->ectx);
+    if (info->dctx)
+	EVP_CIPHER_CTX_free(info->dctx);
+    if (info->lock)
+	ipmi_destroy_lock(info->lock);
+    ipmi_mem_free(info);
+}
+
 static int
 aes_cbc_init(ipmi_con_t *ipmi, ipmi_rmcpp_auth_t *ainfo, void **conf_data)
 {
-    aes_cbc_info_t *info;
-    unsigned int   k2len;
+    aes_cbc_info_t      *info;
+    const unsigned char *k2;
+    unsigned int        k2len;
+    int                 rv;
+
+    if (ipmi_rmcpp_auth_get_k2_len(ainfo) < 16)
+	return EINVAL;
+    k2 = ipmi_rmcpp_auth_get_k2(ainfo, &k2len);
 
     info = ipmi_mem_alloc(sizeof(*info));
     if (!info)
 	return ENOMEM;
+    memset(info, 0, sizeof(*info));
+
+    rv = ipmi_create_lock_os_hnd(ipmi->os_hnd, &info->lock);
+    if (rv)
+	goto out_err;
+
+    info->ectx = EVP_CIPHER_CTX_new();
+    info->dctx = EVP_CIPHER_CTX_new();
+    if (!info->ectx || !info->dctx) {
+	rv = ENOMEM;
+	goto out_err;
+    }
+    if (!EVP_EncryptInit_ex(info->ectx, EVP_aes_128_cbc(), NULL, k2, NULL)
+	|| !EVP_DecryptInit_ex(info->dctx, EVP_aes_128_cbc(), NULL, k2, NULL))
+    {
+	rv = EINVAL;
+	goto out_err;
+    }
+    EVP_CIPHER_CTX_set_padding(info->ectx, 0);
+    EVP_CIPHER_CTX_set_padding(info->dctx, 0);
 
-    if (ipmi_rmcpp_auth_get_k2_len(ainfo) < 16)
-	return EINVAL;
-    
-    memcpy(info->k2, ipmi_rmcpp_auth_get_k2(ainfo, &k2len), 16);
     *conf_data = info;
     return 0;
-}
 
-static void
-aes_cbc_free(ipmi_con_t *ipmi, void *conf_data)
-{
-    aes_cbc_info_t *info = conf_data;
-
-    memset(info->k2, 0, 16);
-    ipmi_mem_free(info);
+ out_err:
+    aes_cbc_free(ipmi, info);
+    return rv;
 }
 
 static int
@@ -85,9 +125,7 @@ aes_cbc_encrypt(ipmi_con_t    *ipmi,
     unsigned char  *iv;
     unsigned int   l = *payload_len;
     unsigned int   i;
-    unsigned char  *d;
-    EVP_CIPHER_CTX *ctx;
-    int            rv;
+    int            rv = 0;
     int            outlen;
     int            tmplen;
     unsigned char  *padpos;
@@ -108,16 +146,9 @@ aes_cbc_encrypt(ipmi_con_t    *ipmi,
     if (l > *max_payload_len)
 	return E2BIG;
 
-    /* We store the unencrypted data here, then crypt into the real
-       data. */
-    d = ipmi_mem_alloc(l);
-    if (!d)
-	return ENOMEM;
-
-    memcpy(d, *payload, *payload_len);
-
-    /* Now add the padding. */
-    padpos = d + *payload_len;
+    /* Add the padding after the data, there is room for it.  The
+       data is encrypted in place. */
+    padpos = (*payload) + *payload_len;
     padval = 1;
     for (i=0; i<padlen; i++, padpos++, padval++)
 	*padpos = padval;
@@ -126,28 +157,24 @@ aes_cbc_encrypt(ipmi_con_t    *ipmi,
     /* Now create the initialization vector, including making room for it. */
     iv = (*payload)-16;
     rv = ipmi->os_hnd->get_random(ipmi->os_hnd, iv, 16);
-    if (rv) {
-	ipmi_mem_free(d);
+    if (rv)
 	return rv;
-    }
     *header_len -= 16;
     *max_payload_len += 16;
 
-    ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) {
-	    rv = ENOMEM;
-	    goto out_cleanup;
-    }
     /* Ok, we're set to do the crypt operation. */
-    EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, info->k2, iv);
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
-    if (!EVP_EncryptUpdate(ctx, *payload, &outlen, d, l)) {
+    ipmi_lock(info->lock);
+    if (!EVP_EncryptInit_ex(info->ectx, NULL, NULL, NULL, iv)) {
 	rv = ENOMEM; /* right? */
-	goto out_cleanup;
+	goto out_unlock;
     }
-    if (!EVP_EncryptFinal_ex(ctx, (*payload) + outlen, &tmplen)) {
+    if (!EVP_EncryptUpdate(info->ectx, *payload, &outlen, *payload, l)) {
 	rv = ENOMEM; /* right? */
-	goto out_cleanup;
+	goto out_unlock;
+    }
+    if (!EVP_EncryptFinal_ex(info->ectx, (*payload) + outlen, &tmplen)) {
+	rv = ENOMEM; /* right? */
+	goto out_unlock;
     }
     outlen += tmplen;
 
@@ -157,9 +184,8 @@ aes_cbc_encrypt(ipmi_con_t    *ipmi,
     *payload = iv;
     *payload_len = outlen + 16;
 
- out_cleanup:
-    EVP_CIPHER_CTX_free(ctx);
-    ipmi_mem_free(d);
+ out_unlock:
+    ipmi_unlock(info->lock);
 
     return rv;
 }
@@ -172,9 +198,7 @@ aes_cbc_decrypt(ipmi_con_t    *ipmi,
 {
     aes_cbc_info_t *info = conf_data;
     unsigned int   l = *payload_len;
-    unsigned char  *d;
     unsigned char  *p;
-    EVP_CIPHER_CTX *ctx;
     int            outlen;
     int            rv = 0;
     unsigned char  *pad;
@@ -188,28 +212,17 @@ aes_cbc_decrypt(ipmi_con_t    *ipmi,
 	return EINVAL;
 
     l -= 16;
-    /* We store the encrypted data here, then decrypt into the real
-       data. */
-    d = ipmi_mem_alloc(l);
-    if (!d)
-	return ENOMEM;
-
     p = (*payload)+16;
 
-    memcpy(d, p, l);
-
-    /* Ok, we're set to do the decrypt operation. */
-    ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) {
-	    rv = ENOMEM;
-	    goto out_cleanup;
-    }
-    EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, info->k2, *payload);
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
-    if (!EVP_DecryptUpdate(ctx, p, &outlen, d, l)) {
-	rv = EINVAL;
-	goto out_cleanup;
+    /* Ok, we're set to do the decrypt operation, in place. */
+    ipmi_lock(info->lock);
+    if (!EVP_DecryptInit_ex(info->dctx, NULL, NULL, NULL, *payload)
+	|| !EVP_DecryptUpdate(info->dctx, p, &outlen, p, l))
+    {
+	ipmi_unlock(info->lock);
+	return EINVAL;
     }
+    ipmi_unlock(info->lock);
 
     if (outlen < 16) {
 	rv = EINVAL;
@@ -239,8 +252,6 @@ aes_cbc_decrypt(ipmi_con_t    *ipmi,
     *payload_len = outlen;
 
  out_cleanup:
-    EVP_CIPHER_CTX_free(ctx);
-    ipmi_mem_free(d);
     return rv;
 }
 
@@ -123,10 +123,12 @@ typedef struct ll_msg_s
     long                         seq;
 
     int                          side_effects;
-
-    ilist_item_t link;
 } ll_msg_t;
 
+/* Initial size of the outstanding command table, must be a power
+   of 2. */
+#define CMDS_TABLE_INIT_SIZE 64
+
 typedef struct activate_timer_info_s
 {
     int           cancelled;
@@ -202,12 +204,18 @@ struct ipmi_domain_s
     ipmi_mc_t *sys_intf_mcs[MAX_CONS];
     ipmi_lock_t *mc_lock;
 
-    /* A list of outstanding messages.  We use this so we can reroute
-       messages to another connection in case a connection fails. */
-    ilist_t     *cmds;
-    ipmi_lock_t *cmds_lock;
-    long        cmds_seq; /* Sequence number for messages to avoid
-			     reuse problems. */
+    /* A table of outstanding messages.  We use this so we can
+       reroute messages to another connection in case a connection
+       fails.  A message lives in the slot given by the low bits of
+       its sequence number, the full sequence number tells a response
+       for the message from one for an earlier message in the same
+       slot. */
+    ll_msg_t     **cmds;
+    unsigned int cmds_size; /* Always a power of 2 */
+    unsigned int cmds_count;
+    ipmi_lock_t  *cmds_lock;
+    long         cmds_seq; /* Sequence number for messages to avoid
+			      reuse problems. */
     long        conn_seq[MAX_CONS]; /* Sequence number for connection
 				       switchovers to avoid handling
 				       old messages. */
@@ -351,6 +359,7 @@ struct ipmi_domain_s
     unsigned int option_local_only : 1;
     unsigned int option_local_only_set : 1;
     unsigned int option_use_cache : 1;
+    unsigned int option_sel_speculate;
 };
 
 /* A list of all domains in the system. */
@@ -612,17 +621,18 @@ cleanup_domain(ipmi_domain_t *domain)
     /* Nuke all outstanding messages. */
     if ((domain->cmds_lock) && (domain->cmds)) {
 	ll_msg_t     *nmsg;
-	int          ok;
-	ilist_iter_t iter;
+	unsigned int i;
 
 	ipmi_lock(domain->cmds_lock);
 
-	ilist_init_iter(&iter, domain->cmds);
-	ok = ilist_first(&iter);
-	while (ok) {
+	for (i=0; i<domain->cmds_size; i++) {
 	    ipmi_msgi_t *rspi;
 
-	    nmsg = ilist_get(&iter);
+	    nmsg = domain->cmds[i];
+	    if (!nmsg)
+		continue;
+	    domain->cmds[i] = NULL;
+	    domain->cmds_count--;
 	    rspi = nmsg->rsp_item;
 
 	    rspi->msg.netfn = nmsg->msg.netfn | 1;
@@ -631,17 +641,14 @@ cleanup_domain(ipmi_domain_t *domain)
 	    rspi->msg.data_len = 1;
 	    rspi->msg.data[0] = IPMI_UNKNOWN_ERR_CC;
 	    deliver_rsp(domain, nmsg->rsp_handler, rspi);
-	    
-	    ilist_delete(&iter);
 	    ipmi_mem_free(nmsg);
-	    ok = ilist_first(&iter);
 	}
 	ipmi_unlock(domain->cmds_lock);
     }
     if (domain->cmds_lock)
 	ipmi_destroy_lock(domain->cmds_lock);
     if (domain->cmds)
-	free_ilist(domain->cmds);
+	ipmi_mem_free(domain->cmds);
 
     /* Shutdown code called here. */
     if (domain->shutdown_handler)
@@ -908,6 +915,11 @@ process_options(ipmi_domain_t      *domain,
 	case IPMI_OPEN_OPTION_USE_CACHE:
 	    domain->option_use_cache = options[i].ival != 0;
 	    break;
+	case IPMI_OPEN_OPTION_SEL_SPECULATE:
+	    if (options[i].ival < 0)
+		return EINVAL;
+	    domain->option_sel_speculate = options[i].ival;
+	    break;
 	case IPMI_OPEN_OPTION_ACTIVATE_IF_POSSIBLE:
 	    domain->option_activate_if_possible = options[i].ival != 0;
 	    break;
@@ -1112,11 +1124,13 @@ setup_domain(const char         *name,
     if (rv)
 	goto out_err;
 
-    domain->cmds = alloc_ilist();
+    domain->cmds = ipmi_mem_alloc(sizeof(ll_msg_t *) * CMDS_TABLE_INIT_SIZE);
     if (! domain->cmds) {
 	rv = ENOMEM;
 	goto out_err;
     }
+    memset(domain->cmds, 0, sizeof(ll_msg_t *) * CMDS_TABLE_INIT_SIZE);
+    domain->cmds_size = CMDS_TABLE_INIT_SIZE;
 
     domain->con_change_cl_handlers = locked_list_alloc(domain->os_hnd);
     if (! domain->con_change_cl_handlers) {
@@ -2008,31 +2022,78 @@ i_ipmi_find_or_create_mc_by_slave_addr(ipmi_domain_t *domain,
  *
  **********************************************************************/
 
-static int cmp_nmsg(void *item, void *cb_data)
+static unsigned int
+cmds_slot(ipmi_domain_t *domain, long seq)
 {
-    ll_msg_t *nmsg1 = item;
-    ll_msg_t *nmsg2 = cb_data;
+    return ((unsigned long) seq) & (domain->cmds_size - 1);
+}
+
+/* Double the size of the outstanding command table when it gets half
+   full, so finding a free slot stays quick.  Two messages in
+   different slots can't end up in the same slot of the bigger table,
+   so the move can't fail.  Must be called with the cmds_lock held. */
+static void
+cmds_grow(ipmi_domain_t *domain)
+{
+    ll_msg_t     **new_cmds;
+    ll_msg_t     **old_cmds = domain->cmds;
+    unsigned int old_size = domain->cmds_size;
+    unsigned int i;
 
-    return ((nmsg1 == nmsg2)
-	    && (nmsg1->domain == nmsg2->domain));
+    if ((domain->cmds_count + 1) * 2 <= old_size)
+	return;
+
+    new_cmds = ipmi_mem_alloc(sizeof(ll_msg_t *) * old_size * 2);
+    if (!new_cmds)
+	/* Just keep using the old table, cmds_add() will fail if it
+	   fills up. */
+	return;
+    memset(new_cmds, 0, sizeof(ll_msg_t *) * old_size * 2);
+    domain->cmds = new_cmds;
+    domain->cmds_size = old_size * 2;
+    for (i=0; i<old_size; i++) {
+	if (old_cmds[i])
+	    new_cmds[cmds_slot(domain, old_cmds[i]->seq)] = old_cmds[i];
+    }
+    ipmi_mem_free(old_cmds);
 }
 
-/* Must be called with the cmds_lock held. */
+/* Give the message a new sequence number that lands on a free slot
+   and put it in the table.  The sequence numbers used are still
+   unique, this just skips the ones for slots in use.  Must be called
+   with the cmds_lock held. */
 static int
-find_and_remove_msg(ipmi_domain_t *domain, ll_msg_t *nmsg, long seq)
+cmds_add(ipmi_domain_t *domain, ll_msg_t *nmsg)
 {
-    ilist_iter_t iter;
-    int          rv = 0;
+    if (domain->cmds_count >= domain->cmds_size)
+	return ENOMEM;
 
-    ilist_init_iter(&iter, domain->cmds);
-    ilist_unpositioned(&iter);
-    if ((ilist_search_iter(&iter, cmp_nmsg, nmsg) != NULL)
-	&& (nmsg->seq == seq))
-    {
-	ilist_delete(&iter);
-	rv = 1;
-    }
-    return rv;
+    while (domain->cmds[cmds_slot(domain, domain->cmds_seq)])
+	domain->cmds_seq++;
+    nmsg->seq = domain->cmds_seq;
+    domain->cmds_seq++;
+    domain->cmds[cmds_slot(domain, nmsg->seq)] = nmsg;
+    domain->cmds_count++;
+    return 0;
+}
+
+/* Must be called with the cmds_lock held. */
+static void
+cmds_remove(ipmi_domain_t *domain, ll_msg_t *nmsg)
+{
+    domain->cmds[cmds_slot(domain, nmsg->seq)] = NULL;
+    domain->cmds_count--;
+}
+
+/* Must be called with the cmds_lock held. */
+static ll_msg_t *
+cmds_find(ipmi_domain_t *domain, long seq)
+{
+    ll_msg_t *nmsg = domain->cmds[cmds_slot(domain, seq)];
+
+    if (nmsg && (nmsg->seq == seq))
+	return nmsg;
+    return NULL;
 }
 
 static int
@@ -2041,7 +2102,7 @@ ll_rsp_handler(ipmi_con_t   *ipmi,
 {
     ipmi_msgi_t   *rspi;
     ipmi_domain_t *domain = orspi->data1;
-    ll_msg_t      *nmsg = orspi->data2;
+    ll_msg_t      *nmsg;
     intptr_t      seq = (intptr_t) orspi->data3;
     intptr_t      conn_seq = (intptr_t) orspi->data4;
     int           rv;
@@ -2053,16 +2114,21 @@ ll_rsp_handler(ipmi_con_t   *ipmi,
 	return IPMI_MSG_ITEM_NOT_USED;
 
     ipmi_lock(domain->cmds_lock);
-    if (conn_seq != domain->conn_seq[nmsg->con]) {
-	/* The message has been rerouted, just ignore this response. */
+    nmsg = cmds_find(domain, seq);
+    if (!nmsg) {
+	/* The message has already been handled or has been given a
+	   new sequence number by a reroute, ignore this response. */
 	ipmi_unlock(domain->cmds_lock);
 	goto out_unlock;
     }
 
-    if (!find_and_remove_msg(domain, nmsg, seq)) {
+    if (conn_seq != domain->conn_seq[nmsg->con]) {
+	/* The message has been rerouted, just ignore this response. */
 	ipmi_unlock(domain->cmds_lock);
 	goto out_unlock;
     }
+
+    cmds_remove(domain, nmsg);
     ipmi_unlock(domain->cmds_lock);
 
     rspi = nmsg->rsp_item;
@@ -2276,17 +2342,27 @@ send_command_addr(ipmi_domain_t                *domain,
     nmsg->side_effects = side_effects;
 
     ipmi_lock(domain->cmds_lock);
-    nmsg->seq = domain->cmds_seq;
-    domain->cmds_seq++;
-
-    /* Have to delay this to here so we are holding the lock. */
-    if (is_ipmb)
+    if (is_ipmb) {
+	/* Have to delay this to here so we are holding the lock. */
 	data4 = (void *) (intptr_t) domain->conn_seq[u];
 
+	/* Add it before sending so it is there when the response
+	   comes in.  If it's a system interface we don't add it to
+	   the table of commands running, because it will never need
+	   to be rerouted. */
+	cmds_grow(domain);
+	rv = cmds_add(domain, nmsg);
+	if (rv)
+	    goto out_unlock;
+    } else {
+	nmsg->seq = domain->cmds_seq;
+	domain->cmds_seq++;
+    }
+
     rspi = ipmi_alloc_msg_item();
     if (!rspi) {
 	rv = ENOMEM;
-	goto out_unlock;
+	goto out_remove;
     }
 
     rspi->data1 = domain;
@@ -2298,13 +2374,14 @@ send_command_addr(ipmi_domain_t                *domain,
 
     if (rv) {
 	ipmi_free_msg_item(rspi);
-	goto out_unlock;
-    } else if (is_ipmb) {
-	/* If it's a system interface we don't add it to the list of
-	   commands running, because it will never need to be
-	   rerouted. */
-	ilist_add_tail(domain->cmds, nmsg, &nmsg->link);
+	goto out_remove;
     }
+    ipmi_unlock(domain->cmds_lock);
+    return 0;
+
+ out_remove:
+    if (is_ipmb)
+	cmds_remove(domain, nmsg);
  out_unlock:
     ipmi_unlock(domain->cmds_lock);
 
@@ -2347,68 +2424,71 @@ ipmi_send_command_addr_sideeff(ipmi_domain_t                *domain,
 static void
 reroute_cmds(ipmi_domain_t *domain, int old_con, int new_con)
 {
-    ilist_iter_t iter;
+    unsigned int i;
     int          rv;
     ll_msg_t     *nmsg;
+    long         first_seq;
 
     ipmi_lock(domain->cmds_lock);
-    ilist_init_iter(&iter, domain->cmds);
-    rv = ilist_first(&iter);
     (domain->conn_seq[old_con])++;
-    while (rv) {
-	nmsg = ilist_get(&iter);
-	if (nmsg->con == old_con) {
-	    ipmi_msgi_t       *rspi;
-	    ipmi_con_option_t opt_data[2];
-	    ipmi_con_option_t *options = NULL;
-
-	    nmsg->seq = domain->cmds_seq;
-	    domain->cmds_seq++; /* Make the message unique so a
-                                   response from the other connection
-                                   will not match. */
-	    nmsg->con = new_con;
-
-	    rspi = ipmi_alloc_msg_item();
-	    if (!rspi)
-		goto send_err;
-
-	    if (nmsg->side_effects) {
-		options = opt_data;
-		options[0].option = IPMI_CON_MSG_OPTION_SIDE_EFFECTS;
-		options[0].ival = 1;
-		options[1].option = IPMI_CON_OPTION_LIST_END;
-	    }
+    first_seq = domain->cmds_seq;
+    for (i=0; i<domain->cmds_size; i++) {
+	ipmi_msgi_t       *rspi;
+	ipmi_con_option_t opt_data[2];
+	ipmi_con_option_t *options = NULL;
+
+	nmsg = domain->cmds[i];
+	if (!nmsg || (nmsg->con != old_con))
+	    continue;
+	if (nmsg->seq - first_seq >= 0)
+	    /* Already moved by this loop into a later slot. */
+	    continue;
 
-	    rspi->data1 = domain;
-	    rspi->data2 = nmsg;
-	    rspi->data3 = (void *) (uintptr_t) nmsg->seq;
-	    rspi->data4 = (void *) (uintptr_t) domain->conn_seq[new_con];
-	    rv = send_command_option(domain, new_con,
-				     &nmsg->rsp_item->addr,
-				     nmsg->rsp_item->addr_len,
-				     &nmsg->msg,
-				     options,
-				     ll_rsp_handler,
-				     rspi);
-	    if (rv) {
-		ipmi_free_msg_item(rspi);
-	    send_err:
-		/* Couldn't send the message, just fail it. */
-		if (nmsg->rsp_handler) {
-		    rspi = nmsg->rsp_item;
-		    rspi->msg.netfn = nmsg->msg.netfn | 1;
-		    rspi->msg.cmd = nmsg->msg.cmd;
-		    rspi->msg.data = rspi->data;
-		    rspi->msg.data_len = 1;
-		    rspi->data[0] = IPMI_UNKNOWN_ERR_CC;
-		    deliver_rsp(domain, nmsg->rsp_handler, rspi);
-		}
-		rv = ilist_delete(&iter);
-		ipmi_mem_free(nmsg);
-		continue;
+	/* Give the message a new sequence number so a response from
+	   the other connection will not match.  It was removed first,
+	   so there is always room to put it back. */
+	cmds_remove(domain, nmsg);
+	cmds_add(domain, nmsg);
+	nmsg->con = new_con;
+
+	rspi = ipmi_alloc_msg_item();
+	if (!rspi)
+	    goto send_err;
+
+	if (nmsg->side_effects) {
+	    options = opt_data;
+	    options[0].option = IPMI_CON_MSG_OPTION_SIDE_EFFECTS;
+	    options[0].ival = 1;
+	    options[1].option = IPMI_CON_OPTION_LIST_END;
+	}
+
+	rspi->data1 = domain;
+	rspi->data2 = nmsg;
+	rspi->data3 = (void *) (uintptr_t) nmsg->seq;
+	rspi->data4 = (void *) (uintptr_t) domain->conn_seq[new_con];
+	rv = send_command_option(domain, new_con,
+				 &nmsg->rsp_item->addr,
+				 nmsg->rsp_item->addr_len,
+				 &nmsg->msg,
+				 options,
+				 ll_rsp_handler,
+				 rspi);
+	if (rv) {
+	    ipmi_free_msg_item(rspi);
+	send_err:
+	    /* Couldn't send the message, just fail it. */
+	    cmds_remove(domain, nmsg);
+	    if (nmsg->rsp_handler) {
+		rspi = nmsg->rsp_item;
+		rspi->msg.netfn = nmsg->msg.netfn | 1;
+		rspi->msg.cmd = nmsg->msg.cmd;
+		rspi->msg.data = rspi->data;
+		rspi->msg.data_len = 1;
+		rspi->data[0] = IPMI_UNKNOWN_ERR_CC;
+		deliver_rsp(domain, nmsg->rsp_handler, rspi);
 	    }
+	    ipmi_mem_free(nmsg);
 	}
-	rv = ilist_next(&iter);
     }
     ipmi_unlock(domain->cmds_lock);
 }
@@ -5162,6 +5242,22 @@ i_ipmi_domain_get_connection(ipmi_domain_t *domain,
     return 0;
 }
 
+unsigned int
+i_ipmi_domain_get_max_outstanding_msgs(ipmi_domain_t *domain)
+{
+    ipmi_con_t *ipmi;
+    int        u = domain->working_conn;
+
+    /* If we don't have any working connection, just use connection
+       zero, like the send code does. */
+    if (u == -1)
+	u = 0;
+    ipmi = domain->conn[u];
+    if (!ipmi || !ipmi->get_max_outstanding_msgs)
+	return 0;
+    return ipmi->get_max_outstanding_msgs(ipmi);
+}
+
 void
 ipmi_domain_iterate_connections(ipmi_domain_t          *domain,
 				ipmi_connection_ptr_cb handler,
@@ -5515,6 +5611,12 @@ ipmi_option_use_cache(ipmi_domain_t *domain)
     return domain->option_use_cache;
 }
 
+unsigned int
+ipmi_option_sel_speculate(ipmi_domain_t *domain)
+{
+    return domain->option_sel_speculate;
+}
+
 int
 ipmi_option_activate_if_possible(ipmi_domain_t *domain)
 {
@@ -147,6 +147,9 @@ struct ipmi_entity_s
 
     dlr_ref_t key;
 
+    /* Next entity in the same bucket of the entity info's hash. */
+    ipmi_entity_t *hash_next;
+
     /* Lock used for protecting misc data. */
     ipmi_lock_t *elock;
 
@@ -324,14 +327,26 @@ struct ipmi_entity_info_s
     ipmi_domain_t         *domain;
     ipmi_domain_id_t      domain_id;
     locked_list_t         *entities;
+
+    /* A hash of the entities by key, so finding an entity doesn't
+       have to search the list.  The list is still kept for
+       iteration, so the order entities are reported in doesn't
+       change.  Protected by the domain entity lock. */
+    ipmi_entity_t         **hash;
+    unsigned int          hash_size; /* Always a power of 2 */
+    unsigned int          hash_count;
 };
 
+/* Initial size of the entity hash, must be a power of 2. */
+#define ENTITY_HASH_INIT_SIZE 64
+
 #define ent_lock(e) ipmi_lock(e->elock)
 #define ent_unlock(e) ipmi_unlock(e->elock)
 
 static void entity_mc_active(ipmi_mc_t *mc, int active, void *cb_data);
 static void call_presence_handlers(ipmi_entity_t *ent, int present);
 static void call_fully_up_handlers(ipmi_entity_t *ent);
+static void entity_hash_remove(ipmi_entity_info_t *ents, ipmi_entity_t *ent);
 
 /***********************************************************************
  *
@@ -450,8 +465,20 @@ ipmi_entity_info_alloc(ipmi_domain_t *domain, ipmi_entity_info_t **new_info)
 	return ENOMEM;
     }
 
+    ents->hash = ipmi_mem_alloc(sizeof(ipmi_entity_t *)
+				* ENTITY_HASH_INIT_SIZE);
+    if (! ents->hash) {
+	locked_list_destroy(ents->entities);
+	ipmi_mem_free(ents);
+	return ENOMEM;
+    }
+    memset(ents->hash, 0, sizeof(ipmi_entity_t *) * ENTITY_HASH_INIT_SIZE);
+    ents->hash_size = ENTITY_HASH_INIT_SIZE;
+    ents->hash_count = 0;
+
     ents->update_handlers = locked_list_alloc(ipmi_domain_get_os_hnd(domain));
     if (! ents->update_handlers) {
+	ipmi_mem_free(ents->hash);
 	locked_list_destroy(ents->entities);
 	ipmi_mem_free(ents);
 	return ENOMEM;
@@ -461,6 +488,7 @@ ipmi_entity_info_alloc(ipmi_domain_t *domain, ipmi_entity_info_t **new_info)
 	= locked_list_alloc(ipmi_domain_get_os_hnd(domain));
     if (! ents->update_cl_handlers) {
 	locked_list_destroy(ents->update_handlers);
+	ipmi_mem_free(ents->hash);
 	locked_list_destroy(ents->entities);
 	ipmi_mem_free(ents);
 	return ENOMEM;
@@ -842,6 +870,7 @@ ipmi_entity_info_destroy(ipmi_entity_info_t *ents)
     locked_list_destroy(ents->update_cl_handlers);
     locked_list_iterate(ents->entities, destroy_entity, NULL);
     locked_list_destroy(ents->entities);
+    ipmi_mem_free(ents->hash);
     ipmi_mem_free(ents);
     return 0;
 }
@@ -909,6 +938,7 @@ cleanup_entity(ipmi_entity_t *ent)
 
 	/* Remove it from the entities list. */
 	locked_list_remove_nolock(ent->ents->entities, ent, NULL);
+	entity_hash_remove(ent->ents, ent);
 
 	/* The sensor, control, parent, and child lists should be empty
 	   now, we can just destroy it. */
@@ -1235,29 +1265,81 @@ ipmi_entity_info_remove_update_handler_cl(ipmi_entity_info_t       *ents,
 	return EINVAL;
 }
 
-typedef struct search_info_s {
-    dlr_ref_t         key;
-    ipmi_entity_t     *ent;
-} search_info_t;
+static unsigned int
+entity_hash_idx(ipmi_entity_info_t *ents, const dlr_ref_t *key)
+{
+    unsigned int idx;
 
-static int
-search_entity(void *cb_data, void *item1, void *item2)
+    idx = ((key->device_num.channel << 24)
+	   | (key->device_num.address << 16)
+	   | (key->entity_id << 8)
+	   | key->entity_instance);
+    /* Fold the device number into the low bits. */
+    idx ^= idx >> 16;
+    return idx & (ents->hash_size - 1);
+}
+
+/* Double the size of the hash when it averages more than two entities
+   per bucket.  If the allocation fails, the old hash still works, it
+   is just slower.  Must be called with the domain entity lock held. */
+static void
+entity_hash_grow(ipmi_entity_info_t *ents)
 {
-    ipmi_entity_t *ent = (ipmi_entity_t *) item1;
-    search_info_t *info = (search_info_t *) cb_data;
-    int           same;
+    ipmi_entity_t **new_hash, **old_hash = ents->hash;
+    ipmi_entity_t *ent, *next;
+    unsigned int  old_size = ents->hash_size;
+    unsigned int  i, idx;
 
-    same = ((ent->key.device_num.channel == info->key.device_num.channel)
-	    && (ent->key.device_num.address == info->key.device_num.address)
-	    && (ent->key.entity_id == info->key.entity_id)
-	    && (ent->key.entity_instance == info->key.entity_instance));
-    if (same) {
-	info->ent = ent;
-	return LOCKED_LIST_ITER_STOP;
+    if (ents->hash_count < (old_size * 2))
+	return;
+
+    new_hash = ipmi_mem_alloc(sizeof(*new_hash) * old_size * 2);
+    if (!new_hash)
+	return;
+    memset(new_hash, 0, sizeof(*new_hash) * old_size * 2);
+    ents->hash = new_hash;
+    ents->hash_size = old_size * 2;
+    for (i=0; i<old_size; i++) {
+	for (ent = old_hash[i]; ent; ent = next) {
+	    next = ent->hash_next;
+	    idx = entity_hash_idx(ents, &ent->key);
+	    ent->hash_next = new_hash[idx];
+	    new_hash[idx] = ent;
+	}
     }
-    return LOCKED_LIST_ITER_CONTINUE;
+    ipmi_mem_free(old_hash);
+}
+
+/* Must be called with the domain entity lock held. */
+static void
+entity_hash_add(ipmi_entity_info_t *ents, ipmi_entity_t *ent)
+{
+    unsigned int idx;
+
+    entity_hash_grow(ents);
+    idx = entity_hash_idx(ents, &ent->key);
+    ent->hash_next = ents->hash[idx];
+    ents->hash[idx] = ent;
+    ents->hash_count++;
+}
+
+/* Must be called with the domain entity lock held. */
+static void
+entity_hash_remove(ipmi_entity_info_t *ents, ipmi_entity_t *ent)
+{
+    ipmi_entity_t **prev;
+
+    prev = &ents->hash[entity_hash_idx(ents, &ent->key)];
+    while (*prev && (*prev != ent))
+	prev = &(*prev)->hash_next;
+    if (*prev) {
+	*prev = ent->hash_next;
+	ents->hash_count--;
+    }
+    ent->hash_next = NULL;
 }
 
+/* Must be called with the domain entity lock held. */
 static int
 entity_find(ipmi_entity_info_t *ents,
 	    ipmi_device_num_t  device_num,
@@ -1265,19 +1347,25 @@ entity_find(ipmi_entity_info_t *ents,
 	    int                entity_instance,
 	    ipmi_entity_t      **found_ent)
 {
-    search_info_t info = { {device_num, entity_id, entity_instance}, NULL};
-    int           rv = 0;
+    dlr_ref_t     key = { device_num, entity_id, entity_instance };
+    ipmi_entity_t *ent;
 
-    locked_list_iterate_nolock(ents->entities, search_entity, &info);
-    if (info.ent == NULL) {
-	rv = ENOENT;
-    } else {
-	info.ent->usecount++;
-	if (found_ent)
-	    *found_ent = info.ent;
+    ent = ents->hash[entity_hash_idx(ents, &key)];
+    while (ent) {
+	if ((ent->key.device_num.channel == key.device_num.channel)
+	    && (ent->key.device_num.address == key.device_num.address)
+	    && (ent->key.entity_id == key.entity_id)
+	    && (ent->key.entity_instance == key.entity_instance))
+	    break;
+	ent = ent->hash_next;
     }
+    if (ent == NULL)
+	return ENOENT;
 
-    return rv;
+    ent->usecount++;
+    if (found_ent)
+	*found_ent = ent;
+    return 0;
 }
 
 int
@@ -1471,6 +1559,7 @@ entity_add(ipmi_entity_info_t *ents,
 
     if (! locked_list_add_nolock(ents->entities, ent, NULL))
 	goto out_err;
+    entity_hash_add(ents, ent);
 
     i_ipmi_domain_entity_unlock(ent->domain);
 
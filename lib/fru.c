@@ -57,6 +57,11 @@
 #define FRU_DATA_FETCH_DECR 8
 #define MIN_FRU_DATA_FETCH 16
 
+/* The maximum number of Read FRU Data commands we will have
+   outstanding at once.  The real limit is the smaller of this and
+   what the connection will have outstanding. */
+#define MAX_FRU_FETCH_WINDOW 8
+
 #define MAX_FRU_DATA_WRITE 16
 #define MAX_FRU_WRITE_RETRIES 30
 
@@ -105,6 +110,17 @@ typedef struct ipmi_fru_op_s
 			 ipmi_fru_node_t **rnode);
 } ipmi_fru_op_t;
 
+/* A piece of the FRU data being read.  Each one has at most one Read
+   FRU Data command outstanding, reading from pos up to end.  Short
+   reads and retries just continue from pos. */
+typedef struct fru_fetch_s
+{
+    unsigned int pos;
+    unsigned int end;
+    unsigned int req_len;
+    int          in_flight;
+} fru_fetch_t;
+
 struct ipmi_fru_s
 {
     char name[IPMI_FRU_NAME_LEN+1];
@@ -146,13 +162,31 @@ struct ipmi_fru_s
     int           access_by_words;
     unsigned char *data;
     unsigned int  data_len;
-    unsigned int  curr_pos;
     unsigned int  curr_write_len;
     int           write_prepared;
     int           saved_err;
 
     int           fetch_size;
 
+    /* Pipelined fetch handling.  Data is handed out to the pieces in
+       order starting at next_pos.  The window grows by one for each
+       good response until the first size error, then by one per
+       window's worth of responses, and is halved on size errors. */
+    fru_fetch_t    fetch[MAX_FRU_FETCH_WINDOW];
+    unsigned int   fetch_window;
+    unsigned int   fetch_max_window;
+    unsigned int   fetch_thresh;
+    unsigned int   fetch_acks;
+    unsigned int   fetch_outstanding;
+    unsigned int   fetch_next_pos;
+    unsigned int   fetch_stop_pos; /* Lowest unread data after an error */
+    int            fetch_err;
+    struct timeval fetch_start;
+
+    /* Statistics from the last fetch of the data. */
+    unsigned int  fetch_usecs;
+    unsigned int  fetch_bytes_per_sec;
+
     /* Is this in the list of FRUs? */
     int in_frulist;
 
@@ -619,8 +653,6 @@ start_fru_fetch(ipmi_fru_t *fru, ipmi_domain_t *domain)
 {
     int rv;
 
-    fru->curr_pos = 0;
-
     if (fru->is_logical)
 	rv = start_logical_fru_fetch(domain, fru);
     else
@@ -629,6 +661,108 @@ start_fru_fetch(ipmi_fru_t *fru, ipmi_domain_t *domain)
     return rv;
 }
 
+/*
+ * FRUs with a timestamp (the ATCA FRU locking ones) can be cached,
+ * the timestamp changes whenever the data is written so it tells us
+ * if the cached copy is still good.  The data is stored with the
+ * timestamp and a format number at the end, like the SDR cache.
+ */
+#define FRU_DB_KEY_LEN 96
+
+static int
+fru_db_key(ipmi_fru_t *fru, ipmi_domain_t *domain, char *key)
+{
+    unsigned char guid[16];
+    char          *s = key;
+    int           i;
+
+    if (!ipmi_option_use_cache(domain))
+	return ENOSYS;
+    if (ipmi_domain_get_guid(domain, guid))
+	return ENOSYS;
+
+    s += sprintf(s, "fru-");
+    for (i=0; i<16; i++)
+	s += sprintf(s, "%2.2x", guid[i]);
+    sprintf(s, "-%d-%x-%d-%d-%d-%d", fru->is_logical, fru->device_address,
+	    fru->device_id, fru->lun, fru->private_bus, fru->channel);
+    return 0;
+}
+
+static void
+fru_db_fetched(void          *cb_data,
+	       int           err,
+	       unsigned char *data,
+	       unsigned int  data_len)
+{
+    ipmi_fru_t *fru = cb_data;
+
+    /* The fetch has already been started from the FRU, too late to
+       use this. */
+    if (!err)
+	fru->os_hnd->database_free(fru->os_hnd, data);
+}
+
+/* Returns true if the data for the timestamp was found in the cache
+   and put into the FRU data. */
+static int
+fru_db_find(ipmi_fru_t *fru, ipmi_domain_t *domain, uint32_t timestamp)
+{
+    os_handler_t  *os_hnd = fru->os_hnd;
+    char          key[FRU_DB_KEY_LEN];
+    unsigned char *db_data;
+    unsigned int  db_data_len;
+    unsigned int  fetched = 0;
+    unsigned int  len;
+    int           found = 0;
+
+    if (!os_hnd->database_find || fru_db_key(fru, domain, key))
+	return 0;
+
+    if (os_hnd->database_find(os_hnd, key, &fetched, &db_data, &db_data_len,
+			      fru_db_fetched, fru))
+	return 0;
+    if (!fetched)
+	return 0;
+
+    if (db_data_len < 5 || db_data[db_data_len - 1] != 1)
+	goto out;
+    len = db_data_len - 5;
+    if (ipmi_get_uint32(db_data + len) != timestamp)
+	goto out;
+
+    fru->data = ipmi_mem_alloc(len ? len : 1);
+    if (!fru->data)
+	goto out;
+    memcpy(fru->data, db_data, len);
+    fru->data_len = len;
+    found = 1;
+
+ out:
+    os_hnd->database_free(os_hnd, db_data);
+    return found;
+}
+
+static void
+fru_db_store(ipmi_fru_t *fru, ipmi_domain_t *domain)
+{
+    os_handler_t  *os_hnd = fru->os_hnd;
+    char          key[FRU_DB_KEY_LEN];
+    unsigned char *d;
+
+    if (!os_hnd->database_store || fru_db_key(fru, domain, key))
+	return;
+
+    d = ipmi_mem_alloc(fru->data_len + 5);
+    if (!d)
+	return;
+    memcpy(d, fru->data, fru->data_len);
+    ipmi_set_uint32(d + fru->data_len, fru->last_timestamp);
+    d[fru->data_len + 4] = 1; /* format # */
+    os_hnd->database_store(os_hnd, key, d, fru->data_len + 5);
+    ipmi_mem_free(d);
+}
+
 static void
 fetch_got_timestamp(ipmi_fru_t    *fru,
 		    ipmi_domain_t *domain,
@@ -648,6 +782,10 @@ fetch_got_timestamp(ipmi_fru_t    *fru,
     }
 
     fru->last_timestamp = timestamp;
+    if (fru_db_find(fru, domain, timestamp)) {
+	fetch_complete(domain, fru, 0);
+	goto out;
+    }
     rv = start_fru_fetch(fru, domain);
     if (rv) {
 	fetch_complete(domain, fru, rv);
@@ -932,10 +1070,10 @@ fetch_complete(ipmi_domain_t *domain, ipmi_fru_t *fru, int err)
     fru_put(fru);
 }
 
-static int request_next_data(ipmi_domain_t *domain,
-			     ipmi_fru_t    *fru,
-			     ipmi_addr_t   *addr,
-			     unsigned int  addr_len);
+static void fru_fetch_continue(ipmi_domain_t *domain,
+			       ipmi_fru_t    *fru,
+			       ipmi_addr_t   *addr,
+			       unsigned int  addr_len);
 
 static void
 end_fru_fetch(ipmi_fru_t    *fru,
@@ -969,8 +1107,12 @@ end_fru_fetch(ipmi_fru_t    *fru,
 	    if (rv)
 		fetch_complete(domain, fru, rv);
 	}
-    } else
+    } else {
+	/* Don't cache data that was cut short by an error. */
+	if (!fru->fetch_err)
+	    fru_db_store(fru, domain);
 	fetch_complete(domain, fru, 0);
+    }
 
  out:
     return;
@@ -983,14 +1125,17 @@ fru_data_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
     unsigned int  addr_len = rspi->addr_len;
     ipmi_msg_t    *msg = &rspi->msg;
     ipmi_fru_t    *fru = rspi->data1;
+    fru_fetch_t   *f = rspi->data2;
     unsigned char *data = msg->data;
-    int           count;
-    int           err;
+    unsigned int  count;
 
     i_ipmi_fru_lock(fru);
 
+    f->in_flight = 0;
+    fru->fetch_outstanding--;
+
     if (fru->deleted) {
-	fetch_complete(domain, fru, ECANCELED);
+	fru->fetch_err = ECANCELED;
 	goto out;
     }
 
@@ -1005,45 +1150,26 @@ fru_data_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 	&& (fru->fetch_size > MIN_FRU_DATA_FETCH))
     {
 	/* System couldn't support the given size, try decreasing and
-	   starting again. */
-	fru->fetch_size -= FRU_DATA_FETCH_DECR;
-	err = request_next_data(domain, fru, addr, addr_len);
-	if (err) {
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "%sfru.c(fru_data_handler): "
-		     "Error requesting next FRU data (2)",
-		     FRU_DOMAIN_NAME(fru));
-	    fetch_complete(domain, fru, err);
-	    goto out;
+	   starting again.  Only decrease once for all the requests
+	   that were sent with the old size.  This may also be the BMC
+	   choking on too many requests, so back off the window,
+	   too. */
+	if (f->req_len >= (unsigned int) fru->fetch_size) {
+	    fru->fetch_size -= FRU_DATA_FETCH_DECR;
+	    fru->fetch_thresh = fru->fetch_window / 2;
+	    if (fru->fetch_thresh == 0)
+		fru->fetch_thresh = 1;
+	    fru->fetch_window = fru->fetch_thresh;
+	    fru->fetch_acks = 0;
 	}
-	goto out_unlock;
+	goto out;
     }
 
     if (data[0] != 0) {
-	if (fru->curr_pos >= 8) {
-	    /* Some screwy cards give more size in the info than they
-	       really have, if we have enough, try to process it. */
-	    ipmi_log(IPMI_LOG_WARNING,
-		     "%sfru.c(fru_data_handler): "
-		     "IPMI error getting FRU data: %x",
-		     FRU_DOMAIN_NAME(fru), data[0]);
-	    fru->data_len = fru->curr_pos;
-	    if (fru->timestamp_cb) {
-		err = fru->timestamp_cb(fru, domain, end_fru_fetch);
-		if (err)
-		    fetch_complete(domain, fru, err);
-		else
-		    goto out_unlock;
-	    } else {
-		fetch_complete(domain, fru, 0);
-	    }
-	} else {
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "%sfru.c(fru_data_handler): "
-		     "IPMI error getting FRU data: %x",
-		     FRU_DOMAIN_NAME(fru), data[0]);
-	    fetch_complete(domain, fru, IPMI_IPMI_ERR_VAL(data[0]));
-	}
+	/* Handled when everything is finished, we may have enough
+	   data to use. */
+	if (!fru->fetch_err)
+	    fru->fetch_err = IPMI_IPMI_ERR_VAL(data[0]);
 	goto out;
     }
 
@@ -1052,7 +1178,7 @@ fru_data_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 		 "%sfru.c(fru_data_handler): "
 		 "FRU data response too small",
 		 FRU_DOMAIN_NAME(fru));
-	fetch_complete(domain, fru, EINVAL);
+	fru->fetch_err = EINVAL;
 	goto out;
     }
 
@@ -1063,82 +1189,228 @@ fru_data_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 		 "%sfru.c(fru_data_handler): "
 		 "FRU got zero-sized data, must make progress!",
 		 FRU_DOMAIN_NAME(fru));
-	fetch_complete(domain, fru, EINVAL);
+	fru->fetch_err = EINVAL;
 	goto out;
     }
 
-    if (count > msg->data_len-2) {
+    if (count > (unsigned int) (msg->data_len-2)) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "%sfru.c(fru_data_handler): "
 		 "FRU data count mismatch",
 		 FRU_DOMAIN_NAME(fru));
-	fetch_complete(domain, fru, EINVAL);
+	fru->fetch_err = EINVAL;
 	goto out;
     }
 
-    memcpy(fru->data+fru->curr_pos, data+2, count);
-    fru->curr_pos += count;
+    /* Anything past what we asked for belongs to another piece. */
+    if (count > f->end - f->pos)
+	count = f->end - f->pos;
 
-    if (fru->curr_pos < fru->data_len) {
-	/* More to fetch. */
-	err = request_next_data(domain, fru, addr, addr_len);
-	if (err) {
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "%sfru.c(fru_data_handler): "
-		     "Error requesting next FRU data",
-		     FRU_DOMAIN_NAME(fru));
-	    fetch_complete(domain, fru, err);
-	    goto out;
-	}
-    } else {
-	if (fru->timestamp_cb) {
-	    err = fru->timestamp_cb(fru, domain, end_fru_fetch);
-	    if (err) {
-		fetch_complete(domain, fru, err);
-		goto out;
-	    }
+    memcpy(fru->data+f->pos, data+2, count);
+    f->pos += count;
+
+    if (fru->fetch_window < fru->fetch_max_window) {
+	if (fru->fetch_window < fru->fetch_thresh) {
+	    fru->fetch_window++;
 	} else {
-	    fetch_complete(domain, fru, 0);
-	    goto out;
+	    fru->fetch_acks++;
+	    if (fru->fetch_acks >= fru->fetch_window) {
+		fru->fetch_window++;
+		fru->fetch_acks = 0;
+	    }
 	}
     }
 
- out_unlock:
-    i_ipmi_fru_unlock(fru);
  out:
+    fru_fetch_continue(domain, fru, addr, addr_len);
     return IPMI_MSG_ITEM_NOT_USED;
 }
 
 static int
 request_next_data(ipmi_domain_t *domain,
 		  ipmi_fru_t    *fru,
+		  fru_fetch_t   *f,
 		  ipmi_addr_t   *addr,
 		  unsigned int  addr_len)
 {
     unsigned char cmd_data[4];
     ipmi_msg_t    msg;
-    int           to_read;
+    unsigned int  to_read;
+    int           rv;
 
     /* We only request as much as we have to.  Don't always reqeust
        the maximum amount, some machines don't like this. */
-    to_read = fru->data_len - fru->curr_pos;
-    if (to_read > fru->fetch_size)
+    to_read = f->end - f->pos;
+    if (to_read > (unsigned int) fru->fetch_size)
 	to_read = fru->fetch_size;
 
     cmd_data[0] = fru->device_id;
-    ipmi_set_uint16(cmd_data+1, fru->curr_pos >> fru->access_by_words);
+    ipmi_set_uint16(cmd_data+1, f->pos >> fru->access_by_words);
     cmd_data[3] = to_read >> fru->access_by_words;
     msg.netfn = IPMI_STORAGE_NETFN;
     msg.cmd = IPMI_READ_FRU_DATA_CMD;
     msg.data = cmd_data;
     msg.data_len = 4;
 
-    return ipmi_send_command_addr(domain,
-				  addr, addr_len,
-				  &msg,
-				  fru_data_handler,
-				  fru,
-				  NULL);
+    rv = ipmi_send_command_addr(domain,
+				addr, addr_len,
+				&msg,
+				fru_data_handler,
+				fru,
+				f);
+    if (!rv) {
+	f->req_len = to_read;
+	f->in_flight = 1;
+	fru->fetch_outstanding++;
+    }
+    return rv;
+}
+
+static void
+fru_fetch_done(ipmi_domain_t *domain, ipmi_fru_t *fru)
+{
+    struct timeval now;
+    unsigned int   len;
+    int            err = fru->fetch_err;
+
+    if (fru->deleted) {
+	fetch_complete(domain, fru, ECANCELED);
+	return;
+    }
+
+    if (err) {
+	len = fru->fetch_next_pos;
+	if (fru->fetch_stop_pos < len)
+	    len = fru->fetch_stop_pos;
+	if (!IPMI_IS_IPMI_ERR(err)) {
+	    fetch_complete(domain, fru, err);
+	    return;
+	}
+	if (len < 8) {
+	    ipmi_log(IPMI_LOG_ERR_INFO,
+		     "%sfru.c(fru_fetch_done): "
+		     "IPMI error getting FRU data: %x",
+		     FRU_DOMAIN_NAME(fru), IPMI_GET_IPMI_ERR(err));
+	    fetch_complete(domain, fru, err);
+	    return;
+	}
+
+	/* Some screwy cards give more size in the info than they
+	   really have, if we have enough, try to process it. */
+	ipmi_log(IPMI_LOG_WARNING,
+		 "%sfru.c(fru_fetch_done): "
+		 "IPMI error getting FRU data: %x",
+		 FRU_DOMAIN_NAME(fru), IPMI_GET_IPMI_ERR(err));
+	fru->data_len = len;
+    }
+
+    fru->os_hnd->get_monotonic_time(fru->os_hnd, &now);
+    fru->fetch_usecs = ((now.tv_sec - fru->fetch_start.tv_sec) * 1000000
+			+ (now.tv_usec - fru->fetch_start.tv_usec));
+    if (fru->fetch_usecs == 0)
+	fru->fetch_usecs = 1;
+    fru->fetch_bytes_per_sec = ((uint64_t) fru->data_len * 1000000
+				/ fru->fetch_usecs);
+
+    if (fru->timestamp_cb) {
+	err = fru->timestamp_cb(fru, domain, end_fru_fetch);
+	if (err)
+	    fetch_complete(domain, fru, err);
+	else
+	    i_ipmi_fru_unlock(fru);
+    } else {
+	fetch_complete(domain, fru, 0);
+    }
+}
+
+/*
+ * Keep the window full of requests.  Must be called with the FRU lock
+ * held, this will release it (or finish the fetch).
+ */
+static void
+fru_fetch_continue(ipmi_domain_t *domain,
+		   ipmi_fru_t    *fru,
+		   ipmi_addr_t   *addr,
+		   unsigned int  addr_len)
+{
+    unsigned int i;
+    fru_fetch_t  *f;
+    int          err;
+
+    for (i = 0; i < MAX_FRU_FETCH_WINDOW; i++) {
+	if (fru->fetch_err)
+	    break;
+	if (fru->fetch_outstanding >= fru->fetch_window)
+	    break;
+
+	f = &fru->fetch[i];
+	if (f->in_flight)
+	    continue;
+	if (f->pos >= f->end) {
+	    if (fru->fetch_next_pos >= fru->data_len)
+		continue;
+	    /* Hand out the next piece of the data. */
+	    f->pos = fru->fetch_next_pos;
+	    f->end = f->pos + fru->fetch_size;
+	    if (f->end > fru->data_len)
+		f->end = fru->data_len;
+	    fru->fetch_next_pos = f->end;
+	}
+
+	err = request_next_data(domain, fru, f, addr, addr_len);
+	if (err) {
+	    ipmi_log(IPMI_LOG_ERR_INFO,
+		     "%sfru.c(fru_fetch_continue): "
+		     "Error requesting next FRU data",
+		     FRU_DOMAIN_NAME(fru));
+	    fru->fetch_err = err;
+	}
+    }
+
+    if (fru->fetch_err) {
+	/* Don't start anything new, but remember where the data stops
+	   being good. */
+	for (i = 0; i < MAX_FRU_FETCH_WINDOW; i++) {
+	    f = &fru->fetch[i];
+	    if (f->in_flight || (f->pos >= f->end))
+		continue;
+	    if (f->pos < fru->fetch_stop_pos)
+		fru->fetch_stop_pos = f->pos;
+	    f->end = f->pos;
+	}
+    }
+
+    if (fru->fetch_outstanding == 0) {
+	/* Nothing in flight and nothing more to send, we are done. */
+	fru_fetch_done(domain, fru);
+	return;
+    }
+
+    i_ipmi_fru_unlock(fru);
+}
+
+static void
+fru_fetch_start(ipmi_domain_t *domain,
+		ipmi_fru_t    *fru,
+		ipmi_addr_t   *addr,
+		unsigned int  addr_len)
+{
+    memset(fru->fetch, 0, sizeof(fru->fetch));
+    fru->fetch_next_pos = 0;
+    fru->fetch_stop_pos = fru->data_len;
+    fru->fetch_outstanding = 0;
+    fru->fetch_err = 0;
+    fru->fetch_acks = 0;
+    fru->fetch_max_window = i_ipmi_domain_get_max_outstanding_msgs(domain);
+    if (fru->fetch_max_window == 0)
+	fru->fetch_max_window = 1;
+    else if (fru->fetch_max_window > MAX_FRU_FETCH_WINDOW)
+	fru->fetch_max_window = MAX_FRU_FETCH_WINDOW;
+    fru->fetch_thresh = fru->fetch_max_window;
+    fru->fetch_window = 1;
+    fru->os_hnd->get_monotonic_time(fru->os_hnd, &fru->fetch_start);
+
+    fru_fetch_continue(domain, fru, addr, addr_len);
 }
 
 static int
@@ -1149,7 +1421,6 @@ fru_inventory_area_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
     ipmi_msg_t    *msg = &rspi->msg;
     ipmi_fru_t    *fru = rspi->data1;
     unsigned char *data = msg->data;
-    int           err;
 
     i_ipmi_fru_lock(fru);
 
@@ -1198,17 +1469,7 @@ fru_inventory_area_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 	goto out;
     }
 
-    err = request_next_data(domain, fru, addr, addr_len);
-    if (err) {
-	ipmi_log(IPMI_LOG_ERR_INFO,
-		 "%sfru.c(fru_inventory_area_handler): "
-		 "Error requesting next FRU data",
-		 FRU_DOMAIN_NAME(fru));
-	fetch_complete(domain, fru, err);
-	goto out;
-    }
-
-    i_ipmi_fru_unlock(fru);
+    fru_fetch_start(domain, fru, addr, addr_len);
  out:
     return IPMI_MSG_ITEM_NOT_USED;
 }
@@ -1614,6 +1875,18 @@ ipmi_fru_get_data_length(ipmi_fru_t *fru)
     return fru->data_len;
 }
 
+unsigned int
+ipmi_fru_get_fetch_usecs(ipmi_fru_t *fru)
+{
+    return fru->fetch_usecs;
+}
+
+unsigned int
+ipmi_fru_get_fetch_bytes_per_sec(ipmi_fru_t *fru)
+{
+    return fru->fetch_bytes_per_sec;
+}
+
 int
 ipmi_fru_get_name(ipmi_fru_t *fru, char *name, int length)
 {
@@ -37,31 +37,130 @@
 
 #include <errno.h>
 #include <string.h>
-#include <openssl/hmac.h>
+#include <openssl/evp.h>
 #include <OpenIPMI/ipmi_lan.h>
 #include <OpenIPMI/internal/ipmi_malloc.h>
+#include <OpenIPMI/internal/ipmi_locks.h>
+
+/*
+ * HMAC is H(K^opad, H(K^ipad, data)).  The digest states after the
+ * two padded keys are worked out once when the session comes up, so
+ * each packet starts from a copy of them instead of setting up the
+ * key again.  The lock is there because more than one thread may be
+ * sending or receiving on the connection.
+ */
+#define HMAC_BLOCK_LEN 64 /* For both MD5 and SHA1 */
 
 typedef struct hmac_info_s
 {
-    const EVP_MD *evp_md;
-    unsigned int  klen;
     unsigned int  ilen;
-    unsigned char k[20];
+    ipmi_lock_t   *lock;
+    EVP_MD_CTX    *inner;
+    EVP_MD_CTX    *outer;
+    EVP_MD_CTX    *work;
 } hmac_info_t;
 
+static void
+hmac_free(ipmi_con_t *ipmi,
+	  void       *integ_data)
+{
+    hmac_info_t *info = integ_data;
+
+    /* Freeing the digest contexts cleanses the keyed state. */
+    if (info->inner)
+	EVP_MD_CTX_free(info->inner);
+    if (info->outer)
+	EVP_MD_CTX_free(info->outer);
+    if (info->work)
+	EVP_MD_CTX_free(info->work);
+    if (info->lock)
+	ipmi_destroy_lock(info->lock);
+    ipmi_mem_free(info);
+}
+
+static int
+hmac_setup(ipmi_con_t          *ipmi,
+	   const EVP_MD        *evp_md,
+	   const unsigned char *k,
+	   unsigned int        klen,
+	   unsigned int        ilen,
+	   void                **integ_data)
+{
+    hmac_info_t   *info;
+    unsigned char pad[HMAC_BLOCK_LEN];
+    unsigned int  i;
+    int           rv;
+
+    info = ipmi_mem_alloc(sizeof(*info));
+    if (!info)
+	return ENOMEM;
+    memset(info, 0, sizeof(*info));
+    info->ilen = ilen;
+
+    rv = ipmi_create_lock_os_hnd(ipmi->os_hnd, &info->lock);
+    if (rv)
+	goto out_err;
+
+    info->inner = EVP_MD_CTX_new();
+    info->outer = EVP_MD_CTX_new();
+    info->work = EVP_MD_CTX_new();
+    if (!info->inner || !info->outer || !info->work) {
+	rv = ENOMEM;
+	goto out_err;
+    }
+
+    rv = EINVAL;
+    memset(pad, 0x36, sizeof(pad));
+    for (i = 0; i < klen; i++)
+	pad[i] ^= k[i];
+    if (!EVP_DigestInit_ex(info->inner, evp_md, NULL)
+	|| !EVP_DigestUpdate(info->inner, pad, sizeof(pad)))
+	goto out_err;
+    memset(pad, 0x5c, sizeof(pad));
+    for (i = 0; i < klen; i++)
+	pad[i] ^= k[i];
+    if (!EVP_DigestInit_ex(info->outer, evp_md, NULL)
+	|| !EVP_DigestUpdate(info->outer, pad, sizeof(pad)))
+	goto out_err;
+    memset(pad, 0, sizeof(pad));
+
+    *integ_data = info;
+    return 0;
+
+ out_err:
+    memset(pad, 0, sizeof(pad));
+    hmac_free(ipmi, info);
+    return rv;
+}
+
+/* Must be called with the lock held. */
+static int
+hmac_gen(hmac_info_t         *info,
+	 const unsigned char *data,
+	 unsigned int        len,
+	 unsigned char       *integ)
+{
+    unsigned char ihash[EVP_MAX_MD_SIZE];
+    unsigned int  ihash_len, integ_len;
+
+    if (!EVP_MD_CTX_copy_ex(info->work, info->inner)
+	|| !EVP_DigestUpdate(info->work, data, len)
+	|| !EVP_DigestFinal_ex(info->work, ihash, &ihash_len)
+	|| !EVP_MD_CTX_copy_ex(info->work, info->outer)
+	|| !EVP_DigestUpdate(info->work, ihash, ihash_len)
+	|| !EVP_DigestFinal_ex(info->work, integ, &integ_len))
+	return EINVAL;
+    return 0;
+}
+
 static int
 hmac_sha1_init(ipmi_con_t       *ipmi,
 	       ipmi_rmcpp_auth_t *ainfo,
 	       void             **integ_data)
 {
-    hmac_info_t         *info;
     const unsigned char *k;
     unsigned int        klen;
 
-    info = ipmi_mem_alloc(sizeof(*info));
-    if (!info)
-	return ENOMEM;
-
     if (ipmi_rmcpp_auth_get_sik_len(ainfo) < 20)
 	return EINVAL;
 
@@ -72,13 +171,7 @@ hmac_sha1_init(ipmi_con_t       *ipmi,
     if (klen < 20)
 	return EINVAL;
 
-    memcpy(info->k, k, 20);
-    info->klen = 20;
-    info->ilen = 12;
-
-    info->evp_md = EVP_sha1();
-    *integ_data = info;
-    return 0;
+    return hmac_setup(ipmi, EVP_sha1(), k, 20, 12, integ_data);
 }
 
 static int
@@ -86,14 +179,9 @@ hmac_md5_init(ipmi_con_t       *ipmi,
 	      ipmi_rmcpp_auth_t *ainfo,
 	      void             **integ_data)
 {
-    hmac_info_t         *info;
     const unsigned char *k;
     unsigned int        klen;
 
-    info = ipmi_mem_alloc(sizeof(*info));
-    if (!info)
-	return ENOMEM;
-
     if (ipmi_rmcpp_auth_get_sik_len(ainfo) < 16)
 	return EINVAL;
 
@@ -101,23 +189,7 @@ hmac_md5_init(ipmi_con_t       *ipmi,
     if (klen < 16)
 	return EINVAL;
 
-    memcpy(info->k, k, 16);
-    info->klen = 16;
-    info->ilen = 16;
-
-    info->evp_md = EVP_md5();
-    *integ_data = info;
-    return 0;
-}
-
-static void
-hmac_free(ipmi_con_t *ipmi,
-	  void       *integ_data)
-{
-    hmac_info_t *info = integ_data;
-
-    memset(info->k, 0, sizeof(info->k));
-    ipmi_mem_free(integ_data);
+    return hmac_setup(ipmi, EVP_md5(), k, 16, 16, integ_data);
 }
 
 static int
@@ -161,8 +233,8 @@ hmac_add(ipmi_con_t    *ipmi,
     hmac_info_t   *info = integ_data;
     unsigned char *p = payload;
     unsigned int  l = *payload_len;
-    unsigned int  ilen;
-    unsigned char integ[20];
+    unsigned char integ[EVP_MAX_MD_SIZE];
+    int           rv;
 
     if (l+info->ilen+1 > max_payload_len)
 	return E2BIG;
@@ -173,8 +245,12 @@ hmac_add(ipmi_con_t    *ipmi,
     p[l] = 0x07; /* Add the next header */
     l++;
 
-    HMAC(info->evp_md, info->k, info->klen, p+4, l-4, integ, &ilen);
-    memcpy(p+l, integ, ilen);
+    ipmi_lock(info->lock);
+    rv = hmac_gen(info, p+4, l-4, integ);
+    ipmi_unlock(info->lock);
+    if (rv)
+	return rv;
+    memcpy(p+l, integ, info->ilen);
     l += info->ilen;
 
     *payload_len = l;
@@ -191,8 +267,8 @@ hmac_check(ipmi_con_t    *ipmi,
     hmac_info_t   *info = integ_data;
     unsigned char *p = payload;
     unsigned int  l = payload_len;
-    unsigned int  ilen;
-    unsigned char new_integ[20];
+    unsigned char new_integ[EVP_MAX_MD_SIZE];
+    int           rv;
 
     /* We don't authenticate this part of the header. */
     p += 4;
@@ -203,7 +279,11 @@ hmac_check(ipmi_con_t    *ipmi,
 
     /* We add 1 to the length because we also check the next header
        field. */
-    HMAC(info->evp_md, info->k, info->klen, p, l+1, new_integ, &ilen);
+    ipmi_lock(info->lock);
+    rv = hmac_gen(info, p, l+1, new_integ);
+    ipmi_unlock(info->lock);
+    if (rv)
+	return rv;
     if (memcmp(new_integ, p+l+1, info->ilen) != 0)
 	return EINVAL;
 
@@ -433,9 +433,11 @@ int i_ipmi_aes_cbc_init(void);
 int i_ipmi_hmac_init(void);
 int i_ipmi_md5_init(void);
 int i_ipmi_fru_init(void);
+int i_ipmi_sensor_init(void);
 int i_ipmi_normal_fru_init(void);
 int i_ipmi_fru_spd_decoder_init(void);
 void i_ipmi_fru_shutdown(void);
+void i_ipmi_sensor_shutdown(void);
 void i_ipmi_normal_fru_shutdown(void);
 void i_ipmi_fru_spd_decoder_shutdown(void);
 int i_ipmi_sol_init(void);
@@ -536,6 +538,10 @@ ipmi_init(os_handler_t *handler)
     if (rv)
 	goto out_err;
 
+    rv = i_ipmi_sensor_init();
+    if (rv)
+	goto out_err;
+
     rv = i_ipmi_normal_fru_init();
     if (rv)
 	goto out_err;
@@ -592,6 +598,7 @@ ipmi_shutdown(void)
     i_ipmi_fru_spd_decoder_shutdown();
     i_ipmi_normal_fru_shutdown();
     i_ipmi_fru_shutdown();
+    i_ipmi_sensor_shutdown();
  shutdown_mc:
     i_ipmi_mc_shutdown();
  shutdown_domain:
@@ -1003,6 +1010,9 @@ i_ipmi_unregister_con_type(const char *name, ipmi_con_setup_t *setup)
     return data.err;
 }
 
+/* How far ahead "-selspeculate" without a depth fetches. */
+#define SEL_SPECULATE_DEFAULT 4
+
 int
 ipmi_parse_options(ipmi_open_option_t *option,
 		   char               *arg)
@@ -1073,6 +1083,23 @@ ipmi_parse_options(ipmi_open_option_t *option,
     } else if (strcmp(arg, "-cache") == 0) {
 	option->option = IPMI_OPEN_OPTION_USE_CACHE;
 	option->ival = 1;
+    } else if (strcmp(arg, "-noselspeculate") == 0) {
+	option->option = IPMI_OPEN_OPTION_SEL_SPECULATE;
+	option->ival = 0;
+    } else if (strcmp(arg, "-selspeculate") == 0) {
+	option->option = IPMI_OPEN_OPTION_SEL_SPECULATE;
+	option->ival = SEL_SPECULATE_DEFAULT;
+    } else if (strncmp(arg, "-selspeculate=", 14) == 0) {
+	char          *end;
+	unsigned long depth;
+
+	/* Options come one argument at a time, so the depth is part of
+	   this one. */
+	depth = strtoul(arg + 14, &end, 0);
+	if ((end == arg + 14) || (*end != '\0') || (depth > 255))
+	    return EINVAL;
+	option->option = IPMI_OPEN_OPTION_SEL_SPECULATE;
+	option->ival = depth;
     } else
 	return EINVAL;
 
@@ -1093,7 +1120,8 @@ ipmi_parse_options_help(void)
 	"-[no]setseltime - setting the SEL clock\n"
 	"-[no]activate - connection activation\n"
 	"-[no]localonly - Just talk to the local BMC, (ATCA-only, for blades)\n"
-        "-[no]cache - use the local cache for SDRs.  On by default."
+        "-[no]cache - use the local cache for SDRs.  On by default.\n"
+	"-[no]selspeculate[=n] - fetch n (default 4) SEL entries ahead\n"
 	"-wait_til_up - wait until the domain is up before returning";
 }
 
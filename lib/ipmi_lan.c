@@ -33,6 +33,10 @@
 
 #include <config.h>
 
+#if defined(HAVE_RECVMMSG) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* For recvmmsg() */
+#endif
+
 #include <sys/types.h>
 #ifdef _WIN32
 #if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
@@ -113,17 +117,20 @@ typedef struct audit_timer_info_s
     ipmi_con_t *ipmi;
 } audit_timer_info_t;
 
+/* These are kept in a per-connection free list and reused, along with
+   their timer, so a command does not allocate in the steady state. */
 typedef struct lan_timer_info_s
 {
     int               cancelled;
     ipmi_con_t        *ipmi;
     os_hnd_timer_id_t *timer;
     unsigned int      seq;
+
+    struct lan_timer_info_s *next;
 } lan_timer_info_t;
 
 typedef struct lan_wait_queue_s
 {
-    lan_timer_info_t      *info;
     ipmi_addr_t           addr;
     unsigned int          addr_len;
     ipmi_msg_t            msg;
@@ -204,6 +211,15 @@ struct lan_link_s
     lan_data_t *lan;
 };
 
+/* Link for the per-fd remote address hash. */
+typedef struct lan_fd_link_s lan_fd_link_t;
+struct lan_fd_link_s
+{
+    lan_fd_link_t *next;
+    lan_data_t    *lan;
+    unsigned int  addr_num;
+};
+
 typedef struct lan_fd_s lan_fd_t;
 
 typedef struct lan_stat_info_s
@@ -293,6 +309,9 @@ typedef struct lan_ip_data_s
 
     /* Use for linked-lists of IP addresses. */
     lan_link_t                 ip_link;
+
+    /* Used for the address hash in the fd. */
+    lan_fd_link_t              fd_link;
 } lan_ip_data_t;
 
 
@@ -310,6 +329,14 @@ struct lan_data_s
     lan_fd_t                   *fd;
     int                        fd_slot;
 
+    /* The session id we hand out for RMCP+ sessions, it encodes the
+       fd_slot so incoming packets can be mapped directly. */
+    uint32_t                   fd_sid;
+
+    /* Set when the last reference is gone and the connection is
+       being torn down.  Protected by the lan list lock. */
+    int                        freeing;
+
     unsigned char              slave_addr[MAX_IPMI_USED_CHANNELS];
     int                        is_active;
     int			       disabled;
@@ -412,6 +439,11 @@ struct lan_data_s
     /* List of messages waiting to be sent. */
     lan_wait_queue_t *wait_q, *wait_q_tail;
 
+    /* Free timer infos (with their timers allocated) and free wait
+       queue entries, protected by seq_num_lock. */
+    lan_timer_info_t *timer_info_pool;
+    lan_wait_queue_t *wait_q_pool;
+
     locked_list_t              *event_handlers;
 
     os_hnd_timer_id_t          *audit_timer;
@@ -1089,15 +1121,49 @@ static int send_auth_cap(ipmi_con_t *ipmi, lan_data_t *lan, int addr_num,
 
 static os_handler_t *lan_os_hnd;
 
-#define MAX_CONS_PER_FD	32
+/*
+ * Connections sharing an fd are kept in a slot table.  For RMCP+ our
+ * session id is (generation << 16) | (slot + 1), so incoming packets
+ * with a session id map directly to the slot, and the generation
+ * (bumped each time a slot is reused) keeps stray packets for an old
+ * session from matching a new one.  Packets without a session id
+ * (RMCP and RMCP+ session setup) are found through a hash on the
+ * remote address; an fd never holds two connections with the same
+ * address.  The slot table starts small and grows as needed.
+ */
+#define INITIAL_CONS_PER_FD	32
+#define MAX_CONS_PER_FD		4096
+#define LAN_SID_SLOT_BITS	16
+#define LAN_SID_SLOT_MASK	((1 << LAN_SID_SLOT_BITS) - 1)
+#define INITIAL_FD_ADDR_HASH	16
+
+typedef struct lan_fd_slot_s
+{
+    lan_data_t   *lan;
+    unsigned int gen;
+    int          next_free;
+} lan_fd_slot_t;
+
 struct lan_fd_s
 {
     int            fd;
     os_hnd_fd_id_t *fd_wait_id;
     unsigned int   cons_in_use;
-    lan_data_t     *lan[MAX_CONS_PER_FD];
     lan_fd_t       *next, *prev;
+
+    /* The os handler loop the fd was added in.  Only connections
+       created in that loop use this fd, so that all of a connection's
+       messages are handled in its own loop. */
+    unsigned int   loop;
+
+    /* The following are protected by con_lock. */
     ipmi_lock_t    *con_lock;
+    lan_fd_slot_t  *slots;
+    unsigned int   num_slots;
+    int            free_slot;
+    lan_fd_link_t  **addr_hash;
+    unsigned int   addr_hash_size; /* Always a power of 2 */
+    unsigned int   addr_count;
 
     /* Main list info. */
     ipmi_lock_t    *lock;
@@ -1106,9 +1172,10 @@ struct lan_fd_s
 };
 
 /* This is a list, but the only searching is to find an fd with a free
-   slot (when creating a new lan).  This is O(1) because the first
-   entry is guaranteed to have a free slot if any have free slots.
-   Note that once one of these is created, it is never destroyed
+   slot (when creating a new lan).  Entries with free slots are kept
+   at the front, so this only has to walk past the entries for other
+   os handler loops (and ones that already have the address).  Note
+   that once one of these is created, it is never destroyed
    (destruction is very difficult because of the race conditions). */
 static ipmi_lock_t *fd_list_lock = NULL;
 static lan_fd_t fd_list;
@@ -1197,14 +1264,260 @@ move_to_lan_list_head(lan_fd_t *item)
     list->next = item;
 }
 
+static unsigned int
+fd_hash_addr(const sockaddr_ip_t *addr)
+{
+    unsigned int idx;
+
+    switch (addr->s_ipsock.s_addr0.sa_family)
+    {
+    case PF_INET:
+	idx = ntohl(addr->s_ipsock.s_addr4.sin_addr.s_addr);
+	idx ^= ntohs(addr->s_ipsock.s_addr4.sin_port) << 16;
+	break;
+#ifdef PF_INET6
+    case PF_INET6:
+	/* Use the lower 4 bytes of the IPV6 address. */
+	idx = addr->s_ipsock.s_addr6.sin6_addr.s6_addr[12] << 24;
+	idx |= addr->s_ipsock.s_addr6.sin6_addr.s6_addr[13] << 16;
+	idx |= addr->s_ipsock.s_addr6.sin6_addr.s6_addr[14] << 8;
+	idx |= addr->s_ipsock.s_addr6.sin6_addr.s6_addr[15];
+	idx ^= ntohs(addr->s_ipsock.s_addr6.sin6_port) << 16;
+	break;
+#endif
+    default:
+	idx = 0;
+    }
+    return idx;
+}
+
+/* Must be called with the fd's con_lock held. */
+static lan_data_t *
+fd_find_lan_by_addr(lan_fd_t *item, sockaddr_ip_t *addr, int *addr_num)
+{
+    lan_fd_link_t *l;
+
+    l = item->addr_hash[fd_hash_addr(addr) & (item->addr_hash_size - 1)];
+    while (l) {
+	if (lan_addr_same(&l->lan->cparm.ip_addr[l->addr_num], addr)) {
+	    *addr_num = l->addr_num;
+	    return l->lan;
+	}
+	l = l->next;
+    }
+    return NULL;
+}
+
+/* Must be called with the fd's con_lock held. */
+static int
+fd_grow_addr_hash(lan_fd_t *item)
+{
+    lan_fd_link_t **new_hash, *l, *next;
+    unsigned int  new_size = item->addr_hash_size * 2;
+    unsigned int  i, idx;
+
+    new_hash = ipmi_mem_alloc(sizeof(*new_hash) * new_size);
+    if (!new_hash)
+	return ENOMEM;
+    memset(new_hash, 0, sizeof(*new_hash) * new_size);
+    for (i=0; i<item->addr_hash_size; i++) {
+	for (l = item->addr_hash[i]; l; l = next) {
+	    next = l->next;
+	    idx = fd_hash_addr(&l->lan->cparm.ip_addr[l->addr_num]);
+	    idx &= new_size - 1;
+	    l->next = new_hash[idx];
+	    new_hash[idx] = l;
+	}
+    }
+    ipmi_mem_free(item->addr_hash);
+    item->addr_hash = new_hash;
+    item->addr_hash_size = new_size;
+    return 0;
+}
+
+/* Must be called with the fd's con_lock held. */
+static int
+fd_grow_slots(lan_fd_t *item)
+{
+    lan_fd_slot_t *new_slots;
+    unsigned int  new_num = item->num_slots * 2;
+    unsigned int  i;
+
+    if (new_num > MAX_CONS_PER_FD)
+	new_num = MAX_CONS_PER_FD;
+    if (new_num <= item->num_slots)
+	return EAGAIN;
+
+    new_slots = ipmi_mem_alloc(sizeof(*new_slots) * new_num);
+    if (!new_slots)
+	return ENOMEM;
+    memcpy(new_slots, item->slots, sizeof(*new_slots) * item->num_slots);
+    for (i=item->num_slots; i<new_num; i++) {
+	new_slots[i].lan = NULL;
+	new_slots[i].gen = 0;
+	new_slots[i].next_free = item->free_slot;
+	item->free_slot = i;
+    }
+    ipmi_mem_free(item->slots);
+    item->slots = new_slots;
+    item->num_slots = new_num;
+    return 0;
+}
+
+/* Must be called with the fd's con_lock held. */
+static int
+fd_alloc_slot(lan_fd_t *item, lan_data_t *lan, int *slot)
+{
+    unsigned int i;
+    int          rv;
+    int          tslot;
+
+    if ((item->addr_count + lan->cparm.num_ip_addr)
+	> (item->addr_hash_size * 2))
+    {
+	rv = fd_grow_addr_hash(item);
+	if (rv)
+	    return rv;
+    }
+
+    if (item->free_slot < 0) {
+	rv = fd_grow_slots(item);
+	if (rv)
+	    return rv;
+    }
+
+    tslot = item->free_slot;
+    item->free_slot = item->slots[tslot].next_free;
+    item->slots[tslot].lan = lan;
+    item->slots[tslot].gen = (item->slots[tslot].gen + 1) & 0xffff;
+    lan->fd_sid = ((item->slots[tslot].gen << LAN_SID_SLOT_BITS)
+		   | (tslot + 1));
+
+    for (i=0; i<lan->cparm.num_ip_addr; i++) {
+	lan_fd_link_t *l = &lan->ip[i].fd_link;
+	unsigned int  idx;
+
+	idx = fd_hash_addr(&lan->cparm.ip_addr[i]);
+	idx &= item->addr_hash_size - 1;
+	l->lan = lan;
+	l->addr_num = i;
+	l->next = item->addr_hash[idx];
+	item->addr_hash[idx] = l;
+    }
+    item->addr_count += lan->cparm.num_ip_addr;
+
+    *slot = tslot;
+    return 0;
+}
+
+/* Must be called with the fd's con_lock held. */
+static void
+fd_free_slot(lan_fd_t *item, int slot)
+{
+    lan_data_t   *lan = item->slots[slot].lan;
+    unsigned int i;
+
+    for (i=0; i<lan->cparm.num_ip_addr; i++) {
+	lan_fd_link_t *l = &lan->ip[i].fd_link;
+	lan_fd_link_t **prev;
+	unsigned int  idx;
+
+	idx = fd_hash_addr(&lan->cparm.ip_addr[i]);
+	idx &= item->addr_hash_size - 1;
+	prev = &item->addr_hash[idx];
+	while (*prev && *prev != l)
+	    prev = &(*prev)->next;
+	if (*prev)
+	    *prev = l->next;
+    }
+    item->addr_count -= lan->cparm.num_ip_addr;
+
+    item->slots[slot].lan = NULL;
+    item->slots[slot].next_free = item->free_slot;
+    item->free_slot = slot;
+}
+
+/* Can we put this lan in this fd?  Must be called with the fd's
+   con_lock held. */
+static int
+fd_addrs_free(lan_fd_t *item, lan_data_t *lan)
+{
+    unsigned int i;
+    int          addr_num;
+
+    /* Can't have two systems with the same address in the same fd
+       entry. */
+    for (i=0; i<lan->cparm.num_ip_addr; i++) {
+	if (fd_find_lan_by_addr(item, &lan->cparm.ip_addr[i], &addr_num))
+	    return 0;
+    }
+    return 1;
+}
+
+static lan_fd_t *
+alloc_lan_fd(void)
+{
+    lan_fd_t     *item;
+    unsigned int i;
+    int          rv;
+
+    item = ipmi_mem_alloc(sizeof(*item));
+    if (!item)
+	return NULL;
+    memset(item, 0, sizeof(*item));
+
+    item->slots = ipmi_mem_alloc(sizeof(*item->slots) * INITIAL_CONS_PER_FD);
+    if (!item->slots)
+	goto out_err;
+    item->num_slots = INITIAL_CONS_PER_FD;
+    item->free_slot = -1;
+    for (i=INITIAL_CONS_PER_FD; i>0; i--) {
+	item->slots[i-1].lan = NULL;
+	item->slots[i-1].gen = 0;
+	item->slots[i-1].next_free = item->free_slot;
+	item->free_slot = i-1;
+    }
+
+    item->addr_hash = ipmi_mem_alloc(sizeof(*item->addr_hash)
+				     * INITIAL_FD_ADDR_HASH);
+    if (!item->addr_hash)
+	goto out_err;
+    memset(item->addr_hash, 0,
+	   sizeof(*item->addr_hash) * INITIAL_FD_ADDR_HASH);
+    item->addr_hash_size = INITIAL_FD_ADDR_HASH;
+
+    rv = ipmi_create_global_lock(&item->con_lock);
+    if (rv)
+	goto out_err;
+
+    return item;
+
+ out_err:
+    if (item->slots)
+	ipmi_mem_free(item->slots);
+    if (item->addr_hash)
+	ipmi_mem_free(item->addr_hash);
+    ipmi_mem_free(item);
+    return NULL;
+}
+
+static void
+free_lan_fd(lan_fd_t *item)
+{
+    ipmi_destroy_lock(item->con_lock);
+    ipmi_mem_free(item->slots);
+    ipmi_mem_free(item->addr_hash);
+    ipmi_mem_free(item);
+}
+
 static lan_fd_t *
 find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 {
     ipmi_lock_t *lock;
     lan_fd_t    *list, *item;
     lan_fd_t    **free_list;
+    unsigned int loop = 0;
     int         rv;
-    int         i;
 
     if (family == PF_INET) {
 	lock = fd_list_lock;
@@ -1222,47 +1535,36 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 	return NULL;
     }
 
+    if (lan_os_hnd->get_loop_id)
+	loop = lan_os_hnd->get_loop_id(lan_os_hnd);
+
     ipmi_lock(lock);
     item = list->next;
  retry:
     if (item->cons_in_use < MAX_CONS_PER_FD) {
-	int tslot = -1;
-	/* Got an entry with a slot, just reuse it. */
-	for (i=0; i<MAX_CONS_PER_FD; i++) {
-	    if (item->lan[i]) {
-		/* Check for a matching IP address.  Can't have two
-		   systems with the same address in the same fd entry. */
-		unsigned int j, k;
-		lan_data_t   *l = item->lan[i];
-
-		for (j=0; j<l->cparm.num_ip_addr; j++) {
-		    for (k=0; k<lan->cparm.num_ip_addr; k++) {
-			if (lan_addr_same(&l->cparm.ip_addr[j],
-					  &lan->cparm.ip_addr[k]))
-			{
-			    /* Found the same address in the same
-			       lan_data file.  Try another one. */
-			    item = item->next;
-			    goto retry;
-			}
-		    }
-		}
-	    } else if (tslot < 0)
-		tslot = i;
+	if (item->loop != loop) {
+	    /* Handled by another loop, don't share it. */
+	    item = item->next;
+	    goto retry;
 	}
-	if (tslot < 0) {
-	    lan_fd_t *next = item->next;
-	    /* Can't happen, but log and fix it up. */
-	    ipmi_log(IPMI_LOG_SEVERE, "ipmi_lan.c: Internal error, count"
-		     " in lan fd list item incorrect, but we can recover.");
-	    item->cons_in_use = MAX_CONS_PER_FD;
-	    move_to_lan_list_end(item);
-	    item = next;
+
+	/* Got an entry with a slot, just reuse it. */
+	ipmi_lock(item->con_lock);
+	if (!fd_addrs_free(item, lan)) {
+	    /* Found the same address in the same lan_data file.  Try
+	       another one. */
+	    ipmi_unlock(item->con_lock);
+	    item = item->next;
 	    goto retry;
 	}
+	rv = fd_alloc_slot(item, lan, slot);
+	ipmi_unlock(item->con_lock);
+	if (rv) {
+	    errno = rv;
+	    item = NULL;
+	    goto out_unlock;
+	}
 	item->cons_in_use++;
-	item->lan[tslot] = lan;
-	*slot = tslot;
 
 	if (item->cons_in_use == MAX_CONS_PER_FD)
 	    /* Out of connections in this item, move it to the end of
@@ -1275,15 +1577,8 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 	    item = *free_list;
 	    *free_list = item->next;
 	} else {
-	    item = ipmi_mem_alloc(sizeof(*item));
+	    item = alloc_lan_fd();
 	    if (item) {
-		memset(item, 0, sizeof(*item));
-		rv = ipmi_create_global_lock(&item->con_lock);
-		if (rv) {
-		    ipmi_mem_free(item);
-		    item = NULL;
-		    goto out_unlock;
-		}
 		item->lock = lock;
 		item->free_list = free_list;
 		item->list = list;
@@ -1294,6 +1589,7 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 
 	item->next = item;
 	item->prev = item;
+	item->loop = loop;
 
 	item->fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
 	if (item->fd == -1) {
@@ -1324,6 +1620,22 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 	    goto out_unlock;
 	}
 
+	ipmi_lock(item->con_lock);
+	rv = fd_alloc_slot(item, lan, slot);
+	ipmi_unlock(item->con_lock);
+	if (rv) {
+#ifdef _WIN32
+	    closesocket(item->fd);
+#else
+	    close(item->fd);
+#endif
+	    item->next = *free_list;
+	    *free_list = item;
+	    item = NULL;
+	    errno = rv;
+	    goto out_unlock;
+	}
+
 	rv = lan_os_hnd->add_fd_to_wait_for(lan_os_hnd,
 					    item->fd,
 					    data_handler, 
@@ -1331,6 +1643,9 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 					    NULL,
 					    &(item->fd_wait_id));
 	if (rv) {
+	    ipmi_lock(item->con_lock);
+	    fd_free_slot(item, *slot);
+	    ipmi_unlock(item->con_lock);
 #ifdef _WIN32
 	    closesocket(item->fd);
 #else
@@ -1343,8 +1658,6 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 	}
 
 	item->cons_in_use++;
-	item->lan[0] = lan;
-	*slot = 0;
 
 	/* This will have free items, put it at the head of the list. */
 	move_to_lan_list_head(item);
@@ -1358,7 +1671,9 @@ static void
 release_lan_fd(lan_fd_t *item, int slot)
 {
     ipmi_lock(item->lock);
-    item->lan[slot] = NULL;
+    ipmi_lock(item->con_lock);
+    fd_free_slot(item, slot);
+    ipmi_unlock(item->con_lock);
     item->cons_in_use--;
     if (item->cons_in_use == 0) {
 	lan_os_hnd->remove_fd_to_wait_for(lan_os_hnd, item->fd_wait_id);
@@ -1382,10 +1697,19 @@ release_lan_fd(lan_fd_t *item, int slot)
 /*
  * We keep two hash tables, one by IP address and one by connection
  * address.
+ *
+ * The lan list lock protects the IP address table, the users count,
+ * and adding and removing connections.  The connection table and the
+ * refcount are also protected by a set of shard locks, picked by the
+ * connection's hash, so that validating a connection and taking a
+ * reference (done for every received packet) only needs a shard
+ * lock.  If both are needed, the lan list lock must be taken first.
  */
-#define LAN_HASH_SIZE 256
+#define LAN_HASH_SIZE 1024
 #define LAN_HASH_SHIFT 6
+#define LAN_LOCK_SHARDS 16
 static ipmi_lock_t *lan_list_lock = NULL;
+static ipmi_lock_t *lan_shard_lock[LAN_LOCK_SHARDS];
 static lan_link_t lan_list[LAN_HASH_SIZE];
 static lan_link_t lan_ip_list[LAN_HASH_SIZE];
 
@@ -1400,6 +1724,12 @@ hash_lan(const ipmi_con_t *ipmi)
     return idx;
 }
 
+static ipmi_lock_t *
+lan_shard(const ipmi_con_t *ipmi)
+{
+    return lan_shard_lock[hash_lan(ipmi) % LAN_LOCK_SHARDS];
+}
+
 static unsigned int
 hash_lan_addr(const struct sockaddr *addr)
 {
@@ -1439,6 +1769,7 @@ lan_add_con(lan_data_t *lan)
     unsigned int i;
 
     ipmi_lock(lan_list_lock);
+    ipmi_lock(lan_shard(lan->ipmi));
     idx = hash_lan(lan->ipmi);
     head = &lan_list[idx];
     lan->link.lan = lan;
@@ -1446,6 +1777,7 @@ lan_add_con(lan_data_t *lan)
     lan->link.prev = head->prev;
     head->prev->next = &lan->link;
     head->prev = &lan->link;
+    ipmi_unlock(lan_shard(lan->ipmi));
 
     for (i=0; i<lan->cparm.num_ip_addr; i++) {
 	struct sockaddr *addr = &lan->cparm.ip_addr[i].s_ipsock.s_addr0;
@@ -1462,7 +1794,8 @@ lan_add_con(lan_data_t *lan)
     ipmi_unlock(lan_list_lock);
 }
 
-/* Must be called with the lan list lock held. */
+/* Must be called with the lan list lock and the lan's shard lock
+   held. */
 static void
 lan_remove_con_nolock(lan_data_t *lan)
 {
@@ -1486,7 +1819,7 @@ lan_find_con(ipmi_con_t *ipmi)
     unsigned int idx;
     lan_link_t   *l;
 
-    ipmi_lock(lan_list_lock);
+    ipmi_lock(lan_shard(ipmi));
     idx = hash_lan(ipmi);
     l = lan_list[idx].next;
     while (l->lan) {
@@ -1496,11 +1829,30 @@ lan_find_con(ipmi_con_t *ipmi)
     }
     if (l->lan)
 	l->lan->refcount++;
-    ipmi_unlock(lan_list_lock);
+    ipmi_unlock(lan_shard(ipmi));
 
     return l->lan;
 }
 
+/*
+ * Like lan_find_con(), but for a lan that is known to still exist
+ * because it was found in its fd's slot table (the caller must hold
+ * the fd's con_lock).  Avoids the hash lookup.
+ */
+static int
+lan_get_from_fd(lan_data_t *lan)
+{
+    int rv = 0;
+
+    ipmi_lock(lan_shard(lan->ipmi));
+    if (lan->link.lan) {
+	lan->refcount++;
+	rv = 1;
+    }
+    ipmi_unlock(lan_shard(lan->ipmi));
+    return rv;
+}
+
 static inline int
 cmp_timeval(struct timeval *tv1, struct timeval *tv2)
 {
@@ -1563,13 +1915,27 @@ lan_put(ipmi_con_t *ipmi)
     lan_data_t *lan = ipmi->con_data;
     int        done;
 
-    ipmi_lock(lan_list_lock);
+    ipmi_lock(lan_shard(ipmi));
     lan->refcount--;
     done = lan->refcount == 0;
+    ipmi_unlock(lan_shard(ipmi));
+    if (!done)
+	return;
 
-    /* If done, remove it before we release the lock. */
-    if (done)
+    /*
+     * Removing it requires the lan list lock, which has to be taken
+     * before the shard lock, so recheck with both held.  Someone may
+     * have found it and taken a reference in the meantime, or another
+     * put may have beat us to this point.
+     */
+    ipmi_lock(lan_list_lock);
+    ipmi_lock(lan_shard(ipmi));
+    done = (lan->refcount == 0) && !lan->freeing;
+    if (done) {
+	lan->freeing = 1;
 	lan_remove_con_nolock(lan);
+    }
+    ipmi_unlock(lan_shard(ipmi));
     ipmi_unlock(lan_list_lock);
 
     if (done)
@@ -2367,6 +2733,62 @@ lost_connection(lan_data_t *lan, unsigned int addr_num)
     }
 }
 
+/* Must be called with the message sequence lock held. */
+static lan_timer_info_t *
+get_timer_info(ipmi_con_t *ipmi, lan_data_t *lan)
+{
+    lan_timer_info_t *info = lan->timer_info_pool;
+    int              rv;
+
+    if (info) {
+	lan->timer_info_pool = info->next;
+	return info;
+    }
+
+    info = ipmi_mem_alloc(sizeof(*info));
+    if (!info)
+	return NULL;
+    memset(info, 0, sizeof(*info));
+    info->ipmi = ipmi;
+    rv = ipmi->os_hnd->alloc_timer(ipmi->os_hnd, &(info->timer));
+    if (rv) {
+	ipmi_mem_free(info);
+	return NULL;
+    }
+    return info;
+}
+
+/* Must be called with the message sequence lock held and the timer
+   stopped. */
+static void
+put_timer_info(lan_data_t *lan, lan_timer_info_t *info)
+{
+    info->cancelled = 0;
+    info->next = lan->timer_info_pool;
+    lan->timer_info_pool = info;
+}
+
+/* Must be called with the message sequence lock held. */
+static lan_wait_queue_t *
+get_wait_q_item(lan_data_t *lan)
+{
+    lan_wait_queue_t *q_item = lan->wait_q_pool;
+
+    if (q_item) {
+	lan->wait_q_pool = q_item->next;
+	return q_item;
+    }
+    return ipmi_mem_alloc(sizeof(*q_item));
+}
+
+/* Must be called with the message sequence lock held. */
+static void
+put_wait_q_item(lan_data_t *lan, lan_wait_queue_t *q_item)
+{
+    q_item->next = lan->wait_q_pool;
+    lan->wait_q_pool = q_item;
+}
+
 static void
 rsp_timeout_handler(void              *cb_data,
 		    os_hnd_timer_id_t *id)
@@ -2390,6 +2812,7 @@ rsp_timeout_handler(void              *cb_data,
 
     /* If we were cancelled, just free the data and ignore it. */
     if (info->cancelled) {
+	put_timer_info(lan, info);
 	ipmi_unlock(lan->seq_num_lock);
 	goto out;
     }
@@ -2399,6 +2822,7 @@ rsp_timeout_handler(void              *cb_data,
 		 IPMI_CONN_NAME(ipmi), seq);
 
     if (! lan->seq_table[seq].inuse) {
+	put_timer_info(lan, info);
 	ipmi_unlock(lan->seq_num_lock);
 	goto out;
     }
@@ -2540,12 +2964,11 @@ rsp_timeout_handler(void              *cb_data,
     handler = lan->seq_table[seq].rsp_handler;
 
     lan->seq_table[seq].inuse = 0;
+    put_timer_info(lan, info);
 
     check_command_queue(ipmi, lan);
     ipmi_unlock(lan->seq_num_lock);
 
-    ipmi->os_hnd->free_timer(ipmi->os_hnd, id);
-
     /* Convert broadcasts back into normal sends. */
     if (rspi->addr.addr_type == IPMI_IPMB_BROADCAST_ADDR_TYPE)
 	rspi->addr.addr_type = IPMI_IPMB_ADDR_TYPE;
@@ -2557,7 +2980,6 @@ rsp_timeout_handler(void              *cb_data,
 
  out:
     lan_put(ipmi);
-    ipmi_mem_free(info);
 }
 
 typedef struct call_event_handler_s
@@ -2649,7 +3071,7 @@ handle_async_event(ipmi_con_t        *ipmi,
 
 /* Must be called with the message sequence lock held. */
 static int
-handle_msg_send(lan_timer_info_t      *info,
+handle_msg_send(ipmi_con_t            *ipmi,
 		int                   addr_num,
 		const ipmi_addr_t     *iaddr,
 		unsigned int          addr_len,
@@ -2658,8 +3080,8 @@ handle_msg_send(lan_timer_info_t      *info,
 		ipmi_msgi_t           *rspi,
 		int                   side_effects)
 {
-    ipmi_con_t        *ipmi = info->ipmi;
     lan_data_t        *lan = ipmi->con_data;
+    lan_timer_info_t  *info;
     unsigned int      seq;
     struct timeval    timeout;
     int               rv;
@@ -2713,8 +3135,6 @@ handle_msg_send(lan_timer_info_t      *info,
 	ipmi_ipmb_addr_t *ipmb = (ipmi_ipmb_addr_t *) addr;
 
 	if (ipmb->channel >= MAX_IPMI_USED_CHANNELS) {
-	    ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-	    ipmi_mem_free(info);
 	    rv = EINVAL;
 	    goto out;
 	}
@@ -2734,6 +3154,12 @@ handle_msg_send(lan_timer_info_t      *info,
 	}
     }
 
+    info = get_timer_info(ipmi, lan);
+    if (!info) {
+	rv = ENOMEM;
+	goto out;
+    }
+
     info->seq = seq;
     lan->seq_table[seq].inuse = 1;
     lan->seq_table[seq].side_effects = side_effects;
@@ -2776,10 +3202,8 @@ handle_msg_send(lan_timer_info_t      *info,
 				   info);
     if (rv) {
 	lan->seq_table[seq].inuse = 0;
-	ipmi->os_hnd->free_timer(ipmi->os_hnd,
-				 lan->seq_table[seq].timer);
 	lan->seq_table[seq].timer = NULL;
-	ipmi_mem_free(info);
+	put_timer_info(lan, info);
 	goto out;
     }
 
@@ -2805,10 +3229,8 @@ handle_msg_send(lan_timer_info_t      *info,
 	if (err) {
 	    info->cancelled = 1;
 	} else {
-	    ipmi->os_hnd->free_timer(ipmi->os_hnd,
-				     lan->seq_table[seq].timer);
 	    lan->seq_table[seq].timer = NULL;
-	    ipmi_mem_free(info);
+	    put_timer_info(lan, info);
 	}
     }
  out:
@@ -2830,7 +3252,7 @@ check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
 	if (lan->wait_q == NULL)
 	    lan->wait_q_tail = NULL;
 
-	rv = handle_msg_send(q_item->info, -1, &q_item->addr, q_item->addr_len,
+	rv = handle_msg_send(ipmi, -1, &q_item->addr, q_item->addr_len,
 			     &(q_item->msg), q_item->rsp_handler,
 			     q_item->rsp_item, q_item->side_effects);
 	if (rv) {
@@ -2845,7 +3267,6 @@ check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
 	    q_item->msg.netfn |= 1; /* Convert it to a response. */
 	    q_item->msg.data[0] = IPMI_UNKNOWN_ERR_CC;
 	    q_item->msg.data_len = 1;
-	    q_item->info = NULL;
 	    ipmi_handle_rsp_item_copyall(ipmi, q_item->rsp_item,
 					 &q_item->addr, q_item->addr_len,
 					 &q_item->msg, q_item->rsp_handler);
@@ -2854,7 +3275,7 @@ check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
 	    /* We successfully sent a message, break out of the loop. */
 	    started = 1;
 	}
-	ipmi_mem_free(q_item);
+	put_wait_q_item(lan, q_item);
     }
 
     if (!started)
@@ -3007,12 +3428,9 @@ handle_payload(ipmi_con_t    *ipmi,
 	/* Couldn't cancel the timer, make sure the timer
 	   doesn't do the callback. */
 	lan->seq_table[seq].timer_info->cancelled = 1;
-    else {
-	/* Timer is cancelled, free its data. */
-	ipmi->os_hnd->free_timer(ipmi->os_hnd,
-				 lan->seq_table[seq].timer);
-	ipmi_mem_free(lan->seq_table[seq].timer_info);
-    }
+    else
+	/* Timer is cancelled, reuse its data. */
+	put_timer_info(lan, lan->seq_table[seq].timer_info);
 
     handler = lan->seq_table[seq].rsp_handler;
     rspi = lan->seq_table[seq].rsp_item;
@@ -3377,6 +3795,10 @@ addr_match_lan(lan_data_t *lan, uint32_t sid, sockaddr_ip_t *addr,
     return 0;
 }
 
+/*
+ * Find the connection for an incoming packet and take a reference
+ * to it.  The caller must lan_put() the result.
+ */
 static ipmi_con_t *
 rmcpp_find_ipmi(lan_fd_t      *item,
 		unsigned char *data,
@@ -3384,8 +3806,8 @@ rmcpp_find_ipmi(lan_fd_t      *item,
 		sockaddr_ip_t *addr,
 		int           *addr_num)
 {
-    /* This is easy, the session id is our slot in the fd or is a
-       message tag. */
+    /* This is easy, the session id has our slot in the fd.  If there
+       is no session id, the address is unique in the fd. */
     unsigned char payload;
     uint32_t      tag;
     uint32_t      sid;
@@ -3393,7 +3815,7 @@ rmcpp_find_ipmi(lan_fd_t      *item,
     unsigned int  mlen;
     unsigned char *d;
     ipmi_con_t    *ipmi = NULL;
-    lan_data_t    *lan;
+    lan_data_t    *lan = NULL;
 
     /* We need to find the sessions id; it's position depends on
        the payload type. */
@@ -3423,34 +3845,49 @@ rmcpp_find_ipmi(lan_fd_t      *item,
     }
 
     sid = ipmi_get_uint32(d);
-    if ((sid == 0) && payloads[payload]->get_msg_tag) {
-	int rv = payloads[payload]->get_msg_tag(d+10, mlen, &ctag);
-	if (rv) {
+    ipmi_lock(item->con_lock);
+    if (sid == 0) {
+	lan = fd_find_lan_by_addr(item, addr, addr_num);
+	if (lan && payloads[payload]->get_msg_tag) {
+	    /* The message tag is our slot (truncated to 8 bits). */
+	    int rv = payloads[payload]->get_msg_tag(d+10, mlen, &ctag);
+	    if (rv) {
+		if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
+		    ipmi_log(IPMI_LOG_DEBUG,
+			     "Error getting message tag: %d", rv);
+		lan = NULL;
+	    } else if (ctag != (unsigned char) lan->fd_slot) {
+		if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
+		    ipmi_log(IPMI_LOG_DEBUG, "tag doesn't match: %d", ctag);
+		lan = NULL;
+	    }
+	} else if (!lan && (DEBUG_RAWMSG || DEBUG_MSG_ERR))
+	    ipmi_log(IPMI_LOG_DEBUG, "No connection for address");
+    } else {
+	tag = (sid & LAN_SID_SLOT_MASK) - 1;
+	if (tag >= item->num_slots) {
 	    if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
-		ipmi_log(IPMI_LOG_DEBUG, "Error getting message tag: %d", rv);
-	    return NULL;
+		ipmi_log(IPMI_LOG_DEBUG, "tag is out of range: %d", tag);
+	} else {
+	    lan = item->slots[tag].lan;
+	    if (lan && !addr_match_lan(lan, sid, addr, addr_num)) {
+		if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
+		    ipmi_log(IPMI_LOG_DEBUG, "tag doesn't match: %d", tag);
+		lan = NULL;
+	    }
 	}
-	tag = ctag;
-    } else
-	tag = sid - 1;
-
-    if (tag >= MAX_CONS_PER_FD) {
-	if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
-	    ipmi_log(IPMI_LOG_DEBUG, "tag is out of range: %d", tag);
-	return NULL;
     }
-
-    ipmi_lock(item->con_lock);
-    lan = item->lan[tag];
-    if (lan && addr_match_lan(lan, sid, addr, addr_num))
+    if (lan && lan_get_from_fd(lan))
 	ipmi = lan->ipmi;
-    else if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
-	ipmi_log(IPMI_LOG_DEBUG, "tag doesn't match: %d", tag);
     ipmi_unlock(item->con_lock);
 
     return ipmi;
 }
 
+/*
+ * Find the connection for an incoming packet and take a reference
+ * to it.  The caller must lan_put() the result.
+ */
 static ipmi_con_t *
 rmcp_find_ipmi(lan_fd_t      *item,
 	       unsigned char *data,
@@ -3458,10 +3895,10 @@ rmcp_find_ipmi(lan_fd_t      *item,
 	       sockaddr_ip_t *addr,
 	       int           *addr_num)
 {
-    /* Old RMCP is harder, we have to hunt. */
+    /* Old RMCP session ids are chosen by the BMC, so look it up by
+       address and then check the session id. */
     uint32_t   sid;
     lan_data_t *lan;
-    int        i;
     ipmi_con_t *ipmi = NULL;
 
     if (len < 13) {
@@ -3472,44 +3909,28 @@ rmcp_find_ipmi(lan_fd_t      *item,
 
     sid = ipmi_get_uint32(data+9);
     ipmi_lock(item->con_lock);
-    for (i=0; i<MAX_CONS_PER_FD; i++) {
-	lan = item->lan[i];
-	if (lan && addr_match_lan(lan, sid, addr, addr_num)) {
-	    ipmi = lan->ipmi;
-	    break;
-	}
-    }
+    lan = fd_find_lan_by_addr(item, addr, addr_num);
+    if (lan && (!sid || (lan->ip[*addr_num].session_id == sid))
+	&& lan_get_from_fd(lan))
+	ipmi = lan->ipmi;
     ipmi_unlock(item->con_lock);
 
     return ipmi;
 }
 
 static void
-data_handler(int            fd,
-	     void           *cb_data,
-	     os_hnd_fd_id_t *id)
+handle_lan_packet(lan_fd_t      *item,
+		  unsigned char *data,
+		  int           len,
+		  sockaddr_ip_t *ipaddrd)
 {
-    lan_fd_t           *item = cb_data;
     ipmi_con_t         *ipmi;
     lan_data_t         *lan;
-    unsigned char      data[IPMI_MAX_LAN_LEN];
-    sockaddr_ip_t      ipaddrd;
-    socklen_t          from_len;
-    int                len;
     int                addr_num = 0; /* Keep gcc happy and initialize */
 
-    from_len = sizeof(ipaddrd.s_ipsock);
-    len = recvfrom(fd, (void*) data, sizeof(data), 0, (struct sockaddr *)&ipaddrd,
-		   &from_len);
-
-    if (len < 0)
-	/* Got an error, probably no data, just return. */
-	return;
-
-    ipaddrd.ip_addr_len = from_len;
     if (DEBUG_RAWMSG) {
 	ipmi_log(IPMI_LOG_DEBUG_START, "incoming\n addr = ");
-	dump_hex((unsigned char *) &ipaddrd, from_len);
+	dump_hex((unsigned char *) ipaddrd, ipaddrd->ip_addr_len);
 	if (len) {
 	    ipmi_log(IPMI_LOG_DEBUG_CONT, "\n data =\n  ");
 	    dump_hex(data, len);
@@ -3534,12 +3955,12 @@ data_handler(int            fd,
     }
 
     if ((data[4] & 0x0f) == IPMI_AUTHTYPE_RMCP_PLUS) {
-	ipmi = rmcpp_find_ipmi(item, data, len, &ipaddrd, &addr_num);
+	ipmi = rmcpp_find_ipmi(item, data, len, ipaddrd, &addr_num);
     } else {
-	ipmi = rmcp_find_ipmi(item, data, len, &ipaddrd, &addr_num);
+	ipmi = rmcp_find_ipmi(item, data, len, ipaddrd, &addr_num);
     }
 
-    if (!lan_valid_ipmi(ipmi))
+    if (!ipmi)
 	/* This can fail due to a race condition, just return and
            everything should be fine. */
 	return;
@@ -3555,9 +3976,74 @@ data_handler(int            fd,
     }
     
     lan_put(ipmi);
-    return;
 }
 
+#ifdef HAVE_RECVMMSG
+/*
+ * Up to MAX_CONS_PER_FD connections share a socket, so when polling
+ * a lot of BMCs responses tend to arrive in bursts.  Pull as many
+ * datagrams as are waiting (up to LAN_RECV_BATCH) with one system
+ * call and demux them one at a time.
+ */
+#define LAN_RECV_BATCH 16
+
+static void
+data_handler(int            fd,
+	     void           *cb_data,
+	     os_hnd_fd_id_t *id)
+{
+    lan_fd_t           *item = cb_data;
+    unsigned char      data[LAN_RECV_BATCH][IPMI_MAX_LAN_LEN];
+    sockaddr_ip_t      ipaddrd[LAN_RECV_BATCH];
+    struct mmsghdr     msgs[LAN_RECV_BATCH];
+    struct iovec       iov[LAN_RECV_BATCH];
+    int                i, count;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < LAN_RECV_BATCH; i++) {
+	iov[i].iov_base = data[i];
+	iov[i].iov_len = sizeof(data[i]);
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &ipaddrd[i].s_ipsock;
+	msgs[i].msg_hdr.msg_namelen = sizeof(ipaddrd[i].s_ipsock);
+    }
+
+    count = recvmmsg(fd, msgs, LAN_RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (count < 0)
+	/* Got an error, probably no data, just return. */
+	return;
+
+    for (i = 0; i < count; i++) {
+	ipaddrd[i].ip_addr_len = msgs[i].msg_hdr.msg_namelen;
+	handle_lan_packet(item, data[i], msgs[i].msg_len, &ipaddrd[i]);
+    }
+}
+#else
+static void
+data_handler(int            fd,
+	     void           *cb_data,
+	     os_hnd_fd_id_t *id)
+{
+    lan_fd_t           *item = cb_data;
+    unsigned char      data[IPMI_MAX_LAN_LEN];
+    sockaddr_ip_t      ipaddrd;
+    socklen_t          from_len;
+    int                len;
+
+    from_len = sizeof(ipaddrd.s_ipsock);
+    len = recvfrom(fd, (void*) data, sizeof(data), 0, (struct sockaddr *)&ipaddrd,
+		   &from_len);
+
+    if (len < 0)
+	/* Got an error, probably no data, just return. */
+	return;
+
+    ipaddrd.ip_addr_len = from_len;
+    handle_lan_packet(item, data, len, &ipaddrd);
+}
+#endif
+
 /* Note that this puts the address number in data4 of the rspi. */
 int
 ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
@@ -3568,7 +4054,6 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
 			      ipmi_ll_rsp_handler_t rsp_handler,
 			      ipmi_msgi_t           *rspi)
 {
-    lan_timer_info_t *info;
     lan_data_t       *lan;
     int              rv;
     /* We store the address number in data4. */
@@ -3592,21 +4077,6 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
     if (msg->netfn & 1)
 	return lan_send_addr(lan, addr, addr_len, msg, 0, addr_num, NULL);
 
-    info = ipmi_mem_alloc(sizeof(*info));
-    if (!info)
-	return ENOMEM;
-    memset(info, 0, sizeof(*info));
-
-    /* Put it in the list first. */
-    info->ipmi = ipmi;
-    info->cancelled = 0;
-
-    rv = ipmi->os_hnd->alloc_timer(ipmi->os_hnd, &(info->timer));
-    if (rv) {
-	ipmi_mem_free(info);
-	return rv;
-    }
-
     ipmi_lock(lan->seq_num_lock);
 
     if (lan->outstanding_msg_count >= 60) {
@@ -3615,24 +4085,13 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
     }
 
     rspi->data4 = (void *) (intptr_t) addr_num;
-    rv = handle_msg_send(info, addr_num, addr, addr_len, msg,
+    rv = handle_msg_send(ipmi, addr_num, addr, addr_len, msg,
 			 rsp_handler, rspi, 0);
-    /* handle_msg_send handles freeing the timer and info on an error */
-    info = NULL;
     if (! rv)
 	lan->outstanding_msg_count++;
-    ipmi_unlock(lan->seq_num_lock);
-    return rv;
 
  out_unlock:
     ipmi_unlock(lan->seq_num_lock);
-    if (rv) {
-	if (info) {
-	    if (info->timer)
-		ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-	    ipmi_mem_free(info);
-	}
-    }
     return rv;
 }
 
@@ -3645,7 +4104,6 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 			ipmi_ll_rsp_handler_t   rsp_handler,
 			ipmi_msgi_t             *trspi)
 {
-    lan_timer_info_t *info;
     lan_data_t       *lan;
     int              rv;
     ipmi_msgi_t      *rspi = trspi;
@@ -3681,34 +4139,17 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 	    return ENOMEM;
     }
 
-    info = ipmi_mem_alloc(sizeof(*info));
-    if (!info) {
-	rv = ENOMEM;
-	goto out_unlock2;
-    }
-    memset(info, 0, sizeof(*info));
-
-    /* Put it in the list first. */
-    info->ipmi = ipmi;
-    info->cancelled = 0;
-
-    rv = ipmi->os_hnd->alloc_timer(ipmi->os_hnd, &(info->timer));
-    if (rv)
-	goto out_unlock;
-
     ipmi_lock(lan->seq_num_lock);
 
     if (lan->outstanding_msg_count >= lan->max_outstanding_msg_count) {
 	lan_wait_queue_t *q_item;
 
-	q_item = ipmi_mem_alloc(sizeof(*q_item));
+	q_item = get_wait_q_item(lan);
 	if (!q_item) {
-	    ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
 	    rv = ENOMEM;
 	    goto out_unlock;
 	}
 
-	q_item->info = info;
 	memcpy(&(q_item->addr), addr, addr_len);
 	q_item->addr_len = addr_len;
 	memcpy(&q_item->msg, msg, sizeof(q_item->msg));
@@ -3727,31 +4168,17 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 	    lan->wait_q_tail->next = q_item;
 	    lan->wait_q_tail = q_item;
 	}
+	rv = 0;
 	goto out_unlock;
     }
 
-    rv = handle_msg_send(info, -1, addr, addr_len, msg,
+    rv = handle_msg_send(ipmi, -1, addr, addr_len, msg,
 			 rsp_handler, rspi, side_effects);
-    /* handle_msg_send handles freeing the timer and info on an error */
-    info = NULL;
     if (!rv)
 	lan->outstanding_msg_count++;
-    else if (!trspi && rspi)
-	/* If we allocated an rspi, free it on error. */
-	ipmi_mem_free(rspi);
-    ipmi_unlock(lan->seq_num_lock);
-    return rv;
 
  out_unlock:
     ipmi_unlock(lan->seq_num_lock);
-    if (rv) {
-	if (info) {
-	    if (info->timer)
-		ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-	    ipmi_mem_free(info);
-	}
-    }
- out_unlock2:
     if (rv) {
 	/* If we allocated an rspi, free it. */
 	if (!trspi && rspi)
@@ -3810,6 +4237,14 @@ lan_get_num_ports(ipmi_con_t *ipmi)
     return lan->cparm.num_ip_addr;
 }
 
+static unsigned int
+lan_get_max_outstanding_msgs(ipmi_con_t *ipmi)
+{
+    lan_data_t *lan = (lan_data_t *) ipmi->con_data;
+
+    return lan->max_outstanding_msg_count;
+}
+
 static int
 lan_get_port_info(ipmi_con_t *ipmi, unsigned int port,
 		  char *info, int *info_len)
@@ -3933,6 +4368,13 @@ cleanup_con(ipmi_con_t *ipmi)
 
     if (ipmi) {
 	lan = (lan_data_t *) ipmi->con_data;
+	while (lan && lan->timer_info_pool) {
+	    lan_timer_info_t *info = lan->timer_info_pool;
+
+	    lan->timer_info_pool = info->next;
+	    ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
+	    ipmi_mem_free(info);
+	}
 	ipmi_con_attr_cleanup(ipmi);
 	if (ipmi->name) {
 	    ipmi_mem_free(ipmi->name);
@@ -3974,6 +4416,12 @@ cleanup_con(ipmi_con_t *ipmi)
 	    locked_list_destroy(lan->ipmb_change_handlers);
 	if (lan->seq_num_lock)
 	    ipmi_destroy_lock(lan->seq_num_lock);
+	while (lan->wait_q_pool) {
+	    lan_wait_queue_t *q_item = lan->wait_q_pool;
+
+	    lan->wait_q_pool = q_item->next;
+	    ipmi_mem_free(q_item);
+	}
 	if (lan->fd)
 	    release_lan_fd(lan->fd, lan->fd_slot);
 	if (lan->authdata)
@@ -4045,10 +4493,8 @@ lan_cleanup(ipmi_con_t *ipmi)
 	       But we must be holding the lock while we do this. */
 	    if (rv)
 		info->cancelled = 1;
-	    else {
-		ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-		ipmi_mem_free(info);
-	    }
+	    else
+		put_timer_info(lan, info);
 
 	    ipmi_unlock(lan->seq_num_lock);
 
@@ -4068,8 +4514,6 @@ lan_cleanup(ipmi_con_t *ipmi)
 	q_item = lan->wait_q;
 	lan->wait_q = q_item->next;
 
-	ipmi->os_hnd->free_timer(ipmi->os_hnd, q_item->info->timer);
-
 	if (!lan->disabled) {
 	    ipmi_unlock(lan->seq_num_lock);
 
@@ -4083,7 +4527,6 @@ lan_cleanup(ipmi_con_t *ipmi)
 	    ipmi_lock(lan->seq_num_lock);
 	}
 
-	ipmi_mem_free(q_item->info);
 	ipmi_mem_free(q_item);
     }
     if (lan->audit_info) {
@@ -4135,7 +4578,9 @@ lan_close_connection_done(ipmi_con_t            *ipmi,
 
     /* Once we begin the shutdown process, we don't want anyone else
        reusing the connection. */
+    ipmi_lock(lan_shard(ipmi));
     lan_remove_con_nolock(lan);
+    ipmi_unlock(lan_shard(ipmi));
     ipmi_unlock(lan_list_lock);
 
     lan->close_done = handler;
@@ -4781,7 +5226,7 @@ start_rmcpp(ipmi_con_t *ipmi, lan_data_t *lan, ipmi_msgi_t *rspi, int addr_num)
     lan->ip[addr_num].unauth_in_seq_num = 0;
     /* Use our fd_slot in the fd for the session id, so we can look it
        up quickly. */
-    lan->ip[addr_num].precon_session_id = lan->fd_slot + 1;
+    lan->ip[addr_num].precon_session_id = lan->fd_sid;
     lan->ip[addr_num].working_conf = IPMI_LANP_CONFIDENTIALITY_ALGORITHM_NONE;
     lan->ip[addr_num].working_integ = IPMI_LANP_INTEGRITY_ALGORITHM_NONE;
 
@@ -5836,6 +6281,7 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
     ipmi->send_command_option = lan_send_command_option;
     ipmi->get_num_ports = lan_get_num_ports;
     ipmi->get_port_info = lan_get_port_info;
+    ipmi->get_max_outstanding_msgs = lan_get_max_outstanding_msgs;
     ipmi->register_stat_handler = lan_register_stat_handler;
     ipmi->unregister_stat_handler = lan_unregister_stat_handler;
     ipmi->disable = lan_disable;
@@ -5918,7 +6364,9 @@ ipmi_lan_handle_external_event(const struct sockaddr *src_addr,
 		if (dst->sin_addr.s_addr == src->sin_addr.s_addr) {
 		    /* We have a match, handle it */
 		    lan = l->lan;
+		    ipmi_lock(lan_shard(lan->ipmi));
 		    lan->refcount++;
+		    ipmi_unlock(lan_shard(lan->ipmi));
 		}
 	    }
 	    break;
@@ -5935,7 +6383,9 @@ ipmi_lan_handle_external_event(const struct sockaddr *src_addr,
 		{
 		    /* We have a match, handle it */
 		    lan = l->lan;
+		    ipmi_lock(lan_shard(lan->ipmi));
 		    lan->refcount++;
+		    ipmi_unlock(lan_shard(lan->ipmi));
 		}
 	    }
 	    break;
@@ -7039,6 +7489,12 @@ i_ipmi_lan_init(os_handler_t *os_hnd)
     if (rv)
 	return rv;
 
+    for (i=0; i<LAN_LOCK_SHARDS; i++) {
+	rv = ipmi_create_global_lock(&lan_shard_lock[i]);
+	if (rv)
+	    return rv;
+    }
+
     rv = ipmi_create_global_lock(&fd_list_lock);
     if (rv)
 	return rv;
@@ -7074,6 +7530,8 @@ i_ipmi_lan_init(os_handler_t *os_hnd)
 void
 i_ipmi_lan_shutdown(void)
 {
+    int i;
+
     i_ipmi_unregister_con_type("lan", lan_setup);
     i_ipmi_free_con_setup(lan_setup);
     lan_setup = NULL;
@@ -7082,6 +7540,12 @@ i_ipmi_lan_shutdown(void)
 	ipmi_destroy_lock(lan_list_lock);
 	lan_list_lock = NULL;
     }
+    for (i=0; i<LAN_LOCK_SHARDS; i++) {
+	if (lan_shard_lock[i]) {
+	    ipmi_destroy_lock(lan_shard_lock[i]);
+	    lan_shard_lock[i] = NULL;
+	}
+    }
     if (lan_payload_lock) {
 	ipmi_destroy_lock(lan_payload_lock);
 	lan_payload_lock = NULL;
@@ -7125,16 +7589,14 @@ i_ipmi_lan_shutdown(void)
 #else
 	    close(e->fd);
 #endif
-	    ipmi_destroy_lock(e->con_lock);
-	    ipmi_mem_free(e);
+	    free_lan_fd(e);
 	}
 	memset(&fd_list, 0, sizeof(fd_list));
     }
     while (fd_free_list) {
 	lan_fd_t *e = fd_free_list;
 	fd_free_list = e->next;
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
 #ifdef PF_INET6
     if (fd6_list_lock) {
@@ -7152,16 +7614,14 @@ i_ipmi_lan_shutdown(void)
 #else
 	    close(e->fd);
 #endif
-	    ipmi_destroy_lock(e->con_lock);
-	    ipmi_mem_free(e);
+	    free_lan_fd(e);
 	}
 	memset(&fd6_list, 0, sizeof(fd6_list));
     }
     while (fd6_free_list) {
 	lan_fd_t *e = fd6_free_list;
 	fd6_free_list = e->next;
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
 #endif
     lan_os_hnd = NULL;
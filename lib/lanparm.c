@@ -823,6 +823,19 @@ typedef struct alert_dest_addr_s
     unsigned short dest_vlan_tag;
 } alert_dest_addr_t;
 
+/* Most Get LAN Configuration Parameters commands ipmi_lan_get_config()
+   keeps in flight, less if the connection can't take that many. */
+#define MAX_LANPARM_FETCH_WINDOW 8
+
+/* One parameter being fetched by ipmi_lan_get_config(). */
+typedef struct lanparm_fetch_s
+{
+    ipmi_lan_config_t *lanc;
+    unsigned char     parm;
+    unsigned char     sel;
+    unsigned int      in_flight : 1;
+} lanparm_fetch_t;
+
 struct ipmi_lan_config_s
 {
     /* Stuff for getting/setting the values. */
@@ -891,6 +904,22 @@ struct ipmi_lan_config_s
     unsigned char  vlan_tag_supported;
     alert_dest_type_t *alert_dest_type;
     alert_dest_addr_t *alert_dest_addr;
+
+    /* For fetching the config.  Parameters that don't depend on
+       anything else are handed out from next_parm, the destination
+       tables once the number of destinations has come back and the
+       cipher suite parms once the number of cipher suites has. */
+    lanparm_fetch_t fetch[MAX_LANPARM_FETCH_WINDOW];
+    unsigned int    fetch_window;
+    unsigned int    fetch_outstanding;
+    int             next_parm;
+    int             next_cs_parm;
+    int             next_dest_type;
+    int             next_dest_addr;
+    int             next_dest_vlan_tag;
+    unsigned int    have_num_alert_destinations : 1;
+    unsigned int    have_num_cipher_suites : 1;
+    unsigned int    have_dest_vlan_tag : 1;
 };
 
 typedef struct lanparms_s lanparms_t;
@@ -1494,14 +1523,104 @@ err_lock_cleared(ipmi_lanparm_t *lanparm,
 }
 
 static void
-got_parm(ipmi_lanparm_t    *lanparm,
+fetch_config_done(ipmi_lanparm_t *lanparm, ipmi_lan_config_t *lanc)
+{
+    unsigned char data[1];
+    int           rv;
+
+    if (!lanc->err) {
+	lanc->done(lanparm, 0, lanc, lanc->cb_data);
+	lanparm_put(lanparm);
+	return;
+    }
+
+    ipmi_log(IPMI_LOG_ERR_INFO,
+	     "lanparm.c(fetch_config_done): Error trying to get parms: %x",
+	     lanc->err);
+    /* Clear the lock */
+    data[0] = 0;
+    rv = ipmi_lanparm_set_parm(lanparm, 0, data, 1, err_lock_cleared, lanc);
+    if (rv) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "lanparm.c(fetch_config_done): Error trying to clear lock: %x",
+		 rv);
+	lanc->done(lanparm, lanc->err, NULL, lanc->cb_data);
+	ipmi_lan_free_config(lanc);
+	lanparm->locked = 0;
+	lanparm_put(lanparm);
+    }
+}
+
+/* Pick the next parameter to fetch into f.  Returns 0 if nothing can
+   be fetched until more responses come back. */
+static int
+fetch_next_parm(ipmi_lan_config_t *lanc, lanparm_fetch_t *f)
+{
+    int parm;
+
+    while (lanc->next_parm < NUM_LANPARMS) {
+	parm = lanc->next_parm++;
+	switch (parm) {
+	case IPMI_LANPARM_DEST_TYPE:
+	case IPMI_LANPARM_DEST_ADDR:
+	case IPMI_LANPARM_CIPHER_SUITE_ENTRY_SUPPORT:
+	case IPMI_LANPARM_CIPHER_SUITE_ENTRY_PRIV:
+	case IPMI_LANPARM_DEST_VLAN_TAG:
+	    /* These wait for the number of entries. */
+	    continue;
+	}
+	if (!lanparms[parm].valid)
+	    continue;
+	f->parm = parm;
+	f->sel = 0;
+	return 1;
+    }
+
+    if (lanc->have_num_cipher_suites && (lanc->num_cipher_suites != 0)
+	&& (lanc->next_cs_parm <= IPMI_LANPARM_CIPHER_SUITE_ENTRY_PRIV))
+    {
+	f->parm = lanc->next_cs_parm++;
+	f->sel = 0;
+	return 1;
+    }
+
+    if (lanc->have_num_alert_destinations) {
+	if (lanc->next_dest_type < lanc->num_alert_destinations) {
+	    f->parm = IPMI_LANPARM_DEST_TYPE;
+	    f->sel = lanc->next_dest_type++;
+	    return 1;
+	}
+	if (lanc->next_dest_addr < lanc->num_alert_destinations) {
+	    f->parm = IPMI_LANPARM_DEST_ADDR;
+	    f->sel = lanc->next_dest_addr++;
+	    return 1;
+	}
+	/* The first VLAN tag tells us if the rest are supported. */
+	if ((lanc->next_dest_vlan_tag < lanc->num_alert_destinations)
+	    && ((lanc->next_dest_vlan_tag == 0)
+		|| (lanc->have_dest_vlan_tag && lanc->vlan_tag_supported)))
+	{
+	    f->parm = IPMI_LANPARM_DEST_VLAN_TAG;
+	    f->sel = lanc->next_dest_vlan_tag++;
+	    return 1;
+	}
+    }
+
+    return 0;
+}
+
+static int
+got_parm(ipmi_lan_config_t *lanc,
+	 lanparm_fetch_t   *f,
 	 int               err,
 	 unsigned char     *data,
-	 unsigned int      data_len,
-	 void              *cb_data)
+	 unsigned int      data_len)
 {
-    ipmi_lan_config_t *lanc = cb_data;
-    lanparms_t        *lp = &(lanparms[lanc->curr_parm]);
+    lanparms_t *lp = &(lanparms[f->parm]);
+
+    /* The handlers work on the current parm and selector. */
+    lanc->curr_parm = f->parm;
+    lanc->curr_sel = f->sel;
 
     /* Check the length, and don't forget the revision byte must be added. */
     if ((!err) && (data_len < (unsigned int) (lp->length+1))) {
@@ -1515,8 +1634,7 @@ got_parm(ipmi_lanparm_t    *lanparm,
 		 "lanparm.c(got_parm): "
 		 " Invalid data length on parm %d was %d, should have been %d",
 		 lanc->curr_parm, data_len, lp->length+1);
-	err = EINVAL;
-	goto done;
+	return EINVAL;
     }
 
     err = lp->get_handler(lanc, lp, err, data);
@@ -1525,58 +1643,24 @@ got_parm(ipmi_lanparm_t    *lanparm,
 		 "lanparm.c(got_parm): "
 		 "Error fetching parm %d: %x",
 		 lanc->curr_parm, err);
-	goto done;
+	return err;
     }
 
  next_parm:
     switch (lanc->curr_parm) {
     case IPMI_LANPARM_NUM_DESTINATIONS:
-	if (lanc->num_alert_destinations == 0)
-	    lanc->curr_parm = IPMI_LANPARM_VLAN_ID;
-	else {
-	    lanc->curr_parm++;
-	    lanc->curr_sel = 0;
-	}
-	break;
-
-    case IPMI_LANPARM_DEST_TYPE:
-	lanc->curr_sel++;
-	if (lanc->curr_sel >= lanc->num_alert_destinations) {
-	    lanc->curr_parm++;
-	    lanc->curr_sel = 0;
-	}
-	break;
-
-    case IPMI_LANPARM_DEST_ADDR:
-	lanc->curr_sel++;
-	if (lanc->curr_sel >= lanc->num_alert_destinations) {
-	    lanc->curr_parm = IPMI_LANPARM_VLAN_ID;
-	    lanc->curr_sel = 0;
-	}
+	lanc->have_num_alert_destinations = 1;
 	break;
 
     case IPMI_LANPARM_NUM_CIPHER_SUITE_ENTRIES:
-	lanc->curr_parm++;
-	if (lanc->num_cipher_suites == 0) {
-	    if (lanc->num_alert_destinations == 0)
-		goto done;
-	    lanc->curr_parm = IPMI_LANPARM_DEST_VLAN_TAG;
-	    lanc->curr_sel = 0;
-	}
-	break;
-
-    case IPMI_LANPARM_CIPHER_SUITE_ENTRY_PRIV:
-	if (lanc->num_alert_destinations == 0)
-	    goto done;
-	else {
-	    lanc->curr_parm++;
-	    lanc->curr_sel = 0;
-	}
+	lanc->have_num_cipher_suites = 1;
 	break;
 
     case IPMI_LANPARM_DEST_VLAN_TAG:
+	if (lanc->curr_sel == 0)
+	    lanc->have_dest_vlan_tag = 1;
 	if (!lanc->vlan_tag_supported)
-	    goto done;
+	    break;
 	if ((data[1] & 0xf) != lanc->curr_sel) {
 	    /* Yikes, wrong selector came back! */
 	    ipmi_log(IPMI_LOG_ERR_INFO,
@@ -1584,55 +1668,159 @@ got_parm(ipmi_lanparm_t    *lanparm,
 		     "Error fetching dest type %d,"
 		     " wrong selector came back, expecting %d, was %d",
 		     lanc->curr_parm, lanc->curr_sel, data[1] & 0xf);
-	    err = EINVAL;
-	    goto done;
+	    return EINVAL;
 	}
-	lanc->curr_sel++;
-	if (lanc->curr_sel >= lanc->num_alert_destinations)
-	    goto done;
 	break;
-
-    default:
-	lanc->curr_parm++;
     }
 
-    lp = &(lanparms[lanc->curr_parm]);
-    if (!lp->valid)
-	goto next_parm;
+    return 0;
+}
 
-    err = ipmi_lanparm_get_parm(lanparm, lanc->curr_parm, lanc->curr_sel, 0,
-				got_parm, lanc);
-    if (err)
-	goto done;
+static void fetch_config_continue(ipmi_lanparm_t    *lanparm,
+				  ipmi_lan_config_t *lanc,
+				  ipmi_mc_t         *mc);
 
-    return;
+static void
+lanparm_parm_fetched(ipmi_mc_t  *mc,
+		     ipmi_msg_t *rsp,
+		     void       *rsp_data)
+{
+    lanparm_fetch_t   *f = rsp_data;
+    ipmi_lan_config_t *lanc = f->lanc;
+    ipmi_lanparm_t    *lanparm = lanc->my_lan;
+    int               err;
 
- done:
-    if (err) {
-	unsigned char data[1];
+    err = check_lanparm_response_param(lanparm, mc, rsp, 2,
+				       "lanparm_parm_fetched");
 
-	ipmi_log(IPMI_LOG_ERR_INFO,
-		 "lanparm.c(got_parm): Error trying to get parm %d: %x",
-		 lanc->curr_parm, err);
-	lanc->err = err;
-	/* Clear the lock */
-	data[0] = 0;
-	err = ipmi_lanparm_set_parm(lanparm, 0, data, 1,
-				    err_lock_cleared, lanc);
-	if (err) {
-	    ipmi_lan_free_config(lanc);
+    lanparm_lock(lanparm);
+    f->in_flight = 0;
+    lanc->fetch_outstanding--;
+
+    /* After an error, just wait for the rest to come back. */
+    if (!lanc->err) {
+	/* Skip over the completion code. */
+	err = got_parm(lanc, f, err, rsp->data + 1, rsp->data_len - 1);
+	if (err)
+	    lanc->err = err;
+    }
+
+    fetch_config_continue(lanparm, lanc, mc);
+}
+
+/*
+ * Keep the window full of requests.  Must be called with the lanparm
+ * lock held, this will release it (or finish the fetch).
+ */
+static void
+fetch_config_continue(ipmi_lanparm_t    *lanparm,
+		      ipmi_lan_config_t *lanc,
+		      ipmi_mc_t         *mc)
+{
+    unsigned char   data[4];
+    ipmi_msg_t      msg;
+    unsigned int    i;
+    lanparm_fetch_t *f;
+    int             rv;
+
+    for (i = 0; i < lanc->fetch_window; i++) {
+	if (lanc->err)
+	    break;
+
+	f = &lanc->fetch[i];
+	if (f->in_flight)
+	    continue;
+	if (!fetch_next_parm(lanc, f))
+	    continue;
+
+	msg.data = data;
+	msg.netfn = IPMI_TRANSPORT_NETFN;
+	msg.cmd = IPMI_GET_LAN_CONFIG_PARMS_CMD;
+	data[0] = lanparm->channel;
+	data[1] = f->parm;
+	data[2] = f->sel;
+	data[3] = 0;
+	msg.data_len = 4;
+	rv = ipmi_mc_send_command(mc, 0, &msg, lanparm_parm_fetched, f);
+	if (rv) {
 	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "lanparm.c(got_parm): Error trying to clear lock: %x",
-		     err);
-	    lanc->done(lanparm, lanc->err, NULL, lanc->cb_data);
-	    ipmi_lan_free_config(lanc);
-	    lanparm->locked = 0;
-	    lanparm_put(lanparm);
+		     "%slanparm.c(fetch_config_continue): "
+		     "could not send cmd: %x",
+		     MC_NAME(mc), rv);
+	    lanc->err = rv;
+	    break;
 	}
-    } else {
-	lanc->done(lanparm, 0, lanc, lanc->cb_data);
-	lanparm_put(lanparm);
+	f->in_flight = 1;
+	lanc->fetch_outstanding++;
+    }
+
+    if (lanc->fetch_outstanding == 0) {
+	/* Nothing in flight and nothing more to send, we are done. */
+	lanparm_unlock(lanparm);
+	if (!lanparm->destroyed)
+	    opq_op_done(lanparm->opq);
+	fetch_config_done(lanparm, lanc);
+	return;
     }
+
+    lanparm_unlock(lanparm);
+}
+
+static void
+start_config_get_cb(ipmi_mc_t *mc, void *cb_data)
+{
+    ipmi_lan_config_t *lanc = cb_data;
+    ipmi_lanparm_t    *lanparm = lanc->my_lan;
+    unsigned int      max;
+
+    lanparm_lock(lanparm);
+    if (lanparm->destroyed) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "%slanparm.c(start_config_get_cb): "
+		 "LANPARM was destroyed while an operation was in progress",
+		 MC_NAME(mc));
+	lanc->err = ECANCELED;
+    }
+
+    max = i_ipmi_domain_get_max_outstanding_msgs(ipmi_mc_get_domain(mc));
+    lanc->fetch_window = MAX_LANPARM_FETCH_WINDOW;
+    if (max && (lanc->fetch_window > max))
+	lanc->fetch_window = max;
+
+    fetch_config_continue(lanparm, lanc, mc);
+}
+
+/* The whole config fetch is one operation on the opq, the parms are
+   fetched in parallel inside it. */
+static int
+start_config_get(void *cb_data, int shutdown)
+{
+    ipmi_lan_config_t *lanc = cb_data;
+    ipmi_lanparm_t    *lanparm = lanc->my_lan;
+    int               rv;
+
+    if (shutdown) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "lanparm.c(start_config_get): "
+		 "LANPARM was destroyed while an operation was in progress");
+	lanc->err = ECANCELED;
+	fetch_config_done(lanparm, lanc);
+	return OPQ_HANDLER_STARTED;
+    }
+
+    /* The read lock must be claimed before the lanparm lock to avoid
+       deadlock. */
+    rv = ipmi_mc_pointer_cb(lanparm->mc, start_config_get_cb, lanc);
+    if (rv) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "lanparm.c(start_config_get): "
+		 "LANPARM's MC is not valid");
+	lanc->err = rv;
+	if (!lanparm->destroyed)
+	    opq_op_done(lanparm->opq);
+	fetch_config_done(lanparm, lanc);
+    }
+    return OPQ_HANDLER_STARTED;
 }
 
 static void 
@@ -1641,7 +1829,6 @@ lock_done(ipmi_lanparm_t *lanparm,
 	  void           *cb_data)
 {
     ipmi_lan_config_t *lanc = cb_data;
-    int               rv;
 
     if (err == IPMI_IPMI_ERR_VAL(0x80)) {
 	/* Lock is not supported, just mark it and go on. */
@@ -1666,28 +1853,16 @@ lock_done(ipmi_lanparm_t *lanparm,
 	lanparm->locked = 1;
     }
 
-    rv = ipmi_lanparm_get_parm(lanparm, lanc->curr_parm, lanc->curr_sel, 0,
-			       got_parm, lanc);
-    if (rv) {
-	unsigned char data[1];
+    if (lanparm->destroyed)
+	lanc->err = EINVAL;
+    else if (!opq_new_op(lanparm->opq, start_config_get, lanc, 0))
+	lanc->err = ENOMEM;
+
+    if (lanc->err) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "lanparm.c(lock_done): Error trying to get parms: %x",
-		 err);
-
-	lanc->err = rv;
-	/* Clear the lock */
-	data[0] = 0;
-	rv = ipmi_lanparm_set_parm(lanparm, 0, data, 1,
-				   err_lock_cleared, lanc);
-	if (rv) {
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "lanparm.c(lock_done): Error trying to clear lock: %x",
-		     err);
-	    lanc->done(lanparm, lanc->err, NULL, lanc->cb_data);
-	    ipmi_lan_free_config(lanc);
-	    lanparm->locked = 0;
-	    lanparm_put(lanparm);
-	}
+		 lanc->err);
+	fetch_config_done(lanparm, lanc);
     }
 }
 
@@ -1698,6 +1873,7 @@ int ipmi_lan_get_config(ipmi_lanparm_t         *lanparm,
     ipmi_lan_config_t *lanc;
     int               rv;
     unsigned char     data[1];
+    unsigned int      i;
 
     lanc = ipmi_mem_alloc(sizeof(*lanc));
     if (!lanc)
@@ -1706,6 +1882,10 @@ int ipmi_lan_get_config(ipmi_lanparm_t         *lanparm,
 
     lanc->curr_parm = 1;
     lanc->curr_sel = 0;
+    lanc->next_parm = 1;
+    lanc->next_cs_parm = IPMI_LANPARM_CIPHER_SUITE_ENTRY_SUPPORT;
+    for (i = 0; i < MAX_LANPARM_FETCH_WINDOW; i++)
+	lanc->fetch[i].lanc = lanc;
     lanc->done = done;
     lanc->cb_data = cb_data;
     lanc->my_lan = lanparm;
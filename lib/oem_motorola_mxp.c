@@ -648,26 +648,48 @@ safe there.  We try to get as much accuracy as we can in this, but it's
 not very good.
 */
 
-static void
+/* Set the same linear conversion factors for every raw value.  Only
+   the first change can fail, it may need a private copy of the
+   sensor's factors. */
+static int
+set_linear_conv(ipmi_sensor_t *sensor, int m, int b, int b_exp, int r_exp)
+{
+    int i;
+    int rv;
+
+    for (i=0; i<256; i++)
+    {
+	rv = ipmi_sensor_set_raw_m(sensor, i, m);
+	if (!rv)
+	    rv = ipmi_sensor_set_raw_b(sensor, i, b);
+	if (!rv)
+	    rv = ipmi_sensor_set_raw_b_exp(sensor, i, b_exp);
+	if (!rv)
+	    rv = ipmi_sensor_set_raw_r_exp(sensor, i, r_exp);
+	if (!rv)
+	    rv = ipmi_sensor_set_raw_accuracy(sensor, i, m);
+	if (!rv)
+	    rv = ipmi_sensor_set_raw_accuracy_exp(sensor, i, r_exp);
+	if (rv)
+	    return rv;
+    }
+    return 0;
+}
+
+static int
 set_volt_conv(ipmi_sensor_t *sensor, double val,
 	      int m, int b, int b_exp, int r_exp)
 {
-    int                         i;
     enum ipmi_thresh_e          event;
     enum ipmi_event_value_dir_e dir;
     double                      v, step;
     int                         offset;
+    int                         rv;
 
     /* The voltage sensors. */
-    for (i=0; i<256; i++)
-    {
-	ipmi_sensor_set_raw_m(sensor, i, m);
-	ipmi_sensor_set_raw_b(sensor, i, b);
-	ipmi_sensor_set_raw_b_exp(sensor, i, b_exp);
-	ipmi_sensor_set_raw_r_exp(sensor, i, r_exp);
-	ipmi_sensor_set_raw_accuracy(sensor, i, m);
-	ipmi_sensor_set_raw_accuracy_exp(sensor, i, r_exp);
-    }
+    rv = set_linear_conv(sensor, m, b, b_exp, r_exp);
+    if (rv)
+	return rv;
     for (event = IPMI_LOWER_NON_CRITICAL;
 	 event < IPMI_UPPER_NON_RECOVERABLE;
 	 event++)
@@ -692,6 +714,7 @@ set_volt_conv(ipmi_sensor_t *sensor, double val,
     ipmi_sensor_set_raw_nominal_reading(sensor, 198);
     ipmi_sensor_set_nominal_reading_specified(sensor, 1);
 
+    return 0;
 }
 
 /* Fixups for the SDRs on the MXP.  They are fairly broken. */
@@ -706,19 +729,21 @@ mxp_new_sensor(ipmi_mc_t     *mc,
     int                         i;
     enum ipmi_thresh_e          event;
     enum ipmi_event_value_dir_e dir;
+    int                         rv = 0;
 
     ipmi_sensor_get_num(sensor, &lun, &num);
 
     switch (num) {
     case 0x0a:
 	/* The LM77 temperature sensor. */
-	for (i=0; i<256; i++) {
+	for (i=0; (i<256) && !rv; i++) {
 	    /* It seems that the lower and upper bits of the LM77
 	       sensor value are truncated to return this, so it's
 	       a simple 1-1 relationship between degrees C and the
 	       value. */
-	    ipmi_sensor_set_raw_m(sensor, i, 1);
-	    ipmi_sensor_set_raw_r_exp(sensor, i, 0);
+	    rv = ipmi_sensor_set_raw_m(sensor, i, 1);
+	    if (!rv)
+		rv = ipmi_sensor_set_raw_r_exp(sensor, i, 0);
 	}
 	for (event = IPMI_LOWER_NON_CRITICAL;
 	     event < IPMI_UPPER_NON_RECOVERABLE;
@@ -737,26 +762,27 @@ mxp_new_sensor(ipmi_mc_t     *mc,
 	break;
 
     case 0x40: /* 5V */
-	set_volt_conv(sensor, 5.0, 25, 50, 0, -3);
+	rv = set_volt_conv(sensor, 5.0, 25, 50, 0, -3);
 	break;
 
     case 0x41: /* 3.3V */
-	set_volt_conv(sensor, 3.3, 165, 330, 0, -4);
+	rv = set_volt_conv(sensor, 3.3, 165, 330, 0, -4);
 	break;
 
     case 0x42: /* 2.5V */
-	set_volt_conv(sensor, 2.5, 125, 250, 0, -4);
+	rv = set_volt_conv(sensor, 2.5, 125, 250, 0, -4);
 	break;
 
     case 0x44: /* 8V */
-	set_volt_conv(sensor, 8.0, 40, 80, 0, -3);
+	rv = set_volt_conv(sensor, 8.0, 40, 80, 0, -3);
 	break;
 
     case 0x43:
 	/* The "Cool" sensor. */
-	for (i=0; i<256; i++) {
-	    ipmi_sensor_set_raw_m(sensor, i, 1);
-	    ipmi_sensor_set_raw_r_exp(sensor, i, -1);
+	for (i=0; (i<256) && !rv; i++) {
+	    rv = ipmi_sensor_set_raw_m(sensor, i, 1);
+	    if (!rv)
+		rv = ipmi_sensor_set_raw_r_exp(sensor, i, -1);
 	}
 	for (event = IPMI_LOWER_NON_CRITICAL;
 	     event < IPMI_UPPER_NON_RECOVERABLE;
@@ -772,6 +798,14 @@ mxp_new_sensor(ipmi_mc_t     *mc,
 	ipmi_sensor_set_event_support(sensor, IPMI_EVENT_SUPPORT_NONE);
 	break;
     }
+
+    /* Returning an error here would mean we handled the sensor, so
+       just report it.  The sensor keeps the factors from its SDR. */
+    if (rv)
+	ipmi_log(IPMI_LOG_SEVERE,
+		 "%soem_motorola_mxp.c(mxp_new_sensor): "
+		 "Unable to set the conversion factors: %x",
+		 SENSOR_NAME(sensor), rv);
     return 0;
 }
 
@@ -1540,6 +1574,8 @@ mxp_alloc_threshold_sensor
     ipmi_sensor_set_base_unit(*sensor, base_unit);
     ipmi_sensor_set_modifier_unit(*sensor, 0);
     ipmi_sensor_set_linearization(*sensor, 0);
+    /* The factors of a new sensor are already all zero, so this can't
+       fail. */
     for (i=0; i<256; i++) {
 	ipmi_sensor_set_raw_m(*sensor, i, 0);
 	ipmi_sensor_set_raw_tolerance(*sensor, i, 0);
@@ -1747,13 +1783,11 @@ mxp_alloc_semi_stand_threshold_sensor
 	ipmi_sensor_threshold_set_settable(*sensor, thresh, 0);
     }
 
-    for (i=0; i<256; i++) {
-	ipmi_sensor_set_raw_m(*sensor, i, m);
-	ipmi_sensor_set_raw_b(*sensor, i, b);
-	ipmi_sensor_set_raw_b_exp(*sensor, i, b_exp);
-	ipmi_sensor_set_raw_r_exp(*sensor, i, r_exp);
-	ipmi_sensor_set_raw_accuracy(*sensor, i, m);
-	ipmi_sensor_set_raw_accuracy_exp(*sensor, i, r_exp);
+    rv = set_linear_conv(*sensor, m, b, b_exp, r_exp);
+    if (rv) {
+	ipmi_sensor_free_nonstandard(*sensor);
+	*sensor = NULL;
+	return rv;
     }
 
     /* Create all the callbacks in the data structure. */
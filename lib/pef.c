@@ -995,6 +995,22 @@ typedef struct ipmi_ask_s
     unsigned int alert_string_set : 4;
 } ipmi_ask_t;
 
+/* How many Get PEF Configuration Parameters commands a config fetch
+   will have outstanding at once.  The real limit is the smaller of
+   this and what the connection will have outstanding. */
+#define MAX_PEF_FETCH_WINDOW 8
+
+/* One parameter being fetched by ipmi_pef_get_config(). */
+typedef struct pef_fetch_s
+{
+    ipmi_pef_config_t *pefc;
+    unsigned char     parm;
+    unsigned char     sel;
+    unsigned char     block;
+    unsigned int      in_flight : 1;
+    unsigned int      more : 1; /* More blocks of an alert string. */
+} pef_fetch_t;
+
 struct ipmi_pef_config_s
 {
     int curr_parm;
@@ -1049,6 +1065,22 @@ struct ipmi_pef_config_s
     unsigned char num_alert_strings;	/* Number of alert strings */
     ipmi_ask_t	  *asks;		/* Alert String Key Table */
     char          **alert_strings;	/* Alert strings */
+
+    /* For fetching the config.  Parameters that don't depend on
+       anything else are handed out from next_parm, the entries of a
+       table once the table size has come back.  The blocks of an
+       alert string are fetched one after the other in one slot. */
+    pef_fetch_t  fetch[MAX_PEF_FETCH_WINDOW];
+    unsigned int fetch_window;
+    unsigned int fetch_outstanding;
+    int          next_parm;
+    int          next_eft;
+    int          next_apt;
+    int          next_ask;
+    int          next_as;
+    unsigned int have_num_event_filters : 1;
+    unsigned int have_num_alert_policies : 1;
+    unsigned int have_num_alert_strings : 1;
 };
 
 
@@ -1582,182 +1614,314 @@ err_lock_cleared(ipmi_pef_t *pef,
 }
 
 static void
-got_parm(ipmi_pef_t     *pef,
-	 int            err,
-	 unsigned char  *data,
-	 unsigned int   data_len,
-	 void           *cb_data)
+fetch_config_done(ipmi_pef_t *pef, ipmi_pef_config_t *pefc)
 {
-    ipmi_pef_config_t *pefc = cb_data;
-    pefparms_t        *lp = &(pefparms[pefc->curr_parm]);
+    unsigned char data[1];
+    int           rv;
+
+    if (!pefc->err) {
+	pefc->done(pef, 0, pefc, pefc->cb_data);
+	pef_put(pef);
+	return;
+    }
+
+    ipmi_log(IPMI_LOG_ERR_INFO,
+	     "pef.c(fetch_config_done): Error trying to get parms: %x",
+	     pefc->err);
+    /* Clear the lock */
+    data[0] = 0;
+    rv = ipmi_pef_set_parm(pef, 0, data, 1, err_lock_cleared, pefc);
+    if (rv) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "pef.c(fetch_config_done): Error trying to clear lock: %x",
+		 rv);
+	pefc->done(pef, pefc->err, NULL, pefc->cb_data);
+	ipmi_pef_free_config(pefc);
+	pef_put(pef);
+    }
+}
+
+/* Pick the next parameter to fetch into f.  Returns 0 if nothing can
+   be fetched until more responses come back. */
+static int
+fetch_next_parm(ipmi_pef_config_t *pefc, pef_fetch_t *f)
+{
+    int parm;
+
+    f->block = 0;
+
+    while (pefc->next_parm < NUM_PEFPARMS) {
+	parm = pefc->next_parm++;
+	switch (parm) {
+	case IPMI_PEFPARM_EVENT_FILTER_TABLE:
+	case IPMI_PEFPARM_ALERT_POLICY_TABLE:
+	case IPMI_PEFPARM_ALERT_STRING_KEY:
+	case IPMI_PEFPARM_ALERT_STRING:
+	    /* These wait for their table size. */
+	    continue;
+	}
+	if (!pefparms[parm].valid)
+	    continue;
+	f->parm = parm;
+	f->sel = 0;
+	return 1;
+    }
+
+    if (pefc->have_num_event_filters
+	&& (pefc->next_eft <= pefc->num_event_filters))
+    {
+	f->parm = IPMI_PEFPARM_EVENT_FILTER_TABLE;
+	f->sel = pefc->next_eft++;
+	return 1;
+    }
+
+    if (pefc->have_num_alert_policies
+	&& (pefc->next_apt <= pefc->num_alert_policies))
+    {
+	f->parm = IPMI_PEFPARM_ALERT_POLICY_TABLE;
+	f->sel = pefc->next_apt++;
+	return 1;
+    }
+
+    if (pefc->have_num_alert_strings) {
+	if (pefc->next_ask < pefc->num_alert_strings) {
+	    f->parm = IPMI_PEFPARM_ALERT_STRING_KEY;
+	    f->sel = pefc->next_ask++;
+	    return 1;
+	}
+	if (pefc->next_as < pefc->num_alert_strings) {
+	    f->parm = IPMI_PEFPARM_ALERT_STRING;
+	    f->sel = pefc->next_as++;
+	    f->block = 1;
+	    return 1;
+	}
+    }
+
+    return 0;
+}
+
+static int
+got_parm(ipmi_pef_config_t *pefc,
+	 pef_fetch_t       *f,
+	 int               err,
+	 unsigned char     *data,
+	 unsigned int      data_len)
+{
+    pefparms_t *lp = &(pefparms[f->parm]);
 
     /* Check the length, and don't forget the revision byte must be added. */
     if ((!err) && (data_len < (unsigned int) (lp->length+1))) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "ipmi_pefparm_got_parm:"
 		 " Invalid data length on parm %d was %d, should have been %d",
-		 pefc->curr_parm, data_len, lp->length+1);
-	err = EINVAL;
-	goto done;
+		 f->parm, data_len, lp->length+1);
+	return EINVAL;
     }
 
     err = lp->get_handler(pefc, lp, err, data, data_len);
     if (err) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "ipmi_pefparm_got_parm: Error fetching parm %d: %x",
-		 pefc->curr_parm, err);
-	goto done;
+		 f->parm, err);
+	return err;
     }
 
- next_parm:
-    switch (pefc->curr_parm) {
+    switch (f->parm) {
     case IPMI_PEFPARM_NUM_EVENT_FILTERS:
-	pefc->curr_parm++;
-	if (pefc->num_event_filters == 0)
-	    pefc->curr_parm = IPMI_PEFPARM_NUM_ALERT_POLICIES;
-	else
-	    pefc->curr_sel = 1;
-	break;
-
-    case IPMI_PEFPARM_EVENT_FILTER_TABLE:
-	if ((data[1] & 0x7f) != pefc->curr_sel) {
-	    /* Yikes, wrong selector came back! */
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "ipmi_pefparm_got_parm: Error fetching eft %d,"
-		     " wrong selector came back, expecting %d, was %d",
-		     pefc->curr_parm, pefc->curr_sel, data[1] & 0x7f);
-	    err = EINVAL;
-	    goto done;
-	}
-	pefc->curr_sel++;
-	if (pefc->curr_sel > pefc->num_event_filters) {
-	    pefc->curr_parm++;
-	    pefc->curr_sel = 0;
-	}
+	pefc->have_num_event_filters = 1;
 	break;
 
     case IPMI_PEFPARM_NUM_ALERT_POLICIES:
-	pefc->curr_parm++;
-	if (pefc->num_alert_policies == 0)
-	    pefc->curr_parm = IPMI_PEFPARM_NUM_ALERT_STRINGS;
-	else
-	    pefc->curr_sel = 1;
-	break;
-
-    case IPMI_PEFPARM_ALERT_POLICY_TABLE:
-	if ((data[1] & 0x7f) != pefc->curr_sel) {
-	    /* Yikes, wrong selector came back! */
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "ipmi_pefparm_got_parm: Error fetching apt %d,"
-		     " wrong selector came back, expecting %d, was %d",
-		     pefc->curr_parm, pefc->curr_sel, data[1] & 0x7f);
-	    err = EINVAL;
-	    goto done;
-	}
-	pefc->curr_sel++;
-	if (pefc->curr_sel > pefc->num_alert_policies) {
-	    pefc->curr_parm++;
-	    pefc->curr_sel = 0;
-	}
+	pefc->have_num_alert_policies = 1;
 	break;
 
     case IPMI_PEFPARM_NUM_ALERT_STRINGS:
-	pefc->curr_parm++;
-	if (pefc->num_alert_strings == 0)
-	    goto done;
-	pefc->curr_sel = 0;
+	pefc->have_num_alert_strings = 1;
 	break;
 
+    case IPMI_PEFPARM_EVENT_FILTER_TABLE:
+    case IPMI_PEFPARM_ALERT_POLICY_TABLE:
     case IPMI_PEFPARM_ALERT_STRING_KEY:
-	if ((data[1] & 0x7f) != pefc->curr_sel) {
+	if ((data[1] & 0x7f) != f->sel) {
 	    /* Yikes, wrong selector came back! */
 	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "ipmi_pefparm_got_parm: Error fetching ask %d,"
+		     "ipmi_pefparm_got_parm: Error fetching parm %d,"
 		     " wrong selector came back, expecting %d, was %d",
-		     pefc->curr_parm, pefc->curr_sel, data[1] & 0x7f);
-	    err = EINVAL;
-	    goto done;
-	}
-	pefc->curr_sel++;
-	if (pefc->curr_sel >= pefc->num_alert_strings) {
-	    pefc->curr_parm++;
-	    pefc->curr_sel = 0;
-	    pefc->curr_block = 1;
+		     f->parm, f->sel, data[1] & 0x7f);
+	    return EINVAL;
 	}
 	break;
 
     case IPMI_PEFPARM_ALERT_STRING:
-	if ((data[1] & 0x7f) != pefc->curr_sel) {
+	if ((data[1] & 0x7f) != f->sel) {
 	    /* Yikes, wrong selector came back! */
 	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "ipmi_pefparm_got_parm: Error fetching ask %d,"
+		     "ipmi_pefparm_got_parm: Error fetching as %d,"
 		     " wrong selector came back, expecting %d, was %d",
-		     pefc->curr_parm, pefc->curr_sel, data[1] & 0x7f);
-	    err = EINVAL;
-	    goto done;
+		     f->parm, f->sel, data[1] & 0x7f);
+	    return EINVAL;
 	}
-	if (data[2] != pefc->curr_block) {
+	if (data[2] != f->block) {
 	    /* Yikes, wrong block came back! */
 	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "ipmi_pefparm_got_parm: Error fetching ask %d,"
+		     "ipmi_pefparm_got_parm: Error fetching as %d,"
 		     " wrong block came back, expecting %d, was %d",
-		     pefc->curr_parm, pefc->curr_block, data[2]);
-	    err = EINVAL;
-	    goto done;
+		     f->parm, f->block, data[2]);
+	    return EINVAL;
 	}
-	if ((data_len < 19) ||
-	    (memchr(data+3, '\0', data_len-3)))
-	{
-	    /* End of string, either a subsize-block or a nil
-	       character in the data. */
-	    pefc->curr_sel++;
-	    pefc->curr_block = 1;
-	    if (pefc->curr_sel >= pefc->num_alert_strings)
-		goto done;
-	} else {
-	    /* Not at the end yet. */
-	    pefc->curr_block++;
+	if ((data_len >= 19) && (!memchr(data+3, '\0', data_len-3))) {
+	    /* Not at the end of the string yet, the end is either a
+	       subsize-block or a nil character in the data. */
+	    f->block++;
+	    f->more = 1;
 	}
 	break;
-
-    default:
-	pefc->curr_parm++;
     }
 
-    lp = &(pefparms[pefc->curr_parm]);
-    if (!lp->valid)
-	goto next_parm;
+    return 0;
+}
 
-    err = ipmi_pef_get_parm(pef, pefc->curr_parm, pefc->curr_sel, 
-			    pefc->curr_block, got_parm, pefc);
-    if (err)
-	goto done;
+static void fetch_config_continue(ipmi_pef_t        *pef,
+				  ipmi_pef_config_t *pefc,
+				  ipmi_mc_t         *mc);
 
-    return;
+static void
+pef_parm_fetched(ipmi_mc_t  *mc,
+		 ipmi_msg_t *rsp,
+		 void       *rsp_data)
+{
+    pef_fetch_t       *f = rsp_data;
+    ipmi_pef_config_t *pefc = f->pefc;
+    ipmi_pef_t        *pef = pefc->my_pef;
+    int               err;
 
- done:
-    if (err) {
-	unsigned char data[1];
+    err = check_pef_response_param(pef, mc, rsp, 2, "pef_parm_fetched");
 
-	ipmi_log(IPMI_LOG_ERR_INFO,
-		 "pef.c(got_parm): Error trying to get parm %d: %x",
-		 pefc->curr_parm, err);
-	pefc->err = err;
-	/* Clear the lock */
-	data[0] = 0;
-	err = ipmi_pef_set_parm(pef, 0, data, 1, err_lock_cleared, pefc);
-	if (err) {
+    pef_lock(pef);
+    f->in_flight = 0;
+    pefc->fetch_outstanding--;
+
+    /* After an error, just wait for the rest to come back. */
+    if (!pefc->err) {
+	/* Skip the completion code. */
+	err = got_parm(pefc, f, err, rsp->data + 1, rsp->data_len - 1);
+	if (err)
+	    pefc->err = err;
+    }
+
+    fetch_config_continue(pef, pefc, mc);
+}
+
+/*
+ * Keep the window full of requests.  Must be called with the PEF lock
+ * held, this will release it (or finish the fetch).
+ */
+static void
+fetch_config_continue(ipmi_pef_t        *pef,
+		      ipmi_pef_config_t *pefc,
+		      ipmi_mc_t         *mc)
+{
+    unsigned char data[3];
+    ipmi_msg_t    msg;
+    unsigned int  i;
+    pef_fetch_t   *f;
+    int           rv;
+
+    for (i = 0; i < pefc->fetch_window; i++) {
+	if (pefc->err)
+	    break;
+
+	f = &pefc->fetch[i];
+	if (f->in_flight)
+	    continue;
+	if (f->more)
+	    f->more = 0;
+	else if (!fetch_next_parm(pefc, f))
+	    continue;
+
+	msg.data = data;
+	msg.netfn = IPMI_SENSOR_EVENT_NETFN;
+	msg.cmd = IPMI_GET_PEF_CONFIG_PARMS_CMD;
+	data[0] = f->parm;
+	data[1] = f->sel;
+	data[2] = f->block;
+	msg.data_len = 3;
+	rv = ipmi_mc_send_command(mc, 0, &msg, pef_parm_fetched, f);
+	if (rv) {
 	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "pef.c(got_parm): Error trying to clear lock: %x",
-		     err);
-	    pefc->done(pef, pefc->err, NULL, pefc->cb_data);
-	    ipmi_pef_free_config(pefc);
-	    pef_put(pef);
+		     "pef.c(fetch_config_continue): could not send cmd: %x",
+		     rv);
+	    pefc->err = rv;
+	    break;
 	}
-    } else {
-	pefc->done(pef, 0, pefc, pefc->cb_data);
-	pef_put(pef);
+	f->in_flight = 1;
+	pefc->fetch_outstanding++;
+    }
+
+    if (pefc->fetch_outstanding == 0) {
+	/* Nothing in flight and nothing more to send, we are done. */
+	pef_unlock(pef);
+	if (!pef->destroyed)
+	    opq_op_done(pef->opq);
+	fetch_config_done(pef, pefc);
+	return;
+    }
+
+    pef_unlock(pef);
+}
+
+static void
+start_config_get_cb(ipmi_mc_t *mc, void *cb_data)
+{
+    ipmi_pef_config_t *pefc = cb_data;
+    ipmi_pef_t        *pef = pefc->my_pef;
+    unsigned int      max;
+
+    pef_lock(pef);
+    if (pef->destroyed) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "start_config_get: "
+		 "PEF was destroyed while an operation was in progress");
+	pefc->err = ECANCELED;
+    }
+
+    max = i_ipmi_domain_get_max_outstanding_msgs(ipmi_mc_get_domain(mc));
+    pefc->fetch_window = MAX_PEF_FETCH_WINDOW;
+    if (max && (pefc->fetch_window > max))
+	pefc->fetch_window = max;
+
+    fetch_config_continue(pef, pefc, mc);
+}
+
+/* The whole config fetch is one operation on the opq, the parms are
+   fetched in parallel inside it. */
+static int
+start_config_get(void *cb_data, int shutdown)
+{
+    ipmi_pef_config_t *pefc = cb_data;
+    ipmi_pef_t        *pef = pefc->my_pef;
+    int               rv;
+
+    if (shutdown) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "start_config_get: "
+		 "PEF was destroyed while an operation was in progress");
+	pefc->err = ECANCELED;
+	fetch_config_done(pef, pefc);
+	return OPQ_HANDLER_STARTED;
+    }
+
+    /* The read lock must be claimed before the pef lock to avoid
+       deadlock. */
+    rv = ipmi_mc_pointer_cb(pef->mc, start_config_get_cb, pefc);
+    if (rv) {
+	ipmi_log(IPMI_LOG_ERR_INFO, "start_config_get: PEF's MC is not valid");
+	pefc->err = rv;
+	if (!pef->destroyed)
+	    opq_op_done(pef->opq);
+	fetch_config_done(pef, pefc);
     }
+    return OPQ_HANDLER_STARTED;
 }
 
 static void 
@@ -1766,7 +1930,6 @@ lock_done(ipmi_pef_t *pef,
 	  void       *cb_data)
 {
     ipmi_pef_config_t *pefc = cb_data;
-    int               rv;
 
     if (err == IPMI_IPMI_ERR_VAL(0x80)) {
 	/* Lock is not supported, just mark it and go on. */
@@ -1790,26 +1953,16 @@ lock_done(ipmi_pef_t *pef,
 
     pefc->pef_locked = 1;
 
-    rv = ipmi_pef_get_parm(pef, pefc->curr_parm, pefc->curr_sel, 0,
-			    got_parm, pefc);
-    if (rv) {
-	unsigned char data[1];
+    if (pef->destroyed)
+	pefc->err = EINVAL;
+    else if (!opq_new_op(pef->opq, start_config_get, pefc, 0))
+	pefc->err = ENOMEM;
 
+    if (pefc->err) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
-		 "pef.c(lock_done): Error trying to get parm %d: %x",
-		 pefc->curr_parm, rv);
-	pefc->err = rv;
-	/* Clear the lock */
-	data[0] = 0;
-	rv = ipmi_pef_set_parm(pef, 0, data, 1, err_lock_cleared, pefc);
-	if (rv) {
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "pef.c(lock_done): Error trying to clear lock: %x",
-		     err);
-	    pefc->done(pef, pefc->err, NULL, pefc->cb_data);
-	    ipmi_pef_free_config(pefc);
-	    pef_put(pef);
-	}
+		 "pef.c(lock_done): Error trying to get parms: %x",
+		 pefc->err);
+	fetch_config_done(pef, pefc);
     }
 }
 
@@ -1820,6 +1973,7 @@ int ipmi_pef_get_config(ipmi_pef_t             *pef,
     ipmi_pef_config_t *pefc;
     int               rv;
     unsigned char     data[1];
+    unsigned int      i;
 
     pefc = ipmi_mem_alloc(sizeof(*pefc));
     if (!pefc)
@@ -1828,6 +1982,11 @@ int ipmi_pef_get_config(ipmi_pef_t             *pef,
 
     pefc->curr_parm = 1;
     pefc->curr_sel = 0;
+    pefc->next_parm = 1;
+    pefc->next_eft = 1;
+    pefc->next_apt = 1;
+    for (i = 0; i < MAX_PEF_FETCH_WINDOW; i++)
+	pefc->fetch[i].pefc = pefc;
     pefc->done = done;
     pefc->cb_data = cb_data;
     pefc->my_pef = pef;
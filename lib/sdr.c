@@ -51,12 +51,20 @@
 #define STD_SDR_FETCH_BYTES 16
 #define MIN_SDR_FETCH_BYTES 10
 #define SDR_FETCH_BYTES_DECR 6
+/* Amount to grow the fetch size by while the responses are clean. */
+#define SDR_FETCH_BYTES_INCR 4
 
 /* Do up to this many retries when the reservation is lost. */
 #define MAX_SDR_FETCH_RETRIES 10
 
-/* Number of outstanding fetch requests we can have out. */
-#define MAX_SDR_FETCH_OUTSTANDING 3
+/* Maximum number of outstanding fetch requests we can have out.  The
+   number actually used adapts between 1 and this, bounded by what
+   the connection will keep outstanding. */
+#define MAX_SDR_FETCH_OUTSTANDING 16
+
+/* Bound on the outstanding requests if the connection doesn't give
+   one. */
+#define DEFAULT_SDR_FETCH_OUTSTANDING 3
 
 typedef struct sdr_fetch_handler_s
 {
@@ -151,6 +159,24 @@ struct ipmi_sdr_info_s
 
     unsigned int           fetch_size;
 
+    /* The fetch window and size adapt to how the target responds.
+       The window grows by one for each clean response up to
+       fetch_thresh, then by one (and the fetch size by
+       SDR_FETCH_BYTES_INCR) per window's worth of clean responses.
+       Errors that look like overload halve the window and set
+       fetch_thresh to the result.  The fetch size never goes above
+       fetch_size_limit, which drops if the target says a size is too
+       big. */
+    unsigned int           fetch_window;
+    unsigned int           fetch_max_window;
+    unsigned int           fetch_thresh;
+    unsigned int           fetch_acks;
+    unsigned int           fetch_size_limit;
+    unsigned int           num_outstanding;
+
+    /* When the current fetch operation started, for statistics. */
+    struct timeval         fetch_start;
+
     unsigned int           curr_read_rec_id;
     unsigned int           next_read_rec_id;
     int                    curr_read_idx;
@@ -197,6 +223,12 @@ struct ipmi_sdr_info_s
     char db_key[32+5];
     int  db_key_set;
 
+    /* Statistics for reading the repository from the target. */
+    ipmi_domain_stat_t *sdr_good_reads;
+    ipmi_domain_stat_t *sdr_read_msecs;
+    ipmi_domain_stat_t *sdr_read_errors;
+    ipmi_domain_stat_t *sdr_read_backoffs;
+
 #ifdef DEBUG_INFO_TRACKING
     struct {
 	int            line;
@@ -254,6 +286,72 @@ cleanup_fetch_items(ipmi_sdr_info_t *sdrs)
     ilist_iter(sdrs->free_fetch, free_fetch, NULL);
     ilist_iter(sdrs->process_fetch, free_fetch, NULL);
     ilist_iter(sdrs->outstanding_fetch, cancel_fetch, NULL);
+    sdrs->num_outstanding = 0;
+}
+
+static void
+sdr_stats_put(ipmi_sdr_info_t *sdrs)
+{
+    if (sdrs->sdr_good_reads)
+	ipmi_domain_stat_put(sdrs->sdr_good_reads);
+    if (sdrs->sdr_read_msecs)
+	ipmi_domain_stat_put(sdrs->sdr_read_msecs);
+    if (sdrs->sdr_read_errors)
+	ipmi_domain_stat_put(sdrs->sdr_read_errors);
+    if (sdrs->sdr_read_backoffs)
+	ipmi_domain_stat_put(sdrs->sdr_read_backoffs);
+}
+
+/* Something went wrong that may be the target being overloaded,
+   back off the fetch window. */
+static void
+fetch_window_backoff(ipmi_sdr_info_t *sdrs)
+{
+    sdrs->fetch_thresh = sdrs->fetch_window / 2;
+    if (sdrs->fetch_thresh == 0)
+	sdrs->fetch_thresh = 1;
+    sdrs->fetch_window = sdrs->fetch_thresh;
+    sdrs->fetch_acks = 0;
+    if (sdrs->sdr_read_backoffs)
+	ipmi_domain_stat_add(sdrs->sdr_read_backoffs, 1);
+}
+
+/* Got a clean response, open things up. */
+static void
+fetch_window_grow(ipmi_sdr_info_t *sdrs)
+{
+    if (sdrs->fetch_window < sdrs->fetch_thresh) {
+	sdrs->fetch_window++;
+	return;
+    }
+
+    sdrs->fetch_acks++;
+    if (sdrs->fetch_acks < sdrs->fetch_window)
+	return;
+    sdrs->fetch_acks = 0;
+    if (sdrs->fetch_window < sdrs->fetch_max_window)
+	sdrs->fetch_window++;
+    if (sdrs->fetch_size < sdrs->fetch_size_limit) {
+	sdrs->fetch_size += SDR_FETCH_BYTES_INCR;
+	if (sdrs->fetch_size > sdrs->fetch_size_limit)
+	    sdrs->fetch_size = sdrs->fetch_size_limit;
+    }
+}
+
+static void
+fetch_window_start(ipmi_sdr_info_t *sdrs, ipmi_mc_t *mc)
+{
+    unsigned int max;
+
+    max = i_ipmi_domain_get_max_outstanding_msgs(ipmi_mc_get_domain(mc));
+    if (max == 0)
+	max = DEFAULT_SDR_FETCH_OUTSTANDING;
+    else if (max > MAX_SDR_FETCH_OUTSTANDING)
+	max = MAX_SDR_FETCH_OUTSTANDING;
+    sdrs->fetch_max_window = max;
+    sdrs->fetch_thresh = max;
+    sdrs->fetch_window = 1;
+    sdrs->fetch_acks = 0;
 }
 
 static void
@@ -417,8 +515,9 @@ ipmi_sdr_info_alloc(ipmi_domain_t   *domain,
     sdrs->lun = lun;
     sdrs->sensor = sensor;
     sdrs->sdr_wait_q = NULL;
-    /* use guaranteed size */
+    /* use guaranteed size, grow from there if it works. */
     sdrs->fetch_size = STD_SDR_FETCH_BYTES;
+    sdrs->fetch_size_limit = MAX_SDR_FETCH_BYTES;
 
     /* Assume we have a dynamic population until told otherwise. */
     sdrs->dynamic_population = 1;
@@ -483,6 +582,27 @@ ipmi_sdr_info_alloc(ipmi_domain_t   *domain,
 	    ipmi_mem_free(sdrs);
 	}
     } else {
+	const char *mcname = i_ipmi_mc_name(mc);
+
+	if (sensor) {
+	    ipmi_domain_stat_register(domain, "device_sdr_good_reads",
+				      mcname, &sdrs->sdr_good_reads);
+	    ipmi_domain_stat_register(domain, "device_sdr_read_msecs",
+				      mcname, &sdrs->sdr_read_msecs);
+	    ipmi_domain_stat_register(domain, "device_sdr_read_errors",
+				      mcname, &sdrs->sdr_read_errors);
+	    ipmi_domain_stat_register(domain, "device_sdr_read_backoffs",
+				      mcname, &sdrs->sdr_read_backoffs);
+	} else {
+	    ipmi_domain_stat_register(domain, "sdr_good_reads",
+				      mcname, &sdrs->sdr_good_reads);
+	    ipmi_domain_stat_register(domain, "sdr_read_msecs",
+				      mcname, &sdrs->sdr_read_msecs);
+	    ipmi_domain_stat_register(domain, "sdr_read_errors",
+				      mcname, &sdrs->sdr_read_errors);
+	    ipmi_domain_stat_register(domain, "sdr_read_backoffs",
+				      mcname, &sdrs->sdr_read_backoffs);
+	}
 	*new_sdrs = sdrs;
     }
  out:
@@ -516,6 +636,8 @@ internal_destroy_sdr_info(ipmi_sdr_info_t *sdrs)
 
     opq_destroy(sdrs->sdr_wait_q);
 
+    sdr_stats_put(sdrs);
+
     ipmi_destroy_lock(sdrs->sdr_lock);
 
     /* Do this after we have gotten rid of all external dependencies,
@@ -616,6 +738,8 @@ fetch_complete(ipmi_sdr_info_t *sdrs, int err)
     sdrs->wait_err = err;
     if (err) {
 	DEBUG_INFO(sdrs);
+	if (sdrs->sdr_read_errors)
+	    ipmi_domain_stat_add(sdrs->sdr_read_errors, 1);
 	if (sdrs->working_sdrs) {
 	    ipmi_mem_free(sdrs->working_sdrs);
 	    sdrs->working_sdrs = NULL;
@@ -627,6 +751,19 @@ fetch_complete(ipmi_sdr_info_t *sdrs, int err)
 	ipmi_sdr_t *to_free = NULL;
 
 	DEBUG_INFO(sdrs);
+	if (sdrs->sdrs_changed) {
+	    /* We actually read the repository, record how long it
+	       took. */
+	    struct timeval now;
+
+	    sdrs->os_hnd->get_monotonic_time(sdrs->os_hnd, &now);
+	    if (sdrs->sdr_good_reads)
+		ipmi_domain_stat_add(sdrs->sdr_good_reads, 1);
+	    if (sdrs->sdr_read_msecs)
+		ipmi_domain_stat_add(sdrs->sdr_read_msecs,
+			((now.tv_sec - sdrs->fetch_start.tv_sec) * 1000
+			 + (now.tv_usec - sdrs->fetch_start.tv_usec) / 1000));
+	}
 	sdrs->fetched = 1;
 	sdrs->num_sdrs = sdrs->curr_read_idx+1;
 	sdrs->sdr_array_size = sdrs->num_sdrs;
@@ -928,6 +1065,7 @@ info_send(ipmi_sdr_info_t *sdrs, fetch_info_t *info, ipmi_mc_t *mc)
     } else {
 	DEBUG_INFO(sdrs);
 	ilist_add_tail(sdrs->outstanding_fetch, info, &info->link);
+	sdrs->num_outstanding++;
     }
 
     return rv;
@@ -942,6 +1080,7 @@ handle_sdr_data(ipmi_mc_t  *mc,
     ipmi_sdr_info_t *sdrs = info->sdrs;
     process_info_t  pinfo;
     int             rv;
+    int             new_size;
 
     sdr_lock(sdrs);
     DEBUG_INFO(sdrs);
@@ -953,6 +1092,7 @@ handle_sdr_data(ipmi_mc_t  *mc,
 		 " outstanding operation list", sdrs->name);
 	goto out_unlock;
     }
+    sdrs->num_outstanding--;
 
     if (sdrs->destroyed) {
 	DEBUG_INFO(sdrs);
@@ -1129,10 +1269,19 @@ handle_sdr_data(ipmi_mc_t  *mc,
 
     if (rsp->data[0] == IPMI_CANNOT_RETURN_REQ_LENGTH_CC) {
 	/* It's more than the system can return in a single messages,
-	   decrease the size. */
+	   decrease the size.  Only do this once for all the fetches
+	   sent with the same size, and don't grow back to it. */
 	ilist_add_tail(sdrs->free_fetch, info, &info->link);
 
-	sdrs->fetch_size -= SDR_FETCH_BYTES_DECR;
+	new_size = (int) info->read_len - SDR_FETCH_BYTES_DECR;
+	if (new_size < (int) sdrs->fetch_size) {
+	    if (new_size < 0)
+		new_size = 0;
+	    sdrs->fetch_size = new_size;
+	    if (sdrs->fetch_size >= MIN_SDR_FETCH_BYTES)
+		sdrs->fetch_size_limit = sdrs->fetch_size;
+	    fetch_window_backoff(sdrs);
+	}
 	if (sdrs->fetch_size < MIN_SDR_FETCH_BYTES) {
 	    DEBUG_INFO(sdrs);
 	    ipmi_log(IPMI_LOG_ERR_INFO,
@@ -1164,6 +1313,35 @@ handle_sdr_data(ipmi_mc_t  *mc,
 	}
     }
 
+    if (((rsp->data[0] == IPMI_TIMEOUT_CC)
+	 || (rsp->data[0] == IPMI_UNKNOWN_ERR_CC))
+	&& (sdrs->sdr_retry_count < MAX_SDR_FETCH_RETRIES))
+    {
+	/* The target (or something on the way) may be choking on the
+	   number of outstanding requests or the size, back off both
+	   and retry this SDR. */
+	DEBUG_INFO(sdrs);
+	sdrs->sdr_retry_count++;
+	fetch_window_backoff(sdrs);
+	if (sdrs->fetch_size > STD_SDR_FETCH_BYTES) {
+	    sdrs->fetch_size -= SDR_FETCH_BYTES_DECR;
+	    if (sdrs->fetch_size < STD_SDR_FETCH_BYTES)
+		sdrs->fetch_size = STD_SDR_FETCH_BYTES;
+	}
+
+	/* Cancel any current or newer pending operations. */
+	cancel_same_or_newer(sdrs, info->idx);
+
+	/* Re-start the fetch on this SDR. */
+	sdrs->next_read_offset = -1;
+	sdrs->read_size = -1;
+	sdrs->next_read_rec_id = info->sdr_rec;
+	sdrs->curr_read_idx = info->idx-1;
+
+	ilist_add_tail(sdrs->free_fetch, info, &info->link);
+	goto out_nextmsg;
+    }
+
     if (rsp->data[0] != 0) {
 	DEBUG_INFO(sdrs);
 	ilist_add_tail(sdrs->free_fetch, info, &info->link);
@@ -1207,6 +1385,7 @@ handle_sdr_data(ipmi_mc_t  *mc,
     }
 
     /* We have a good response */
+    fetch_window_grow(sdrs);
 
     /* First handle the info for fetching data. */
     if (info->offset == 0) {
@@ -1217,8 +1396,9 @@ handle_sdr_data(ipmi_mc_t  *mc,
 	sdrs->next_read_offset = info->read_len;
     }
 
-    /* Now process it for the user. */
-    memcpy(info->data, rsp->data+1, rsp->data_len-1);
+    /* Now process it for the user.  Only take what we asked for,
+       that's all the buffer holds. */
+    memcpy(info->data, rsp->data+1, info->read_len+2);
 
     pinfo.processed = 0;
     pinfo.sdrs = sdrs;
@@ -1259,8 +1439,11 @@ handle_sdr_data(ipmi_mc_t  *mc,
     }
 
  out_nextmsg:
-    while (!ilist_empty(sdrs->free_fetch)) {
-	/* We have some free buffers, see what we can do with them. */
+    while (!ilist_empty(sdrs->free_fetch)
+	   && (sdrs->num_outstanding < sdrs->fetch_window))
+    {
+	/* We have some free buffers and room in the window, see what
+	   we can do with them. */
 
 	if (sdrs->next_read_offset == 0)
 	    /* We need to get the SDR header before we can go on. */
@@ -1654,6 +1837,8 @@ handle_sdr_info(ipmi_mc_t  *mc,
     sdrs->curr_rec_id = 0;
     sdrs->read_offset = 0; /* First thing is to read the header. */
 
+    fetch_window_start(sdrs, mc);
+
     sdrs->next_read_rec_id = 0;
     sdrs->curr_read_rec_id = 0;
     sdrs->curr_read_idx = 0;
@@ -1767,6 +1952,7 @@ handle_start_fetch_cb(ipmi_mc_t *mc, void *cb_data)
     sdrs->wait_err = 0;
     sdrs->sdr_retry_count = 0;
     sdr_lock(sdrs);
+    sdrs->os_hnd->get_monotonic_time(sdrs->os_hnd, &sdrs->fetch_start);
     rv = start_fetch(sdrs, mc, 0);
     if (rv) {
 	DEBUG_INFO(sdrs);
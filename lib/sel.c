@@ -48,6 +48,15 @@
 
 #define MAX_SEL_FETCH_RETRIES 10
 
+/* The most Get SEL Entry commands a speculative fetch will have
+   sent ahead and not yet used, including the one for the entry being
+   fetched. */
+#define MAX_SEL_SPECULATE 16
+
+/* A Get SEL Entry response is 16 bytes of record, 2 bytes of next
+   record id and the completion code. */
+#define SEL_ENTRY_RSP_LEN 19
+
 typedef struct sel_fetch_handler_s
 {
     ipmi_sel_info_t     *sel;
@@ -65,6 +74,14 @@ typedef struct sel_event_holder_s
     unsigned int cancelled : 1;
     unsigned int refcount;
     ipmi_event_t *event;
+
+    /* The record id the holder is filed under in the SEL's hash.
+       This does not change when the event is replaced. */
+    unsigned int recid;
+    struct sel_event_holder_s *hash_next;
+
+    /* Entry in the SEL's list of events. */
+    ilist_item_t link;
 } sel_event_holder_t;
 
 static sel_event_holder_t *
@@ -105,6 +122,23 @@ typedef struct sel_clear_req_s
 
 #define SEL_NAME_LEN (IPMI_MC_NAME_LEN + 32)
 
+/* A Get SEL Entry command sent during a speculative fetch. */
+typedef struct sel_spec_s
+{
+    ipmi_sel_info_t *sel;
+    unsigned int    gen;
+    unsigned int    recid;
+    int             done;
+    unsigned int    rsp_len;
+    unsigned char   rsp[SEL_ENTRY_RSP_LEN];
+} sel_spec_t;
+
+/* What to do once the outstanding speculative commands drain. */
+enum sel_spec_finish_e { SEL_SPEC_FINISH_NONE,
+			 SEL_SPEC_FINISH_COMPLETE,
+			 SEL_SPEC_FINISH_CLEAR,
+			 SEL_SPEC_FINISH_RESTART };
+
 struct ipmi_sel_info_s
 {
     ipmi_mcid_t mc;
@@ -159,6 +193,26 @@ struct ipmi_sel_info_s
     unsigned int           fetch_retry_count;
     sel_fetch_handler_t    *fetch_handlers;
 
+    /* Speculative fetching.  Besides the command for curr_rec_id,
+       commands are sent for the record ids after it, guessing that
+       they are handed out in order.  When a response comes back, its
+       next record id is looked up in the commands already sent
+       (spec).  After a wrong guess the commands in spec are dropped,
+       the ones still outstanding are left to finish and their
+       responses thrown away; changing spec_gen marks them.  The fetch
+       does not finish until everything sent has come back, so the
+       SEL can't go away under them. */
+    unsigned int           spec_depth; /* 0 if off */
+    unsigned int           spec_window;
+    unsigned int           spec_gen;
+    unsigned int           spec_outstanding;
+    unsigned int           spec_next_recid;
+    sel_spec_t             *spec[MAX_SEL_SPECULATE];
+    unsigned int           spec_count;
+    sel_fetch_handler_t    *spec_elem;
+    enum sel_spec_finish_e spec_finish;
+    int                    spec_finish_err;
+
     /* When we start a fetch, we start with this id.  This is the last
        one we successfully fetches (or 0 if it is not valid) so we can
        find the next valid id to fetch. */
@@ -179,6 +233,11 @@ struct ipmi_sel_info_s
     unsigned int num_sels;
     unsigned int del_sels;
 
+    /* The events in the list are also hashed by record id, so an
+       event can be found without searching the list. */
+    sel_event_holder_t **events_hash;
+    unsigned int       events_hash_size; /* Always a power of 2 */
+
     /* We serialize operations through here, since we are dealing with
        a locked resource. */
     opq_t *opq;
@@ -193,6 +252,8 @@ struct ipmi_sel_info_s
     ipmi_domain_stat_t *sel_fail_scan_lost_reservation;
     ipmi_domain_stat_t *sel_received_events;
     ipmi_domain_stat_t *sel_fetch_errors;
+    ipmi_domain_stat_t *sel_speculate_hits;
+    ipmi_domain_stat_t *sel_speculate_misses;
 
     ipmi_domain_stat_t *sel_good_clears;
     ipmi_domain_stat_t *sel_clear_lost_reservation;
@@ -216,31 +277,112 @@ static inline void sel_unlock(ipmi_sel_info_t *sel)
 	sel->os_hnd->unlock(sel->os_hnd, sel->sel_lock);
 }
 
+/* Record ids are 16 bits and usually handed out in order, so the low
+   bits of the record id make a good hash. */
+#define SEL_EVENTS_HASH_INIT_SIZE 64
+#define SEL_EVENTS_HASH_MAX_SIZE  65536
+
+static sel_event_holder_t *
+find_event(ipmi_sel_info_t *sel, unsigned int recid)
+{
+    sel_event_holder_t *holder;
+
+    holder = sel->events_hash[recid & (sel->events_hash_size - 1)];
+    while (holder && (holder->recid != recid))
+	holder = holder->hash_next;
+    return holder;
+}
+
+/* Grow the hash when it averages more than one event per bucket.  If
+   the allocation fails the old hash is kept, lookups just get
+   slower. */
 static void
-free_event(ilist_iter_t *iter, void *item, void *cb_data)
+events_hash_grow(ipmi_sel_info_t *sel)
 {
-    sel_event_holder_t *holder = item;
-    sel_event_holder_put(holder);
+    sel_event_holder_t **new_hash, *holder, *next;
+    unsigned int       new_size = sel->events_hash_size * 2;
+    unsigned int       i, idx;
+
+    new_hash = ipmi_mem_alloc(sizeof(*new_hash) * new_size);
+    if (!new_hash)
+	return;
+    memset(new_hash, 0, sizeof(*new_hash) * new_size);
+    for (i=0; i<sel->events_hash_size; i++) {
+	for (holder = sel->events_hash[i]; holder; holder = next) {
+	    next = holder->hash_next;
+	    idx = holder->recid & (new_size - 1);
+	    holder->hash_next = new_hash[idx];
+	    new_hash[idx] = holder;
+	}
+    }
+    ipmi_mem_free(sel->events_hash);
+    sel->events_hash = new_hash;
+    sel->events_hash_size = new_size;
 }
 
+/* Put a new holder at the end of the event list and in the hash. */
 static void
-free_events(ilist_t *events)
+add_event_holder(ipmi_sel_info_t    *sel,
+		 sel_event_holder_t *holder,
+		 unsigned int       recid)
 {
-    ilist_iter(events, free_event, NULL);
+    unsigned int idx;
+
+    if (((sel->num_sels + sel->del_sels) >= sel->events_hash_size)
+	&& (sel->events_hash_size < SEL_EVENTS_HASH_MAX_SIZE))
+	events_hash_grow(sel);
+
+    ilist_add_tail(sel->events, holder, &holder->link);
+    holder->recid = recid;
+    idx = recid & (sel->events_hash_size - 1);
+    holder->hash_next = sel->events_hash[idx];
+    sel->events_hash[idx] = holder;
 }
 
-static int
-recid_search_cmp(void *item, void *cb_data)
+/* Remove the holder from the hash.  The caller must remove it from
+   the list. */
+static void
+unhash_event_holder(ipmi_sel_info_t *sel, sel_event_holder_t *holder)
+{
+    sel_event_holder_t **prev;
+
+    prev = &sel->events_hash[holder->recid & (sel->events_hash_size - 1)];
+    while (*prev && (*prev != holder))
+	prev = &(*prev)->hash_next;
+    if (*prev)
+	*prev = holder->hash_next;
+    holder->hash_next = NULL;
+}
+
+/* Remove the holder from the list and the hash. */
+static void
+remove_event_holder(ipmi_sel_info_t *sel, sel_event_holder_t *holder)
+{
+    ilist_iter_t iter;
+
+    unhash_event_holder(sel, holder);
+    ilist_init_iter(&iter, sel->events);
+    ilist_position_at(&iter, &holder->link);
+    ilist_delete(&iter);
+}
+
+static void
+free_event(ilist_iter_t *iter, void *item, void *cb_data)
 {
     sel_event_holder_t *holder = item;
-    unsigned int       recid = *((unsigned int *) cb_data);
+    ipmi_sel_info_t    *sel = cb_data;
 
-    return ipmi_event_get_record_id(holder->event) == recid;
+    /* The list link lives in the holder, so take it off the list
+       before the holder can go away. */
+    unhash_event_holder(sel, holder);
+    ilist_delete(iter);
+    sel_event_holder_put(holder);
 }
-static sel_event_holder_t *
-find_event(ilist_t *list, unsigned int recid)
+
+static void
+free_events(ipmi_sel_info_t *sel)
 {
-    return ilist_search(list, recid_search_cmp, &recid);
+    ilist_iter(sel->events, free_event, sel);
 }
 
 static int
@@ -312,6 +454,16 @@ ipmi_sel_alloc(ipmi_mc_t       *mc,
 	goto out;
     }
 
+    sel->events_hash = ipmi_mem_alloc(sizeof(sel_event_holder_t *)
+				      * SEL_EVENTS_HASH_INIT_SIZE);
+    if (!sel->events_hash) {
+	rv = ENOMEM;
+	goto out;
+    }
+    memset(sel->events_hash, 0,
+	   sizeof(sel_event_holder_t *) * SEL_EVENTS_HASH_INIT_SIZE);
+    sel->events_hash_size = SEL_EVENTS_HASH_INIT_SIZE;
+
     sel->mc = ipmi_mc_convert_to_id(mc);
     sel->destroyed = 0;
     sel->in_destroy = 0;
@@ -326,6 +478,10 @@ ipmi_sel_alloc(ipmi_mc_t       *mc,
     sel->fetch_handlers = NULL;
     sel->new_event_handler = NULL;
 
+    sel->spec_depth = ipmi_option_sel_speculate(domain);
+    if (sel->spec_depth >= MAX_SEL_SPECULATE)
+	sel->spec_depth = MAX_SEL_SPECULATE - 1;
+
     sel->opq = opq_alloc(sel->os_hnd);
     if (!sel->opq) {
 	rv = ENOMEM;
@@ -343,6 +499,8 @@ ipmi_sel_alloc(ipmi_mc_t       *mc,
 	if (sel) {
 	    if (sel->events)
 		free_ilist(sel->events);
+	    if (sel->events_hash)
+		ipmi_mem_free(sel->events_hash);
 	    if (sel->opq)
 		opq_destroy(sel->opq);
 	    if (sel->sel_lock)
@@ -365,6 +523,12 @@ ipmi_sel_alloc(ipmi_mc_t       *mc,
 	ipmi_domain_stat_register(domain, "sel_fetch_errors",
 				  i_ipmi_mc_name(mc),
 				  &sel->sel_fetch_errors);
+	ipmi_domain_stat_register(domain, "sel_speculate_hits",
+				  i_ipmi_mc_name(mc),
+				  &sel->sel_speculate_hits);
+	ipmi_domain_stat_register(domain, "sel_speculate_misses",
+				  i_ipmi_mc_name(mc),
+				  &sel->sel_speculate_misses);
 	ipmi_domain_stat_register(domain, "sel_good_clears",
 				  i_ipmi_mc_name(mc),
 				  &sel->sel_good_clears);
@@ -394,15 +558,22 @@ ipmi_sel_alloc(ipmi_mc_t       *mc,
 static void
 internal_destroy_sel(ipmi_sel_info_t *sel)
 {
+    unsigned int i;
+
     sel->in_destroy = 1;
 
     /* We don't have to have a valid ipmi to destroy an SEL, the are
        designed to live after the ipmi has been destroyed. */
 
     if (sel->events) {
-	free_events(sel->events);
+	free_events(sel);
 	free_ilist(sel->events);
     }
+    if (sel->events_hash)
+	ipmi_mem_free(sel->events_hash);
+    /* Only responses from speculative fetches can be left here. */
+    for (i=0; i<sel->spec_count; i++)
+	ipmi_mem_free(sel->spec[i]);
     sel_unlock(sel);
 
     if (sel->opq)
@@ -421,6 +592,10 @@ internal_destroy_sel(ipmi_sel_info_t *sel)
 	ipmi_domain_stat_put(sel->sel_received_events);
     if (sel->sel_fetch_errors)
 	ipmi_domain_stat_put(sel->sel_fetch_errors);
+    if (sel->sel_speculate_hits)
+	ipmi_domain_stat_put(sel->sel_speculate_hits);
+    if (sel->sel_speculate_misses)
+	ipmi_domain_stat_put(sel->sel_speculate_misses);
     if (sel->sel_good_clears)
 	ipmi_domain_stat_put(sel->sel_good_clears);
     if (sel->sel_clear_lost_reservation)
@@ -528,6 +703,7 @@ free_deleted_event(ilist_iter_t *iter, void *item, void *cb_data)
     ipmi_sel_info_t    *sel = cb_data;
 
     if (holder->deleted) {
+	unhash_event_holder(sel, holder);
 	ilist_delete(iter);
 	holder->cancelled = 1;
 	sel->del_sels--;
@@ -611,6 +787,278 @@ send_sel_clear(sel_fetch_handler_t *elem, ipmi_mc_t *mc)
 
 static int start_fetch(void *cb_data, int shutdown);
 
+/* Drop the speculative commands.  The ones still outstanding are left
+   to come back and be thrown away.  Must be called with the sel lock
+   held. */
+static void
+sel_spec_cancel(ipmi_sel_info_t *sel)
+{
+    unsigned int i;
+
+    sel->spec_gen++;
+    for (i=0; i<sel->spec_count; i++) {
+	if (sel->spec[i]->done)
+	    ipmi_mem_free(sel->spec[i]);
+    }
+    sel->spec_count = 0;
+}
+
+/* If speculative commands are outstanding, drop them and finish the
+   fetch the given way when they have all come back.  Returns true if
+   so, the caller should then just unlock.  Must be called with the
+   sel lock held. */
+static int
+sel_spec_defer_finish(ipmi_sel_info_t        *sel,
+		      enum sel_spec_finish_e finish,
+		      int                    err)
+{
+    if (sel->spec_outstanding == 0)
+	return 0;
+    sel_spec_cancel(sel);
+    sel->spec_finish = finish;
+    sel->spec_finish_err = err;
+    return 1;
+}
+
+/* Complete a fetch from the Get SEL Entry handling, waiting for any
+   speculative commands first.  Must be called with the sel lock held,
+   this unlocks it. */
+static void
+sel_fetch_done(ipmi_sel_info_t *sel, int err)
+{
+    if (sel_spec_defer_finish(sel, SEL_SPEC_FINISH_COMPLETE, err))
+	sel_unlock(sel);
+    else
+	fetch_complete(sel, err, 1);
+}
+
+/* Called when a speculative command comes back, to do the deferred
+   finish once they all have.  Must be called with the sel lock held,
+   this unlocks it. */
+static void
+sel_spec_check_finish(ipmi_sel_info_t *sel, ipmi_mc_t *mc)
+{
+    enum sel_spec_finish_e finish = sel->spec_finish;
+    int                    rv;
+
+    if ((sel->spec_outstanding > 0) || (finish == SEL_SPEC_FINISH_NONE)) {
+	sel_unlock(sel);
+	return;
+    }
+
+    sel->spec_finish = SEL_SPEC_FINISH_NONE;
+    switch (finish) {
+    case SEL_SPEC_FINISH_CLEAR:
+	if (mc && !sel->destroyed) {
+	    /* We don't care if this fails, because it will just
+	       happen again later if it does. */
+	    rv = send_sel_clear(sel->spec_elem, mc);
+	    if (!rv) {
+		sel_unlock(sel);
+		break;
+	    }
+	}
+	fetch_complete(sel, 0, 1);
+	break;
+
+    case SEL_SPEC_FINISH_RESTART:
+	sel_unlock(sel);
+	start_fetch(sel->spec_elem, 0);
+	break;
+
+    default:
+	fetch_complete(sel, sel->spec_finish_err, 1);
+	break;
+    }
+}
+
+static void handle_sel_spec_data(ipmi_mc_t  *mc,
+				 ipmi_msg_t *rsp,
+				 void       *rsp_data);
+
+/* Send a Get SEL Entry command for a speculative fetch.  Must be
+   called with the sel lock held. */
+static int
+sel_spec_send(ipmi_sel_info_t *sel, ipmi_mc_t *mc, unsigned int recid)
+{
+    unsigned char cmd_data[MAX_IPMI_DATA_SIZE];
+    ipmi_msg_t    cmd_msg;
+    sel_spec_t    *spec;
+    int           rv;
+
+    if (sel->spec_count >= MAX_SEL_SPECULATE)
+	return EAGAIN;
+
+    spec = ipmi_mem_alloc(sizeof(*spec));
+    if (!spec)
+	return ENOMEM;
+    spec->sel = sel;
+    spec->gen = sel->spec_gen;
+    spec->recid = recid;
+    spec->done = 0;
+
+    cmd_msg.data = cmd_data;
+    cmd_msg.netfn = IPMI_STORAGE_NETFN;
+    cmd_msg.cmd = IPMI_GET_SEL_ENTRY_CMD;
+    cmd_msg.data_len = 6;
+    ipmi_set_uint16(cmd_msg.data, sel->reservation);
+    ipmi_set_uint16(cmd_msg.data+2, recid);
+    cmd_msg.data[4] = 0;
+    cmd_msg.data[5] = 0xff;
+    rv = ipmi_mc_send_command(mc, sel->lun, &cmd_msg,
+			      handle_sel_spec_data, spec);
+    if (rv) {
+	ipmi_mem_free(spec);
+	return rv;
+    }
+
+    sel->spec[sel->spec_count++] = spec;
+    sel->spec_outstanding++;
+    return 0;
+}
+
+/* Guess that the record ids after the ones already sent are in
+   order and send commands for them, up to the window. */
+static void
+sel_spec_fill(ipmi_sel_info_t *sel, ipmi_mc_t *mc)
+{
+    while ((sel->spec_outstanding < sel->spec_window)
+	   && (sel->spec_next_recid < 0xffff)
+	   && (sel->spec_next_recid <= sel->curr_rec_id + sel->spec_depth))
+    {
+	if (sel_spec_send(sel, mc, sel->spec_next_recid))
+	    break;
+	sel->spec_next_recid++;
+    }
+}
+
+static void
+sel_spec_remove(ipmi_sel_info_t *sel, sel_spec_t *spec)
+{
+    unsigned int i;
+
+    for (i=0; i<sel->spec_count; i++) {
+	if (sel->spec[i] == spec) {
+	    sel->spec_count--;
+	    sel->spec[i] = sel->spec[sel->spec_count];
+	    break;
+	}
+    }
+}
+
+/* Get the entry for curr_rec_id in a speculative fetch.  If its
+   response is already here, it is copied into rsp and *got_rsp is
+   set.  Otherwise a command is sent for it if one isn't already
+   outstanding.  If predicted is set, curr_rec_id came from the last
+   entry's next record id and it counts as a hit or a miss.  Must be
+   called with the sel lock held. */
+static int
+sel_spec_request(ipmi_sel_info_t *sel,
+		 ipmi_mc_t       *mc,
+		 int             predicted,
+		 ipmi_msg_t      *rsp,
+		 int             *got_rsp)
+{
+    sel_spec_t   *spec = NULL;
+    unsigned int i;
+    int          rv;
+
+    *got_rsp = 0;
+    for (i=0; i<sel->spec_count; i++) {
+	if (sel->spec[i]->recid == sel->curr_rec_id) {
+	    spec = sel->spec[i];
+	    break;
+	}
+    }
+
+    if (predicted) {
+	if (spec && sel->sel_speculate_hits)
+	    ipmi_domain_stat_add(sel->sel_speculate_hits, 1);
+	else if (!spec && sel->sel_speculate_misses)
+	    ipmi_domain_stat_add(sel->sel_speculate_misses, 1);
+    }
+
+    if (spec && spec->done && (spec->rsp[0] != 0)) {
+	/* The error may just be from sending too many at once, ask
+	   again rather than failing the fetch on a guess. */
+	sel_spec_remove(sel, spec);
+	ipmi_mem_free(spec);
+	spec = NULL;
+    }
+
+    if (!spec) {
+	/* A wrong guess, or the start of a fetch.  Start guessing
+	   again from here. */
+	sel_spec_cancel(sel);
+	rv = sel_spec_send(sel, mc, sel->curr_rec_id);
+	if (rv)
+	    return rv;
+	sel->spec_next_recid = sel->curr_rec_id + 1;
+    } else if (spec->done) {
+	memcpy(rsp->data, spec->rsp, spec->rsp_len);
+	rsp->data_len = spec->rsp_len;
+	sel_spec_remove(sel, spec);
+	ipmi_mem_free(spec);
+	*got_rsp = 1;
+    }
+
+    sel_spec_fill(sel, mc);
+    return 0;
+}
+
+static void handle_sel_data(ipmi_mc_t  *mc,
+			    ipmi_msg_t *rsp,
+			    void       *rsp_data);
+
+static void
+handle_sel_spec_data(ipmi_mc_t  *mc,
+		     ipmi_msg_t *rsp,
+		     void       *rsp_data)
+{
+    sel_spec_t      *spec = rsp_data;
+    ipmi_sel_info_t *sel = spec->sel;
+    unsigned char   data[SEL_ENTRY_RSP_LEN];
+    ipmi_msg_t      msg;
+
+    sel_lock(sel);
+    sel->spec_outstanding--;
+
+    if (spec->gen != sel->spec_gen) {
+	/* A dropped guess. */
+	ipmi_mem_free(spec);
+	sel_spec_check_finish(sel, mc);
+	return;
+    }
+
+    if (mc && (rsp->data_len > 0)) {
+	spec->rsp_len = rsp->data_len;
+	if (spec->rsp_len > SEL_ENTRY_RSP_LEN)
+	    spec->rsp_len = SEL_ENTRY_RSP_LEN;
+	memcpy(spec->rsp, rsp->data, spec->rsp_len);
+    } else {
+	spec->rsp[0] = IPMI_UNKNOWN_ERR_CC;
+	spec->rsp_len = 1;
+    }
+
+    if (spec->recid != sel->curr_rec_id) {
+	/* Not needed yet, keep it until it is. */
+	spec->done = 1;
+	sel_unlock(sel);
+	return;
+    }
+
+    /* This is the entry being fetched, handle it as usual. */
+    sel_spec_remove(sel, spec);
+    memcpy(data, spec->rsp, spec->rsp_len);
+    msg = *rsp;
+    msg.data = data;
+    msg.data_len = spec->rsp_len;
+    ipmi_mem_free(spec);
+    sel_unlock(sel);
+    handle_sel_data(mc, &msg, sel->spec_elem);
+}
+
+
 static void
 handle_sel_data(ipmi_mc_t  *mc,
 		ipmi_msg_t *rsp,
@@ -626,15 +1074,21 @@ handle_sel_data(ipmi_mc_t  *mc,
     unsigned int        record_id;
     ipmi_time_t         timestamp;
     sel_event_holder_t  *holder;
+    int                 predicted;
+    int                 got_rsp = 0;
+    ipmi_msg_t          spec_rsp;
+    unsigned char       spec_rsp_data[SEL_ENTRY_RSP_LEN];
 
 
     sel_lock(sel);
+ process_rsp:
+    event_is_new = 0;
     if (sel->destroyed) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "%ssel.c(handle_sel_data): "
 		 "SEL info was destroyed while an operation was in"
 		 " progress(2)", sel->name);
-	fetch_complete(sel, ECANCELED, 1);
+	sel_fetch_done(sel, ECANCELED);
 	goto out;
     }
 
@@ -643,7 +1097,7 @@ handle_sel_data(ipmi_mc_t  *mc,
 		 "%ssel.c(handle_sel_data): "
 		 "handle_sel_data: MC went away while SEL op was in progress",
 		 sel->name);
-        fetch_complete(sel, ECANCELED, 1);
+        sel_fetch_done(sel, ECANCELED);
 	goto out;
     }
 	
@@ -665,9 +1119,11 @@ handle_sel_data(ipmi_mc_t  *mc,
 		     "%ssel.c(handle_sel_data): "
 		     "Too many lost reservations in SEL fetch",
 		     sel->name);
-	    fetch_complete(sel, EAGAIN, 1);
+	    sel_fetch_done(sel, EAGAIN);
 	    goto out;
 	} else {
+	    if (sel_spec_defer_finish(sel, SEL_SPEC_FINISH_RESTART, 0))
+		goto out_unlock;
 	    sel_unlock(sel);
 	    start_fetch(elem, 0);
 	    goto out;
@@ -678,7 +1134,7 @@ handle_sel_data(ipmi_mc_t  *mc,
 		 "%ssel.c(handle_sel_data): "
 		 "Received a short SEL data message",
 		 sel->name);
-	fetch_complete(sel, EINVAL, 1);
+	sel_fetch_done(sel, EINVAL);
 	goto out;
     }
 
@@ -698,6 +1154,7 @@ handle_sel_data(ipmi_mc_t  *mc,
 	    sel->start_rec_id = 0;
 	    sel->curr_rec_id = 0;
 	    del_event = NULL;
+	    predicted = 0;
 	    goto start_request_sel_data;
 	}
 	if (sel->sel_fetch_errors)
@@ -706,7 +1163,7 @@ handle_sel_data(ipmi_mc_t  *mc,
 		 "%ssel.c(handle_sel_data): "
 		 "IPMI error from SEL fetch: %x",
 		 sel->name, rsp->data[0]);
-	fetch_complete(sel, IPMI_IPMI_ERR_VAL(rsp->data[0]), 1);
+	sel_fetch_done(sel, IPMI_IPMI_ERR_VAL(rsp->data[0]));
 	goto out;
     }
 
@@ -729,14 +1186,14 @@ handle_sel_data(ipmi_mc_t  *mc,
 		 "%ssel.c(handle_sel_data): "
 		 "Could not allocate event for SEL",
 		 sel->name);
-	fetch_complete(sel, ENOMEM, 1);
+	sel_fetch_done(sel, ENOMEM);
 	goto out;
     }
 
     if ((timestamp > 0) && (timestamp < ipmi_mc_get_startup_SEL_time(mc)))
 	ipmi_event_set_is_old(del_event, 1);
 
-    holder = find_event(sel->events, record_id);
+    holder = find_event(sel, record_id);
     if (!holder) {
 	holder = sel_event_holder_alloc();
 	if (!holder) {
@@ -744,18 +1201,10 @@ handle_sel_data(ipmi_mc_t  *mc,
 		     "%ssel.c(handle_sel_data): "
 		     "Could not allocate log information for SEL",
 		     sel->name);
-	    fetch_complete(sel, ENOMEM, 1);
-	    goto out;
-	}
-	if (!ilist_add_tail(sel->events, holder, NULL)) {
-	    ipmi_mem_free(holder);
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "%ssel.c(handle_sel_data): "
-		     "Could not link log onto the log linked list",
-		     sel->name);
-	    fetch_complete(sel, ENOMEM, 1);
+	    sel_fetch_done(sel, ENOMEM);
 	    goto out;
 	}
+	add_event_holder(sel, holder, record_id);
 	holder->event = del_event;
 	holder->deleted = 0;
 	event_is_new = 1;
@@ -807,6 +1256,11 @@ handle_sel_data(ipmi_mc_t  *mc,
 	if ((sel->num_sels == 0)
 	    && ((!ilist_empty(sel->events)) || sel->overflow))
 	{
+	    /* Wait for any outstanding speculative fetches, they
+	       would hold up the clear. */
+	    if (sel_spec_defer_finish(sel, SEL_SPEC_FINISH_CLEAR, 0))
+		goto out_unlock;
+
 	    /* We don't care if this fails, because it will just
 	       happen again later if it does. */
 	    rv = send_sel_clear(elem, mc);
@@ -817,30 +1271,37 @@ handle_sel_data(ipmi_mc_t  *mc,
 	    rv = 0;
 	    goto out_unlock;
 	} else {
-	    fetch_complete(sel, 0, 1);
+	    sel_fetch_done(sel, 0);
 	    goto out;
 	}
     }
     sel->start_rec_id = sel->curr_rec_id;
     memcpy(sel->start_rec_id_data, rsp->data+5, 14);
     sel->curr_rec_id = sel->next_rec_id;
+    predicted = 1;
 
  start_request_sel_data:
     /* Request some more data. */
-    cmd_msg.data = cmd_data;
-    cmd_msg.netfn = IPMI_STORAGE_NETFN;
-    cmd_msg.cmd = IPMI_GET_SEL_ENTRY_CMD;
-    cmd_msg.data_len = 6;
-    ipmi_set_uint16(cmd_msg.data, sel->reservation);
-    ipmi_set_uint16(cmd_msg.data+2, sel->curr_rec_id);
-    cmd_msg.data[4] = 0;
-    cmd_msg.data[5] = 0xff;
-    rv = ipmi_mc_send_command(mc, sel->lun, &cmd_msg, handle_sel_data, elem);
+    if (sel->spec_depth) {
+	spec_rsp.data = spec_rsp_data;
+	rv = sel_spec_request(sel, mc, predicted, &spec_rsp, &got_rsp);
+    } else {
+	cmd_msg.data = cmd_data;
+	cmd_msg.netfn = IPMI_STORAGE_NETFN;
+	cmd_msg.cmd = IPMI_GET_SEL_ENTRY_CMD;
+	cmd_msg.data_len = 6;
+	ipmi_set_uint16(cmd_msg.data, sel->reservation);
+	ipmi_set_uint16(cmd_msg.data+2, sel->curr_rec_id);
+	cmd_msg.data[4] = 0;
+	cmd_msg.data[5] = 0xff;
+	rv = ipmi_mc_send_command(mc, sel->lun, &cmd_msg,
+				  handle_sel_data, elem);
+    }
     if (rv) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "%ssel.c(handle_sel_clear): "
 		 "Could not send SEL fetch command: %x", sel->name, rv);
-	fetch_complete(sel, rv, 1);
+	sel_fetch_done(sel, rv);
 	goto out;
     }
 
@@ -851,6 +1312,12 @@ handle_sel_data(ipmi_mc_t  *mc,
 	handler(sel, mc, del_event, cb_data);
 	sel_lock(sel);
     }
+
+    if (got_rsp) {
+	/* The next entry was fetched ahead of time, handle it now. */
+	rsp = &spec_rsp;
+	goto process_rsp;
+    }
  out_unlock:
     sel_unlock(sel);
  out:
@@ -988,15 +1455,32 @@ handle_sel_info(ipmi_mc_t  *mc,
 
     /* Fetch the first SEL entry. */
     sel->curr_rec_id = sel->start_rec_id;
-    cmd_msg.data = cmd_data;
-    cmd_msg.netfn = IPMI_STORAGE_NETFN;
-    cmd_msg.cmd = IPMI_GET_SEL_ENTRY_CMD;
-    cmd_msg.data_len = 6;
-    ipmi_set_uint16(cmd_msg.data, sel->reservation);
-    ipmi_set_uint16(cmd_msg.data+2, sel->curr_rec_id);
-    cmd_msg.data[4] = 0;
-    cmd_msg.data[5] = 0xff;
-    rv = ipmi_mc_send_command(mc, sel->lun, &cmd_msg, handle_sel_data, elem);
+    if (sel->spec_depth) {
+	unsigned int max;
+	int          got_rsp;
+
+	/* Nothing from an earlier fetch is outstanding here, a fetch
+	   can't finish or restart until its commands come back. */
+	max = i_ipmi_domain_get_max_outstanding_msgs(ipmi_mc_get_domain(mc));
+	sel->spec_window = sel->spec_depth + 1;
+	if (max && (sel->spec_window > max))
+	    sel->spec_window = max;
+	sel->spec_elem = elem;
+	sel->spec_finish = SEL_SPEC_FINISH_NONE;
+	sel_spec_cancel(sel); /* Drop anything left from the last fetch. */
+	rv = sel_spec_request(sel, mc, 0, NULL, &got_rsp);
+    } else {
+	cmd_msg.data = cmd_data;
+	cmd_msg.netfn = IPMI_STORAGE_NETFN;
+	cmd_msg.cmd = IPMI_GET_SEL_ENTRY_CMD;
+	cmd_msg.data_len = 6;
+	ipmi_set_uint16(cmd_msg.data, sel->reservation);
+	ipmi_set_uint16(cmd_msg.data+2, sel->curr_rec_id);
+	cmd_msg.data[4] = 0;
+	cmd_msg.data[5] = 0xff;
+	rv = ipmi_mc_send_command(mc, sel->lun, &cmd_msg,
+				  handle_sel_data, elem);
+    }
     if (rv) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "%ssel.c(handle_sel_info): "
@@ -1337,6 +1821,7 @@ free_all_event(ilist_iter_t *iter, void *item, void *cb_data)
 	sel->del_sels--;
 	holder->cancelled = 1;
     }
+    unhash_event_holder(sel, holder);
     ilist_delete(iter);
     sel_event_holder_put(holder);
 }
@@ -1480,14 +1965,10 @@ handle_sel_delete(ipmi_mc_t  *mc,
     } else {	
 	/* We deleted the entry, so remove it from our database. */
 	sel_event_holder_t *real_holder;
-	ilist_iter_t       iter;
 
-	ilist_init_iter(&iter, sel->events);
-	ilist_unpositioned(&iter);
-	real_holder = ilist_search_iter(&iter, recid_search_cmp,
-					&(data->record_id));
+	real_holder = find_event(sel, data->record_id);
 	if (real_holder) {
-	    ilist_delete(&iter);
+	    remove_event_holder(sel, real_holder);
 	    sel_event_holder_put(real_holder);
 	    sel->del_sels--;
 	}
@@ -1836,7 +2317,6 @@ sel_del_event_cb(ipmi_mc_t *mc, void *cb_data)
     ipmi_event_t          *event = info->event;
     int                   cmp_event = info->cmp_event;
     sel_event_holder_t    *real_holder = NULL;
-    ilist_iter_t          iter;
     int                   start_fetch = 0;
 
     sel_lock(sel);
@@ -1846,10 +2326,7 @@ sel_del_event_cb(ipmi_mc_t *mc, void *cb_data)
     }
 
     if (event) {
-	ilist_init_iter(&iter, sel->events);
-	ilist_unpositioned(&iter);
-	real_holder = ilist_search_iter(&iter, recid_search_cmp,
-				    &info->record_id);
+	real_holder = find_event(sel, info->record_id);
 	if (!real_holder) {
 	    info->rv = EINVAL;
 	    goto out_unlock;
@@ -2082,21 +2559,23 @@ ipmi_sel_get_last_event(ipmi_sel_info_t *sel)
 ipmi_event_t *
 ipmi_sel_get_next_event(ipmi_sel_info_t *sel, const ipmi_event_t *event)
 {
-    ilist_iter_t iter;
-    ipmi_event_t *rv = NULL;
-    unsigned int record_id;
+    ilist_iter_t       iter;
+    ipmi_event_t       *rv = NULL;
+    unsigned int       record_id;
+    sel_event_holder_t *holder;
 
     sel_lock(sel);
     if (sel->destroyed) {
 	sel_unlock(sel);
 	return NULL;
     }
-    ilist_init_iter(&iter, sel->events);
-    ilist_unpositioned(&iter);
     record_id = ipmi_event_get_record_id(event);
-    if (ilist_search_iter(&iter, recid_search_cmp, &record_id)) {
+    holder = find_event(sel, record_id);
+    if (holder) {
+	ilist_init_iter(&iter, sel->events);
+	ilist_position_at(&iter, &holder->link);
 	if (ilist_next(&iter)) {
-	    sel_event_holder_t *holder = ilist_get(&iter);
+	    holder = ilist_get(&iter);
 
 	    while (holder->deleted) {
 		if (! ilist_next(&iter))
@@ -2114,21 +2593,23 @@ ipmi_sel_get_next_event(ipmi_sel_info_t *sel, const ipmi_event_t *event)
 ipmi_event_t *
 ipmi_sel_get_prev_event(ipmi_sel_info_t *sel, const ipmi_event_t *event)
 {
-    ilist_iter_t iter;
-    ipmi_event_t *rv = NULL;
-    unsigned int record_id;
+    ilist_iter_t       iter;
+    ipmi_event_t       *rv = NULL;
+    unsigned int       record_id;
+    sel_event_holder_t *holder;
 
     sel_lock(sel);
     if (sel->destroyed) {
 	sel_unlock(sel);
 	return NULL;
     }
-    ilist_init_iter(&iter, sel->events);
-    ilist_unpositioned(&iter);
     record_id = ipmi_event_get_record_id(event);
-    if (ilist_search_iter(&iter, recid_search_cmp, &record_id)) {
+    holder = find_event(sel, record_id);
+    if (holder) {
+	ilist_init_iter(&iter, sel->events);
+	ilist_position_at(&iter, &holder->link);
 	if (ilist_prev(&iter)) {
-	    sel_event_holder_t *holder = ilist_get(&iter);
+	    holder = ilist_get(&iter);
 
 	    while (holder->deleted) {
 		if (! ilist_prev(&iter))
@@ -2156,7 +2637,7 @@ ipmi_sel_get_event_by_recid(ipmi_sel_info_t *sel,
 	return NULL;
     }
 
-    holder = find_event(sel->events, record_id);
+    holder = find_event(sel, record_id);
     if (!holder)
 	goto out_unlock;
 
@@ -2398,17 +2879,14 @@ ipmi_sel_event_add(ipmi_sel_info_t *sel,
     }
 
     record_id = ipmi_event_get_record_id(new_event);
-    holder = find_event(sel->events, record_id);
+    holder = find_event(sel, record_id);
     if (!holder) {
 	holder = sel_event_holder_alloc();
 	if (!holder) {
 	    rv = ENOMEM;
 	    goto out_unlock;
 	}
-	if (!ilist_add_tail(sel->events, holder, NULL)) {
-	    rv = ENOMEM;
-	    goto out_unlock;
-	}
+	add_event_holder(sel, holder, record_id);
 	holder->event = ipmi_event_dup(new_event);
 	sel->num_sels++;
     } else if (event_cmp(holder->event, new_event) == 0) {
@@ -66,6 +66,51 @@ struct ipmi_sensor_info_s
     unsigned int             sensor_count;
 };
 
+/* The conversion factors for one raw value. */
+typedef struct sensor_conv_ent_s
+{
+    int m : 10;
+    unsigned int tolerance : 6;
+    int b : 10;
+    int r_exp : 4;
+    unsigned int accuracy_exp : 2;
+    int accuracy : 10;
+    int b_exp : 4;
+} sensor_conv_ent_t;
+
+/*
+ * Almost all sensors are linear with the same factors for every raw
+ * value and lots of sensors have the same factors, so a table is
+ * shared by all the sensors (in all domains) that have the same
+ * values.  A table with one entry uses that entry for all raw values.
+ *
+ * Interned tables are in conv_hash and are never changed, changing
+ * the values of a sensor gets it a private 256-entry copy.  Private
+ * tables are interned when the sensor is added.
+ *
+ * The linearization and data format are part of the key, so an
+ * interned table also holds the cooked value for every raw value.
+ * It is computed when the table is first interned and is only used
+ * if the sensor's linearization and format still match.
+ */
+typedef struct sensor_conv_s sensor_conv_t;
+struct sensor_conv_s
+{
+    unsigned int      refcount;
+    unsigned int      interned : 1;
+    unsigned int      hash;
+    sensor_conv_t     *next;
+    unsigned char     linearization;
+    unsigned char     analog_data_format;
+    double            *cooked; /* NULL if the values can't be converted */
+    unsigned int      num_ent; /* 1 or 256 */
+    sensor_conv_ent_t ent[1];
+};
+
+#define SENSOR_CONV_HASH_SIZE 256
+static sensor_conv_t *conv_hash[SENSOR_CONV_HASH_SIZE];
+static ipmi_lock_t *conv_lock;
+
 #define SENSOR_ID_LEN 32 /* 16 bytes are allowed for a sensor. */
 struct ipmi_sensor_s
 {
@@ -157,15 +202,9 @@ struct ipmi_sensor_s
 
     unsigned char linearization;
 
-    struct {
-	int m : 10;
-	unsigned int tolerance : 6;
-	int b : 10;
-	int r_exp : 4;
-	unsigned int accuracy_exp : 2;
-	int accuracy : 10;
-	int b_exp : 4;
-    } conv[256];
+    /* Conversion factors, shared with other sensors that have the
+       same ones.  NULL means they are all zero. */
+    sensor_conv_t *conv;
 
     unsigned int  normal_min_specified : 1;
     unsigned int  normal_max_specified : 1;
@@ -226,6 +265,264 @@ struct ipmi_sensor_s
 
 static void sensor_final_destroy(ipmi_sensor_t *sensor);
 
+/***********************************************************************
+ *
+ * Conversion factor tables.
+ *
+ **********************************************************************/
+
+static const sensor_conv_ent_t conv_zero_ent;
+
+static int sensor_conv_calc(sensor_conv_t *conv,
+			    int           linearization,
+			    int           analog_data_format,
+			    int           val,
+			    double        *result);
+
+static inline const sensor_conv_ent_t *
+sensor_conv(ipmi_sensor_t *sensor, int val)
+{
+    sensor_conv_t *conv = sensor->conv;
+
+    if (!conv)
+	return &conv_zero_ent;
+    if (conv->num_ent == 1)
+	return &conv->ent[0];
+    return &conv->ent[val & 0xff];
+}
+
+static sensor_conv_t *
+sensor_conv_alloc(unsigned int num_ent)
+{
+    sensor_conv_t *conv;
+    unsigned int  size;
+
+    size = sizeof(*conv) + ((num_ent - 1) * sizeof(sensor_conv_ent_t));
+    conv = ipmi_mem_alloc(size);
+    if (!conv)
+	return NULL;
+    /* Zero it all, the tables are compared and hashed as bytes. */
+    memset(conv, 0, size);
+    conv->refcount = 1;
+    conv->num_ent = num_ent;
+    return conv;
+}
+
+static void
+sensor_conv_get(sensor_conv_t *conv)
+{
+    if (!conv)
+	return;
+    ipmi_lock(conv_lock);
+    conv->refcount++;
+    ipmi_unlock(conv_lock);
+}
+
+static void
+sensor_conv_free(sensor_conv_t *conv)
+{
+    if (conv->cooked)
+	ipmi_mem_free(conv->cooked);
+    ipmi_mem_free(conv);
+}
+
+static void
+sensor_conv_put(sensor_conv_t *conv)
+{
+    sensor_conv_t **c;
+
+    if (!conv)
+	return;
+
+    if (!conv->interned) {
+	/* Private tables are only used by one sensor. */
+	sensor_conv_free(conv);
+	return;
+    }
+
+    ipmi_lock(conv_lock);
+    conv->refcount--;
+    if (conv->refcount > 0) {
+	ipmi_unlock(conv_lock);
+	return;
+    }
+    c = &conv_hash[conv->hash % SENSOR_CONV_HASH_SIZE];
+    while (*c != conv)
+	c = &(*c)->next;
+    *c = conv->next;
+    ipmi_unlock(conv_lock);
+    sensor_conv_free(conv);
+}
+
+static unsigned int
+sensor_conv_hash(sensor_conv_t *conv)
+{
+    unsigned char *d = (unsigned char *) conv->ent;
+    unsigned int  len = conv->num_ent * sizeof(sensor_conv_ent_t);
+    unsigned int  hash = 2166136261U;
+    unsigned int  i;
+
+    for (i=0; i<len; i++)
+	hash = (hash ^ d[i]) * 16777619U;
+    hash = (hash ^ conv->linearization) * 16777619U;
+    hash = (hash ^ conv->analog_data_format) * 16777619U;
+    return hash;
+}
+
+/* Fill in the cooked values.  If any raw value can't be converted
+   the table is not used and every conversion is done the long way
+   (and gets the error). */
+static void
+sensor_conv_cook(sensor_conv_t *conv)
+{
+    double       *cooked;
+    unsigned int i;
+
+    cooked = ipmi_mem_alloc(256 * sizeof(*cooked));
+    if (!cooked)
+	return;
+    for (i=0; i<256; i++) {
+	if (sensor_conv_calc(conv, conv->linearization,
+			     conv->analog_data_format, i, &cooked[i]))
+	{
+	    ipmi_mem_free(cooked);
+	    return;
+	}
+    }
+    conv->cooked = cooked;
+}
+
+/* Find the interned table with the same values as conv.  Must be
+   called with conv_lock held. */
+static sensor_conv_t *
+sensor_conv_find(sensor_conv_t *conv)
+{
+    sensor_conv_t *c;
+
+    for (c = conv_hash[conv->hash % SENSOR_CONV_HASH_SIZE]; c; c = c->next) {
+	if ((c->hash == conv->hash) && (c->num_ent == conv->num_ent)
+	    && (c->linearization == conv->linearization)
+	    && (c->analog_data_format == conv->analog_data_format)
+	    && (memcmp(c->ent, conv->ent,
+		       conv->num_ent * sizeof(conv->ent[0])) == 0))
+	    break;
+    }
+    return c;
+}
+
+/* Replace the sensor's private table (if it has one) with the shared
+   one for the same values, compacting it if all the values are the
+   same.  The private table is freed, so this must be done before the
+   sensor is visible to anyone else.  If we run out of memory the
+   sensor just keeps its private table. */
+static void
+sensor_conv_intern(ipmi_sensor_t *sensor)
+{
+    sensor_conv_t *conv = sensor->conv;
+    sensor_conv_t *c;
+    unsigned int  i;
+
+    if (!conv || conv->interned)
+	return;
+
+    conv->linearization = sensor->linearization;
+    conv->analog_data_format = sensor->analog_data_format;
+
+    if (conv->num_ent > 1) {
+	for (i=1; i<conv->num_ent; i++) {
+	    if (memcmp(&conv->ent[i], &conv->ent[0], sizeof(conv->ent[0])))
+		break;
+	}
+	if (i == conv->num_ent) {
+	    c = sensor_conv_alloc(1);
+	    if (c) {
+		c->ent[0] = conv->ent[0];
+		c->linearization = conv->linearization;
+		c->analog_data_format = conv->analog_data_format;
+		ipmi_mem_free(conv);
+		conv = c;
+		sensor->conv = c;
+	    }
+	}
+    }
+
+    conv->hash = sensor_conv_hash(conv);
+
+    /* Most tables are already there, so look first.  Cooking takes
+       256 conversions, so it is done without the lock and the search
+       is done again before the insert. */
+    ipmi_lock(conv_lock);
+    c = sensor_conv_find(conv);
+    if (c)
+	goto found;
+    ipmi_unlock(conv_lock);
+
+    /* Done before the table is visible to anyone else, interned
+       tables are never changed so readers don't need the lock. */
+    sensor_conv_cook(conv);
+
+    /* The second search and the insert are done under one hold of the
+       lock, so two sensors with the same new values can't both add a
+       table. */
+    ipmi_lock(conv_lock);
+    c = sensor_conv_find(conv);
+    if (c)
+	goto found;
+    conv->interned = 1;
+    conv->next = conv_hash[conv->hash % SENSOR_CONV_HASH_SIZE];
+    conv_hash[conv->hash % SENSOR_CONV_HASH_SIZE] = conv;
+    ipmi_unlock(conv_lock);
+    return;
+
+ found:
+    c->refcount++;
+    sensor->conv = c;
+    ipmi_unlock(conv_lock);
+    sensor_conv_free(conv);
+}
+
+/* Get an entry of the sensor's table for changing, giving the sensor
+   a private table if it doesn't already have one. */
+static sensor_conv_ent_t *
+sensor_conv_for_write(ipmi_sensor_t *sensor, int idx)
+{
+    sensor_conv_t *conv = sensor->conv;
+    sensor_conv_t *nconv;
+    unsigned int  i;
+
+    idx &= 0xff;
+    if (conv && !conv->interned)
+	return &conv->ent[idx];
+
+    nconv = sensor_conv_alloc(256);
+    if (!nconv)
+	return NULL;
+    if (conv) {
+	for (i=0; i<256; i++)
+	    nconv->ent[i] = conv->ent[conv->num_ent == 1 ? 0 : i];
+	sensor_conv_put(conv);
+    }
+    sensor->conv = nconv;
+    return &nconv->ent[idx];
+}
+
+int
+i_ipmi_sensor_init(void)
+{
+    if (conv_lock)
+	return 0;
+    return ipmi_create_global_lock(&conv_lock);
+}
+
+void
+i_ipmi_sensor_shutdown(void)
+{
+    if (conv_lock) {
+	ipmi_destroy_lock(conv_lock);
+	conv_lock = NULL;
+    }
+}
+
 /***********************************************************************
  *
  * Sensor ID handling.
@@ -831,6 +1128,15 @@ ipmi_sensor_alloc_nonstandard(ipmi_sensor_t **new_sensor)
     return 0;
 }
 
+void
+ipmi_sensor_free_nonstandard(ipmi_sensor_t *sensor)
+{
+    if (sensor->oem_info_cleanup_handler)
+	sensor->oem_info_cleanup_handler(sensor, sensor->oem_info);
+    sensor_conv_put(sensor->conv);
+    ipmi_mem_free(sensor);
+}
+
 int
 ipmi_sensor_add_nonstandard(ipmi_mc_t              *mc,
 			    ipmi_mc_t              *source_mc,
@@ -857,6 +1163,9 @@ ipmi_sensor_add_nonstandard(ipmi_mc_t              *mc,
     if ((num >= 256) && (num != UINT_MAX))
 	return EINVAL;
 
+    /* Share the conversion factors before anyone can see the sensor. */
+    sensor_conv_intern(sensor);
+
     i_ipmi_domain_entity_lock(domain);
     ipmi_lock(sensors->idx_lock);
 
@@ -1046,6 +1355,7 @@ sensor_final_destroy(ipmi_sensor_t *sensor)
 	sensor->oem_info_cleanup_handler(sensor, sensor->oem_info);
 
     i_ipmi_entity_put(sensor->entity);
+    sensor_conv_put(sensor->conv);
     ipmi_mem_free(sensor);
 }
 
@@ -1345,16 +1655,22 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 	    s[p]->linearization = sdr.data[18] & 0x7f;
 
 	    if (s[p]->linearization <= 11) {
-		for (j=0; j<256; j++) {
-		    s[p]->conv[j].m = sdr.data[19] | ((sdr.data[20] & 0xc0) << 2);
-		    s[p]->conv[j].tolerance = sdr.data[20] & 0x3f;
-		    s[p]->conv[j].b = sdr.data[21] | ((sdr.data[22] & 0xc0) << 2);
-		    s[p]->conv[j].accuracy = ((sdr.data[22] & 0x3f)
-					     | ((sdr.data[23] & 0xf0) << 2));
-		    s[p]->conv[j].accuracy_exp = (sdr.data[23] >> 2) & 0x3;
-		    s[p]->conv[j].r_exp = (sdr.data[24] >> 4) & 0xf;
-		    s[p]->conv[j].b_exp = sdr.data[24] & 0xf;
-		}
+		sensor_conv_ent_t *e;
+
+		/* The same values are used for every raw value. */
+		s[p]->conv = sensor_conv_alloc(1);
+		if (!s[p]->conv)
+		    goto out_err_enomem;
+		e = &s[p]->conv->ent[0];
+		e->m = sdr.data[19] | ((sdr.data[20] & 0xc0) << 2);
+		e->tolerance = sdr.data[20] & 0x3f;
+		e->b = sdr.data[21] | ((sdr.data[22] & 0xc0) << 2);
+		e->accuracy = ((sdr.data[22] & 0x3f)
+			       | ((sdr.data[23] & 0xf0) << 2));
+		e->accuracy_exp = (sdr.data[23] >> 2) & 0x3;
+		e->r_exp = (sdr.data[24] >> 4) & 0xf;
+		e->b_exp = sdr.data[24] & 0xf;
+		sensor_conv_intern(s[p]);
 	    }
 
 	    s[p]->sensor_direction = sdr.data[23] & 0x3;
@@ -1450,6 +1766,7 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 		    if (!s[p+j])
 			goto out_err_enomem;
 		    memcpy(s[p+j], s[p], sizeof(ipmi_sensor_t));
+		    sensor_conv_get(s[p+j]->conv);
 		    
 		    /* In case of error */
 		    s[p+j]->handler_list = NULL;
@@ -1547,6 +1864,7 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 		    locked_list_destroy(s[i]->handler_list);
 		if (s[i]->handler_list_cl)
 		    locked_list_destroy(s[i]->handler_list_cl);
+		sensor_conv_put(s[i]->conv);
 		ipmi_mem_free(s[i]);
 	    }
 	ipmi_mem_free(s);
@@ -1580,6 +1898,9 @@ handle_new_sensor(ipmi_domain_t *domain,
     {
         /* Nothing to do, OEM code handled the sensor. */
     } else {
+	/* In case the OEM code changed the conversion factors.  This
+	   has to be done before the sensor is added to the entity. */
+	sensor_conv_intern(sensor);
 	ipmi_entity_add_sensor(sensor->entity, sensor, link);
     }
 
@@ -1619,13 +1940,16 @@ static int cmp_sensor(ipmi_sensor_t *s1,
     if (s1->modifier_unit != s2->modifier_unit) return 0;
     if (s1->linearization != s2->linearization) return 0;
     if (s1->linearization <= 11) {
-	if (s1->conv[0].m != s2->conv[0].m) return 0;
-	if (s1->conv[0].tolerance != s2->conv[0].tolerance) return 0;
-	if (s1->conv[0].b != s2->conv[0].b) return 0;
-	if (s1->conv[0].accuracy != s2->conv[0].accuracy) return 0;
-	if (s1->conv[0].accuracy_exp != s2->conv[0].accuracy_exp) return 0;
-	if (s1->conv[0].r_exp != s2->conv[0].r_exp) return 0;
-	if (s1->conv[0].b_exp != s2->conv[0].b_exp) return 0;
+	const sensor_conv_ent_t *c1 = sensor_conv(s1, 0);
+	const sensor_conv_ent_t *c2 = sensor_conv(s2, 0);
+
+	if (c1->m != c2->m) return 0;
+	if (c1->tolerance != c2->tolerance) return 0;
+	if (c1->b != c2->b) return 0;
+	if (c1->accuracy != c2->accuracy) return 0;
+	if (c1->accuracy_exp != c2->accuracy_exp) return 0;
+	if (c1->r_exp != c2->r_exp) return 0;
+	if (c1->b_exp != c2->b_exp) return 0;
     }
     if (s1->normal_min_specified != s2->normal_min_specified) return 0;
     if (s1->normal_max_specified != s2->normal_max_specified) return 0;
@@ -1948,6 +2272,7 @@ ipmi_sensor_handle_sdrs(ipmi_domain_t   *domain,
 	    opq_destroy(nsensor->waitq);
 	    locked_list_destroy(nsensor->handler_list);
 	    locked_list_destroy(nsensor->handler_list_cl);
+	    sensor_conv_put(nsensor->conv);
 	    ipmi_mem_free(nsensor);
 	    ent_item->sensor = NULL;
 	    sdr_sensors[i] = osensor;
@@ -2744,7 +3069,7 @@ ipmi_sensor_get_raw_m(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].m;
+    return sensor_conv(sensor, val)->m;
 }
 
 int
@@ -2752,7 +3077,7 @@ ipmi_sensor_get_raw_tolerance(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].tolerance;
+    return sensor_conv(sensor, val)->tolerance;
 }
 
 int
@@ -2760,7 +3085,7 @@ ipmi_sensor_get_raw_b(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].b;
+    return sensor_conv(sensor, val)->b;
 }
 
 int
@@ -2768,7 +3093,7 @@ ipmi_sensor_get_raw_accuracy(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].accuracy;
+    return sensor_conv(sensor, val)->accuracy;
 }
 
 int
@@ -2776,7 +3101,7 @@ ipmi_sensor_get_raw_accuracy_exp(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].accuracy_exp;
+    return sensor_conv(sensor, val)->accuracy_exp;
 }
 
 int
@@ -2784,7 +3109,7 @@ ipmi_sensor_get_raw_r_exp(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].r_exp;
+    return sensor_conv(sensor, val)->r_exp;
 }
 
 int
@@ -2792,7 +3117,7 @@ ipmi_sensor_get_raw_b_exp(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].b_exp;
+    return sensor_conv(sensor, val)->b_exp;
 }
 
 int
@@ -3113,46 +3438,102 @@ ipmi_sensor_set_linearization(ipmi_sensor_t *sensor, int linearization)
     sensor->linearization = linearization;
 }
 
-void
+int
 ipmi_sensor_set_raw_m(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].m = val;
+    sensor_conv_ent_t *e;
+
+    if (sensor_conv(sensor, idx)->m == val)
+	return 0;
+    e = sensor_conv_for_write(sensor, idx);
+    if (!e)
+	return ENOMEM;
+    e->m = val;
+    return 0;
 }
 
-void
+int
 ipmi_sensor_set_raw_tolerance(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].tolerance = val;
+    sensor_conv_ent_t *e;
+
+    if (sensor_conv(sensor, idx)->tolerance == val)
+	return 0;
+    e = sensor_conv_for_write(sensor, idx);
+    if (!e)
+	return ENOMEM;
+    e->tolerance = val;
+    return 0;
 }
 
-void
+int
 ipmi_sensor_set_raw_b(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].b = val;
+    sensor_conv_ent_t *e;
+
+    if (sensor_conv(sensor, idx)->b == val)
+	return 0;
+    e = sensor_conv_for_write(sensor, idx);
+    if (!e)
+	return ENOMEM;
+    e->b = val;
+    return 0;
 }
 
-void
+int
 ipmi_sensor_set_raw_accuracy(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].accuracy = val;
+    sensor_conv_ent_t *e;
+
+    if (sensor_conv(sensor, idx)->accuracy == val)
+	return 0;
+    e = sensor_conv_for_write(sensor, idx);
+    if (!e)
+	return ENOMEM;
+    e->accuracy = val;
+    return 0;
 }
 
-void
+int
 ipmi_sensor_set_raw_accuracy_exp(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].accuracy_exp = val;
+    sensor_conv_ent_t *e;
+
+    if (sensor_conv(sensor, idx)->accuracy_exp == val)
+	return 0;
+    e = sensor_conv_for_write(sensor, idx);
+    if (!e)
+	return ENOMEM;
+    e->accuracy_exp = val;
+    return 0;
 }
 
-void
+int
 ipmi_sensor_set_raw_r_exp(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].r_exp = val;
+    sensor_conv_ent_t *e;
+
+    if (sensor_conv(sensor, idx)->r_exp == val)
+	return 0;
+    e = sensor_conv_for_write(sensor, idx);
+    if (!e)
+	return ENOMEM;
+    e->r_exp = val;
+    return 0;
 }
 
-void
+int
 ipmi_sensor_set_raw_b_exp(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].b_exp = val;
+    sensor_conv_ent_t *e;
+
+    if (sensor_conv(sensor, idx)->b_exp == val)
+	return 0;
+    e = sensor_conv_for_write(sensor, idx);
+    if (!e)
+	return ENOMEM;
+    e->b_exp = val;
+    return 0;
 }
 
 void
@@ -4967,6 +5348,487 @@ stand_ipmi_sensor_get_states(ipmi_sensor_t         *sensor,
     return rv;
 }
 
+/***********************************************************************
+ *
+ * Sweeping the readings of a set of sensors.
+ *
+ **********************************************************************/
+
+/* How many readings to have outstanding if the connection doesn't
+   tell us.  The connection queues anything past its own limit, this
+   just keeps us from dumping the whole sweep into that queue. */
+#define SENSOR_SWEEP_DEFAULT_WINDOW 4
+
+typedef struct sensor_sweep_s sensor_sweep_t;
+
+typedef struct sensor_sweep_ent_s
+{
+    sensor_sweep_t *sweep;
+    unsigned int   idx;
+
+    int            threshold;
+    int            analog;
+
+    /* If direct is set, the Get Sensor Reading command goes straight
+       to addr.  Otherwise the sensor has its own code for reading
+       (OEM sensors and such) and we go through that. */
+    int            direct;
+    ipmi_addr_t    addr;
+    unsigned int   addr_len;
+    unsigned int   num;
+
+    int            send_err;
+} sensor_sweep_ent_t;
+
+struct sensor_sweep_s
+{
+    ipmi_lock_t                *lock;
+    ipmi_domain_id_t           domain_id;
+
+    unsigned int               count;
+    unsigned int               next;
+    unsigned int               window;
+    unsigned int               outstanding;
+    /* Number of threads that have dropped the lock to send something.
+       Nothing may free the sweep while this is non-zero. */
+    unsigned int               sending;
+
+    ipmi_sensor_sweep_result_t *results;
+    ipmi_states_t              *states;
+    sensor_sweep_ent_t         *ents;
+
+    ipmi_sensor_sweep_cb       done;
+    void                       *cb_data;
+};
+
+static void
+sensor_sweep_free(sensor_sweep_t *sweep)
+{
+    if (sweep->lock)
+	ipmi_destroy_lock(sweep->lock);
+    if (sweep->results)
+	ipmi_mem_free(sweep->results);
+    if (sweep->states)
+	ipmi_mem_free(sweep->states);
+    if (sweep->ents)
+	ipmi_mem_free(sweep->ents);
+    ipmi_mem_free(sweep);
+}
+
+static int sensor_sweep_send(ipmi_domain_t      *domain,
+			     sensor_sweep_ent_t *ent);
+
+/* Called with the sweep lock held, returns with it released.  Keeps
+   the window full and reports the results when everything is
+   done. */
+static void
+sensor_sweep_next(ipmi_domain_t *domain, sensor_sweep_t *sweep)
+{
+    unsigned int i;
+    int          rv;
+
+    while ((sweep->next < sweep->count)
+	   && (sweep->outstanding < sweep->window))
+    {
+	i = sweep->next++;
+	if (sweep->results[i].err)
+	    continue;
+	if (!domain) {
+	    /* The domain went away, just fail the rest. */
+	    sweep->results[i].err = ECANCELED;
+	    continue;
+	}
+
+	sweep->outstanding++;
+	sweep->sending++;
+	ipmi_unlock(sweep->lock);
+	rv = sensor_sweep_send(domain, &sweep->ents[i]);
+	ipmi_lock(sweep->lock);
+	sweep->sending--;
+	if (rv) {
+	    sweep->results[i].err = rv;
+	    sweep->outstanding--;
+	}
+    }
+
+    if ((sweep->next < sweep->count) || sweep->outstanding || sweep->sending) {
+	ipmi_unlock(sweep->lock);
+	return;
+    }
+    ipmi_unlock(sweep->lock);
+
+    sweep->done(domain, domain ? 0 : ECANCELED, sweep->results, sweep->count,
+		sweep->cb_data);
+    sensor_sweep_free(sweep);
+}
+
+static void
+sensor_sweep_ent_done(ipmi_domain_t *domain, sensor_sweep_t *sweep)
+{
+    ipmi_lock(sweep->lock);
+    sweep->outstanding--;
+    sensor_sweep_next(domain, sweep);
+}
+
+static void
+sensor_sweep_ent_done_cb(ipmi_domain_t *domain, void *cb_data)
+{
+    sensor_sweep_ent_done(domain, cb_data);
+}
+
+static void
+sensor_sweep_ent_done_id(sensor_sweep_t *sweep)
+{
+    int rv;
+
+    rv = ipmi_domain_pointer_cb(sweep->domain_id, sensor_sweep_ent_done_cb,
+				sweep);
+    if (rv)
+	sensor_sweep_ent_done(NULL, sweep);
+}
+
+static void
+sensor_sweep_convert(ipmi_sensor_t *sensor, void *cb_data)
+{
+    sensor_sweep_ent_t         *ent = cb_data;
+    ipmi_sensor_sweep_result_t *res = &ent->sweep->results[ent->idx];
+
+    if (ipmi_sensor_convert_from_raw(sensor, res->raw_value, &res->val) == 0)
+	res->value_present = IPMI_BOTH_VALUES_PRESENT;
+}
+
+static int
+sensor_sweep_rsp_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
+{
+    sensor_sweep_ent_t         *ent = rspi->data1;
+    sensor_sweep_t             *sweep = ent->sweep;
+    ipmi_sensor_sweep_result_t *res = &sweep->results[ent->idx];
+    ipmi_states_t              *states = res->states;
+    ipmi_msg_t                 *msg = &rspi->msg;
+
+    if (msg->data[0]) {
+	res->err = IPMI_IPMI_ERR_VAL(msg->data[0]);
+	goto out;
+    }
+    if (msg->data_len < 3) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "sensor.c(sensor_sweep_rsp_handler):"
+		 " Response was too short, got %d, expected 3",
+		 msg->data_len);
+	res->err = EINVAL;
+	goto out;
+    }
+
+    states->__event_messages_enabled = (msg->data[2] >> 7) & 1;
+    states->__sensor_scanning_enabled = (msg->data[2] >> 6) & 1;
+    states->__initial_update_in_progress = (msg->data[2] >> 5) & 1;
+
+    if (ent->threshold) {
+	res->raw_value = msg->data[1];
+	if (msg->data_len >= 4)
+	    states->__states = msg->data[3];
+	if (ent->analog) {
+	    res->value_present = IPMI_RAW_VALUE_PRESENT;
+	    if (domain)
+		ipmi_sensor_pointer_cb(res->sensor_id, sensor_sweep_convert,
+				       ent);
+	}
+    } else {
+	if (msg->data_len >= 4)
+	    states->__states |= msg->data[3];
+	if (msg->data_len >= 5)
+	    states->__states |= msg->data[4] << 8;
+    }
+
+ out:
+    sensor_sweep_ent_done(domain, sweep);
+    return IPMI_MSG_ITEM_NOT_USED;
+}
+
+static void
+sensor_sweep_reading_cb(ipmi_sensor_t             *sensor,
+			int                       err,
+			enum ipmi_value_present_e value_present,
+			unsigned int              raw_value,
+			double                    val,
+			ipmi_states_t             *states,
+			void                      *cb_data)
+{
+    sensor_sweep_ent_t         *ent = cb_data;
+    ipmi_sensor_sweep_result_t *res = &ent->sweep->results[ent->idx];
+
+    res->err = err;
+    if (!err) {
+	res->value_present = value_present;
+	res->raw_value = raw_value;
+	res->val = val;
+	ipmi_copy_states(res->states, states);
+    }
+    sensor_sweep_ent_done_id(ent->sweep);
+}
+
+static void
+sensor_sweep_states_cb(ipmi_sensor_t *sensor,
+		       int           err,
+		       ipmi_states_t *states,
+		       void          *cb_data)
+{
+    sensor_sweep_ent_t         *ent = cb_data;
+    ipmi_sensor_sweep_result_t *res = &ent->sweep->results[ent->idx];
+
+    res->err = err;
+    if (!err)
+	ipmi_copy_states(res->states, states);
+    sensor_sweep_ent_done_id(ent->sweep);
+}
+
+static void
+sensor_sweep_read(ipmi_sensor_t *sensor, void *cb_data)
+{
+    sensor_sweep_ent_t *ent = cb_data;
+
+    if (ent->threshold)
+	ent->send_err = ipmi_sensor_get_reading(sensor,
+						sensor_sweep_reading_cb, ent);
+    else
+	ent->send_err = ipmi_sensor_get_states(sensor,
+					       sensor_sweep_states_cb, ent);
+}
+
+static int
+sensor_sweep_send(ipmi_domain_t *domain, sensor_sweep_ent_t *ent)
+{
+    ipmi_msg_t    msg;
+    unsigned char data[1];
+    int           rv;
+
+    if (ent->direct) {
+	/* This skips the sensor's opq, which is fine for a reading, it
+	   doesn't change anything on the sensor. */
+	msg.netfn = IPMI_SENSOR_EVENT_NETFN;
+	msg.cmd = IPMI_GET_SENSOR_READING_CMD;
+	msg.data = data;
+	msg.data_len = 1;
+	data[0] = ent->num;
+	return ipmi_send_command_addr(domain, &ent->addr, ent->addr_len, &msg,
+				      sensor_sweep_rsp_handler, ent, NULL);
+    }
+
+    ent->send_err = 0;
+    rv = ipmi_sensor_pointer_cb(ent->sweep->results[ent->idx].sensor_id,
+				sensor_sweep_read, ent);
+    if (!rv)
+	rv = ent->send_err;
+    return rv;
+}
+
+static void
+sensor_sweep_setup(ipmi_sensor_t *sensor, void *cb_data)
+{
+    sensor_sweep_ent_t         *ent = cb_data;
+    ipmi_sensor_sweep_result_t *res = &ent->sweep->results[ent->idx];
+
+    ent->threshold = (sensor->event_reading_type
+		      == IPMI_EVENT_READING_TYPE_THRESHOLD);
+    if (ent->threshold) {
+	ent->analog = (sensor->analog_data_format
+		       != IPMI_ANALOG_DATA_FORMAT_NOT_ANALOG);
+	ent->direct = (sensor->cbs.ipmi_sensor_get_reading
+		       == stand_ipmi_sensor_get_reading);
+    } else {
+	ent->direct = (sensor->cbs.ipmi_sensor_get_states
+		       == stand_ipmi_sensor_get_states);
+    }
+
+    if (!ent->direct)
+	return;
+
+    /* The other paths check this when they send, this one doesn't
+       have the sensor then. */
+    if (sensor->destroyed) {
+	res->err = EINVAL;
+	return;
+    }
+    if (!sensor->readable) {
+	res->err = ENOSYS;
+	return;
+    }
+    ipmi_mc_get_ipmi_address(sensor->mc, &ent->addr, &ent->addr_len);
+    res->err = ipmi_addr_set_lun(&ent->addr, sensor->send_lun);
+    ent->num = sensor->num;
+}
+
+static int
+sensor_sweep_start(ipmi_domain_t        *domain,
+		   ipmi_sensor_id_t     *sensors,
+		   unsigned int         count,
+		   ipmi_sensor_sweep_cb done,
+		   void                 *cb_data)
+{
+    sensor_sweep_t *sweep;
+    unsigned int   alloc_count = count ? count : 1;
+    unsigned int   i;
+    int            rv;
+
+    sweep = ipmi_mem_alloc(sizeof(*sweep));
+    if (!sweep)
+	return ENOMEM;
+    memset(sweep, 0, sizeof(*sweep));
+    sweep->domain_id = ipmi_domain_convert_to_id(domain);
+    sweep->count = count;
+    sweep->done = done;
+    sweep->cb_data = cb_data;
+    sweep->window = i_ipmi_domain_get_max_outstanding_msgs(domain);
+    if (sweep->window == 0)
+	sweep->window = SENSOR_SWEEP_DEFAULT_WINDOW;
+
+    rv = ipmi_create_lock(domain, &sweep->lock);
+    if (rv)
+	goto out_err;
+    sweep->results = ipmi_mem_alloc(sizeof(*sweep->results) * alloc_count);
+    sweep->states = ipmi_mem_alloc(sizeof(*sweep->states) * alloc_count);
+    sweep->ents = ipmi_mem_alloc(sizeof(*sweep->ents) * alloc_count);
+    if (!sweep->results || !sweep->states || !sweep->ents) {
+	rv = ENOMEM;
+	goto out_err;
+    }
+    memset(sweep->results, 0, sizeof(*sweep->results) * alloc_count);
+    memset(sweep->ents, 0, sizeof(*sweep->ents) * alloc_count);
+
+    for (i=0; i<count; i++) {
+	ipmi_sensor_sweep_result_t *res = &sweep->results[i];
+	sensor_sweep_ent_t         *ent = &sweep->ents[i];
+
+	ent->sweep = sweep;
+	ent->idx = i;
+	res->sensor_id = sensors[i];
+	res->value_present = IPMI_NO_VALUES_PRESENT;
+	res->states = &sweep->states[i];
+	ipmi_init_states(res->states);
+	rv = ipmi_sensor_pointer_cb(sensors[i], sensor_sweep_setup, ent);
+	if (rv)
+	    res->err = rv;
+    }
+
+    ipmi_lock(sweep->lock);
+    sensor_sweep_next(domain, sweep);
+    return 0;
+
+ out_err:
+    sensor_sweep_free(sweep);
+    return rv;
+}
+
+typedef struct sensor_sweep_list_s
+{
+    ipmi_sensor_id_t *ids;
+    unsigned int     count;
+    unsigned int     len;
+    int              err;
+} sensor_sweep_list_t;
+
+static void
+sensor_sweep_list_add(ipmi_entity_t *ent, ipmi_sensor_t *sensor, void *cb_data)
+{
+    sensor_sweep_list_t *list = cb_data;
+    ipmi_sensor_id_t    *new_ids;
+
+    if (list->err)
+	return;
+
+    if (list->count == list->len) {
+	unsigned int new_len = list->len ? list->len * 2 : 64;
+
+	new_ids = ipmi_mem_alloc(sizeof(*new_ids) * new_len);
+	if (!new_ids) {
+	    list->err = ENOMEM;
+	    return;
+	}
+	if (list->ids) {
+	    memcpy(new_ids, list->ids, sizeof(*new_ids) * list->count);
+	    ipmi_mem_free(list->ids);
+	}
+	list->ids = new_ids;
+	list->len = new_len;
+    }
+    list->ids[list->count++] = ipmi_sensor_convert_to_id(sensor);
+}
+
+static void
+sensor_sweep_list_entity(ipmi_entity_t *entity, void *cb_data)
+{
+    ipmi_entity_iterate_sensors(entity, sensor_sweep_list_add, cb_data);
+}
+
+int
+ipmi_domain_sweep_sensors(ipmi_domain_t        *domain,
+			  ipmi_sensor_id_t     *sensors,
+			  unsigned int         count,
+			  ipmi_sensor_sweep_cb done,
+			  void                 *cb_data)
+{
+    sensor_sweep_list_t list;
+    int                 rv;
+
+    CHECK_DOMAIN_LOCK(domain);
+
+    if (!done)
+	return EINVAL;
+
+    if (sensors)
+	return sensor_sweep_start(domain, sensors, count, done, cb_data);
+
+    memset(&list, 0, sizeof(list));
+    rv = ipmi_domain_iterate_entities(domain, sensor_sweep_list_entity, &list);
+    if (!rv)
+	rv = list.err;
+    if (!rv)
+	rv = sensor_sweep_start(domain, list.ids, list.count, done, cb_data);
+    if (list.ids)
+	ipmi_mem_free(list.ids);
+    return rv;
+}
+
+int
+ipmi_mc_sweep_sensors(ipmi_mc_t            *mc,
+		      ipmi_sensor_sweep_cb done,
+		      void                 *cb_data)
+{
+    ipmi_sensor_info_t *sensors = i_ipmi_mc_get_sensors(mc);
+    ipmi_sensor_id_t   *ids;
+    unsigned int       count = 0;
+    unsigned int       i, j;
+    int                rv;
+
+    CHECK_MC_LOCK(mc);
+
+    if (!done)
+	return EINVAL;
+
+    ipmi_lock(sensors->idx_lock);
+    for (i=0; i<=4; i++)
+	count += sensors->idx_size[i];
+    ids = ipmi_mem_alloc(sizeof(*ids) * (count ? count : 1));
+    if (!ids) {
+	ipmi_unlock(sensors->idx_lock);
+	return ENOMEM;
+    }
+    count = 0;
+    for (i=0; i<=4; i++) {
+	for (j=0; j<sensors->idx_size[i]; j++) {
+	    ipmi_sensor_t *sensor = sensors->sensors_by_idx[i][j];
+
+	    if (sensor && !sensor->destroyed)
+		ids[count++] = ipmi_sensor_convert_to_id(sensor);
+	}
+    }
+    ipmi_unlock(sensors->idx_lock);
+
+    rv = sensor_sweep_start(ipmi_mc_get_domain(mc), ids, count, done, cb_data);
+    ipmi_mem_free(ids);
+    return rv;
+}
+
 /***********************************************************************
  *
  * Various data conversion stuff.
@@ -5040,32 +5902,37 @@ sign_extend(int m, int bits)
 }
 
 static int
-stand_ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
-				   int           val,
-				   double        *result)
+sensor_conv_calc(sensor_conv_t *conv,
+		 int           linearization,
+		 int           analog_data_format,
+		 int           val,
+		 double        *result)
 {
     double m, b, b_exp, r_exp, fval;
     linearizer c_func;
+    const sensor_conv_ent_t *c;
 
-    if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
-	/* Not a threshold sensor, it doesn't have readings. */
-	return ENOSYS;
-
-    if (sensor->linearization == IPMI_LINEARIZATION_NONLINEAR)
+    if (linearization == IPMI_LINEARIZATION_NONLINEAR)
 	c_func = c_linear;
-    else if (sensor->linearization <= 11)
-	c_func = linearize[sensor->linearization];
+    else if (linearization <= 11)
+	c_func = linearize[linearization];
     else
 	return EINVAL;
 
     val &= 0xff;
 
-    m = sensor->conv[val].m;
-    b = sensor->conv[val].b;
-    r_exp = sensor->conv[val].r_exp;
-    b_exp = sensor->conv[val].b_exp;
+    if (!conv)
+	c = &conv_zero_ent;
+    else if (conv->num_ent == 1)
+	c = &conv->ent[0];
+    else
+	c = &conv->ent[val];
+    m = c->m;
+    b = c->b;
+    r_exp = c->r_exp;
+    b_exp = c->b_exp;
 
-    switch(sensor->analog_data_format) {
+    switch(analog_data_format) {
 	case IPMI_ANALOG_DATA_FORMAT_UNSIGNED:
 	    fval = val;
 	    break;
@@ -5086,15 +5953,71 @@ stand_ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
     return 0;
 }
 
+static int
+stand_ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
+				   int           val,
+				   double        *result)
+{
+    sensor_conv_t *conv = sensor->conv;
+
+    if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
+	/* Not a threshold sensor, it doesn't have readings. */
+	return ENOSYS;
+
+    if (conv && conv->cooked
+	&& (conv->linearization == sensor->linearization)
+	&& (conv->analog_data_format == sensor->analog_data_format))
+    {
+	*result = conv->cooked[val & 0xff];
+	return 0;
+    }
+
+    return sensor_conv_calc(conv, sensor->linearization,
+			    sensor->analog_data_format, val, result);
+}
+
+/* Return the cooked values for the sensor if the standard conversion
+   is in use and they are valid for it, NULL if not. */
+static const double *
+sensor_cooked_table(ipmi_sensor_t *sensor)
+{
+    sensor_conv_t *conv = sensor->conv;
+
+    if (sensor->cbs.ipmi_sensor_convert_from_raw
+	!= stand_ipmi_sensor_convert_from_raw)
+	return NULL;
+    if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
+	return NULL;
+    if (!conv || !conv->cooked
+	|| (conv->linearization != sensor->linearization)
+	|| (conv->analog_data_format != sensor->analog_data_format))
+	return NULL;
+    return conv->cooked;
+}
+
+static int
+sensor_cooked_val(ipmi_sensor_t *sensor,
+		  const double  *cooked,
+		  int           raw,
+		  double        *result)
+{
+    if (cooked) {
+	*result = cooked[raw & 0xff];
+	return 0;
+    }
+    return ipmi_sensor_convert_from_raw(sensor, raw, result);
+}
+
 static int
 stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 				 enum ipmi_round_e rounding,
 				 double            val,
 				 int               *result)
 {
-    double cval;
-    int    lowraw, highraw, raw, maxraw, minraw, next_raw;
-    int    rv;
+    double       cval;
+    int          lowraw, highraw, raw, maxraw, minraw, next_raw;
+    int          rv;
+    const double *cooked;
 
     if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
 	/* Not a threshold sensor, it doesn't have readings. */
@@ -5127,10 +6050,12 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
     }
 
     /* We do a binary search for the right value.  Yuck, but I don't
-       have a better plan that will work with non-linear sensors. */
+       have a better plan that will work with non-linear sensors.  If
+       we have the cooked values this is just a search of the table. */
+    cooked = sensor_cooked_table(sensor);
     do {
 	raw = next_raw;
-	rv = ipmi_sensor_convert_from_raw(sensor, raw, &cval);
+	rv = sensor_cooked_val(sensor, cooked, raw, &cval);
 	if (rv)
 	    return rv;
 
@@ -5151,7 +6076,7 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 	    if (val > cval) {
 		if (raw < maxraw) {
 		    double nval;
-		    rv = ipmi_sensor_convert_from_raw(sensor, raw+1, &nval);
+		    rv = sensor_cooked_val(sensor, cooked, raw+1, &nval);
 		    if (rv)
 			return rv;
 		    nval = cval + ((nval - cval) / 2.0);
@@ -5161,7 +6086,7 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 	    } else {
 		if (raw > minraw) {
 		    double pval;
-		    rv = ipmi_sensor_convert_from_raw(sensor, raw-1, &pval);
+		    rv = sensor_cooked_val(sensor, cooked, raw-1, &pval);
 		    if (rv)
 			return rv;
 		    pval = pval + ((cval - pval) / 2.0);
@@ -5212,8 +6137,8 @@ stand_ipmi_sensor_get_tolerance(ipmi_sensor_t *sensor,
 
     val &= 0xff;
 
-    m = sensor->conv[val].m;
-    r_exp = sensor->conv[val].r_exp;
+    m = sensor_conv(sensor, val)->m;
+    r_exp = sensor_conv(sensor, val)->r_exp;
 
     fval = sign_extend(val, 8);
 
@@ -5233,8 +6158,8 @@ stand_ipmi_sensor_get_accuracy(ipmi_sensor_t *sensor, int val, double *accuracy)
 
     val &= 0xff;
 
-    a = sensor->conv[val].accuracy;
-    a_exp = sensor->conv[val].r_exp;
+    a = sensor_conv(sensor, val)->accuracy;
+    a_exp = sensor_conv(sensor, val)->r_exp;
 
     *accuracy = (a * pow(10, a_exp)) / 100.0;
     return 0;
@@ -5511,6 +6436,33 @@ ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
     return sensor->cbs.ipmi_sensor_convert_from_raw(sensor, val, result);
 }
 
+int
+ipmi_sensor_convert_from_raw_batch(ipmi_sensor_t *sensor,
+				   const int     *raw,
+				   double        *result,
+				   unsigned int  count)
+{
+    const double *cooked;
+    unsigned int i;
+    int          rv;
+
+    CHECK_SENSOR_LOCK(sensor);
+
+    cooked = sensor_cooked_table(sensor);
+    if (cooked) {
+	for (i=0; i<count; i++)
+	    result[i] = cooked[raw[i] & 0xff];
+	return 0;
+    }
+
+    for (i=0; i<count; i++) {
+	rv = ipmi_sensor_convert_from_raw(sensor, raw[i], &result[i]);
+	if (rv)
+	    return rv;
+    }
+    return 0;
+}
+
 int
 ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 			   enum ipmi_round_e rounding,
@@ -795,6 +795,18 @@ ipmi_solparm_set_parm(ipmi_solparm_t       *solparm,
     return rv;
 }
 
+/* There are only eight SOL parms, so this fetches them all at once
+   unless the connection limits it. */
+#define MAX_SOLPARM_FETCH_WINDOW 8
+
+/* One parameter being fetched by ipmi_sol_get_config(). */
+typedef struct solparm_fetch_s
+{
+    ipmi_sol_config_t *solc;
+    unsigned char     parm;
+    unsigned int      in_flight : 1;
+} solparm_fetch_t;
+
 struct ipmi_sol_config_s
 {
     /* Stuff for getting/setting the values. */
@@ -831,6 +843,13 @@ struct ipmi_sol_config_s
     unsigned char retry_interval;
     unsigned char port_number_supported;
     unsigned int port_number;
+
+    /* For fetching the config, the parms don't depend on each other
+       so they are just handed out in order from next_parm. */
+    solparm_fetch_t fetch[MAX_SOLPARM_FETCH_WINDOW];
+    unsigned int    fetch_window;
+    unsigned int    fetch_outstanding;
+    int             next_parm;
 };
 
 typedef struct solparms_s solparms_t;
@@ -1027,14 +1046,42 @@ err_lock_cleared(ipmi_solparm_t *solparm,
 }
 
 static void
-got_parm(ipmi_solparm_t    *solparm,
+fetch_config_done(ipmi_solparm_t *solparm, ipmi_sol_config_t *solc)
+{
+    unsigned char data[1];
+    int           rv;
+
+    if (!solc->err) {
+	solc->done(solparm, 0, solc, solc->cb_data);
+	solparm_put(solparm);
+	return;
+    }
+
+    ipmi_log(IPMI_LOG_ERR_INFO,
+	     "solparm.c(fetch_config_done): Error trying to get parms: %x",
+	     solc->err);
+    /* Clear the lock */
+    data[0] = 0;
+    rv = ipmi_solparm_set_parm(solparm, 0, data, 1, err_lock_cleared, solc);
+    if (rv) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "solparm.c(fetch_config_done): Error trying to clear lock: %x",
+		 rv);
+	solc->done(solparm, solc->err, NULL, solc->cb_data);
+	ipmi_sol_free_config(solc);
+	solparm->locked = 0;
+	solparm_put(solparm);
+    }
+}
+
+static int
+got_parm(ipmi_sol_config_t *solc,
+	 solparm_fetch_t   *f,
 	 int               err,
 	 unsigned char     *data,
-	 unsigned int      data_len,
-	 void              *cb_data)
+	 unsigned int      data_len)
 {
-    ipmi_sol_config_t *solc = cb_data;
-    solparms_t        *lp = &(solparms[solc->curr_parm]);
+    solparms_t *lp = &(solparms[f->parm]);
 
     /* Check the length, and don't forget the revision byte must be added. */
     if ((!err) && (data_len < (unsigned int) (lp->length+1))) {
@@ -1042,14 +1089,13 @@ got_parm(ipmi_solparm_t    *solparm,
 	    /* Some systems return zero-length data for optional parms. */
 	    unsigned char *opt = ((unsigned char *)solc) + lp->optional_offset;
 	    *opt = 0;
-	    goto next_parm;
+	    return 0;
 	}
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "solparm.c(got_parm): "
 		 " Invalid data length on parm %d was %d, should have been %d",
-		 solc->curr_parm, data_len, lp->length+1);
-	err = EINVAL;
-	goto done;
+		 f->parm, data_len, lp->length+1);
+	return EINVAL;
     }
 
     err = lp->get_handler(solc, lp, err, data);
@@ -1057,55 +1103,162 @@ got_parm(ipmi_solparm_t    *solparm,
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "solparm.c(got_parm): "
 		 "Error fetching parm %d: %x",
-		 solc->curr_parm, err);
-	goto done;
+		 f->parm, err);
+	return err;
     }
 
- next_parm:
-    switch (solc->curr_parm) {
-    case IPMI_SOLPARM_PAYLOAD_PORT_NUMBER:
-	goto done;
-    default:
-	solc->curr_parm++;
-    }
+    return 0;
+}
 
-    lp = &(solparms[solc->curr_parm]);
-    if (!lp->valid)
-	goto next_parm;
+static void fetch_config_continue(ipmi_solparm_t    *solparm,
+				  ipmi_sol_config_t *solc,
+				  ipmi_mc_t         *mc);
 
-    err = ipmi_solparm_get_parm(solparm, solc->curr_parm, solc->curr_sel, 0,
-				got_parm, solc);
-    if (err)
-	goto done;
+static void
+solparm_parm_fetched(ipmi_mc_t  *mc,
+		     ipmi_msg_t *rsp,
+		     void       *rsp_data)
+{
+    solparm_fetch_t   *f = rsp_data;
+    ipmi_sol_config_t *solc = f->solc;
+    ipmi_solparm_t    *solparm = solc->my_sol;
+    int               err;
 
-    return;
+    err = check_solparm_response_param(solparm, mc, rsp, 2,
+				       "solparm_parm_fetched");
 
- done:
-    if (err) {
-	unsigned char data[1];
+    solparm_lock(solparm);
+    f->in_flight = 0;
+    solc->fetch_outstanding--;
+
+    /* After an error, just wait for the rest to come back. */
+    if (!solc->err) {
+	/* Skip over the completion code. */
+	err = got_parm(solc, f, err, rsp->data + 1, rsp->data_len - 1);
+	if (err)
+	    solc->err = err;
+    }
 
-	ipmi_log(IPMI_LOG_ERR_INFO,
-		 "solparm.c(got_parm): Error trying to get parm %d: %x",
-		 solc->curr_parm, err);
-	solc->err = err;
-	/* Clear the lock */
-	data[0] = 0;
-	err = ipmi_solparm_set_parm(solparm, 0, data, 1,
-				    err_lock_cleared, solc);
-	if (err) {
-	    ipmi_sol_free_config(solc);
+    fetch_config_continue(solparm, solc, mc);
+}
+
+/*
+ * Keep the window full of requests.  Must be called with the solparm
+ * lock held, this will release it (or finish the fetch).
+ */
+static void
+fetch_config_continue(ipmi_solparm_t    *solparm,
+		      ipmi_sol_config_t *solc,
+		      ipmi_mc_t         *mc)
+{
+    unsigned char   data[4];
+    ipmi_msg_t      msg;
+    unsigned int    i;
+    solparm_fetch_t *f;
+    int             rv;
+
+    for (i = 0; i < solc->fetch_window; i++) {
+	if (solc->err)
+	    break;
+
+	f = &solc->fetch[i];
+	if (f->in_flight)
+	    continue;
+	while ((solc->next_parm <= IPMI_SOLPARM_PAYLOAD_PORT_NUMBER)
+	       && !solparms[solc->next_parm].valid)
+	    solc->next_parm++;
+	if (solc->next_parm > IPMI_SOLPARM_PAYLOAD_PORT_NUMBER)
+	    break;
+	f->parm = solc->next_parm++;
+
+	msg.data = data;
+	msg.netfn = IPMI_TRANSPORT_NETFN;
+	msg.cmd = IPMI_GET_SOL_CONFIGURATION_PARAMETERS;
+	data[0] = solparm->channel;
+	data[1] = f->parm;
+	data[2] = 0;
+	data[3] = 0;
+	msg.data_len = 4;
+	rv = ipmi_mc_send_command(mc, 0, &msg, solparm_parm_fetched, f);
+	if (rv) {
 	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "solparm.c(got_parm): Error trying to clear lock: %x",
-		     err);
-	    solc->done(solparm, solc->err, NULL, solc->cb_data);
-	    ipmi_sol_free_config(solc);
-	    solparm->locked = 0;
-	    solparm_put(solparm);
+		     "%ssolparm.c(fetch_config_continue): "
+		     "could not send cmd: %x",
+		     MC_NAME(mc), rv);
+	    solc->err = rv;
+	    break;
 	}
-    } else {
-	solc->done(solparm, 0, solc, solc->cb_data);
-	solparm_put(solparm);
+	f->in_flight = 1;
+	solc->fetch_outstanding++;
+    }
+
+    if (solc->fetch_outstanding == 0) {
+	/* Nothing in flight and nothing more to send, we are done. */
+	solparm_unlock(solparm);
+	if (!solparm->destroyed)
+	    opq_op_done(solparm->opq);
+	fetch_config_done(solparm, solc);
+	return;
+    }
+
+    solparm_unlock(solparm);
+}
+
+static void
+start_config_get_cb(ipmi_mc_t *mc, void *cb_data)
+{
+    ipmi_sol_config_t *solc = cb_data;
+    ipmi_solparm_t    *solparm = solc->my_sol;
+    unsigned int      max;
+
+    solparm_lock(solparm);
+    if (solparm->destroyed) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "%ssolparm.c(start_config_get_cb): "
+		 "SOLPARM was destroyed while an operation was in progress",
+		 MC_NAME(mc));
+	solc->err = ECANCELED;
     }
+
+    max = i_ipmi_domain_get_max_outstanding_msgs(ipmi_mc_get_domain(mc));
+    solc->fetch_window = MAX_SOLPARM_FETCH_WINDOW;
+    if (max && (solc->fetch_window > max))
+	solc->fetch_window = max;
+
+    fetch_config_continue(solparm, solc, mc);
+}
+
+/* The whole config fetch is one operation on the opq, the parms are
+   fetched in parallel inside it. */
+static int
+start_config_get(void *cb_data, int shutdown)
+{
+    ipmi_sol_config_t *solc = cb_data;
+    ipmi_solparm_t    *solparm = solc->my_sol;
+    int               rv;
+
+    if (shutdown) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "solparm.c(start_config_get): "
+		 "SOLPARM was destroyed while an operation was in progress");
+	solc->err = ECANCELED;
+	fetch_config_done(solparm, solc);
+	return OPQ_HANDLER_STARTED;
+    }
+
+    /* The read lock must be claimed before the solparm lock to avoid
+       deadlock. */
+    rv = ipmi_mc_pointer_cb(solparm->mc, start_config_get_cb, solc);
+    if (rv) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "solparm.c(start_config_get): "
+		 "SOLPARM's MC is not valid");
+	solc->err = rv;
+	if (!solparm->destroyed)
+	    opq_op_done(solparm->opq);
+	fetch_config_done(solparm, solc);
+    }
+    return OPQ_HANDLER_STARTED;
 }
 
 static void 
@@ -1114,7 +1267,6 @@ lock_done(ipmi_solparm_t *solparm,
 	  void           *cb_data)
 {
     ipmi_sol_config_t *solc = cb_data;
-    int               rv;
 
     if (err == IPMI_IPMI_ERR_VAL(0x80)) {
 	/* Lock is not supported, just mark it and go on. */
@@ -1139,28 +1291,16 @@ lock_done(ipmi_solparm_t *solparm,
 	solparm->locked = 1;
     }
 
-    rv = ipmi_solparm_get_parm(solparm, solc->curr_parm, solc->curr_sel, 0,
-			       got_parm, solc);
-    if (rv) {
-	unsigned char data[1];
+    if (solparm->destroyed)
+	solc->err = EINVAL;
+    else if (!opq_new_op(solparm->opq, start_config_get, solc, 0))
+	solc->err = ENOMEM;
+
+    if (solc->err) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "solparm.c(lock_done): Error trying to get parms: %x",
-		 err);
-
-	solc->err = rv;
-	/* Clear the lock */
-	data[0] = 0;
-	rv = ipmi_solparm_set_parm(solparm, 0, data, 1,
-				   err_lock_cleared, solc);
-	if (rv) {
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "solparm.c(lock_done): Error trying to clear lock: %x",
-		     err);
-	    solc->done(solparm, solc->err, NULL, solc->cb_data);
-	    ipmi_sol_free_config(solc);
-	    solparm->locked = 0;
-	    solparm_put(solparm);
-	}
+		 solc->err);
+	fetch_config_done(solparm, solc);
     }
 }
 
@@ -1171,6 +1311,7 @@ int ipmi_sol_get_config(ipmi_solparm_t         *solparm,
     ipmi_sol_config_t *solc;
     int               rv;
     unsigned char     data[1];
+    unsigned int      i;
 
     solc = ipmi_mem_alloc(sizeof(*solc));
     if (!solc)
@@ -1179,6 +1320,9 @@ int ipmi_sol_get_config(ipmi_solparm_t         *solparm,
 
     solc->curr_parm = 1;
     solc->curr_sel = 0;
+    solc->next_parm = 1;
+    for (i = 0; i < MAX_SOLPARM_FETCH_WINDOW; i++)
+	solc->fetch[i].solc = solc;
     solc->done = done;
     solc->cb_data = cb_data;
     solc->my_sol = solparm;
@@ -2112,15 +2112,14 @@ static void sensor_get_thresholds_handler(ipmi_sensor_t     *sensor,
 }
 
 static void
-sensor_get_reading_handler(ipmi_sensor_t             *sensor,
-			   int                       err,
-			   enum ipmi_value_present_e value_present,
-			   unsigned int              raw_value,
-			   double                    value,
-			   ipmi_states_t             *states,
-			   void                      *cb_data)
+sensor_reading_call_cb(swig_cb_val               *cb,
+		       ipmi_sensor_t             *sensor,
+		       int                       err,
+		       enum ipmi_value_present_e value_present,
+		       unsigned int              raw_value,
+		       double                    value,
+		       ipmi_states_t             *states)
 {
-    swig_cb_val *cb = cb_data;
     swig_ref    sensor_ref;
     int         raw_set = 0;
     int         value_set = 0;
@@ -2138,17 +2137,31 @@ sensor_get_reading_handler(ipmi_sensor_t             *sensor,
 		 err, raw_set, raw_value, value_set, value, statestr);
     swig_free_ref_check(sensor_ref, ipmi_sensor_t);
     free(statestr);
+}
+
+static void
+sensor_get_reading_handler(ipmi_sensor_t             *sensor,
+			   int                       err,
+			   enum ipmi_value_present_e value_present,
+			   unsigned int              raw_value,
+			   double                    value,
+			   ipmi_states_t             *states,
+			   void                      *cb_data)
+{
+    swig_cb_val *cb = cb_data;
+
+    sensor_reading_call_cb(cb, sensor, err, value_present, raw_value, value,
+			   states);
     /* One-time call, get rid of the CB. */
     deref_swig_cb_val(cb);
 }
 
 static void
-sensor_get_states_handler(ipmi_sensor_t *sensor,
-			  int           err,
-			  ipmi_states_t *states,
-			  void          *cb_data)
+sensor_states_call_cb(swig_cb_val   *cb,
+		      ipmi_sensor_t *sensor,
+		      int           err,
+		      ipmi_states_t *states)
 {
-    swig_cb_val *cb = cb_data;
     swig_ref    sensor_ref;
     char        *statestr;
 
@@ -2158,6 +2171,67 @@ sensor_get_states_handler(ipmi_sensor_t *sensor,
 		 err, statestr);
     swig_free_ref_check(sensor_ref, ipmi_sensor_t);
     free(statestr);
+}
+
+static void
+sensor_get_states_handler(ipmi_sensor_t *sensor,
+			  int           err,
+			  ipmi_states_t *states,
+			  void          *cb_data)
+{
+    swig_cb_val *cb = cb_data;
+
+    sensor_states_call_cb(cb, sensor, err, states);
+    /* One-time call, get rid of the CB. */
+    deref_swig_cb_val(cb);
+}
+
+typedef struct sensor_sweep_out_s
+{
+    swig_cb_val                *cb;
+    ipmi_sensor_sweep_result_t *res;
+} sensor_sweep_out_t;
+
+static void
+sensor_sweep_out(ipmi_sensor_t *sensor, void *cb_data)
+{
+    sensor_sweep_out_t         *info = cb_data;
+    ipmi_sensor_sweep_result_t *res = info->res;
+
+    if (ipmi_sensor_get_event_reading_type(sensor)
+	== IPMI_EVENT_READING_TYPE_THRESHOLD)
+	sensor_reading_call_cb(info->cb, sensor, res->err, res->value_present,
+			       res->raw_value, res->val, res->states);
+    else
+	sensor_states_call_cb(info->cb, sensor, res->err, res->states);
+}
+
+static void
+sensor_sweep_handler(ipmi_domain_t              *domain,
+		     int                        err,
+		     ipmi_sensor_sweep_result_t *results,
+		     unsigned int               count,
+		     void                       *cb_data)
+{
+    swig_cb_val        *cb = cb_data;
+    swig_ref           domain_ref;
+    sensor_sweep_out_t info;
+    unsigned int       i;
+
+    info.cb = cb;
+    for (i=0; i<count; i++) {
+	info.res = &results[i];
+	ipmi_sensor_pointer_cb(results[i].sensor_id, sensor_sweep_out, &info);
+    }
+
+    /* The domain is NULL if it went away during the sweep, that makes
+       an undefined reference, like a missing FRU does. */
+    domain_ref = swig_make_ref(domain, ipmi_domain_t);
+    swig_call_cb(cb, "sensor_sweep_cb", "%p%d", &domain_ref, err);
+    if (domain)
+	swig_free_ref_check(domain_ref, ipmi_domain_t);
+    else
+	swig_free_ref(domain_ref);
     /* One-time call, get rid of the CB. */
     deref_swig_cb_val(cb);
 }
@@ -4311,6 +4385,35 @@ char *get_error_string(unsigned int val);
 	return rv;
     }
 
+    /*
+     * Read the current value of every sensor in the domain.  The
+     * readings are fetched together, which is much faster than
+     * calling get_value on each sensor.  For each sensor, the
+     * threshold_reading_cb or discrete_states_cb method of the first
+     * parameter is called just like get_value does for the sensor.
+     * When that is done, the sensor_sweep_cb method of the first
+     * parameter is called with the following parameters: <self>
+     * <domain> <err>.
+     */
+    int sweep_sensors(swig_cb *handler)
+    {
+	swig_cb_val *handler_val;
+	int         rv;
+
+	IPMI_SWIG_C_CB_ENTRY
+	if (! valid_swig_cb(handler, sensor_sweep_cb))
+	    rv = EINVAL;
+	else {
+	    handler_val = ref_swig_cb(handler, sensor_sweep_cb);
+	    rv = ipmi_domain_sweep_sensors(self, NULL, 0,
+					   sensor_sweep_handler, handler_val);
+	    if (rv)
+		deref_swig_cb_val(handler_val);
+	}
+	IPMI_SWIG_C_CB_EXIT
+	return rv;
+    }
+
     /*
      * Return the type of the domain, either unknown, mxp, or atca.
      * Others may be added later.
@@ -6412,6 +6515,31 @@ ipmi_args_t *alloc_parse_args(argarray *args);
 	return rv;
     }
 
+    /*
+     * Read the current value of every sensor on the MC.  This works
+     * like sweep_sensors on the domain, the sensor_sweep_cb method
+     * of the first parameter is called with <self> <domain> <err>
+     * after all the sensors have been reported.
+     */
+    int sweep_sensors(swig_cb *handler)
+    {
+	swig_cb_val *handler_val;
+	int         rv;
+
+	IPMI_SWIG_C_CB_ENTRY
+	if (! valid_swig_cb(handler, sensor_sweep_cb))
+	    rv = EINVAL;
+	else {
+	    handler_val = ref_swig_cb(handler, sensor_sweep_cb);
+	    rv = ipmi_mc_sweep_sensors(self, sensor_sweep_handler,
+				       handler_val);
+	    if (rv)
+		deref_swig_cb_val(handler_val);
+	}
+	IPMI_SWIG_C_CB_EXIT
+	return rv;
+    }
+
     /*
      * Set the time between SEL rescans for the MC (and only that MC).
      * Parm 1 is the time in seconds.
@@ -0,0 +1,1146 @@
+/*
+ * bench_domain.c
+ *
+ * Benchmarks of the library against a simulated BMC.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * Lesser General Public License (GPL) Version 2 or the modified BSD
+ * license below.  The following disclamer applies to both licenses:
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * GNU Lesser General Public Licence
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Modified BSD Licence
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *   3. The name of the author may not be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ */
+
+/*
+ * Usage: bench_domain [-s ipmi_sim] [-c count] [-d depth] test
+ *
+ * Writes a configuration for ipmi_sim with a generated SDR repository
+ * (and whatever else the test needs) into a temporary directory,
+ * starts ipmi_sim on it, opens a domain on it over the LAN, and
+ * measures one thing:
+ *
+ * sensors: The library's heap use once the domain is up with count
+ * (default 1000) threshold sensors, using 37 different sets of
+ * conversion factors.  The heap is counted through the OS handler's
+ * mem_alloc and mem_free.
+ *
+ * cmds: Sends count (default 1000) Get Device ID commands at once to
+ * a second MC on the IPMB, so they are all outstanding in the domain,
+ * and waits for all the responses.  This is done a number of times
+ * and the time per command is reported.
+ *
+ * entities: Fills the SDR repository with entity association records
+ * for count (default 5000) entities.  Reports how long the domain
+ * takes to come up, which includes fetching the SDRs and the first
+ * scan that creates the entities, and the time for
+ * ipmi_entity_scan_sdrs() to scan the unchanged repository again.
+ *
+ * sel: Fills the BMC's SEL with count (default 65534, all it can hold)
+ * events.  Reports how long the domain takes to come up, which
+ * includes the first read of the SEL, and the time for
+ * ipmi_domain_reread_sels() to read it all again.  Closing the
+ * domain afterwards frees the SEL with all the events still in it.
+ *
+ * selspec: The sel test with speculative SEL fetching, depth (default
+ * 4) entries ahead.  Afterwards a second domain reads the SEL without
+ * speculation, its events must be the same, and the speculation hits
+ * and misses are reported.
+ *
+ * pps: A UDP load client for ipmi_sim's LAN interface.  count
+ * (default 8) sockets each keep 8 sessionless Get Channel
+ * Authentication Capabilities requests outstanding for a few seconds,
+ * and the responses per second are reported.
+ *
+ * The domain is closed after each test, so running under valgrind or
+ * a sanitizer also checks the teardown.
+ *
+ * ipmi_sim defaults to ../lanserv/ipmi_sim, where it is in the build
+ * tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <OpenIPMI/ipmiif.h>
+#include <OpenIPMI/ipmi_posix.h>
+#include <OpenIPMI/ipmi_lan.h>
+#include <OpenIPMI/ipmi_auth.h>
+#include <OpenIPMI/ipmi_msgbits.h>
+#include <OpenIPMI/ipmi_conn.h>
+#include <OpenIPMI/ipmi_mc.h>
+#include <OpenIPMI/selector.h>
+#include <OpenIPMI/internal/ipmi_domain.h>
+#include <OpenIPMI/internal/ipmi_entity.h>
+
+typedef struct bench_test_s
+{
+    char         *name;
+    unsigned int def_count;
+    int          read_sel;
+    int          sel_speculate;
+
+    /* Write the emu commands for the BMC's contents. */
+    void (*write_emu)(FILE *f, unsigned int count);
+
+    /* Called before the domain is opened, and once it is fully up. */
+    void (*start)(unsigned int count);
+    void (*run)(ipmi_domain_t *domain, unsigned int count);
+} bench_test_t;
+
+static os_handler_t *os_hnd;
+static char sim_dir[] = "/tmp/bench_domainXXXXXX";
+static pid_t sim_pid;
+static int sim_port;
+static int domain_up;
+static int domain_err;
+static int domain_closed;
+static unsigned int count;
+static unsigned int spec_depth = 4;
+
+static void
+err_leave(int err, char *str)
+{
+    fprintf(stderr, "%s: %s (%d)\n", str, strerror(err), err);
+    if (sim_pid > 0)
+	kill(sim_pid, SIGTERM);
+    exit(1);
+}
+
+static double
+now_secs(void)
+{
+    struct timeval tv;
+
+    sel_get_monotonic_time(&tv);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+/*
+ * Count the bytes the library has allocated.  Everything it allocates
+ * goes through the OS handler, so keep the size in front of each
+ * block.
+ */
+typedef union
+{
+    size_t      size;
+    long double align;
+} mem_hdr_t;
+
+static long heap_bytes;
+static void *(*real_mem_alloc)(int size);
+static void (*real_mem_free)(void *data);
+
+static void *
+counting_mem_alloc(int size)
+{
+    mem_hdr_t *h = real_mem_alloc(size + sizeof(*h));
+
+    if (!h)
+	return NULL;
+    h->size = size;
+    heap_bytes += size;
+    return h + 1;
+}
+
+static void
+counting_mem_free(void *data)
+{
+    mem_hdr_t *h = ((mem_hdr_t *) data) - 1;
+
+    heap_bytes -= h->size;
+    real_mem_free(h);
+}
+
+/* Run the OS handler until *done is set or secs go by. */
+static void
+wait_for(int *done, double secs, char *what)
+{
+    double         end = now_secs() + secs;
+    struct timeval tv;
+
+    while (!*done) {
+	if (now_secs() > end)
+	    err_leave(ETIMEDOUT, what);
+	tv.tv_sec = 0;
+	tv.tv_usec = 100000;
+	os_hnd->perform_one_op(os_hnd, &tv);
+    }
+}
+
+/* Write out a main SDR repository record. */
+static void
+write_sdr(FILE *f, unsigned char *sdr)
+{
+    unsigned int i;
+
+    fprintf(f, "main_sdr_add 0x20");
+    for (i = 0; i < (unsigned int) sdr[4] + 5; i++)
+	fprintf(f, " 0x%2.2x", sdr[i]);
+    fprintf(f, "\n");
+}
+
+/*
+ * A full threshold sensor record for a temperature sensor on the BMC.
+ * Sensor n goes on LUN n / 256, the m value (in 1 to nconv) picks
+ * the conversion factors.
+ */
+static void
+write_threshold_sensor(FILE *f, unsigned int n, unsigned char entity_id,
+		       unsigned char entity_instance, unsigned int m)
+{
+    unsigned char sdr[64];
+    int           len;
+
+    memset(sdr, 0, sizeof(sdr));
+    sdr[2] = 0x51;
+    sdr[3] = 0x01;
+    sdr[5] = 0x20;
+    sdr[6] = (n / 256) & 3;
+    sdr[7] = n % 256;
+    sdr[8] = entity_id;
+    sdr[9] = entity_instance;
+    sdr[11] = 0x48;	/* Auto rearm, readable thresholds */
+    sdr[12] = 0x01;	/* Temperature */
+    sdr[13] = 0x01;	/* Threshold */
+    sdr[19] = 0x3f;
+    sdr[21] = 0x01;	/* Degrees C */
+    sdr[24] = m & 0xff;
+    sdr[25] = (m >> 2) & 0xc0;
+    sdr[26] = n % 7;
+    sdr[29] = 0xe0;	/* r_exp -2 */
+    sdr[34] = 0xff;
+    len = sprintf((char *) sdr + 48, "T%u", n);
+    sdr[47] = 0xc0 | len;
+    sdr[4] = 48 + len - 5;
+    write_sdr(f, sdr);
+}
+
+/*
+ * An entity association record for a container and the four entities
+ * it contains.  Entity n gets an id and instance from n, using
+ * system-relative instances.
+ */
+static void
+write_entity_assoc(FILE *f, unsigned int n)
+{
+    unsigned char sdr[16];
+    unsigned int  i;
+
+    memset(sdr, 0, sizeof(sdr));
+    sdr[2] = 0x51;
+    sdr[3] = 0x08;
+    sdr[4] = 11;
+    for (i = 0; i < 5; i++) {
+	/* Skip the flags byte after the container. */
+	sdr[5 + (i * 2) + (i > 0)] = 0x90 + ((n + i) / 96);
+	sdr[6 + (i * 2) + (i > 0)] = (n + i) % 96;
+    }
+    write_sdr(f, sdr);
+}
+
+static void
+write_config(bench_test_t *test)
+{
+    char name[sizeof(sim_dir) + 16];
+    FILE *f;
+
+    sprintf(name, "%s/lan.conf", sim_dir);
+    f = fopen(name, "w");
+    if (!f)
+	err_leave(errno, "Unable to write lan.conf");
+    fprintf(f,
+	    "name \"bench\"\n"
+	    "set_working_mc 0x20\n"
+	    "  startlan 1\n"
+	    "    addr 127.0.0.1 %d\n"
+	    "    priv_limit admin\n"
+	    "    allowed_auths_callback none\n"
+	    "    allowed_auths_user none\n"
+	    "    allowed_auths_operator none\n"
+	    "    allowed_auths_admin none\n"
+	    "    guid a123456789abcdefa123456789abcdef\n"
+	    "  endlan\n"
+	    "  user 2 true \"bench\" \"\" admin 10 none\n",
+	    sim_port);
+    fclose(f);
+
+    sprintf(name, "%s/bench.emu", sim_dir);
+    f = fopen(name, "w");
+    if (!f)
+	err_leave(errno, "Unable to write bench.emu");
+    fprintf(f,
+	    "mc_setbmc 0x20\n"
+	    "mc_add 0x20 0 no-device-sdrs 0x23 9 8 0x9f 0x1291 0xf02\n");
+    test->write_emu(f, count);
+    fprintf(f, "mc_enable 0x20\n");
+    fclose(f);
+}
+
+/* Pick a free port by binding to port 0 and letting it go. */
+static int
+free_port(void)
+{
+    struct sockaddr_in addr;
+    socklen_t          addrlen = sizeof(addr);
+    int                fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+	err_leave(errno, "socket");
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+	err_leave(errno, "bind");
+    if (getsockname(fd, (struct sockaddr *) &addr, &addrlen) == -1)
+	err_leave(errno, "getsockname");
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/* A sessionless Get Channel Authentication Capabilities request. */
+static unsigned char auth_caps_req[] = {
+    0x06, 0x00, 0xff, 0x07,	/* RMCP */
+    0x00, 0, 0, 0, 0, 0, 0, 0, 0, 9,
+    0x20, 0x18, 0xc8, 0x81, 0x00, 0x38, 0x0e, 0x04, 0x35
+};
+
+static void
+sim_sockaddr(struct sockaddr_in *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port = htons(sim_port);
+}
+
+/*
+ * ipmi_sim opens its LAN port when the emu file enables the BMC, at
+ * the end, so send it Get Channel Authentication Capabilities until
+ * it answers.
+ */
+static void
+wait_for_sim(double secs)
+{
+    struct sockaddr_in addr;
+    unsigned char      rsp[64];
+    struct timeval     tv;
+    double             end = now_secs() + secs;
+    int                status;
+    int                fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+	err_leave(errno, "socket");
+    tv.tv_sec = 0;
+    tv.tv_usec = 200000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    sim_sockaddr(&addr);
+    for (;;) {
+	if (waitpid(sim_pid, &status, WNOHANG) == sim_pid) {
+	    sim_pid = 0;
+	    err_leave(ECHILD, "ipmi_sim exited");
+	}
+	if (now_secs() > end)
+	    err_leave(ETIMEDOUT, "Waiting for ipmi_sim");
+	sendto(fd, auth_caps_req, sizeof(auth_caps_req), 0,
+	       (struct sockaddr *) &addr, sizeof(addr));
+	if (recv(fd, rsp, sizeof(rsp), 0) > 0)
+	    break;
+    }
+    close(fd);
+}
+
+static void
+start_sim(char *sim, bench_test_t *test)
+{
+    char conf[sizeof(sim_dir) + 16], emu[sizeof(sim_dir) + 16];
+    int  fd;
+
+    if (!mkdtemp(sim_dir))
+	err_leave(errno, "Unable to create a temporary directory");
+    sim_port = free_port();
+    write_config(test);
+    sprintf(conf, "%s/lan.conf", sim_dir);
+    sprintf(emu, "%s/bench.emu", sim_dir);
+
+    sim_pid = fork();
+    if (sim_pid == -1)
+	err_leave(errno, "fork");
+    if (sim_pid == 0) {
+	fd = open("/dev/null", O_RDWR);
+	if (fd >= 0) {
+	    dup2(fd, 0);
+	    dup2(fd, 1);
+	    dup2(fd, 2);
+	}
+	execl(sim, sim, "-n", "-p", "-c", conf, "-f", emu, "-s", sim_dir,
+	      NULL);
+	_exit(1);
+    }
+    wait_for_sim(600.0);
+}
+
+static void
+stop_sim(void)
+{
+    char cmd[sizeof(sim_dir) + 16];
+
+    if (sim_pid > 0) {
+	kill(sim_pid, SIGTERM);
+	waitpid(sim_pid, NULL, 0);
+	sim_pid = 0;
+    }
+    sprintf(cmd, "rm -rf %s", sim_dir);
+    if (system(cmd))
+	fprintf(stderr, "Unable to remove %s\n", sim_dir);
+}
+
+static void
+con_change(ipmi_domain_t *domain, int err, unsigned int conn_num,
+	   unsigned int port_num, int still_connected, void *cb_data)
+{
+    if (err) {
+	domain_err = err;
+	domain_up = 1;
+    }
+}
+
+static void
+fully_up(ipmi_domain_t *domain, void *cb_data)
+{
+    domain_up = 1;
+}
+
+static void
+run_test_cb(ipmi_domain_t *domain, void *cb_data)
+{
+    bench_test_t *test = cb_data;
+
+    test->run(domain, count);
+}
+
+static void
+closed(void *cb_data)
+{
+    domain_closed = 1;
+}
+
+static void
+close_domain_cb(ipmi_domain_t *domain, void *cb_data)
+{
+    int rv;
+
+    rv = ipmi_domain_close(domain, closed, NULL);
+    if (rv)
+	err_leave(rv, "ipmi_domain_close");
+}
+
+/* Open a domain on the simulator and wait until it is fully up. */
+static void
+setup_domain(char *name, int read_sel, unsigned int sel_speculate,
+	     ipmi_domain_id_t *domain_id)
+{
+    ipmi_open_option_t opts[8];
+    ipmi_con_t         *con;
+    char               port[16];
+    /* ipmi_lanp_setup_con() looks at a port for every possible
+       address, not just the ones given. */
+    char               *addrs[2] = { "127.0.0.1", NULL };
+    char               *ports[2] = { port, NULL };
+    int                rv;
+
+    sprintf(port, "%d", sim_port);
+    rv = ipmi_ip_setup_con(addrs, ports, 1, IPMI_AUTHTYPE_NONE,
+			   IPMI_PRIVILEGE_ADMIN, "bench", 5, "", 0,
+			   os_hnd, NULL, &con);
+    if (rv)
+	err_leave(rv, "ipmi_ip_setup_con");
+
+    opts[0].option = IPMI_OPEN_OPTION_ALL;
+    opts[0].ival = 0;
+    opts[1].option = IPMI_OPEN_OPTION_SDRS;
+    opts[1].ival = 1;
+    opts[2].option = IPMI_OPEN_OPTION_SEL;
+    opts[2].ival = read_sel;
+    opts[3].option = IPMI_OPEN_OPTION_USE_CACHE;
+    opts[3].ival = 0;
+    opts[4].option = IPMI_OPEN_OPTION_SET_EVENT_RCVR;
+    opts[4].ival = 0;
+    opts[5].option = IPMI_OPEN_OPTION_SET_SEL_TIME;
+    opts[5].ival = 0;
+    opts[6].option = IPMI_OPEN_OPTION_OEM_INIT;
+    opts[6].ival = 0;
+    opts[7].option = IPMI_OPEN_OPTION_SEL_SPECULATE;
+    opts[7].ival = sel_speculate;
+
+    domain_up = 0;
+    domain_err = 0;
+    rv = ipmi_open_domain(name, &con, 1, con_change, NULL,
+			  fully_up, NULL, opts, 8, domain_id);
+    if (rv)
+	err_leave(rv, "ipmi_open_domain");
+    wait_for(&domain_up, 600.0, "Waiting for the domain");
+    if (domain_err)
+	err_leave(domain_err, "Opening the domain");
+}
+
+static void
+close_domain(ipmi_domain_id_t domain_id)
+{
+    int rv;
+
+    domain_closed = 0;
+    rv = ipmi_domain_pointer_cb(domain_id, close_domain_cb, NULL);
+    if (rv)
+	err_leave(rv, "ipmi_domain_pointer_cb");
+    wait_for(&domain_closed, 60.0, "Waiting for the domain to close");
+}
+
+static void
+open_domain(bench_test_t *test)
+{
+    ipmi_domain_id_t domain_id;
+    int              rv;
+
+    if (test->start)
+	test->start(count);
+    setup_domain("bench", test->read_sel,
+		 test->sel_speculate ? spec_depth : 0, &domain_id);
+
+    rv = ipmi_domain_pointer_cb(domain_id, run_test_cb, test);
+    if (rv)
+	err_leave(rv, "ipmi_domain_pointer_cb");
+
+    /* Tear it all down again, with everything the test left in it. */
+    close_domain(domain_id);
+}
+
+/*
+ * sensors
+ */
+#define SENSOR_CONVS 37
+
+static long sensors_heap_start;
+
+static void
+sensors_write_emu(FILE *f, unsigned int count)
+{
+    unsigned int i;
+
+    if (count > 1024)
+	err_leave(EINVAL, "At most 1024 sensors");
+    for (i = 0; i < count; i++)
+	write_threshold_sensor(f, i, 7, 0x60 + (i % 32),
+			       1 + (i % SENSOR_CONVS));
+}
+
+static void
+sensors_start(unsigned int count)
+{
+    sensors_heap_start = heap_bytes;
+}
+
+static void
+sensors_count_sensor(ipmi_entity_t *entity, ipmi_sensor_t *sensor,
+		     void *cb_data)
+{
+    unsigned int *found = cb_data;
+
+    (*found)++;
+}
+
+static void
+sensors_count_entity(ipmi_entity_t *entity, void *cb_data)
+{
+    ipmi_entity_iterate_sensors(entity, sensors_count_sensor, cb_data);
+}
+
+static void
+sensors_run(ipmi_domain_t *domain, unsigned int count)
+{
+    long         bytes = heap_bytes - sensors_heap_start;
+    unsigned int found = 0;
+
+    ipmi_domain_iterate_entities(domain, sensors_count_entity, &found);
+    if (found != count)
+	err_leave(EINVAL, "Sensor count mismatch");
+
+    printf("%u sensors, %ld bytes, %ld bytes/sensor\n",
+	   count, bytes, bytes / (long) count);
+}
+
+/*
+ * cmds
+ */
+#define CMDS_ROUNDS 20
+
+static unsigned int cmds_rsps;
+static int          cmds_done;
+
+static void
+cmds_write_emu(FILE *f, unsigned int count)
+{
+    fprintf(f,
+	    "mc_add 0x30 0 no-device-sdrs 0x23 9 8 0x9f 0x1291 0xf02\n"
+	    "mc_enable 0x30\n");
+}
+
+static int
+cmds_rsp(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
+{
+    if ((rspi->msg.data_len < 1) || (rspi->msg.data[0] != 0))
+	err_leave(EINVAL, "Get Device ID failed");
+    cmds_rsps++;
+    if (cmds_rsps == count)
+	cmds_done = 1;
+    return IPMI_MSG_ITEM_NOT_USED;
+}
+
+static void
+cmds_run(ipmi_domain_t *domain, unsigned int count)
+{
+    ipmi_ipmb_addr_t addr;
+    ipmi_msg_t       msg;
+    double           start, end;
+    unsigned int     i, j;
+    int              rv;
+
+    addr.addr_type = IPMI_IPMB_ADDR_TYPE;
+    addr.channel = 0;
+    addr.slave_addr = 0x30;
+    addr.lun = 0;
+    msg.netfn = IPMI_APP_NETFN;
+    msg.cmd = IPMI_GET_DEVICE_ID_CMD;
+    msg.data = NULL;
+    msg.data_len = 0;
+
+    start = now_secs();
+    for (i = 0; i < CMDS_ROUNDS; i++) {
+	cmds_rsps = 0;
+	cmds_done = 0;
+	for (j = 0; j < count; j++) {
+	    rv = ipmi_send_command_addr(domain, (ipmi_addr_t *) &addr,
+					sizeof(addr), &msg, cmds_rsp,
+					NULL, NULL);
+	    if (rv)
+		err_leave(rv, "ipmi_send_command_addr");
+	}
+	wait_for(&cmds_done, 60.0, "Waiting for the responses");
+    }
+    end = now_secs();
+
+    printf("%u commands outstanding, %u rounds, %.2fus/command\n",
+	   count, CMDS_ROUNDS,
+	   (end - start) * 1000000.0 / (count * CMDS_ROUNDS));
+}
+
+/*
+ * entities
+ */
+#define ENTITIES_ROUNDS 20
+
+static double entities_open_start;
+
+static void
+entities_start(unsigned int count)
+{
+    entities_open_start = now_secs();
+}
+
+static void
+entities_write_emu(FILE *f, unsigned int count)
+{
+    unsigned int i;
+
+    if ((count % 5) || (count > 5000))
+	err_leave(EINVAL, "The entity count must be a multiple of 5 <= 5000");
+    for (i = 0; i < count; i += 5)
+	write_entity_assoc(f, i);
+}
+
+static void
+entities_count(ipmi_entity_t *entity, void *cb_data)
+{
+    unsigned int *found = cb_data;
+
+    (*found)++;
+}
+
+static void
+entities_run(ipmi_domain_t *domain, unsigned int count)
+{
+    ipmi_entity_info_t *ents = ipmi_domain_get_entities(domain);
+    ipmi_sdr_info_t    *sdrs = ipmi_domain_get_main_sdrs(domain);
+    unsigned int       found = 0;
+    double             open_time = now_secs() - entities_open_start;
+    double             start, end;
+    unsigned int       i;
+    int                rv;
+
+    /* The BMC adds an entity of its own. */
+    ipmi_domain_iterate_entities(domain, entities_count, &found);
+    if (found != count + 1)
+	err_leave(EINVAL, "Entity count mismatch");
+
+    start = now_secs();
+    for (i = 0; i < ENTITIES_ROUNDS; i++) {
+	rv = ipmi_entity_scan_sdrs(domain, NULL, ents, sdrs);
+	if (rv)
+	    err_leave(rv, "ipmi_entity_scan_sdrs");
+    }
+    end = now_secs();
+
+    printf("%u entities, %.2fms to come up, %.2fms/rescan\n",
+	   count, open_time * 1000.0,
+	   (end - start) * 1000.0 / ENTITIES_ROUNDS);
+}
+
+/*
+ * sel
+ */
+static double events_open_start;
+static int    events_done;
+
+static void
+events_write_emu(FILE *f, unsigned int count)
+{
+    unsigned int i;
+
+    /* Record ids 0 and 0xffff are reserved. */
+    if (count > 65534)
+	err_leave(EINVAL, "At most 65534 SEL entries");
+    fprintf(f, "sel_enable 0x20 %u 0x0a\n", count);
+    for (i = 0; i < count; i++)
+	/* A temperature upper critical going high event. */
+	fprintf(f, "sel_add 0x20 0x02 0 0 0 0 0x20 0 0x04 0x01 %u 0x01"
+		" 0x09 0 0\n", i % 256);
+}
+
+static void
+events_start(unsigned int count)
+{
+    events_open_start = now_secs();
+}
+
+static void
+events_domain_done(ipmi_domain_t *domain, int err, void *cb_data)
+{
+    if (err)
+	err_leave(err, cb_data);
+    events_done = 1;
+}
+
+static void
+events_added(ipmi_mc_t *mc, unsigned int record_id, int err, void *cb_data)
+{
+    if (err)
+	err_leave(err, "ipmi_mc_add_event_to_sel");
+    events_done = 1;
+}
+
+static void
+events_add(ipmi_mc_t *mc, void *cb_data)
+{
+    int rv;
+
+    rv = ipmi_mc_add_event_to_sel(mc, cb_data, events_added, NULL);
+    if (rv)
+	err_leave(rv, "ipmi_mc_add_event_to_sel");
+}
+
+/*
+ * Make the next fetch read the whole SEL again.  A fetch starts from
+ * the next to last record the previous one got, or from the
+ * beginning if that record has been deleted.  Delete it and add it
+ * back, so the SEL's add time changes.
+ */
+static void
+events_reset_fetch(ipmi_domain_t *domain)
+{
+    ipmi_event_t  *last, *event;
+    ipmi_mcid_t   mcid;
+    int           rv;
+
+    last = ipmi_domain_last_event(domain);
+    if (!last)
+	err_leave(ENOENT, "ipmi_domain_last_event");
+    event = ipmi_domain_prev_event(domain, last);
+    ipmi_event_free(last);
+    if (!event)
+	err_leave(ENOENT, "ipmi_domain_prev_event");
+    mcid = ipmi_event_get_mcid(event);
+
+    events_done = 0;
+    rv = ipmi_event_delete(event, events_domain_done, "ipmi_event_delete");
+    if (rv)
+	err_leave(rv, "ipmi_event_delete");
+    wait_for(&events_done, 60.0, "Waiting for the delete");
+
+    /* The BMC's last add time is in seconds, make sure it changes. */
+    sleep(1);
+
+    events_done = 0;
+    rv = ipmi_mc_pointer_cb(mcid, events_add, event);
+    if (rv)
+	err_leave(rv, "ipmi_mc_pointer_cb");
+    wait_for(&events_done, 60.0, "Waiting for the add");
+    ipmi_event_free(event);
+}
+
+static void
+events_run(ipmi_domain_t *domain, unsigned int count)
+{
+    double       open_time = now_secs() - events_open_start;
+    double       start, end;
+    unsigned int found;
+    int          rv;
+
+    rv = ipmi_domain_sel_count(domain, &found);
+    if (rv)
+	err_leave(rv, "ipmi_domain_sel_count");
+    if (found != count)
+	err_leave(EINVAL, "SEL count mismatch");
+
+    /* Only fetch the SEL when asked. */
+    ipmi_domain_set_sel_rescan_time(domain, 0);
+    events_reset_fetch(domain);
+
+    events_done = 0;
+    start = now_secs();
+    rv = ipmi_domain_reread_sels(domain, events_domain_done,
+				 "ipmi_domain_reread_sels");
+    if (rv)
+	err_leave(rv, "ipmi_domain_reread_sels");
+    wait_for(&events_done, 600.0, "Waiting for the SEL");
+    end = now_secs();
+
+    rv = ipmi_domain_sel_count(domain, &found);
+    if (rv)
+	err_leave(rv, "ipmi_domain_sel_count");
+    if (found != count)
+	err_leave(EINVAL, "SEL count mismatch after the reread");
+
+    printf("%u events, %.2fs to come up, %.2fs to reread\n",
+	   count, open_time, end - start);
+}
+
+/*
+ * selspec
+ */
+typedef struct events_snap_s
+{
+    unsigned int  record_id;
+    unsigned int  type;
+    unsigned int  data_len;
+    unsigned char data[16];
+} events_snap_t;
+
+static events_snap_t *events_snap;
+static unsigned int  events_snap_count;
+
+static void
+events_snap_one(events_snap_t *snap, ipmi_event_t *event)
+{
+    snap->record_id = ipmi_event_get_record_id(event);
+    snap->type = ipmi_event_get_type(event);
+    snap->data_len = ipmi_event_get_data_len(event);
+    if (snap->data_len > sizeof(snap->data))
+	snap->data_len = sizeof(snap->data);
+    ipmi_event_get_data(event, snap->data, 0, snap->data_len);
+}
+
+/* Copy the domain's events, in order, into events_snap. */
+static void
+events_take_snap(ipmi_domain_t *domain)
+{
+    ipmi_event_t *event, *next;
+    unsigned int num;
+    int          rv;
+
+    rv = ipmi_domain_sel_count(domain, &num);
+    if (rv)
+	err_leave(rv, "ipmi_domain_sel_count");
+    events_snap = malloc((num + 1) * sizeof(*events_snap));
+    if (!events_snap)
+	err_leave(ENOMEM, "malloc");
+
+    events_snap_count = 0;
+    event = ipmi_domain_first_event(domain);
+    while (event) {
+	if (events_snap_count >= num)
+	    err_leave(EINVAL, "More events than the SEL count");
+	events_snap_one(events_snap + events_snap_count, event);
+	events_snap_count++;
+	next = ipmi_domain_next_event(domain, event);
+	ipmi_event_free(event);
+	event = next;
+    }
+}
+
+/* Check the domain's events against events_snap. */
+static void
+events_compare_cb(ipmi_domain_t *domain, void *cb_data)
+{
+    ipmi_event_t  *event, *next;
+    events_snap_t snap;
+    unsigned int  i = 0;
+
+    event = ipmi_domain_first_event(domain);
+    while (event) {
+	if (i >= events_snap_count)
+	    err_leave(EINVAL, "The plain fetch got more events");
+	events_snap_one(&snap, event);
+	if ((snap.record_id != events_snap[i].record_id)
+	    || (snap.type != events_snap[i].type)
+	    || (snap.data_len != events_snap[i].data_len)
+	    || (memcmp(snap.data, events_snap[i].data, snap.data_len) != 0))
+	{
+	    fprintf(stderr, "Event %u differs, record id %4.4x vs %4.4x\n",
+		    i, events_snap[i].record_id, snap.record_id);
+	    err_leave(EINVAL, "The speculative fetch got a different SEL");
+	}
+	i++;
+	next = ipmi_domain_next_event(domain, event);
+	ipmi_event_free(event);
+	event = next;
+    }
+    if (i != events_snap_count)
+	err_leave(EINVAL, "The plain fetch got fewer events");
+}
+
+static void
+events_sum_stat(ipmi_domain_t *domain, ipmi_domain_stat_t *stat,
+		void *cb_data)
+{
+    unsigned int *sum = cb_data;
+
+    *sum += ipmi_domain_stat_get(stat);
+}
+
+static void
+events_spec_run(ipmi_domain_t *domain, unsigned int count)
+{
+    ipmi_domain_id_t ref_id;
+    unsigned int     hits = 0, misses = 0;
+    int              rv;
+
+    /* This domain fetches speculatively, time that as usual. */
+    events_run(domain, count);
+    ipmi_domain_stat_iterate(domain, "sel_speculate_hits", NULL,
+			     events_sum_stat, &hits);
+    ipmi_domain_stat_iterate(domain, "sel_speculate_misses", NULL,
+			     events_sum_stat, &misses);
+    events_take_snap(domain);
+
+    /* Read the same SEL without speculation and compare. */
+    setup_domain("bench-plain", 1, 0, &ref_id);
+    rv = ipmi_domain_pointer_cb(ref_id, events_compare_cb, NULL);
+    if (rv)
+	err_leave(rv, "ipmi_domain_pointer_cb");
+    close_domain(ref_id);
+    free(events_snap);
+
+    printf("%u ahead, same as a plain fetch, %u hits, %u misses\n",
+	   spec_depth, hits, misses);
+}
+
+/*
+ * pps
+ */
+#define PPS_WINDOW 8
+#define PPS_SECS   3.0
+
+static void
+pps_write_emu(FILE *f, unsigned int count)
+{
+}
+
+static void
+pps_send(int fd, unsigned int num)
+{
+    while (num-- > 0) {
+	if (send(fd, auth_caps_req, sizeof(auth_caps_req), 0) == -1
+	    && errno != EAGAIN && errno != EWOULDBLOCK)
+	    err_leave(errno, "send");
+    }
+}
+
+static void
+pps_run(ipmi_domain_t *domain, unsigned int count)
+{
+    struct sockaddr_in addr;
+    struct pollfd      *pfds;
+    unsigned char      rsp[64];
+    unsigned long      rsps = 0;
+    double             start, end;
+    unsigned int       i;
+    int                rv;
+
+    pfds = malloc(count * sizeof(*pfds));
+    if (!pfds)
+	err_leave(ENOMEM, "malloc");
+    sim_sockaddr(&addr);
+    for (i = 0; i < count; i++) {
+	pfds[i].fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (pfds[i].fd == -1)
+	    err_leave(errno, "socket");
+	if (connect(pfds[i].fd, (struct sockaddr *) &addr, sizeof(addr)))
+	    err_leave(errno, "connect");
+	fcntl(pfds[i].fd, F_SETFL, O_NONBLOCK);
+	pfds[i].events = POLLIN;
+	pps_send(pfds[i].fd, PPS_WINDOW);
+    }
+
+    start = now_secs();
+    end = start + PPS_SECS;
+    while (now_secs() < end) {
+	rv = poll(pfds, count, 100);
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    err_leave(errno, "poll");
+	}
+	if (rv == 0) {
+	    /* Something got dropped, fill the windows again. */
+	    for (i = 0; i < count; i++)
+		pps_send(pfds[i].fd, PPS_WINDOW);
+	    continue;
+	}
+	for (i = 0; i < count; i++) {
+	    if (!(pfds[i].revents & POLLIN))
+		continue;
+	    while (recv(pfds[i].fd, rsp, sizeof(rsp), 0) > 0) {
+		rsps++;
+		pps_send(pfds[i].fd, 1);
+	    }
+	}
+    }
+    end = now_secs();
+
+    for (i = 0; i < count; i++)
+	close(pfds[i].fd);
+    free(pfds);
+
+    printf("%u sockets, %u outstanding each, %.0f responses/s\n",
+	   count, PPS_WINDOW, rsps / (end - start));
+}
+
+static bench_test_t tests[] =
+{
+    { "sensors",  1000,  0, 0, sensors_write_emu,  sensors_start,
+      sensors_run },
+    { "cmds",     1000,  0, 0, cmds_write_emu,     NULL,
+      cmds_run },
+    { "entities", 5000,  0, 0, entities_write_emu, entities_start,
+      entities_run },
+    { "sel",      65534, 1, 0, events_write_emu,   events_start,
+      events_run },
+    { "selspec",  65534, 1, 1, events_write_emu,   events_start,
+      events_spec_run },
+    { "pps",      8,     0, 0, pps_write_emu,      NULL,
+      pps_run },
+    { NULL }
+};
+
+int
+main(int argc, char *argv[])
+{
+    char         *sim = "../lanserv/ipmi_sim";
+    bench_test_t *test;
+    int          c;
+    int          rv;
+
+    while ((c = getopt(argc, argv, "s:c:d:")) != -1) {
+	switch (c) {
+	case 's':
+	    sim = optarg;
+	    break;
+	case 'c':
+	    count = strtoul(optarg, NULL, 0);
+	    break;
+	case 'd':
+	    spec_depth = strtoul(optarg, NULL, 0);
+	    break;
+	default:
+	    fprintf(stderr, "Usage: bench_domain [-s ipmi_sim] [-c count]"
+		    " [-d depth] test\n");
+	    exit(1);
+	}
+    }
+    if (optind >= argc)
+	err_leave(EINVAL, "No test given");
+    for (test = tests; test->name; test++) {
+	if (strcmp(test->name, argv[optind]) == 0)
+	    break;
+    }
+    if (!test->name)
+	err_leave(EINVAL, argv[optind]);
+    if (!count)
+	count = test->def_count;
+
+    os_hnd = ipmi_posix_setup_os_handler();
+    if (!os_hnd)
+	err_leave(ENOMEM, "ipmi_posix_setup_os_handler");
+    real_mem_alloc = os_hnd->mem_alloc;
+    os_hnd->mem_alloc = counting_mem_alloc;
+    real_mem_free = os_hnd->mem_free;
+    os_hnd->mem_free = counting_mem_free;
+
+    rv = ipmi_init(os_hnd);
+    if (rv)
+	err_leave(rv, "ipmi_init");
+
+    start_sim(sim, test);
+    open_domain(test);
+    stop_sim();
+
+    return 0;
+}
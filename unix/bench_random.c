@@ -0,0 +1,160 @@
+/*
+ * bench_random.c
+ *
+ * Microbenchmark for the POSIX OS handler get_random().
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * Lesser General Public License (GPL) Version 2 or the modified BSD
+ * license below.  The following disclamer applies to both licenses:
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * GNU Lesser General Public Licence
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Modified BSD Licence
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *   3. The name of the author may not be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ */
+
+/*
+ * Usage: bench_random [seconds]
+ *
+ * Measures the cost of getting a 16-byte AES-CBC IV, per call,
+ * through the OS handler's get_random() and by opening and reading
+ * /dev/urandom for every call, the way get_random() used to work.
+ * Also measures a few larger sizes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <OpenIPMI/selector.h>
+#include <OpenIPMI/ipmi_posix.h>
+
+static void
+err_leave(int err, char *str)
+{
+    fprintf(stderr, "%s: %s (%d)\n", str, strerror(err), err);
+    exit(1);
+}
+
+static double
+now_secs(void)
+{
+    struct timeval tv;
+
+    sel_get_monotonic_time(&tv);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static int
+urandom_read(os_handler_t *os_hnd, void *data, unsigned int len)
+{
+    int fd = open("/dev/urandom", O_RDONLY);
+    int rv;
+
+    if (fd == -1)
+	return errno;
+
+    while (len > 0) {
+	rv = read(fd, data, len);
+	if (rv < 0) {
+	    rv = errno;
+	    goto out;
+	}
+	len -= rv;
+	data += rv;
+    }
+
+    rv = 0;
+
+ out:
+    close(fd);
+    return rv;
+}
+
+static double
+bench(os_handler_t *os_hnd,
+      int (*get)(os_handler_t *os_hnd, void *data, unsigned int len),
+      unsigned int len, double secs)
+{
+    unsigned char data[4096];
+    unsigned long count = 0;
+    double start, end;
+    unsigned int i;
+    int rv;
+
+    start = now_secs();
+    do {
+	for (i = 0; i < 1000; i++) {
+	    rv = get(os_hnd, data, len);
+	    if (rv)
+		err_leave(rv, "get random");
+	}
+	count += i;
+	end = now_secs();
+    } while (end - start < secs);
+    return (end - start) * 1000000000.0 / count;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static unsigned int sizes[] = { 16, 20, 256, 4096, 0 };
+    os_handler_t *os_hnd;
+    double secs = 1.0;
+    double old, new;
+    unsigned int i;
+
+    if (argc > 1)
+	secs = strtod(argv[1], NULL);
+
+    os_hnd = ipmi_posix_setup_os_handler();
+    if (!os_hnd)
+	err_leave(ENOMEM, "ipmi_posix_setup_os_handler");
+
+    printf("%8s %16s %16s\n", "bytes", "ns/call urandom", "ns/call handler");
+    for (i = 0; sizes[i]; i++) {
+	old = bench(os_hnd, urandom_read, sizes[i], secs);
+	new = bench(os_hnd, os_hnd->get_random, sizes[i], secs);
+	printf("%8u %16.0f %16.0f\n", sizes[i], old, new);
+    }
+
+    os_hnd->free_os_handler(os_hnd);
+    return 0;
+}
@@ -0,0 +1,404 @@
+/*
+ * bench_rmcpp.c
+ *
+ * Microbenchmark for RMCP+ AES-CBC and HMAC packet handling.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * Lesser General Public License (GPL) Version 2 or the modified BSD
+ * license below.  The following disclamer applies to both licenses:
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * GNU Lesser General Public Licence
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Modified BSD Licence
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *   3. The name of the author may not be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ */
+
+/*
+ * Usage: bench_rmcpp [seconds]
+ *
+ * Measures sealing a packet (AES-CBC-128 encrypt and HMAC-SHA1-96)
+ * and opening it again (HMAC check and decrypt), per packet, two
+ * ways: setting up a new cipher context and HMAC key for every
+ * packet and copying the payload to scratch memory, the way lib/
+ * aes_cbc.c and hmac.c used to work, and with contexts keyed once
+ * per session that only load the IV and copy the digest states, the
+ * way they work now.  Both produce the same bytes.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <OpenIPMI/selector.h>
+
+#ifdef HAVE_OPENSSL
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#define INTEG_LEN  12	/* HMAC-SHA1-96 */
+#define BLOCK_LEN  16
+#define HMAC_BLOCK 64
+#define MAX_DATA   4096
+
+static unsigned char k1[20], k2[BLOCK_LEN];
+
+typedef struct keyed_s
+{
+    EVP_CIPHER_CTX *ectx;
+    EVP_CIPHER_CTX *dctx;
+    EVP_MD_CTX     *inner;
+    EVP_MD_CTX     *outer;
+    EVP_MD_CTX     *work;
+} keyed_t;
+
+static void
+err_leave(int err, char *str)
+{
+    fprintf(stderr, "%s: %s (%d)\n", str, strerror(err), err);
+    exit(1);
+}
+
+static double
+now_secs(void)
+{
+    struct timeval tv;
+
+    sel_get_monotonic_time(&tv);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+/* Pad the data the way IPMI does, returning the padded length. */
+static unsigned int
+add_pad(unsigned char *d, unsigned int len)
+{
+    unsigned int padlen = 15 - (len % BLOCK_LEN);
+    unsigned int i;
+
+    for (i = 0; i < padlen; i++)
+	d[len + i] = i + 1;
+    d[len + padlen] = padlen;
+    return len + padlen + 1;
+}
+
+static int
+check_pad(unsigned char *d, unsigned int len, unsigned int *out_len)
+{
+    unsigned int padlen = d[len - 1];
+    unsigned int i;
+
+    if (padlen >= BLOCK_LEN)
+	return EINVAL;
+    for (i = 0; i < padlen; i++) {
+	if (d[len - 2 - i] != padlen - i)
+	    return EINVAL;
+    }
+    *out_len = len - padlen - 1;
+    return 0;
+}
+
+/*
+ * Per packet setup.  pkt is the IV followed by room for the encrypted
+ * data and the integrity trailer, the return is the sealed length.
+ */
+static unsigned int
+old_seal(unsigned char *pkt, unsigned char *data, unsigned int len)
+{
+    EVP_CIPHER_CTX *ctx;
+    unsigned char  *d;
+    unsigned char  integ[EVP_MAX_MD_SIZE];
+    unsigned int   l, ilen;
+    int            outlen, tmplen;
+
+    d = malloc(len + BLOCK_LEN);
+    if (!d)
+	err_leave(ENOMEM, "malloc");
+    memcpy(d, data, len);
+    l = add_pad(d, len);
+
+    ctx = EVP_CIPHER_CTX_new();
+    if (!ctx)
+	err_leave(ENOMEM, "EVP_CIPHER_CTX_new");
+    EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, k2, pkt);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    if (!EVP_EncryptUpdate(ctx, pkt + BLOCK_LEN, &outlen, d, l)
+	|| !EVP_EncryptFinal_ex(ctx, pkt + BLOCK_LEN + outlen, &tmplen))
+	err_leave(EINVAL, "encrypt");
+    EVP_CIPHER_CTX_free(ctx);
+    free(d);
+    l = BLOCK_LEN + outlen + tmplen;
+
+    HMAC(EVP_sha1(), k1, sizeof(k1), pkt, l, integ, &ilen);
+    memcpy(pkt + l, integ, INTEG_LEN);
+    return l + INTEG_LEN;
+}
+
+static unsigned int
+old_open(unsigned char *pkt, unsigned int len, unsigned char **data)
+{
+    EVP_CIPHER_CTX *ctx;
+    unsigned char  *d;
+    unsigned char  integ[EVP_MAX_MD_SIZE];
+    unsigned int   l = len - INTEG_LEN, ilen, out_len;
+    int            outlen;
+
+    HMAC(EVP_sha1(), k1, sizeof(k1), pkt, l, integ, &ilen);
+    if (memcmp(integ, pkt + l, INTEG_LEN) != 0)
+	err_leave(EINVAL, "integrity check");
+
+    l -= BLOCK_LEN;
+    d = malloc(l);
+    if (!d)
+	err_leave(ENOMEM, "malloc");
+    memcpy(d, pkt + BLOCK_LEN, l);
+    ctx = EVP_CIPHER_CTX_new();
+    if (!ctx)
+	err_leave(ENOMEM, "EVP_CIPHER_CTX_new");
+    EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, k2, pkt);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    if (!EVP_DecryptUpdate(ctx, pkt + BLOCK_LEN, &outlen, d, l))
+	err_leave(EINVAL, "decrypt");
+    EVP_CIPHER_CTX_free(ctx);
+    free(d);
+
+    if (check_pad(pkt + BLOCK_LEN, outlen, &out_len))
+	err_leave(EINVAL, "padding");
+    *data = pkt + BLOCK_LEN;
+    return out_len;
+}
+
+/* Keyed once, the way the library and ipmi_sim do it now. */
+static void
+keyed_setup(keyed_t *k)
+{
+    unsigned char pad[HMAC_BLOCK];
+    unsigned int  i;
+
+    k->ectx = EVP_CIPHER_CTX_new();
+    k->dctx = EVP_CIPHER_CTX_new();
+    k->inner = EVP_MD_CTX_new();
+    k->outer = EVP_MD_CTX_new();
+    k->work = EVP_MD_CTX_new();
+    if (!k->ectx || !k->dctx || !k->inner || !k->outer || !k->work)
+	err_leave(ENOMEM, "keyed_setup");
+    if (!EVP_EncryptInit_ex(k->ectx, EVP_aes_128_cbc(), NULL, k2, NULL)
+	|| !EVP_DecryptInit_ex(k->dctx, EVP_aes_128_cbc(), NULL, k2, NULL))
+	err_leave(EINVAL, "keyed_setup");
+    EVP_CIPHER_CTX_set_padding(k->ectx, 0);
+    EVP_CIPHER_CTX_set_padding(k->dctx, 0);
+
+    memset(pad, 0x36, sizeof(pad));
+    for (i = 0; i < sizeof(k1); i++)
+	pad[i] ^= k1[i];
+    if (!EVP_DigestInit_ex(k->inner, EVP_sha1(), NULL)
+	|| !EVP_DigestUpdate(k->inner, pad, sizeof(pad)))
+	err_leave(EINVAL, "keyed_setup");
+    memset(pad, 0x5c, sizeof(pad));
+    for (i = 0; i < sizeof(k1); i++)
+	pad[i] ^= k1[i];
+    if (!EVP_DigestInit_ex(k->outer, EVP_sha1(), NULL)
+	|| !EVP_DigestUpdate(k->outer, pad, sizeof(pad)))
+	err_leave(EINVAL, "keyed_setup");
+}
+
+static void
+keyed_hmac(keyed_t *k, unsigned char *data, unsigned int len,
+	   unsigned char *integ)
+{
+    unsigned char ihash[EVP_MAX_MD_SIZE];
+    unsigned int  ihash_len, integ_len;
+
+    if (!EVP_MD_CTX_copy_ex(k->work, k->inner)
+	|| !EVP_DigestUpdate(k->work, data, len)
+	|| !EVP_DigestFinal_ex(k->work, ihash, &ihash_len)
+	|| !EVP_MD_CTX_copy_ex(k->work, k->outer)
+	|| !EVP_DigestUpdate(k->work, ihash, ihash_len)
+	|| !EVP_DigestFinal_ex(k->work, integ, &integ_len))
+	err_leave(EINVAL, "hmac");
+}
+
+static unsigned int
+keyed_seal(keyed_t *k, unsigned char *pkt, unsigned char *data,
+	   unsigned int len)
+{
+    unsigned char integ[EVP_MAX_MD_SIZE];
+    unsigned int  l;
+    int           outlen, tmplen;
+
+    /* The library encrypts in place, the payload is already there. */
+    memcpy(pkt + BLOCK_LEN, data, len);
+    l = add_pad(pkt + BLOCK_LEN, len);
+    if (!EVP_EncryptInit_ex(k->ectx, NULL, NULL, NULL, pkt)
+	|| !EVP_EncryptUpdate(k->ectx, pkt + BLOCK_LEN, &outlen,
+			      pkt + BLOCK_LEN, l)
+	|| !EVP_EncryptFinal_ex(k->ectx, pkt + BLOCK_LEN + outlen, &tmplen))
+	err_leave(EINVAL, "encrypt");
+    l = BLOCK_LEN + outlen + tmplen;
+
+    keyed_hmac(k, pkt, l, integ);
+    memcpy(pkt + l, integ, INTEG_LEN);
+    return l + INTEG_LEN;
+}
+
+static unsigned int
+keyed_open(keyed_t *k, unsigned char *pkt, unsigned int len,
+	   unsigned char **data)
+{
+    unsigned char integ[EVP_MAX_MD_SIZE];
+    unsigned int  l = len - INTEG_LEN, out_len;
+    int           outlen;
+
+    keyed_hmac(k, pkt, l, integ);
+    if (memcmp(integ, pkt + l, INTEG_LEN) != 0)
+	err_leave(EINVAL, "integrity check");
+
+    l -= BLOCK_LEN;
+    if (!EVP_DecryptInit_ex(k->dctx, NULL, NULL, NULL, pkt)
+	|| !EVP_DecryptUpdate(k->dctx, pkt + BLOCK_LEN, &outlen,
+			      pkt + BLOCK_LEN, l))
+	err_leave(EINVAL, "decrypt");
+
+    if (check_pad(pkt + BLOCK_LEN, outlen, &out_len))
+	err_leave(EINVAL, "padding");
+    *data = pkt + BLOCK_LEN;
+    return out_len;
+}
+
+static unsigned char pkt[BLOCK_LEN + MAX_DATA + BLOCK_LEN + INTEG_LEN];
+static unsigned char data[MAX_DATA];
+
+/* Make a new IV for each packet, it's part of the sealed output. */
+static void
+next_iv(unsigned char *iv, unsigned long n)
+{
+    memset(iv, 0, BLOCK_LEN);
+    memcpy(iv, &n, sizeof(n));
+}
+
+static double
+bench(keyed_t *k, unsigned int len, double secs)
+{
+    unsigned long count = 0;
+    unsigned char *out;
+    unsigned int  l, i;
+    double        start, end;
+
+    start = now_secs();
+    do {
+	for (i = 0; i < 1000; i++) {
+	    next_iv(pkt, count + i);
+	    if (k) {
+		l = keyed_seal(k, pkt, data, len);
+		l = keyed_open(k, pkt, l, &out);
+	    } else {
+		l = old_seal(pkt, data, len);
+		l = old_open(pkt, l, &out);
+	    }
+	    if (l != len)
+		err_leave(EINVAL, "length mismatch");
+	}
+	count += i;
+	end = now_secs();
+    } while (end - start < secs);
+    return (end - start) * 1000000000.0 / count;
+}
+
+/* Both ways have to produce the same packet and get the data back. */
+static void
+check_same(keyed_t *k, unsigned int len)
+{
+    static unsigned char opkt[sizeof(pkt)];
+    unsigned char        *out;
+    unsigned int         l1, l2;
+
+    next_iv(opkt, len);
+    l1 = old_seal(opkt, data, len);
+    next_iv(pkt, len);
+    l2 = keyed_seal(k, pkt, data, len);
+    if (l1 != l2 || memcmp(opkt, pkt, l1) != 0)
+	err_leave(EINVAL, "sealed packets differ");
+    if (keyed_open(k, opkt, l1, &out) != len || memcmp(out, data, len) != 0)
+	err_leave(EINVAL, "keyed open failed");
+    if (old_open(pkt, l2, &out) != len || memcmp(out, data, len) != 0)
+	err_leave(EINVAL, "old open failed");
+}
+
+int
+main(int argc, char *argv[])
+{
+    static unsigned int sizes[] = { 16, 64, 256, 1024, 0 };
+    keyed_t      k;
+    double       secs = 1.0;
+    double       old, new;
+    unsigned int i;
+
+    if (argc > 1)
+	secs = strtod(argv[1], NULL);
+
+    for (i = 0; i < sizeof(k1); i++)
+	k1[i] = i * 7 + 1;
+    for (i = 0; i < sizeof(k2); i++)
+	k2[i] = i * 13 + 5;
+    for (i = 0; i < sizeof(data); i++)
+	data[i] = i;
+    keyed_setup(&k);
+
+    printf("%8s %20s %20s\n", "bytes", "ns/packet per-packet",
+	   "ns/packet keyed");
+    for (i = 0; sizes[i]; i++) {
+	check_same(&k, sizes[i]);
+	old = bench(NULL, sizes[i], secs);
+	new = bench(&k, sizes[i], secs);
+	printf("%8u %20.0f %20.0f\n", sizes[i], old, new);
+    }
+
+    return 0;
+}
+
+#else
+
+int
+main(int argc, char *argv[])
+{
+    printf("Built without OpenSSL, nothing to measure\n");
+    return 0;
+}
+
+#endif /* HAVE_OPENSSL */
@@ -0,0 +1,290 @@
+/*
+ * bench_selector.c
+ *
+ * Microbenchmarks for the selector.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * Lesser General Public License (GPL) Version 2 or the modified BSD
+ * license below.  The following disclamer applies to both licenses:
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * GNU Lesser General Public Licence
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Modified BSD Licence
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *   3. The name of the author may not be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ */
+
+/*
+ * Usage: bench_selector [seconds]
+ *
+ * fd mode: Registers N pipes that are always readable (the data is
+ * never drained) and counts how many read handler calls the selector
+ * can make per second with one fd per wait and with batched waits.
+ *
+ * timer mode: Starts N timers a few seconds out, then restarts them
+ * one after another (stop and start with a new timeout, like a
+ * command timer when the response arrives) and counts restarts per
+ * second with the heap and with the timer wheel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <OpenIPMI/selector.h>
+
+static unsigned long count;
+static unsigned int rand_state = 1;
+
+static void
+err_leave(int err, char *str)
+{
+    fprintf(stderr, "%s: %s (%d)\n", str, strerror(err), err);
+    exit(1);
+}
+
+static double
+now_secs(void)
+{
+    struct timeval tv;
+
+    sel_get_monotonic_time(&tv);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static void
+read_ready(int fd, void *cb_data)
+{
+    count++;
+}
+
+static int
+bench_fds(unsigned int nfds, unsigned int batch, double secs, double *rate)
+{
+    struct selector_s *sel;
+    int (*fds)[2];
+    unsigned int i, opened = 0;
+    struct timeval tv;
+    double start, end;
+    int rv;
+
+    fds = malloc(nfds * sizeof(*fds));
+    if (!fds)
+	return ENOMEM;
+
+    rv = sel_alloc_selector_nothread(&sel);
+    if (rv)
+	err_leave(rv, "sel_alloc_selector_nothread");
+    rv = sel_set_max_fd_events(sel, batch);
+    if (rv)
+	err_leave(rv, "sel_set_max_fd_events");
+
+    for (i = 0; i < nfds; i++) {
+	if (pipe(fds[i]) == -1) {
+	    rv = errno;
+	    goto out;
+	}
+	opened++;
+	if (write(fds[i][1], "x", 1) != 1) {
+	    rv = errno;
+	    goto out;
+	}
+	rv = sel_set_fd_handlers(sel, fds[i][0], NULL, read_ready,
+				 NULL, NULL, NULL);
+	if (rv)
+	    goto out;
+	sel_set_fd_read_handler(sel, fds[i][0], SEL_FD_HANDLER_ENABLED);
+    }
+
+    count = 0;
+    start = now_secs();
+    do {
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	sel_select(sel, NULL, 0, NULL, &tv);
+	end = now_secs();
+    } while (end - start < secs);
+    *rate = count / (end - start);
+
+ out:
+    for (i = 0; i < opened; i++) {
+	sel_clear_fd_handlers(sel, fds[i][0]);
+	close(fds[i][0]);
+	close(fds[i][1]);
+    }
+    /* Let the fd done handlers run. */
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    sel_select(sel, NULL, 0, NULL, &tv);
+    sel_free_selector(sel);
+    free(fds);
+    return rv;
+}
+
+static unsigned int
+next_rand(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static void
+timer_expired(struct selector_s *sel, sel_timer_t *timer, void *data)
+{
+    count++;
+}
+
+static void
+rand_timeout(struct timeval *now, struct timeval *tv)
+{
+    unsigned int msec = 2000 + next_rand() % 3000;
+
+    tv->tv_sec = now->tv_sec + msec / 1000;
+    tv->tv_usec = now->tv_usec + (msec % 1000) * 1000;
+    if (tv->tv_usec >= 1000000) {
+	tv->tv_sec++;
+	tv->tv_usec -= 1000000;
+    }
+}
+
+static int
+bench_timers(unsigned int ntimers, int timer_type, double secs, double *rate)
+{
+    struct selector_s *sel;
+    sel_timer_t **timers;
+    unsigned int i, allocated = 0;
+    unsigned long restarts = 0;
+    struct timeval now, tv;
+    double start, end;
+    int rv;
+
+    timers = malloc(ntimers * sizeof(*timers));
+    if (!timers)
+	return ENOMEM;
+
+    rv = sel_alloc_selector_timers(&sel, timer_type, 0,
+				   NULL, NULL, NULL, NULL, NULL);
+    if (rv)
+	err_leave(rv, "sel_alloc_selector_timers");
+
+    sel_get_monotonic_time(&now);
+    for (i = 0; i < ntimers; i++) {
+	rv = sel_alloc_timer(sel, timer_expired, NULL, &timers[i]);
+	if (rv)
+	    goto out;
+	allocated++;
+	rand_timeout(&now, &tv);
+	sel_start_timer(timers[i], &tv);
+    }
+
+    count = 0;
+    start = now_secs();
+    do {
+	/* Let the selector look at the timers now and then. */
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	sel_select(sel, NULL, 0, NULL, &tv);
+
+	sel_get_monotonic_time(&now);
+	for (i = 0; i < 1000; i++) {
+	    sel_timer_t *timer = timers[next_rand() % ntimers];
+
+	    sel_stop_timer(timer);
+	    rand_timeout(&now, &tv);
+	    sel_start_timer(timer, &tv);
+	}
+	restarts += i;
+	end = now_secs();
+    } while (end - start < secs);
+    *rate = restarts / (end - start);
+
+ out:
+    for (i = 0; i < allocated; i++)
+	sel_free_timer(timers[i]);
+    sel_free_selector(sel);
+    free(timers);
+    return rv;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static unsigned int fd_counts[] = { 1, 16, 64, 256, 1024, 4096, 0 };
+    static unsigned int timer_counts[] = { 1000, 10000, 100000, 0 };
+    double secs = 1.0;
+    struct rlimit rl;
+    unsigned int i;
+    double single, batched, heap, wheel;
+    int rv;
+
+    if (argc > 1)
+	secs = strtod(argv[1], NULL);
+
+    /* Each pipe is two fds, get as many as we can. */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    printf("%8s %16s %16s\n", "fds", "events/s (1)", "events/s (batch)");
+    for (i = 0; fd_counts[i]; i++) {
+	rv = bench_fds(fd_counts[i], 1, secs, &single);
+	if (!rv)
+	    rv = bench_fds(fd_counts[i], SEL_MAX_FD_EVENTS, secs, &batched);
+	if (rv) {
+	    printf("%8u skipped: %s\n", fd_counts[i], strerror(rv));
+	    continue;
+	}
+	printf("%8u %16.0f %16.0f\n", fd_counts[i], single, batched);
+    }
+
+    printf("\n%8s %16s %16s\n", "timers", "restarts/s heap", "restarts/s wheel");
+    for (i = 0; timer_counts[i]; i++) {
+	rv = bench_timers(timer_counts[i], SEL_TIMERS_HEAP, secs, &heap);
+	if (!rv)
+	    rv = bench_timers(timer_counts[i], SEL_TIMERS_WHEEL, secs, &wheel);
+	if (rv) {
+	    printf("%8u skipped: %s\n", timer_counts[i], strerror(rv));
+	    continue;
+	}
+	printf("%8u %16.0f %16.0f\n", timer_counts[i], heap, wheel);
+    }
+
+    return 0;
+}
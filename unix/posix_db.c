@@ -0,0 +1,259 @@
+/*
+ * posix_db.c
+ *
+ * On-disk cache for the POSIX OS handler database calls.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "posix_db.h"
+
+#define POSIX_DB_DIR		".OpenIPMI_cache"
+#define POSIX_DB_MAGIC		0x4f494442 /* "OIDB" */
+#define POSIX_DB_VERSION	1
+/* Keeps the header well inside the first page, posix_db_free()
+   depends on that to find the start of the mapping. */
+#define POSIX_DB_MAX_KEY	255
+
+/*
+ * The file is the header, the key padded to 8 bytes, then the data
+ * starting at hdr_len.  The key is kept so a find can tell if two
+ * keys mapped to the same file name.  Entries are in native byte
+ * order, they are only a cache for the local machine.
+ */
+typedef struct posix_db_hdr_s
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t hdr_len;
+    uint32_t key_len;
+    uint32_t data_len;
+} posix_db_hdr_t;
+
+char *
+posix_db_default_dir(void)
+{
+    char *home = getenv("HOME");
+    char *dir;
+
+    if (!home)
+	return NULL;
+    dir = malloc(strlen(home) + strlen(POSIX_DB_DIR) + 2);
+    if (!dir)
+	return NULL;
+    strcpy(dir, home);
+    strcat(dir, "/");
+    strcat(dir, POSIX_DB_DIR);
+    return dir;
+}
+
+static char *
+key_to_filename(const char *dir, const char *key, const char *suffix)
+{
+    unsigned int dlen = strlen(dir);
+    unsigned int klen = strlen(key);
+    char         *name, *p;
+
+    name = malloc(dlen + klen + strlen(suffix) + 2);
+    if (!name)
+	return NULL;
+    strcpy(name, dir);
+    p = name + dlen;
+    *p++ = '/';
+    for (; *key; key++) {
+	if (isalnum((unsigned char) *key) || *key == '-' || *key == '_'
+	    || (*key == '.' && p != name + dlen + 1))
+	    *p++ = *key;
+	else
+	    *p++ = '_';
+    }
+    strcpy(p, suffix);
+    return name;
+}
+
+static unsigned int
+calc_hdr_len(unsigned int key_len)
+{
+    return sizeof(posix_db_hdr_t) + ((key_len + 7) & ~7);
+}
+
+static int
+write_all(int fd, const void *data, unsigned int len)
+{
+    const unsigned char *d = data;
+    ssize_t             rv;
+
+    while (len > 0) {
+	rv = write(fd, d, len);
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return errno;
+	}
+	d += rv;
+	len -= rv;
+    }
+    return 0;
+}
+
+int
+posix_db_store(const char          *dir,
+	       const char          *key,
+	       const unsigned char *data,
+	       unsigned int        data_len)
+{
+    unsigned int   key_len = strlen(key);
+    unsigned int   hdr_len = calc_hdr_len(key_len);
+    unsigned char  *hdr;
+    posix_db_hdr_t h;
+    char           *name, *tmpname;
+    int            fd;
+    int            rv;
+
+    if (key_len > POSIX_DB_MAX_KEY)
+	return EINVAL;
+
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+	return errno;
+
+    name = key_to_filename(dir, key, "");
+    if (!name)
+	return ENOMEM;
+    tmpname = key_to_filename(dir, key, ".XXXXXX");
+    if (!tmpname) {
+	free(name);
+	return ENOMEM;
+    }
+
+    hdr = calloc(1, hdr_len);
+    if (!hdr) {
+	rv = ENOMEM;
+	goto out;
+    }
+    h.magic = POSIX_DB_MAGIC;
+    h.version = POSIX_DB_VERSION;
+    h.hdr_len = hdr_len;
+    h.key_len = key_len;
+    h.data_len = data_len;
+    memcpy(hdr, &h, sizeof(h));
+    memcpy(hdr + sizeof(h), key, key_len);
+
+    /* Write a new file and rename it over the old one, so anyone
+       finding the entry sees either the old or the new one. */
+    fd = mkstemp(tmpname);
+    if (fd == -1) {
+	rv = errno;
+	goto out;
+    }
+    rv = write_all(fd, hdr, hdr_len);
+    if (!rv)
+	rv = write_all(fd, data, data_len);
+    if (close(fd) == -1 && !rv)
+	rv = errno;
+    if (!rv && rename(tmpname, name) == -1)
+	rv = errno;
+    if (rv)
+	unlink(tmpname);
+
+ out:
+    free(hdr);
+    free(tmpname);
+    free(name);
+    return rv;
+}
+
+int
+posix_db_find(const char    *dir,
+	      const char    *key,
+	      unsigned char **data,
+	      unsigned int  *data_len)
+{
+    unsigned int   key_len = strlen(key);
+    posix_db_hdr_t *h;
+    struct stat    st;
+    unsigned char  *base;
+    char           *name;
+    int            fd;
+
+    if (key_len > POSIX_DB_MAX_KEY)
+	return ENOENT;
+
+    name = key_to_filename(dir, key, "");
+    if (!name)
+	return ENOMEM;
+    fd = open(name, O_RDONLY);
+    free(name);
+    if (fd == -1)
+	return ENOENT;
+
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) calc_hdr_len(key_len)) {
+	close(fd);
+	return ENOENT;
+    }
+
+    /* The mapping stays valid after the close, and a later store
+       renames a new file into place instead of changing this one. */
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+	return ENOENT;
+
+    h = (posix_db_hdr_t *) base;
+    if (h->magic != POSIX_DB_MAGIC
+	|| h->version != POSIX_DB_VERSION
+	|| h->key_len != key_len
+	|| h->hdr_len != calc_hdr_len(key_len)
+	|| ((off_t) h->hdr_len + h->data_len) != st.st_size
+	|| memcmp(base + sizeof(*h), key, key_len) != 0)
+    {
+	munmap(base, st.st_size);
+	return ENOENT;
+    }
+
+    *data = base + h->hdr_len;
+    *data_len = h->data_len;
+    return 0;
+}
+
+void
+posix_db_free(unsigned char *data)
+{
+    uintptr_t      page_mask = sysconf(_SC_PAGESIZE) - 1;
+    posix_db_hdr_t *h;
+
+    h = (posix_db_hdr_t *) ((uintptr_t) data & ~page_mask);
+    munmap(h, h->hdr_len + h->data_len);
+}
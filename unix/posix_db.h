@@ -0,0 +1,59 @@
+/*
+ * posix_db.h
+ *
+ * On-disk cache for the POSIX OS handler database calls.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef OPENIPMI_POSIX_DB_H
+#define OPENIPMI_POSIX_DB_H
+
+/*
+ * Each key is stored in its own file in a cache directory, with a
+ * small versioned header holding the key and data length.  Stores
+ * write a temporary file and rename it into place, so readers never
+ * see a partial entry and no locking is needed.  Finds map the file
+ * read-only and return a pointer into the mapping, which must be
+ * released with posix_db_free().
+ */
+
+/* The directory used if the user doesn't set one, $HOME/.OpenIPMI_cache.
+   Returns a malloc-ed string, or NULL if there is no home directory or
+   no memory. */
+char *posix_db_default_dir(void);
+
+int posix_db_store(const char          *dir,
+		   const char          *key,
+		   const unsigned char *data,
+		   unsigned int        data_len);
+
+/* Returns ENOENT if the key is not in the cache or its entry is not
+   usable (wrong version, truncated, etc.). */
+int posix_db_find(const char    *dir,
+		  const char    *key,
+		  unsigned char **data,
+		  unsigned int  *data_len);
+
+void posix_db_free(unsigned char *data);
+
+#endif /* OPENIPMI_POSIX_DB_H */
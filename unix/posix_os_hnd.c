@@ -44,12 +44,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
-#ifdef HAVE_GDBM
-#include <gdbm.h>
-#endif
 
 #include <OpenIPMI/ipmi_posix.h>
 
+#include "posix_db.h"
+#include "posix_random.h"
+
 /* CHEAP HACK - we don't want the user to have to provide this any
    more. */
 extern void posix_vlog(char                 *format,
@@ -61,10 +61,8 @@ typedef struct iposix_info_s
 {
     struct selector_s *sel;
     os_vlog_t  log_handler;
-#ifdef HAVE_GDBM
-    char *gdbm_filename;
-    GDBM_FILE gdbmf;
-#endif
+    char *db_dir;
+    posix_rand_t *rand;
 } iposix_info_t;
 
 struct os_hnd_fd_id_s
@@ -300,27 +298,12 @@ free_timer(os_handler_t *handler, os_hnd_timer_id_t *timer_data)
 static int
 get_random(os_handler_t *handler, void *data, unsigned int len)
 {
-    int fd = open("/dev/urandom", O_RDONLY);
-    int rv = 0;
-
-    if (fd == -1)
-	return errno;
-
-    while (len > 0) {
-	rv = read(fd, data, len);
-	if (rv < 0) {
-	    rv = errno;
-	    goto out;
-	}
-	len -= rv;
-	data += rv;
-    }
-
-    rv = 0;
+    iposix_info_t *info = handler->internal_data;
 
- out:
-    close(fd);
-    return rv;
+    /* If the buffer can't be allocated, just read directly. */
+    if (!info->rand)
+	posix_rand_alloc(&info->rand);
+    return posix_rand_get(info->rand, data, len);
 }
 
 static void
@@ -446,29 +429,6 @@ posix_free(void *data)
     free(data);
 }
 
-#ifdef HAVE_GDBM
-#define GDBM_FILE ".OpenIPMI_db"
-
-static void
-init_gdbm(iposix_info_t *info)
-{
-    if (!info->gdbm_filename) {
-	char *home = getenv("HOME");
-	if (!home)
-	    return;
-	info->gdbm_filename = malloc(strlen(home)+strlen(GDBM_FILE)+2);
-	if (!info->gdbm_filename)
-	    return;
-	strcpy(info->gdbm_filename, home);
-	strcat(info->gdbm_filename, "/");
-	strcat(info->gdbm_filename, GDBM_FILE);
-    }
-
-    info->gdbmf = gdbm_open(info->gdbm_filename, 512, GDBM_WRCREAT, 0600,
-			    NULL);
-    /* gdbmf will be NULL on error, which is what reports an error. */
-}
-
 static int
 database_store(os_handler_t  *handler,
 	       char          *key,
@@ -476,24 +436,14 @@ database_store(os_handler_t  *handler,
 	       unsigned int  data_len)
 {
     iposix_info_t *info = handler->internal_data;
-    datum         gkey, gdata;
-    int           rv;
 
-    if (!info->gdbmf) {
-	init_gdbm(info);
-	if (!info->gdbmf)
+    if (!info->db_dir) {
+	info->db_dir = posix_db_default_dir();
+	if (!info->db_dir)
 	    return EINVAL;
     }
 
-    gkey.dptr = key;
-    gkey.dsize = strlen(key);
-    gdata.dptr = (char *) data;
-    gdata.dsize = data_len;
-
-    rv = gdbm_store(info->gdbmf, gkey, gdata, GDBM_REPLACE);
-    if (rv)
-	return EINVAL;
-    return 0;
+    return posix_db_store(info->db_dir, key, data, data_len);
 }
 
 static int
@@ -509,21 +459,17 @@ database_find(os_handler_t  *handler,
 	      void *cb_data)
 {
     iposix_info_t *info = handler->internal_data;
-    datum         gkey, gdata;
+    int           rv;
 
-    if (!info->gdbmf) {
-	init_gdbm(info);
-	if (!info->gdbmf)
+    if (!info->db_dir) {
+	info->db_dir = posix_db_default_dir();
+	if (!info->db_dir)
 	    return EINVAL;
     }
 
-    gkey.dptr = key;
-    gkey.dsize = strlen(key);
-    gdata = gdbm_fetch(info->gdbmf, gkey);
-    if (!gdata.dptr)
-	return EINVAL;
-    *data = (unsigned char *) gdata.dptr;
-    *data_len = gdata.dsize;
+    rv = posix_db_find(info->db_dir, key, data, data_len);
+    if (rv)
+	return rv;
     *fetch_completed = 1;
     return 0;
 }
@@ -532,11 +478,11 @@ static void
 database_free(os_handler_t  *handler,
 	      unsigned char *data)
 {
-    free(data);
+    posix_db_free(data);
 }
 
 static int
-set_gdbm_filename(os_handler_t *os_hnd, char *name)
+set_db_dir(os_handler_t *os_hnd, char *name)
 {
     iposix_info_t *info = os_hnd->internal_data;
     char          *nname;
@@ -544,12 +490,11 @@ set_gdbm_filename(os_handler_t *os_hnd, char *name)
     nname = strdup(name);
     if (!nname)
 	return ENOMEM;
-    if (info->gdbm_filename)
-	free(info->gdbm_filename);
-    info->gdbm_filename = nname;
+    if (info->db_dir)
+	free(info->db_dir);
+    info->db_dir = nname;
     return 0;
 }
-#endif
 
 static void sset_log_handler(os_handler_t *handler,
 			     os_vlog_t    log_handler)
@@ -603,12 +548,10 @@ static os_handler_t ipmi_posix_os_handler =
     .free_os_handler = free_os_handler,
     .perform_one_op = perform_one_op,
     .operation_loop = operation_loop,
-#ifdef HAVE_GDBM
     .database_store = database_store,
     .database_find = database_find,
     .database_free = database_free,
-    .database_set_filename = set_gdbm_filename,
-#endif
+    .database_set_filename = set_db_dir,
     .set_log_handler = sset_log_handler,
     .get_monotonic_time = get_monotonic_time,
     .get_real_time = get_real_time
@@ -643,12 +586,10 @@ ipmi_posix_free_os_handler(os_handler_t *os_hnd)
 {
     iposix_info_t *info = os_hnd->internal_data;
 
-#ifdef HAVE_GDBM
-    if (info->gdbm_filename)
-	free(info->gdbm_filename);
-    if (info->gdbmf)
-	gdbm_close(info->gdbmf);
-#endif
+    if (info->db_dir)
+	free(info->db_dir);
+    if (info->rand)
+	posix_rand_free(info->rand);
     free(info);
     free(os_hnd);
 }
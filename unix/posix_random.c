@@ -0,0 +1,182 @@
+/*
+ * posix_random.c
+ *
+ * Buffered random numbers for the POSIX OS handlers.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#ifdef HAVE_SYS_RANDOM_H
+#include <sys/random.h>
+#endif
+
+#include "posix_random.h"
+
+/* Makes the structure exactly 4096 bytes, a page on most systems. */
+#define POSIX_RAND_BUF_LEN	(4096 - 4 * sizeof(unsigned int))
+
+/* Requests this big or bigger bypass the buffer. */
+#define POSIX_RAND_DIRECT_LEN	(POSIX_RAND_BUF_LEN / 4)
+
+struct posix_rand_s
+{
+    /* posix_rand_fork_gen + 1 when the buffer contents may be used.
+       Zero after the kernel wipes the page in a child. */
+    unsigned int  gen;
+    unsigned int  check_pid;
+    pid_t         pid;
+    /* The unused bytes are at the end of buf. */
+    unsigned int  avail;
+    unsigned char buf[POSIX_RAND_BUF_LEN];
+};
+
+static volatile unsigned int posix_rand_fork_gen;
+
+static int
+posix_rand_fill(unsigned char *data, unsigned int len)
+{
+#ifdef HAVE_GETRANDOM
+    ssize_t rv;
+
+    while (len > 0) {
+	rv = getrandom(data, len, 0);
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == ENOSYS)
+		/* Old kernel, use the device. */
+		goto use_dev;
+	    return errno;
+	}
+	len -= rv;
+	data += rv;
+    }
+    return 0;
+
+ use_dev:
+#endif
+    {
+	int fd = open("/dev/urandom", O_RDONLY);
+	int rv = 0;
+
+	if (fd == -1)
+	    return errno;
+
+	while (len > 0) {
+	    rv = read(fd, data, len);
+	    if (rv < 0) {
+		if (errno == EINTR)
+		    continue;
+		rv = errno;
+		goto out;
+	    }
+	    len -= rv;
+	    data += rv;
+	}
+	rv = 0;
+
+    out:
+	close(fd);
+	return rv;
+    }
+}
+
+int
+posix_rand_alloc(posix_rand_t **rbuf)
+{
+    posix_rand_t *r;
+
+    r = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED)
+	return ENOMEM;
+
+    /* The mapping is zero-filled, so the buffer starts out empty. */
+#ifdef MADV_WIPEONFORK
+    if (madvise(r, sizeof(*r), MADV_WIPEONFORK) != 0)
+#endif
+    {
+	r->check_pid = 1;
+	r->pid = getpid();
+    }
+
+    *rbuf = r;
+    return 0;
+}
+
+void
+posix_rand_free(posix_rand_t *rbuf)
+{
+    memset(rbuf->buf, 0, sizeof(rbuf->buf));
+    munmap(rbuf, sizeof(*rbuf));
+}
+
+int
+posix_rand_get(posix_rand_t *rbuf, void *data, unsigned int len)
+{
+    unsigned char *start;
+    int           rv;
+
+    if (!rbuf || len >= POSIX_RAND_DIRECT_LEN)
+	return posix_rand_fill(data, len);
+
+    if (rbuf->gen != posix_rand_fork_gen + 1
+	|| (rbuf->check_pid && rbuf->pid != getpid()))
+    {
+	/* New or forked, nothing in the buffer may be used. */
+	rbuf->avail = 0;
+	rbuf->gen = posix_rand_fork_gen + 1;
+	if (rbuf->check_pid)
+	    rbuf->pid = getpid();
+    }
+
+    if (rbuf->avail < len) {
+	rv = posix_rand_fill(rbuf->buf, sizeof(rbuf->buf));
+	if (rv) {
+	    rbuf->avail = 0;
+	    return rv;
+	}
+	rbuf->avail = sizeof(rbuf->buf);
+    }
+
+    /* Hand out the bytes and forget them. */
+    rbuf->avail -= len;
+    start = rbuf->buf + rbuf->avail;
+    memcpy(data, start, len);
+    memset(start, 0, len);
+    return 0;
+}
+
+void
+posix_rand_forked(void)
+{
+    posix_rand_fork_gen++;
+}
@@ -0,0 +1,58 @@
+/*
+ * posix_random.h
+ *
+ * Buffered random numbers for the POSIX OS handlers.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef OPENIPMI_POSIX_RANDOM_H
+#define OPENIPMI_POSIX_RANDOM_H
+
+/*
+ * get_random() is called for every AES-CBC IV and for the session
+ * setup random numbers, so rather than open and read /dev/urandom
+ * each time, a buffer is filled from the kernel (getrandom() where
+ * available) and small requests are handed out of it.  Bytes are
+ * cleared from the buffer as they are used.  A buffer is not
+ * thread-safe, the threaded OS handler keeps one per thread.
+ *
+ * A forked child must never hand out the same bytes as its parent.
+ * The buffer is wiped by the kernel on fork where MADV_WIPEONFORK is
+ * supported, otherwise the pid is checked on each use.
+ * sel_setup_forked_process() also discards every buffer through
+ * posix_rand_forked().
+ */
+typedef struct posix_rand_s posix_rand_t;
+
+int posix_rand_alloc(posix_rand_t **rbuf);
+void posix_rand_free(posix_rand_t *rbuf);
+
+/* Fill "data" with "len" random bytes.  Large requests are read
+   directly into "data" without going through the buffer.  "rbuf" may
+   be NULL, in which case the request is never buffered. */
+int posix_rand_get(posix_rand_t *rbuf, void *data, unsigned int len);
+
+/* Throw away anything buffered, call this in a forked child. */
+void posix_rand_forked(void);
+
+#endif /* OPENIPMI_POSIX_RANDOM_H */
@@ -46,10 +46,7 @@
 #include <pthread.h>
 #include <string.h>
 #include <signal.h>
-
-#ifdef HAVE_GDBM
-#include <gdbm.h>
-#endif
+#include <stdint.h>
 
 #include <OpenIPMI/os_handler.h>
 #include <OpenIPMI/selector.h>
@@ -57,6 +54,9 @@
 
 #include <OpenIPMI/internal/ipmi_int.h>
 
+#include "posix_db.h"
+#include "posix_random.h"
+
 /* CHEAP HACK - we don't want the user to have to provide this any
    more. */
 extern void posix_vlog(char                 *format,
@@ -83,14 +83,21 @@ static void i_posix_unlock(pthread_mutex_t *lock)
 typedef struct pt_os_hnd_data_s
 {
     struct selector_s *sel;
+
+    /* If there is more than one loop, the selector for each, see
+       ipmi_posix_thread_setup_os_handler_loops().  loops[0] is sel.
+       loop_key holds the calling thread's loop number + 1. */
+    struct selector_s **loops;
+    unsigned int     num_loops;
+    unsigned int     next_run_loop;
+    pthread_key_t    loop_key;
+    pthread_mutex_t  loop_lock;
+
     os_vlog_t        log_handler;
     int              wake_sig;
     struct sigaction oldact;
-#ifdef HAVE_GDBM
-    char *gdbm_filename;
-    GDBM_FILE gdbmf;
-    pthread_mutex_t gdbm_lock;
-#endif
+    char *db_dir;
+    pthread_mutex_t db_lock;
 } pt_os_hnd_data_t;
 
 
@@ -101,8 +108,59 @@ struct os_hnd_fd_id_s
     os_data_ready_t data_ready;
     os_handler_t    *handler;
     os_fd_data_freed_t freed;
+    struct selector_s *sel;
 };
 
+/* The selector new fds and timers from the calling thread go in. */
+static struct selector_s *
+alloc_sel(pt_os_hnd_data_t *info)
+{
+    uintptr_t loop;
+
+    if (!info->loops)
+	return info->sel;
+
+    loop = (uintptr_t) pthread_getspecific(info->loop_key);
+    if (!loop)
+	return info->sel;
+    return info->loops[loop - 1];
+}
+
+static unsigned int
+get_loop_id(os_handler_t *os_hnd)
+{
+    pt_os_hnd_data_t *info = os_hnd->internal_data;
+    uintptr_t        loop;
+
+    if (!info->loops)
+	return 0;
+
+    loop = (uintptr_t) pthread_getspecific(info->loop_key);
+    if (!loop)
+	return 0;
+    return loop - 1;
+}
+
+/* The selector the calling thread runs, picking one if it has not
+   run one yet. */
+static struct selector_s *
+run_sel(pt_os_hnd_data_t *info)
+{
+    uintptr_t loop;
+
+    if (!info->loops)
+	return info->sel;
+
+    loop = (uintptr_t) pthread_getspecific(info->loop_key);
+    if (!loop) {
+	i_posix_lock(&info->loop_lock);
+	loop = (info->next_run_loop++ % info->num_loops) + 1;
+	i_posix_unlock(&info->loop_lock);
+	pthread_setspecific(info->loop_key, (void *) loop);
+    }
+    return info->loops[loop - 1];
+}
+
 static void
 fd_handler(int fd, void *data)
 {
@@ -136,12 +194,13 @@ add_fd(os_handler_t       *handler,
     os_hnd_fd_id_t   *fd_data;
     int              rv;
     pt_os_hnd_data_t *info = handler->internal_data;
-    struct selector_s *posix_sel = info->sel;
+    struct selector_s *posix_sel = alloc_sel(info);
 
     fd_data = malloc(sizeof(*fd_data));
     if (!fd_data)
 	return ENOMEM;
 
+    fd_data->sel = posix_sel;
     fd_data->fd = fd;
     fd_data->cb_data = cb_data;
     fd_data->data_ready = data_ready;
@@ -164,8 +223,7 @@ add_fd(os_handler_t       *handler,
 static int
 remove_fd(os_handler_t *handler, os_hnd_fd_id_t *fd_data)
 {
-    pt_os_hnd_data_t *info = handler->internal_data;
-    struct selector_s *posix_sel = info->sel;
+    struct selector_s *posix_sel = fd_data->sel;
 
     sel_set_fd_read_handler(posix_sel, fd_data->fd, SEL_FD_HANDLER_DISABLED);
     sel_clear_fd_handlers(posix_sel, fd_data->fd);
@@ -263,7 +321,7 @@ alloc_timer(os_handler_t      *handler,
     os_hnd_timer_id_t *timer_data;
     int               rv;
     pt_os_hnd_data_t  *info = handler->internal_data;
-    struct selector_s *posix_sel = info->sel;
+    struct selector_s *posix_sel = alloc_sel(info);
 
     timer_data = malloc(sizeof(*timer_data));
     if (!timer_data)
@@ -300,30 +358,42 @@ free_timer(os_handler_t *handler, os_hnd_timer_id_t *timer_data)
     return 0;
 }
 
-static int
-get_random(os_handler_t *handler, void *data, unsigned int len)
+/* The random buffers are per-thread, not per-handler, so no locking
+   is needed and they go away when the thread does. */
+static void
+rand_key_free(void *data)
 {
-    int fd = open("/dev/urandom", O_RDONLY);
-    int rv;
+    posix_rand_free(data);
+}
 
-    if (fd == -1)
-	return errno;
+static pthread_key_t rand_key;
+static int rand_key_err;
+static pthread_once_t rand_key_once = PTHREAD_ONCE_INIT;
 
-    while (len > 0) {
-	rv = read(fd, data, len);
-	if (rv < 0) {
-	    rv = errno;
-	    goto out;
+static void
+rand_key_alloc(void)
+{
+    rand_key_err = pthread_key_create(&rand_key, rand_key_free);
+}
+
+static int
+get_random(os_handler_t *handler, void *data, unsigned int len)
+{
+    posix_rand_t *rbuf = NULL;
+
+    pthread_once(&rand_key_once, rand_key_alloc);
+    if (!rand_key_err) {
+	rbuf = pthread_getspecific(rand_key);
+	if (!rbuf && !posix_rand_alloc(&rbuf)) {
+	    if (pthread_setspecific(rand_key, rbuf)) {
+		posix_rand_free(rbuf);
+		rbuf = NULL;
+	    }
 	}
-	len -= rv;
-	data += rv;
     }
 
-    rv = 0;
-
- out:
-    close(fd);
-    return rv;
+    /* With no buffer this just reads directly. */
+    return posix_rand_get(rbuf, data, len);
 }
 
 static void
@@ -620,13 +690,14 @@ ipmi_posix_thread_free_os_handler(os_handler_t *os_hnd)
 {
     pt_os_hnd_data_t *info = os_hnd->internal_data;
 
-#ifdef HAVE_GDBM
-    pthread_mutex_destroy(&info->gdbm_lock);
-    if (info->gdbm_filename)
-	free(info->gdbm_filename);
-    if (info->gdbmf)
-	gdbm_close(info->gdbmf);
-#endif
+    if (info->loops) {
+	pthread_key_delete(info->loop_key);
+	pthread_mutex_destroy(&info->loop_lock);
+	free(info->loops);
+    }
+    pthread_mutex_destroy(&info->db_lock);
+    if (info->db_dir)
+	free(info->db_dir);
     free(info);
     free(os_hnd);
 }
@@ -671,7 +742,7 @@ perform_one_op(os_handler_t   *os_hnd,
     pt_os_hnd_data_t *info = os_hnd->internal_data;
     int              rv;
 
-    rv = sel_select(info->sel, posix_thread_send_sig, (long) &self, info,
+    rv = sel_select(run_sel(info), posix_thread_send_sig, (long) &self, info,
 		    timeout);
     if (rv == -1)
 	return errno;
@@ -686,15 +757,18 @@ operation_loop(os_handler_t *os_hnd)
     pthread_t        self = pthread_self();
     pt_os_hnd_data_t *info = os_hnd->internal_data;
 
-    sel_select_loop(info->sel, posix_thread_send_sig, (long) &self, info);
+    sel_select_loop(run_sel(info), posix_thread_send_sig, (long) &self, info);
 }
 
 static void
 free_os_handler(os_handler_t *os_hnd)
 {
     pt_os_hnd_data_t *info = os_hnd->internal_data;
+    unsigned int     i;
 
     sigaction(info->wake_sig, &info->oldact, NULL);
+    for (i = 1; i < info->num_loops; i++)
+	sel_free_selector(info->loops[i]);
     sel_free_selector(info->sel);
     ipmi_posix_thread_free_os_handler(os_hnd);
 }
@@ -711,29 +785,6 @@ posix_free(void *data)
     free(data);
 }
 
-#ifdef HAVE_GDBM
-#define GDBM_FILE ".OpenIPMI_db"
-
-static void
-init_gdbm(pt_os_hnd_data_t *info)
-{
-    if (!info->gdbm_filename) {
-	char *home = getenv("HOME");
-	if (!home)
-	    return;
-	info->gdbm_filename = malloc(strlen(home)+strlen(GDBM_FILE)+2);
-	if (!info->gdbm_filename)
-	    return;
-	strcpy(info->gdbm_filename, home);
-	strcat(info->gdbm_filename, "/");
-	strcat(info->gdbm_filename, GDBM_FILE);
-    }
-
-    info->gdbmf = gdbm_open(info->gdbm_filename, 512, GDBM_WRCREAT, 0600,
-			    NULL);
-    /* gdbmf will be NULL on error, which is what reports an error. */
-}
-
 static int
 database_store(os_handler_t  *handler,
 	       char          *key,
@@ -741,28 +792,19 @@ database_store(os_handler_t  *handler,
 	       unsigned int  data_len)
 {
     pt_os_hnd_data_t *info = handler->internal_data;
-    datum            gkey, gdata;
     int              rv;
 
-    i_posix_lock(&info->gdbm_lock);
-    if (!info->gdbmf) {
-	init_gdbm(info);
-	if (!info->gdbmf) {
-	    i_posix_unlock(&info->gdbm_lock);
+    i_posix_lock(&info->db_lock);
+    if (!info->db_dir) {
+	info->db_dir = posix_db_default_dir();
+	if (!info->db_dir) {
+	    i_posix_unlock(&info->db_lock);
 	    return EINVAL;
 	}
     }
-
-    gkey.dptr = key;
-    gkey.dsize = strlen(key);
-    gdata.dptr = (char *) data;
-    gdata.dsize = data_len;
-
-    rv = gdbm_store(info->gdbmf, gkey, gdata, GDBM_REPLACE);
-    i_posix_unlock(&info->gdbm_lock);
-    if (rv)
-	return EINVAL;
-    return 0;
+    rv = posix_db_store(info->db_dir, key, data, data_len);
+    i_posix_unlock(&info->db_lock);
+    return rv;
 }
 
 static int
@@ -778,25 +820,20 @@ database_find(os_handler_t  *handler,
 	      void *cb_data)
 {
     pt_os_hnd_data_t *info = handler->internal_data;
-    datum            gkey, gdata;
+    int              rv;
 
-    i_posix_lock(&info->gdbm_lock);
-    if (!info->gdbmf) {
-	init_gdbm(info);
-	if (!info->gdbmf) {
-	    i_posix_unlock(&info->gdbm_lock);
+    i_posix_lock(&info->db_lock);
+    if (!info->db_dir) {
+	info->db_dir = posix_db_default_dir();
+	if (!info->db_dir) {
+	    i_posix_unlock(&info->db_lock);
 	    return EINVAL;
 	}
     }
-
-    gkey.dptr = key;
-    gkey.dsize = strlen(key);
-    gdata = gdbm_fetch(info->gdbmf, gkey);
-    i_posix_unlock(&info->gdbm_lock);
-    if (!gdata.dptr)
-	return EINVAL;
-    *data = (unsigned char *) gdata.dptr;
-    *data_len = gdata.dsize;
+    rv = posix_db_find(info->db_dir, key, data, data_len);
+    i_posix_unlock(&info->db_lock);
+    if (rv)
+	return rv;
     *fetch_completed = 1;
     return 0;
 }
@@ -805,11 +842,11 @@ static void
 database_free(os_handler_t  *handler,
 	      unsigned char *data)
 {
-    free(data);
+    posix_db_free(data);
 }
 
 static int
-set_gdbm_filename(os_handler_t *os_hnd, char *name)
+set_db_dir(os_handler_t *os_hnd, char *name)
 {
     pt_os_hnd_data_t *info = os_hnd->internal_data;
     char             *nname;
@@ -817,12 +854,13 @@ set_gdbm_filename(os_handler_t *os_hnd, char *name)
     nname = strdup(name);
     if (!nname)
 	return ENOMEM;
-    if (info->gdbm_filename)
-	free(info->gdbm_filename);
-    info->gdbm_filename = nname;
+    i_posix_lock(&info->db_lock);
+    if (info->db_dir)
+	free(info->db_dir);
+    info->db_dir = nname;
+    i_posix_unlock(&info->db_lock);
     return 0;
 }
-#endif
 
 static void sset_log_handler(os_handler_t *handler,
 			     os_vlog_t    log_handler)
@@ -886,15 +924,14 @@ static os_handler_t ipmi_posix_thread_os_handler =
     .free_os_handler = free_os_handler,
     .perform_one_op = perform_one_op,
     .operation_loop = operation_loop,
-#ifdef HAVE_GDBM
     .database_store = database_store,
     .database_find = database_find,
     .database_free = database_free,
-    .database_set_filename = set_gdbm_filename,
-#endif
+    .database_set_filename = set_db_dir,
     .set_log_handler = sset_log_handler,
     .get_monotonic_time = get_monotonic_time,
-    .get_real_time = get_real_time
+    .get_real_time = get_real_time,
+    .get_loop_id = get_loop_id
 };
 
 os_handler_t *
@@ -902,9 +939,7 @@ ipmi_posix_thread_get_os_handler2(int wake_sig)
 {
     os_handler_t     *rv;
     pt_os_hnd_data_t *info;
-#ifdef HAVE_GDBM
     int              err;
-#endif
 
     rv = malloc(sizeof(*rv));
     if (!rv)
@@ -920,14 +955,12 @@ ipmi_posix_thread_get_os_handler2(int wake_sig)
     memset(info, 0, sizeof(*info));
     rv->internal_data = info;
 
-#ifdef HAVE_GDBM
-    err = pthread_mutex_init(&info->gdbm_lock, NULL);
+    err = pthread_mutex_init(&info->db_lock, NULL);
     if (err) {
 	free(info);
 	free(rv);
 	return NULL;
     }
-#endif
 
     info->wake_sig = wake_sig;
 
@@ -983,40 +1016,110 @@ slock_unlock(sel_lock_t *l)
 }
 
 os_handler_t *
-ipmi_posix_thread_setup_os_handler(int wake_sig)
+ipmi_posix_thread_setup_os_handler_loops(int wake_sig, unsigned int num_loops,
+					 int timer_type)
 {
     os_handler_t     *os_hnd;
     pt_os_hnd_data_t *info;
     struct sigaction act;
+    unsigned int     i;
     int              rv;
 
+    if (num_loops < 1)
+	return NULL;
+
     os_hnd = ipmi_posix_thread_get_os_handler2(wake_sig);
     if (!os_hnd)
 	return NULL;
 
     info = os_hnd->internal_data;
 
-    rv = sel_alloc_selector_thread(&info->sel, wake_sig,
-				   slock_alloc, slock_free,
-				   slock_lock, slock_unlock, os_hnd);
-    if (rv) {
-	ipmi_posix_thread_free_os_handler(os_hnd);
-	os_hnd = NULL;
-	goto out;
+    if (num_loops > 1) {
+	info->loops = malloc(num_loops * sizeof(*info->loops));
+	if (!info->loops)
+	    goto out_err;
+	rv = pthread_mutex_init(&info->loop_lock, NULL);
+	if (rv) {
+	    free(info->loops);
+	    info->loops = NULL;
+	    goto out_err;
+	}
+	rv = pthread_key_create(&info->loop_key, NULL);
+	if (rv) {
+	    pthread_mutex_destroy(&info->loop_lock);
+	    free(info->loops);
+	    info->loops = NULL;
+	    goto out_err;
+	}
+    }
+
+    for (i = 0; i < num_loops; i++) {
+	struct selector_s *sel;
+
+	rv = sel_alloc_selector_timers(&sel, timer_type, wake_sig,
+				       slock_alloc, slock_free,
+				       slock_lock, slock_unlock, os_hnd);
+	if (rv)
+	    goto out_err_sels;
+	if (info->loops) {
+	    /* Each loop normally has one thread, so take as many
+	       events per wait as we can. */
+	    sel_set_max_fd_events(sel, SEL_MAX_FD_EVENTS);
+	    info->loops[i] = sel;
+	}
+	if (i == 0)
+	    info->sel = sel;
+	info->num_loops++;
     }
 
     act.sa_handler = posix_thread_sighandler;
     sigemptyset(&act.sa_mask);
     act.sa_flags = 0;
     rv = sigaction(wake_sig, &act, &info->oldact);
-    if (rv) {
-	ipmi_posix_thread_free_os_handler(os_hnd);
-	os_hnd = NULL;
-	goto out;
-    }
+    if (rv)
+	goto out_err_sels;
 
- out:
     return os_hnd;
+
+ out_err_sels:
+    for (i = 1; i < info->num_loops; i++)
+	sel_free_selector(info->loops[i]);
+    if (info->sel)
+	sel_free_selector(info->sel);
+ out_err:
+    ipmi_posix_thread_free_os_handler(os_hnd);
+    return NULL;
+}
+
+os_handler_t *
+ipmi_posix_thread_setup_os_handler(int wake_sig)
+{
+    return ipmi_posix_thread_setup_os_handler_loops(wake_sig, 1,
+						    SEL_TIMERS_HEAP);
+}
+
+unsigned int
+ipmi_posix_thread_os_handler_num_loops(os_handler_t *os_hnd)
+{
+    pt_os_hnd_data_t *info = os_hnd->internal_data;
+
+    if (!info->loops)
+	return 1;
+    return info->num_loops;
+}
+
+int
+ipmi_posix_thread_os_handler_set_loop(os_handler_t *os_hnd,
+				      unsigned int loop)
+{
+    pt_os_hnd_data_t *info = os_hnd->internal_data;
+
+    if (loop >= ipmi_posix_thread_os_handler_num_loops(os_hnd))
+	return EINVAL;
+    if (!info->loops)
+	return 0;
+    return pthread_setspecific(info->loop_key,
+			       (void *) (uintptr_t) (loop + 1));
 }
 
 /*
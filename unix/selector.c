@@ -59,6 +59,7 @@ static void syslog(int level, char *format, ...) {}
 #include <signal.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 #ifdef HAVE_EPOLL_PWAIT
 #include <sys/epoll.h>
 #else
@@ -67,6 +68,8 @@ static void syslog(int level, char *format, ...) {}
 #define EPOLL_CTL_MOD 0
 #endif
 
+#include "posix_random.h"
+
 struct sel_runner_s
 {
     struct selector_s *sel;
@@ -113,6 +116,11 @@ typedef struct fd_control_s
 #ifdef HAVE_EPOLL_PWAIT
     /* See the comment in process_fds_epoll() on the use of this. */
     uint32_t saved_events;
+
+    /* The value of the selector's fd_del_count the last time this
+       fd's handlers were deleted or replaced.  Used to tell if an
+       event returned from epoll is stale. */
+    unsigned long del_count;
 #endif
 } fd_control_t;
 
@@ -131,7 +139,8 @@ typedef struct heap_val_s
     /* Who owns me? */
     struct selector_s *sel;
 
-    /* Am I currently running? */
+    /* Am I currently running?  This is set when the timer is in the
+       heap or the wheel, whichever the selector uses. */
     int in_heap;
 
     /* Am I currently stopped? */
@@ -145,6 +154,12 @@ typedef struct heap_val_s
 
     sel_timeout_handler_t done_handler;
     void *done_cb_data;
+
+    /* Links and position for the timer wheel, if in use. */
+    struct sel_timer_s *wheel_next, *wheel_prev;
+    uint64_t wheel_tick;
+    unsigned int wheel_level;
+    unsigned int wheel_slot;
 } heap_val_t;
 
 typedef struct theap_s theap_t;
@@ -181,6 +196,290 @@ heap_cmp_key(heap_val_t *v1, heap_val_t *v2)
 
 #include "heap.h"
 
+/*
+ * A hierarchical timer wheel, an alternative to the heap for
+ * selectors with a lot of timers.  Starting and stopping a timer is
+ * O(1); the cost is that timers are rounded up to the next
+ * WHEEL_TICK_USEC and that timers far in the future are moved down
+ * the levels as their time approaches.
+ *
+ * Each level has WHEEL_SLOTS slots, level n slots are WHEEL_SLOTS^n
+ * ticks wide.  A timer goes into the lowest level that covers its
+ * expiry.  When the current tick crosses a slot boundary on level
+ * n, the next slot on level n+1 is emptied and its timers are put
+ * back in with their real expiry ("cascaded").  Timers past the top
+ * level are parked in the farthest top level slot and go back in
+ * the same way.  Bitmaps of the non-empty slots let us skip idle
+ * time without walking every tick.
+ */
+#define WHEEL_TICK_USEC	1000
+#define WHEEL_BITS	8
+#define WHEEL_SLOTS	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_WORDS	(WHEEL_SLOTS / 64)
+
+/* Used as the level for timers waiting to be run. */
+#define WHEEL_EXPIRED	WHEEL_LEVELS
+
+typedef struct sel_wheel_s
+{
+    sel_timer_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t    used[WHEEL_LEVELS][WHEEL_WORDS];
+
+    /* Timers whose time has come, in tick order.  The slot lists
+       are LIFO, so timers that expire in the same tick run in the
+       reverse of the order they were put in their last slot. */
+    sel_timer_t *expired, *expired_tail;
+
+    /* The next tick to be processed; everything before it is done. */
+    uint64_t cur;
+
+    /* The tick the waiting threads are going to wake up at.  Only a
+       timer before this needs to wake them. */
+    uint64_t wait_tick;
+
+    unsigned int count;
+} sel_wheel_t;
+
+static uint64_t
+wheel_tv_to_tick(const struct timeval *tv)
+{
+    /* Round up so a timer never goes off early. */
+    return (((uint64_t) tv->tv_sec * 1000000 + tv->tv_usec
+	     + WHEEL_TICK_USEC - 1) / WHEEL_TICK_USEC);
+}
+
+static unsigned int
+wheel_ctz(uint64_t v)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(v);
+#else
+    unsigned int n = 0;
+
+    while (!(v & 1)) {
+	v >>= 1;
+	n++;
+    }
+    return n;
+#endif
+}
+
+/*
+ * Find the first used slot at or after "start" on a level, wrapping
+ * around.  Returns the distance from start, or -1 if the level is
+ * empty.
+ */
+static int
+wheel_find_used(sel_wheel_t *w, unsigned int level, unsigned int start)
+{
+    unsigned int i, word = start / 64;
+    uint64_t     bits;
+
+    bits = w->used[level][word] & (~(uint64_t) 0 << (start % 64));
+    for (i = 0; i <= WHEEL_WORDS; i++) {
+	if (bits) {
+	    unsigned int slot = word * 64 + wheel_ctz(bits);
+
+	    return (slot - start) & WHEEL_MASK;
+	}
+	word = (word + 1) % WHEEL_WORDS;
+	bits = w->used[level][word];
+	if (i == WHEEL_WORDS - 1)
+	    /* Back around to the starting word, only look below start. */
+	    bits &= ~(~(uint64_t) 0 << (start % 64));
+    }
+    return -1;
+}
+
+static void
+wheel_link(sel_wheel_t *w, sel_timer_t *timer,
+	   unsigned int level, unsigned int slot)
+{
+    sel_timer_t **head;
+
+    timer->val.wheel_level = level;
+    timer->val.wheel_slot = slot;
+    timer->val.wheel_prev = NULL;
+    if (level == WHEEL_EXPIRED) {
+	timer->val.wheel_next = NULL;
+	timer->val.wheel_prev = w->expired_tail;
+	if (w->expired_tail)
+	    w->expired_tail->val.wheel_next = timer;
+	else
+	    w->expired = timer;
+	w->expired_tail = timer;
+	return;
+    }
+
+    head = &w->slots[level][slot];
+    timer->val.wheel_next = *head;
+    if (*head)
+	(*head)->val.wheel_prev = timer;
+    *head = timer;
+    w->used[level][slot / 64] |= (uint64_t) 1 << (slot % 64);
+}
+
+static void
+wheel_unlink(sel_wheel_t *w, sel_timer_t *timer)
+{
+    unsigned int level = timer->val.wheel_level;
+    unsigned int slot = timer->val.wheel_slot;
+    sel_timer_t  *next = timer->val.wheel_next;
+    sel_timer_t  *prev = timer->val.wheel_prev;
+
+    if (next)
+	next->val.wheel_prev = prev;
+    if (level == WHEEL_EXPIRED) {
+	if (prev)
+	    prev->val.wheel_next = next;
+	else
+	    w->expired = next;
+	if (!next)
+	    w->expired_tail = prev;
+	return;
+    }
+
+    if (prev)
+	prev->val.wheel_next = next;
+    else
+	w->slots[level][slot] = next;
+    if (!w->slots[level][slot])
+	w->used[level][slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+}
+
+/* Put a timer in the slot for its tick, based on the current tick. */
+static void
+wheel_place(sel_wheel_t *w, sel_timer_t *timer)
+{
+    uint64_t     tick = timer->val.wheel_tick;
+    uint64_t     delta;
+    unsigned int level;
+
+    if (tick < w->cur)
+	tick = w->cur;
+    delta = tick - w->cur;
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+	if (delta < ((uint64_t) 1 << (WHEEL_BITS * (level + 1))))
+	    break;
+    }
+    if (delta >= ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)))
+	/* Too far out, park it and try again when it comes around. */
+	tick = w->cur + ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+    wheel_link(w, timer, level,
+	       (tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+}
+
+static void
+wheel_add(sel_wheel_t *w, sel_timer_t *timer)
+{
+    timer->val.wheel_tick = wheel_tv_to_tick(&timer->val.timeout);
+    wheel_place(w, timer);
+    w->count++;
+}
+
+static void
+wheel_remove(sel_wheel_t *w, sel_timer_t *timer)
+{
+    wheel_unlink(w, timer);
+    w->count--;
+}
+
+/*
+ * Return the next tick at or after the current one where something
+ * happens: a level 0 slot runs or a higher level slot is cascaded.
+ * Returns 0 if the wheel is empty.
+ */
+static int
+wheel_next_event(sel_wheel_t *w, uint64_t *tick)
+{
+    unsigned int level;
+    int          found = 0;
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+	unsigned int shift = WHEEL_BITS * level;
+	uint64_t     first = (w->cur + ((uint64_t) 1 << shift) - 1) >> shift;
+	int          dist;
+	uint64_t     t;
+
+	dist = wheel_find_used(w, level, first & WHEEL_MASK);
+	if (dist < 0)
+	    continue;
+	t = (first + dist) << shift;
+	if (!found || t < *tick)
+	    *tick = t;
+	found = 1;
+    }
+    return found;
+}
+
+static void
+wheel_cascade(sel_wheel_t *w, unsigned int level, unsigned int slot)
+{
+    sel_timer_t *timer = w->slots[level][slot];
+
+    w->slots[level][slot] = NULL;
+    w->used[level][slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+    while (timer) {
+	sel_timer_t *next = timer->val.wheel_next;
+
+	wheel_place(w, timer);
+	timer = next;
+    }
+}
+
+/* Move every timer due at or before "now" to the expired list. */
+static void
+wheel_advance(sel_wheel_t *w, uint64_t now)
+{
+    uint64_t tick;
+
+    if (w->count == 0) {
+	if (w->cur <= now)
+	    w->cur = now + 1;
+	return;
+    }
+
+    while (w->cur <= now) {
+	unsigned int level, slot;
+	sel_timer_t  *timer;
+
+	if (!wheel_next_event(w, &tick) || tick > now) {
+	    w->cur = now + 1;
+	    break;
+	}
+	w->cur = tick;
+
+	/* Cascade down from the highest level that rolls over here. */
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+	    if ((tick >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK)
+		break;
+	}
+	while (--level > 0)
+	    wheel_cascade(w, level,
+			  (tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+
+	/*
+	 * Anything started from here on with an expired time goes
+	 * into the next tick, not this one, so move on before
+	 * collecting this slot.
+	 */
+	w->cur = tick + 1;
+	slot = tick & WHEEL_MASK;
+	timer = w->slots[0][slot];
+	w->slots[0][slot] = NULL;
+	w->used[0][slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+	while (timer) {
+	    sel_timer_t *next = timer->val.wheel_next;
+
+	    wheel_link(w, timer, WHEEL_EXPIRED, 0);
+	    timer = next;
+	}
+    }
+}
+
 /* Used to build a list of threads that may need to be woken if a
    timer on the top of the heap changes, or an FD is added/removed.
    See i_wake_sel_thread() for more info. */
@@ -208,8 +507,11 @@ struct selector_s
 
     void *fd_lock;
 
-    /* The timer heap. */
+    /* The timers, in timer_heap or timer_wheel depending on
+       timer_type. */
+    int timer_type;
     theap_t timer_heap;
+    sel_wheel_t *timer_wheel;
 
     /* This is a list of items waiting to be woken up because they are
        sitting in a select.  See i_wake_sel_thread() for more info. */
@@ -224,6 +526,9 @@ struct selector_s
 
 #ifdef HAVE_EPOLL_PWAIT
     int epollfd;
+
+    /* Maximum number of events to pull from epoll per wait. */
+    unsigned int max_fd_events;
 #endif
     sel_lock_t *(*sel_lock_alloc)(void *cb_data);
     void (*sel_lock_free)(sel_lock_t *);
@@ -303,12 +608,92 @@ sel_wake_all(struct selector_s *sel)
     sel_timer_unlock(sel);
 }
 
-static void
-wake_timer_sel_thread(struct selector_s *sel, volatile sel_timer_t *old_top)
+/*
+ * Timer queue operations, these hide whether the heap or the wheel is
+ * in use.  They must be called with the timer lock held.  Add and
+ * remove return true if the first timer to go off changed, meaning
+ * the waiting threads need to be woken.
+ */
+static int
+timerq_add(struct selector_s *sel, sel_timer_t *timer)
+{
+    sel_wheel_t *w = sel->timer_wheel;
+
+    if (!w) {
+	theap_add(&sel->timer_heap, timer);
+	return theap_get_top(&sel->timer_heap) == timer;
+    }
+
+    wheel_add(w, timer);
+    if (timer->val.wheel_tick < w->wait_tick) {
+	w->wait_tick = timer->val.wheel_tick;
+	return 1;
+    }
+    return 0;
+}
+
+static int
+timerq_remove(struct selector_s *sel, sel_timer_t *timer)
+{
+    int was_top;
+
+    if (sel->timer_wheel) {
+	/* Waking up early is harmless, don't bother. */
+	wheel_remove(sel->timer_wheel, timer);
+	return 0;
+    }
+
+    was_top = theap_get_top(&sel->timer_heap) == timer;
+    theap_remove(&sel->timer_heap, timer);
+    return was_top;
+}
+
+/* Return a timer that is due to run at "now", or NULL if none are. */
+static sel_timer_t *
+timerq_get_expired(struct selector_s *sel, struct timeval *now)
+{
+    sel_wheel_t *w = sel->timer_wheel;
+    sel_timer_t *timer;
+
+    if (!w) {
+	timer = theap_get_top(&sel->timer_heap);
+	if (timer && cmp_timeval(now, &timer->val.timeout) >= 0)
+	    return timer;
+	return NULL;
+    }
+
+    if (!w->expired)
+	wheel_advance(w, (((uint64_t) now->tv_sec * 1000000 + now->tv_usec)
+			  / WHEEL_TICK_USEC));
+    return w->expired;
+}
+
+/* Get the time the next timer goes off.  Returns 0 if there are no
+   timers. */
+static int
+timerq_next_timeout(struct selector_s *sel, struct timeval *next)
 {
-    if (old_top != theap_get_top(&sel->timer_heap))
-	/* If the top value changed, restart the waiting thread. */
-	i_wake_sel_thread(sel);
+    sel_wheel_t *w = sel->timer_wheel;
+    sel_timer_t *timer;
+    uint64_t    tick, usec;
+
+    if (!w) {
+	timer = theap_get_top(&sel->timer_heap);
+	if (!timer)
+	    return 0;
+	*next = timer->val.timeout;
+	return 1;
+    }
+
+    if (!wheel_next_event(w, &tick)) {
+	w->wait_tick = UINT64_MAX;
+	return 0;
+    }
+    w->wait_tick = tick;
+    usec = tick * WHEEL_TICK_USEC;
+    next->tv_sec = usec / 1000000;
+    next->tv_usec = usec % 1000000;
+    return 1;
 }
 
 /* Wait list management.  These *must* be called with the timer list
@@ -478,10 +863,11 @@ sel_set_fd_handlers(struct selector_s *sel,
 	oldstate = fdc->state;
 	olddata = fdc->data;
 	added = 0;
+	sel->fd_del_count++;
 #ifdef HAVE_EPOLL_PWAIT
 	fdc->saved_events = 0;
+	fdc->del_count = sel->fd_del_count;
 #endif
-	sel->fd_del_count++;
     }
     fdc->state = state;
     fdc->data = data;
@@ -529,10 +915,11 @@ i_sel_clear_fd_handler(struct selector_s *sel, int fd, int imm)
 	fdc->state = NULL;
 
 	sel_update_fd(sel, fdc, EPOLL_CTL_DEL);
+	sel->fd_del_count++;
 #ifdef HAVE_EPOLL_PWAIT
 	fdc->saved_events = 0;
+	fdc->del_count = sel->fd_del_count;
 #endif
-	sel->fd_del_count++;
     }
 
     init_fd(fdc);
@@ -545,11 +932,15 @@ i_sel_clear_fd_handler(struct selector_s *sel, int fd, int imm)
 	FD_CLR(fd, &sel->except_set);
     }
 
-    /* Move maxfd down if necessary. */
+    /* Move maxfd down if necessary.  With epoll, fds can be above
+       FD_SETSIZE, so this has to go through the hash. */
     if (fd == sel->maxfd) {
-	while (sel->maxfd >= 0 && (!sel->fds[sel->maxfd] ||
-				   !sel->fds[sel->maxfd]->state))
+	while (sel->maxfd >= 0) {
+	    fdc = get_fd(sel, sel->maxfd);
+	    if (fdc && fdc->state)
+		break;
 	    sel->maxfd--;
+	}
     }
 
     sel_fd_unlock(sel);
@@ -761,11 +1152,10 @@ sel_stop_timer_i(struct selector_s *sel, sel_timer_t *timer)
 	return ETIMEDOUT;
 
     if (timer->val.in_heap) {
-	volatile sel_timer_t *old_top = theap_get_top(&sel->timer_heap);
-
-	theap_remove(&sel->timer_heap, timer);
 	timer->val.in_heap = 0;
-	wake_timer_sel_thread(sel, old_top);
+	if (timerq_remove(sel, timer))
+	    /* If the top value changed, restart the waiting thread. */
+	    i_wake_sel_thread(sel);
     }
     timer->val.stopped = 1;
 
@@ -796,7 +1186,6 @@ sel_start_timer(sel_timer_t    *timer,
 		struct timeval *timeout)
 {
     struct selector_s *sel = timer->val.sel;
-    volatile sel_timer_t *old_top;
 
     sel_timer_lock(sel);
     if (timer->val.in_heap) {
@@ -804,19 +1193,17 @@ sel_start_timer(sel_timer_t    *timer,
 	return EBUSY;
     }
 
-    old_top = theap_get_top(&sel->timer_heap);
-
     timer->val.timeout = *timeout;
 
     if (!timer->val.in_handler) {
 	/* Wait until the handler returns to start the timer. */
-	theap_add(&sel->timer_heap, timer);
 	timer->val.in_heap = 1;
+	if (timerq_add(sel, timer))
+	    /* If the top value changed, restart the waiting thread. */
+	    i_wake_sel_thread(sel);
     }
     timer->val.stopped = 0;
 
-    wake_timer_sel_thread(sel, old_top);
-
     sel_timer_unlock(sel);
 
     return 0;
@@ -863,12 +1250,12 @@ sel_stop_timer_with_done(sel_timer_t *timer,
      */
     timer->val.in_handler = 1;
     if (timer->val.in_heap) {
-	theap_remove(&sel->timer_heap, timer);
+	timerq_remove(sel, timer);
 	timer->val.in_heap = 0;
     }
     sel_get_monotonic_time(&timer->val.timeout);
-    theap_add(&sel->timer_heap, timer);
-    wake_timer_sel_thread(sel, NULL);
+    timerq_add(sel, timer);
+    i_wake_sel_thread(sel);
 
  out_unlock:
     sel_timer_unlock(sel);
@@ -896,13 +1283,12 @@ process_timers(struct selector_s       *sel,
 	       unsigned int            *count,
 	       volatile struct timeval *timeout)
 {
-    struct timeval now;
+    struct timeval now, next;
     sel_timer_t    *timer;
 
-    timer = theap_get_top(&sel->timer_heap);
     sel_get_monotonic_time(&now);
-    while (timer && cmp_timeval(&now, &timer->val.timeout) >= 0) {
-	theap_remove(&(sel->timer_heap), timer);
+    while ((timer = timerq_get_expired(sel, &now))) {
+	timerq_remove(sel, timer);
 	timer->val.in_heap = 0;
 	timer->val.stopped = 1;
 
@@ -933,22 +1319,18 @@ process_timers(struct selector_s       *sel,
 	    free(timer);
 	else if (!timer->val.stopped) {
 	    /* We were restarted while in the handler. */
-	    theap_add(&sel->timer_heap, timer);
+	    timerq_add(sel, timer);
 	    timer->val.in_heap = 1;
 	}
-
-	timer = theap_get_top(&sel->timer_heap);
     }
 
     if (*count) {
 	/* If called, set the timeout to zero. */
 	timeout->tv_sec = 0;
 	timeout->tv_usec = 0;
-    } else if (timer) {
+    } else if (timerq_next_timeout(sel, &next)) {
 	sel_get_monotonic_time(&now);
-	diff_timeval((struct timeval *) timeout,
-		     (struct timeval *) &timer->val.timeout,
-		     &now);
+	diff_timeval((struct timeval *) timeout, &next, &now);
     } else {
 	/* No timers, just set a long time. */
 	timeout->tv_sec = 100000;
@@ -1162,40 +1544,18 @@ out:
 }
 
 #ifdef HAVE_EPOLL_PWAIT
-static int
-process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout,
-		  sigset_t *isigmask)
+static void
+handle_epoll_event(struct selector_s *sel, struct epoll_event *event,
+		   unsigned long entry_fd_del_count)
 {
-    int rv;
-    struct epoll_event event;
-    int timeout;
-    sigset_t sigmask;
     fd_control_t *fdc;
-    unsigned long entry_fd_del_count = sel->fd_del_count;
-
-    setup_my_sigmask(&sigmask, isigmask);
-
-    if (tvtimeout->tv_sec > 600)
-	 /* Don't wait over 10 minutes, to work around an old epoll bug
-	    and avoid issues with timeout overflowing on 64-bit systems,
-	    which is much larger that 10 minutes, but who cares. */
-	timeout = 600 * 1000;
-    else
-	timeout = ((tvtimeout->tv_sec * 1000) +
-		   (tvtimeout->tv_usec + 999) / 1000);
-
-    sigdelset(&sigmask, sel->wake_sig);
-    rv = epoll_pwait(sel->epollfd, &event, 1, timeout, &sigmask);
-    if (rv <= 0)
-	return rv;
 
-    sel_fd_lock(sel);
-    valid_fd(sel, event.data.fd, &fdc);
-    if (entry_fd_del_count != sel->fd_del_count)
-	/* Something was deleted from the FD set, don't process this as it
-	   may be from the old fd wakeup. */
+    valid_fd(sel, event->data.fd, &fdc);
+    if ((long) (fdc->del_count - entry_fd_del_count) > 0)
+	/* This fd was deleted or replaced since we went into the wait,
+	   don't process this as it may be from the old fd wakeup. */
 	goto rearm;
-    if (event.events & (EPOLLHUP | EPOLLERR)) {
+    if (event->events & (EPOLLHUP | EPOLLERR)) {
 	/*
 	 * The crazy people that designed epoll made it so that EPOLLHUP
 	 * and EPOLLERR always wake it up, even if they are not set.  That
@@ -1207,20 +1567,20 @@ process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout,
 	 * by hand.
 	 */
 	sel_update_fd(sel, fdc, EPOLL_CTL_DEL);
-	fdc->saved_events = event.events & (EPOLLHUP | EPOLLERR);
+	fdc->saved_events = event->events & (EPOLLHUP | EPOLLERR);
 	/*
 	 * Have it handle read data, too, so if there is a pending
 	 * error it will get handled.
 	 */
-	event.events |= EPOLLIN;
+	event->events |= EPOLLIN;
     }
-    if (event.events & (EPOLLIN | EPOLLHUP))
+    if (event->events & (EPOLLIN | EPOLLHUP))
 	handle_selector_call(sel, fdc, NULL, fdc->read_enabled,
 			     fdc->handle_read);
-    if (event.events & EPOLLOUT)
+    if (event->events & EPOLLOUT)
 	handle_selector_call(sel, fdc, NULL, fdc->write_enabled,
 			     fdc->handle_write);
-    if (event.events & (EPOLLPRI | EPOLLERR))
+    if (event->events & (EPOLLPRI | EPOLLERR))
 	handle_selector_call(sel, fdc, NULL, fdc->except_enabled,
 			     fdc->handle_except);
 
@@ -1228,6 +1588,46 @@ process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout,
     /* Rearm the event.  Remember it could have been deleted in the handler. */
     if (fdc->state)
 	sel_update_fd(sel, fdc, EPOLL_CTL_MOD);
+}
+
+/*
+ * Pull up to max_fd_events events from epoll and handle them all in
+ * one pass.  Every fd is registered EPOLLONESHOT, so an fd returned
+ * here is disabled until it is rearmed in handle_epoll_event() and
+ * other threads waiting on the same epoll cannot get it.  Handlers
+ * may delete or replace other fds in the batch, so staleness is
+ * checked per event against the fd's own del_count.
+ */
+static int
+process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout,
+		  sigset_t *isigmask)
+{
+    int rv, i;
+    struct epoll_event events[SEL_MAX_FD_EVENTS];
+    int timeout;
+    sigset_t sigmask;
+    unsigned long entry_fd_del_count = sel->fd_del_count;
+
+    setup_my_sigmask(&sigmask, isigmask);
+
+    if (tvtimeout->tv_sec > 600)
+	 /* Don't wait over 10 minutes, to work around an old epoll bug
+	    and avoid issues with timeout overflowing on 64-bit systems,
+	    which is much larger that 10 minutes, but who cares. */
+	timeout = 600 * 1000;
+    else
+	timeout = ((tvtimeout->tv_sec * 1000) +
+		   (tvtimeout->tv_usec + 999) / 1000);
+
+    sigdelset(&sigmask, sel->wake_sig);
+    rv = epoll_pwait(sel->epollfd, events, sel->max_fd_events, timeout,
+		     &sigmask);
+    if (rv <= 0)
+	return rv;
+
+    sel_fd_lock(sel);
+    for (i = 0; i < rv; i++)
+	handle_epoll_event(sel, &events[i], entry_fd_del_count);
     sel_fd_unlock(sel);
 
     return rv;
@@ -1238,6 +1638,8 @@ sel_setup_forked_process(struct selector_s *sel)
 {
     int i;
 
+    posix_rand_forked();
+
     /*
      * More epoll stupidity.  In a forked process we must create a new
      * epoll because the epoll state is shared between a parent and a
@@ -1251,10 +1653,13 @@ sel_setup_forked_process(struct selector_s *sel)
 	return errno;
     }
 
-    for (i = 0; i <= sel->maxfd; i++) {
-	fd_control_t *fdc = sel->fds[i];
-	if (fdc && fdc->state)
-	    sel_update_fd(sel, fdc, EPOLL_CTL_ADD);
+    for (i = 0; i < FD_SETSIZE; i++) {
+	fd_control_t *fdc;
+
+	for (fdc = sel->fds[i]; fdc; fdc = fdc->next) {
+	    if (fdc->state)
+		sel_update_fd(sel, fdc, EPOLL_CTL_ADD);
+	}
     }
     return 0;
 }
@@ -1262,7 +1667,7 @@ sel_setup_forked_process(struct selector_s *sel)
 int
 sel_setup_forked_process(struct selector_s *sel)
 {
-    /* Nothing to do. */
+    posix_rand_forked();
     return 0;
 }
 #endif
@@ -1389,7 +1794,8 @@ sel_select_loop(struct selector_s *sel,
 
 /* Initialize the select code. */
 int
-sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
+sel_alloc_selector_timers(struct selector_s **new_selector, int timer_type,
+			  int wake_sig,
 			  sel_lock_t *(*sel_lock_alloc)(void *cb_data),
 			  void (*sel_lock_free)(sel_lock_t *),
 			  void (*sel_lock)(sel_lock_t *),
@@ -1400,11 +1806,29 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     int rv;
     sigset_t sigset;
 
+    if (timer_type != SEL_TIMERS_HEAP && timer_type != SEL_TIMERS_WHEEL)
+	return EINVAL;
+
     sel = malloc(sizeof(*sel));
     if (!sel)
 	return ENOMEM;
     memset(sel, 0, sizeof(*sel));
 
+    sel->timer_type = timer_type;
+    if (timer_type == SEL_TIMERS_WHEEL) {
+	struct timeval now;
+
+	sel->timer_wheel = malloc(sizeof(*sel->timer_wheel));
+	if (!sel->timer_wheel) {
+	    free(sel);
+	    return ENOMEM;
+	}
+	memset(sel->timer_wheel, 0, sizeof(*sel->timer_wheel));
+	sel_get_monotonic_time(&now);
+	sel->timer_wheel->cur = wheel_tv_to_tick(&now);
+	sel->timer_wheel->wait_tick = UINT64_MAX;
+    }
+
     sel->sel_lock_alloc = sel_lock_alloc;
     sel->sel_lock_free = sel_lock_free;
     sel->sel_lock = sel_lock;
@@ -1427,12 +1851,16 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     if (sel->sel_lock_alloc) {
 	sel->timer_lock = sel->sel_lock_alloc(cb_data);
 	if (!sel->timer_lock) {
+	    if (sel->timer_wheel)
+		free(sel->timer_wheel);
 	    free(sel);
 	    return ENOMEM;
 	}
 	sel->fd_lock = sel->sel_lock_alloc(cb_data);
 	if (!sel->fd_lock) {
 	    sel->sel_lock_free(sel->fd_lock);
+	    if (sel->timer_wheel)
+		free(sel->timer_wheel);
 	    free(sel);
 	    return ENOMEM;
 	}
@@ -1447,6 +1875,8 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 	    sel->sel_lock_free(sel->fd_lock);
 		sel->sel_lock_free(sel->timer_lock);
 	}
+	if (sel->timer_wheel)
+	    free(sel->timer_wheel);
 	free(sel);
 	return rv;
     }
@@ -1455,6 +1885,7 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     sel->epollfd = epoll_create(32768);
     if (sel->epollfd == -1)
 	syslog(LOG_ERR, "Unable to set up epoll, falling back to select: %m");
+    sel->max_fd_events = 1;
 #endif
 
     *new_selector = sel;
@@ -1462,6 +1893,30 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     return 0;
 }
 
+int
+sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
+			  sel_lock_t *(*sel_lock_alloc)(void *cb_data),
+			  void (*sel_lock_free)(sel_lock_t *),
+			  void (*sel_lock)(sel_lock_t *),
+			  void (*sel_unlock)(sel_lock_t *),
+			  void *cb_data)
+{
+    return sel_alloc_selector_timers(new_selector, SEL_TIMERS_HEAP, wake_sig,
+				     sel_lock_alloc, sel_lock_free,
+				     sel_lock, sel_unlock, cb_data);
+}
+
+int
+sel_set_max_fd_events(struct selector_s *sel, unsigned int count)
+{
+    if (count < 1 || count > SEL_MAX_FD_EVENTS)
+	return EINVAL;
+#ifdef HAVE_EPOLL_PWAIT
+    sel->max_fd_events = count;
+#endif
+    return 0;
+}
+
 int
 sel_alloc_selector_nothread(struct selector_s **new_selector)
 {
@@ -1475,6 +1930,25 @@ sel_free_selector(struct selector_s *sel)
     sel_timer_t *elem;
     unsigned int i;
 
+    if (sel->timer_wheel) {
+	sel_wheel_t *w = sel->timer_wheel;
+	unsigned int level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+	    for (i = 0; i < WHEEL_SLOTS; i++) {
+		while ((elem = w->slots[level][i])) {
+		    w->slots[level][i] = elem->val.wheel_next;
+		    free(elem);
+		}
+	    }
+	}
+	while ((elem = w->expired)) {
+	    w->expired = elem->val.wheel_next;
+	    free(elem);
+	}
+	free(w);
+    }
+
     elem = theap_get_top(&(sel->timer_heap));
     while (elem) {
 	theap_remove(&(sel->timer_heap), elem);
@@ -58,8 +58,20 @@
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <OpenIPMI/ipmiif.h>
 #include <OpenIPMI/ipmi_posix.h>
+#include <OpenIPMI/ipmi_lan.h>
+#include <OpenIPMI/ipmi_auth.h>
+#include <OpenIPMI/ipmi_msgbits.h>
+#include <OpenIPMI/ipmi_err.h>
 #include <OpenIPMI/internal/ipmi_malloc.h>
+#include <OpenIPMI/internal/ipmi_int.h>
 
 os_handler_t *test_os_hnd;
 
@@ -161,6 +173,65 @@ timeout_handler(void *cb_data, os_hnd_timer_id_t *id)
     }
 }
 
+static void
+test_random(os_handler_t *os_hnd)
+{
+    unsigned char a[16], b[16], big[8192];
+    unsigned int  i, j;
+    int           fds[2];
+    pid_t         pid;
+    int           rv;
+
+    /* Small requests come from the buffer, go past its end a few
+       times. */
+    for (i = 0; i < 1000; i++) {
+	rv = os_hnd->get_random(os_hnd, a, sizeof(a));
+	if (rv)
+	    err_leave(rv, "Unable to get random data");
+	rv = os_hnd->get_random(os_hnd, b, sizeof(b));
+	if (rv)
+	    err_leave(rv, "Unable to get random data");
+	if (memcmp(a, b, sizeof(a)) == 0)
+	    err_leave(0, "Random data repeated\n");
+    }
+
+    /* A large request bypasses the buffer. */
+    memset(big, 0, sizeof(big));
+    rv = os_hnd->get_random(os_hnd, big, sizeof(big));
+    if (rv)
+	err_leave(rv, "Unable to get random data");
+    for (i = 0, j = 0; i < sizeof(big); i++)
+	j += big[i] == 0;
+    if (j > sizeof(big) / 64)
+	err_leave(0, "Too many zeros in random data: %u\n", j);
+
+    /* A forked child must not get the bytes the parent gets. */
+    if (pipe(fds) == -1)
+	err_leave(errno, "Unable to create pipe");
+    rv = os_hnd->get_random(os_hnd, a, 1); /* Make sure it's buffered. */
+    if (rv)
+	err_leave(rv, "Unable to get random data");
+    pid = fork();
+    if (pid == -1)
+	err_leave(errno, "Unable to fork");
+    if (pid == 0) {
+	if (os_hnd->get_random(os_hnd, b, sizeof(b))
+	    || write(fds[1], b, sizeof(b)) != sizeof(b))
+	    _exit(1);
+	_exit(0);
+    }
+    rv = os_hnd->get_random(os_hnd, a, sizeof(a));
+    if (rv)
+	err_leave(rv, "Unable to get random data");
+    if (read(fds[0], b, sizeof(b)) != sizeof(b))
+	err_leave(0, "Unable to read from child\n");
+    waitpid(pid, NULL, 0);
+    close(fds[0]);
+    close(fds[1]);
+    if (memcmp(a, b, sizeof(a)) == 0)
+	err_leave(0, "Forked child got the parent's random data\n");
+}
+
 static void
 test_os_handler(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory)
 {
@@ -178,6 +249,9 @@ test_os_handler(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory)
     os_hnd->log(os_hnd, IPMI_LOG_FATAL, "This is a test: %d %s",
 		47, "Hello");
 
+    fprintf(stderr, "Random test\n");
+    test_random(os_hnd);
+
     fprintf(stderr, "Timer test\n");
     timer_waiter = os_handler_alloc_waiter(factory);
     if (!timer_waiter)
@@ -209,6 +283,359 @@ test_os_handler(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory)
     os_hnd->free_os_handler(os_hnd);
 }
 
+#define NUM_SEL_TIMERS 1000
+
+struct sel_timer_test {
+    sel_timer_t    *timer;
+    struct timeval expire;
+    int            stopped;
+    int            fired;
+};
+
+static void
+sel_timer_test_handler(struct selector_s *sel, sel_timer_t *timer, void *data)
+{
+    struct sel_timer_test *t = data;
+    struct timeval now;
+
+    sel_get_monotonic_time(&now);
+    if (t->stopped)
+	err_leave(0, "Stopped timer went off\n");
+    if (t->fired)
+	err_leave(0, "Timer went off twice\n");
+    /* Don't check for late, a loaded machine can run timers late. */
+    if (now.tv_sec < t->expire.tv_sec
+	|| (now.tv_sec == t->expire.tv_sec && now.tv_usec < t->expire.tv_usec))
+	err_leave(0, "Timer went off early\n");
+    t->fired = 1;
+}
+
+/*
+ * Start a lot of timers spread over a couple of seconds, stop half of
+ * them, and make sure the rest go off once, not early.  This crosses
+ * several slots on the second level of the timer wheel.
+ */
+static void
+test_sel_timers(struct selector_s *sel)
+{
+    static struct sel_timer_test t[NUM_SEL_TIMERS];
+    struct timeval now, tv;
+    unsigned int i, fired = 0;
+    int rv;
+
+    fprintf(stderr, "Selector timer test\n");
+    sel_get_monotonic_time(&now);
+    for (i = 0; i < NUM_SEL_TIMERS; i++) {
+	rv = sel_alloc_timer(sel, sel_timer_test_handler, &t[i],
+			     &t[i].timer);
+	if (rv)
+	    err_leave(rv, "Unable to allocate selector timer\n");
+	tv.tv_sec = 0;
+	tv.tv_usec = (i * 1997) % 1000000;
+	t[i].expire = now;
+	t[i].expire.tv_sec += i % 3;
+	t[i].expire.tv_usec += tv.tv_usec;
+	if (t[i].expire.tv_usec >= 1000000) {
+	    t[i].expire.tv_sec++;
+	    t[i].expire.tv_usec -= 1000000;
+	}
+	t[i].stopped = 0;
+	t[i].fired = 0;
+	rv = sel_start_timer(t[i].timer, &t[i].expire);
+	if (rv)
+	    err_leave(rv, "Unable to start selector timer\n");
+    }
+    for (i = 0; i < NUM_SEL_TIMERS; i += 2) {
+	rv = sel_stop_timer(t[i].timer);
+	if (rv)
+	    err_leave(rv, "Unable to stop selector timer\n");
+	t[i].stopped = 1;
+    }
+
+    for (;;) {
+	for (i = 0, fired = 0; i < NUM_SEL_TIMERS; i++)
+	    fired += t[i].fired;
+	if (fired == NUM_SEL_TIMERS / 2)
+	    break;
+	sel_get_monotonic_time(&tv);
+	/* The last timers are due in 3 seconds, give them plenty of
+	   slack before calling them lost. */
+	if (tv.tv_sec > now.tv_sec + 30)
+	    err_leave(0, "Only %u selector timers went off\n", fired);
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	sel_select(sel, NULL, 0, NULL, &tv);
+    }
+
+    for (i = 0; i < NUM_SEL_TIMERS; i++)
+	sel_free_timer(t[i].timer);
+}
+
+/*
+ * Just enough of a BMC on the loopback interface to bring up an IPMI
+ * 1.5 LAN session with no authentication and answer Get Device ID.
+ */
+#define BMC_SESSION_ID 0x12345678
+#define BMC_TEMP_SESSION_ID 0x11111111
+
+static int bmc_fd;
+static uint32_t bmc_session_id;
+static uint32_t bmc_seq;
+static int bmc_seq_started;
+
+static unsigned char
+ipmb_checksum(const unsigned char *data, int size)
+{
+    unsigned char csum = 0;
+
+    for (; size > 0; size--, data++)
+	csum += *data;
+    return -csum;
+}
+
+static void
+bmc_handle_msg(int fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    unsigned char      req[256], rsp[256];
+    unsigned char      *msg, *data, *r;
+    unsigned int       data_len, rdata_len = 0;
+    struct sockaddr_in from;
+    socklen_t          fromlen = sizeof(from);
+    uint32_t           session_id = bmc_session_id;
+    ssize_t            len;
+
+    len = recvfrom(fd, req, sizeof(req), 0, (struct sockaddr *) &from,
+		   &fromlen);
+    if (len < 21 || req[4] != IPMI_AUTHTYPE_NONE || len < req[13] + 14)
+	return;
+    msg = req + 14;
+    data = msg + 6;
+    data_len = req[13] - 7;
+
+    r = rsp + 14 + 6;
+    r[0] = 0;
+    switch (msg[5]) {
+    case IPMI_GET_CHANNEL_AUTH_CAPABILITIES_CMD:
+	r[1] = 1; /* channel */
+	r[2] = 1 << IPMI_AUTHTYPE_NONE;
+	r[3] = 0x04;
+	memset(r + 4, 0, 5);
+	rdata_len = 8;
+	break;
+
+    case IPMI_GET_SESSION_CHALLENGE_CMD:
+	ipmi_set_uint32(r + 1, BMC_TEMP_SESSION_ID);
+	memset(r + 5, 0x5a, 16);
+	rdata_len = 20;
+	break;
+
+    case IPMI_ACTIVATE_SESSION_CMD:
+	if (data_len < 22)
+	    return;
+	/* The response goes out on the temporary session id, and starts
+	   the sequence numbers the client asked for. */
+	session_id = BMC_TEMP_SESSION_ID;
+	bmc_session_id = BMC_SESSION_ID;
+	bmc_seq = ipmi_get_uint32(data + 18);
+	bmc_seq_started = 1;
+	r[1] = IPMI_AUTHTYPE_NONE;
+	ipmi_set_uint32(r + 2, BMC_SESSION_ID);
+	ipmi_set_uint32(r + 6, 1);
+	r[10] = IPMI_PRIVILEGE_ADMIN;
+	rdata_len = 10;
+	break;
+
+    case IPMI_SET_SESSION_PRIVILEGE_CMD:
+	r[1] = data[0];
+	rdata_len = 1;
+	break;
+
+    case IPMI_GET_DEVICE_ID_CMD:
+	memset(r + 1, 0, 11);
+	r[5] = 0x51; /* IPMI version 1.5 */
+	rdata_len = 11;
+	break;
+
+    case IPMI_CLOSE_SESSION_CMD:
+	break;
+
+    default:
+	r[0] = IPMI_INVALID_CMD_CC;
+	break;
+    }
+    rdata_len++;
+
+    rsp[0] = 6;
+    rsp[1] = 0;
+    rsp[2] = 0xff;
+    rsp[3] = 7;
+    rsp[4] = IPMI_AUTHTYPE_NONE;
+    ipmi_set_uint32(rsp + 5, bmc_seq_started ? bmc_seq++ : 0);
+    ipmi_set_uint32(rsp + 9, session_id);
+    rsp[13] = rdata_len + 7;
+    r = rsp + 14;
+    r[0] = msg[3];
+    r[1] = ((msg[1] | 0x04) & 0xfc) | (msg[4] & 3);
+    r[2] = ipmb_checksum(r, 2);
+    r[3] = msg[0];
+    r[4] = (msg[4] & 0xfc) | (msg[1] & 3);
+    r[5] = msg[5];
+    r[6 + rdata_len] = ipmb_checksum(r + 3, 3 + rdata_len);
+
+    sendto(fd, rsp, 14 + rsp[13], 0, (struct sockaddr *) &from, fromlen);
+}
+
+static unsigned int lan_allocs;
+static void *(*real_mem_alloc)(int size);
+static int (*real_alloc_timer)(os_handler_t *handler,
+			       os_hnd_timer_id_t **id);
+
+static void *
+counting_mem_alloc(int size)
+{
+    lan_allocs++;
+    return real_mem_alloc(size);
+}
+
+static int
+counting_alloc_timer(os_handler_t *handler, os_hnd_timer_id_t **id)
+{
+    lan_allocs++;
+    return real_alloc_timer(handler, id);
+}
+
+static unsigned int lan_con_up;
+static unsigned int lan_rsps;
+
+static void
+lan_con_changed(ipmi_con_t *ipmi, int err, unsigned int port_num,
+		int any_port_up, void *cb_data)
+{
+    if (err)
+	err_leave(err, "LAN connection failed\n");
+    lan_con_up = any_port_up;
+}
+
+static int
+lan_rsp_handler(ipmi_con_t *ipmi, ipmi_msgi_t *rspi)
+{
+    if (rspi->msg.data_len < 1 || rspi->msg.data[0] != 0)
+	err_leave(0, "Bad Get Device ID response\n");
+    lan_rsps++;
+    return IPMI_MSG_ITEM_USED;
+}
+
+static void
+lan_wait(os_handler_t *os_hnd, unsigned int *done, unsigned int val)
+{
+    struct timeval tv;
+    unsigned int   i;
+
+    for (i = 0; *done != val; i++) {
+	if (i > 5000)
+	    err_leave(0, "Timed out waiting on the LAN connection\n");
+	tv.tv_sec = 0;
+	tv.tv_usec = 1000;
+	os_hnd->perform_one_op(os_hnd, &tv);
+    }
+}
+
+#define NUM_LAN_CMDS 1000
+
+/*
+ * Once a connection has sent a command or two, sending more should
+ * not allocate anything: the command's timer state is kept for
+ * reuse and the caller supplies the response item.
+ */
+static void
+test_lan_allocs(os_handler_t *os_hnd)
+{
+    struct sockaddr_in           addr;
+    socklen_t                    addrlen = sizeof(addr);
+    struct in_addr               ip;
+    int                          port;
+    os_hnd_fd_id_t               *fd_id;
+    ipmi_con_t                   *con;
+    ipmi_system_interface_addr_t si;
+    ipmi_msg_t                   msg;
+    ipmi_msgi_t                  *rspi;
+    unsigned int                 i;
+    int                          rv;
+
+    fprintf(stderr, "LAN command allocation test\n");
+    bmc_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (bmc_fd == -1)
+	err_leave(errno, "Unable to open BMC socket\n");
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(bmc_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+	err_leave(errno, "Unable to bind BMC socket\n");
+    if (getsockname(bmc_fd, (struct sockaddr *) &addr, &addrlen) == -1)
+	err_leave(errno, "Unable to get BMC address\n");
+    rv = os_hnd->add_fd_to_wait_for(os_hnd, bmc_fd, bmc_handle_msg, NULL,
+				    NULL, &fd_id);
+    if (rv)
+	err_leave(rv, "Unable to add BMC fd\n");
+
+    real_mem_alloc = os_hnd->mem_alloc;
+    os_hnd->mem_alloc = counting_mem_alloc;
+    real_alloc_timer = os_hnd->alloc_timer;
+    os_hnd->alloc_timer = counting_alloc_timer;
+
+    rv = ipmi_init(os_hnd);
+    if (rv)
+	err_leave(rv, "Unable to initialize IPMI\n");
+
+    ip = addr.sin_addr;
+    port = ntohs(addr.sin_port);
+    rv = ipmi_lan_setup_con(&ip, &port, 1, IPMI_AUTHTYPE_NONE,
+			    IPMI_PRIVILEGE_ADMIN, "", 0, "", 0,
+			    os_hnd, NULL, &con);
+    if (rv)
+	err_leave(rv, "Unable to set up LAN connection\n");
+    rv = con->add_con_change_handler(con, lan_con_changed, NULL);
+    if (rv)
+	err_leave(rv, "Unable to add connection change handler\n");
+    rv = con->start_con(con);
+    if (rv)
+	err_leave(rv, "Unable to start LAN connection\n");
+    lan_wait(os_hnd, &lan_con_up, 1);
+
+    si.addr_type = IPMI_SYSTEM_INTERFACE_ADDR_TYPE;
+    si.channel = IPMI_BMC_CHANNEL;
+    si.lun = 0;
+    msg.netfn = IPMI_APP_NETFN;
+    msg.cmd = IPMI_GET_DEVICE_ID_CMD;
+    msg.data = NULL;
+    msg.data_len = 0;
+    rspi = ipmi_alloc_msg_item();
+    if (!rspi)
+	err_leave(ENOMEM, "Unable to allocate response item\n");
+
+    for (i = 0; i < NUM_LAN_CMDS + 2; i++) {
+	/* The first couple of commands fill the connection's caches. */
+	if (i == 2)
+	    lan_allocs = 0;
+	rv = con->send_command(con, (ipmi_addr_t *) &si, sizeof(si), &msg,
+			       lan_rsp_handler, rspi);
+	if (rv)
+	    err_leave(rv, "Unable to send LAN command\n");
+	lan_wait(os_hnd, &lan_rsps, i + 1);
+    }
+    if (lan_allocs)
+	err_leave(0, "%u allocations sending %d LAN commands\n",
+		  lan_allocs, NUM_LAN_CMDS);
+
+    os_hnd->mem_alloc = real_mem_alloc;
+    os_hnd->alloc_timer = real_alloc_timer;
+    ipmi_free_msg_item(rspi);
+    con->close_connection(con);
+    os_hnd->remove_fd_to_wait_for(os_hnd, fd_id);
+    close(bmc_fd);
+    ipmi_shutdown();
+}
+
 static void
 reset_tests(void)
 {
@@ -221,6 +648,7 @@ main(int argc, char *argv[])
 {
     os_handler_waiter_factory_t *factory;
     os_handler_t *os_hnd;
+    struct selector_s *sel;
     int          rv;
 
     fprintf(stderr, "*** Testing POSIX OS handler\n");
@@ -235,6 +663,26 @@ main(int argc, char *argv[])
     if (rv != ENOSYS)
 	err_leave(rv, "Expected ENOSYS allocating threaded factory\n");
     rv = os_handler_alloc_waiter_factory(os_hnd, 0, 0, &factory);
+    if (rv)
+	err_leave(rv, "Unable to allocate waiter factory\n");
+    test_sel_timers(ipmi_posix_os_handler_get_sel(os_hnd));
+    test_os_handler(os_hnd, factory);
+
+    fprintf(stderr, "*** Testing POSIX OS handler (timer wheel)\n");
+    reset_tests();
+    os_hnd = ipmi_posix_get_os_handler();
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    rv = sel_alloc_selector_timers(&sel, SEL_TIMERS_WHEEL, 0,
+				   NULL, NULL, NULL, NULL, NULL);
+    if (rv)
+	err_leave(rv, "Unable to allocate timer wheel selector\n");
+    ipmi_posix_os_handler_set_sel(os_hnd, sel);
+    ipmi_malloc_init(os_hnd);
+    test_sel_timers(sel);
+    rv = os_handler_alloc_waiter_factory(os_hnd, 0, 0, &factory);
     if (rv)
 	err_leave(rv, "Unable to allocate waiter factory\n");
     test_os_handler(os_hnd, factory);
@@ -264,5 +712,38 @@ main(int argc, char *argv[])
 	err_leave(rv, "Unable to allocate waiter factory\n");
     test_os_handler(os_hnd, factory);
 
+    fprintf(stderr, "*** Testing POSIX Threaded OS handler (4 loops)\n");
+    reset_tests();
+    os_hnd = ipmi_posix_thread_setup_os_handler_loops(SIGUSR1, 4,
+						      SEL_TIMERS_WHEEL);
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    if (ipmi_posix_thread_os_handler_num_loops(os_hnd) != 4)
+	err_leave(0, "Wrong number of loops\n");
+    if (ipmi_posix_thread_os_handler_set_loop(os_hnd, 4) != EINVAL)
+	err_leave(0, "Able to set an invalid loop\n");
+    /* Put the test's timer on a loop other than the first one. */
+    rv = ipmi_posix_thread_os_handler_set_loop(os_hnd, 3);
+    if (rv)
+	err_leave(rv, "Unable to set loop\n");
+    if (os_hnd->get_loop_id(os_hnd) != 3)
+	err_leave(0, "Wrong loop id\n");
+    ipmi_malloc_init(os_hnd);
+    rv = os_handler_alloc_waiter_factory(os_hnd, 4, 0, &factory);
+    if (rv)
+	err_leave(rv, "Unable to allocate waiter factory\n");
+    test_os_handler(os_hnd, factory);
+
+    fprintf(stderr, "*** Testing LAN connection\n");
+    os_hnd = ipmi_posix_setup_os_handler();
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    test_lan_allocs(os_hnd);
+    os_hnd->free_os_handler(os_hnd);
+
     return 0;
 }
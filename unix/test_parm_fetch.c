@@ -0,0 +1,1006 @@
+/*
+ * test_parm_fetch.c
+ *
+ * Tests for the windowed PEF/LAN/SOL configuration fetches.  This is
+ * built once for each of lib/pef.c, lib/lanparm.c and lib/solparm.c,
+ * with the MC and domain replaced by a fake BMC that answers the
+ * outstanding commands in random order.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * Lesser General Public License (GPL) Version 2 or the modified BSD
+ * license below.  The following disclamer applies to both licenses:
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * GNU Lesser General Public Licence
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Modified BSD Licence
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *   3. The name of the author may not be used to endorse or promote
+ *      products derived from this software without specific prior
+ *      written permission.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+/* The code under test is pulled in whole so the fake MC and domain
+   below can stand in for the real ones. */
+#if defined(TEST_PEF)
+#include "../lib/pef.c"
+#define PARM_NAME		"PEF"
+#define PARM_NETFN		IPMI_SENSOR_EVENT_NETFN
+#define PARM_GET_CMD		IPMI_GET_PEF_CONFIG_PARMS_CMD
+#define PARM_SET_CMD		IPMI_SET_PEF_CONFIG_PARMS_CMD
+#define PARM_REQ_OFFSET		0 /* No channel byte. */
+#define PARM_TABLE		pefparms
+#define NUM_PARMS		NUM_PEFPARMS
+#define MAX_FETCH_WINDOW	MAX_PEF_FETCH_WINDOW
+#define PARM_GET_CONFIG		ipmi_pef_get_config
+#define PARM_CLEAR_LOCK		ipmi_pef_clear_lock
+#define PARM_FREE_CONFIG	ipmi_pef_free_config
+#define PARM_DESTROY		ipmi_pef_destroy
+typedef ipmi_pef_t parm_t;
+typedef ipmi_pef_config_t config_t;
+#elif defined(TEST_LANPARM)
+#include "../lib/lanparm.c"
+#define PARM_NAME		"LAN"
+#define PARM_NETFN		IPMI_TRANSPORT_NETFN
+#define PARM_GET_CMD		IPMI_GET_LAN_CONFIG_PARMS_CMD
+#define PARM_SET_CMD		IPMI_SET_LAN_CONFIG_PARMS_CMD
+#define PARM_REQ_OFFSET		1 /* After the channel. */
+#define PARM_TABLE		lanparms
+#define NUM_PARMS		NUM_LANPARMS
+#define MAX_FETCH_WINDOW	MAX_LANPARM_FETCH_WINDOW
+#define PARM_GET_CONFIG		ipmi_lan_get_config
+#define PARM_CLEAR_LOCK		ipmi_lan_clear_lock
+#define PARM_FREE_CONFIG	ipmi_lan_free_config
+#define PARM_DESTROY		ipmi_lanparm_destroy
+typedef ipmi_lanparm_t parm_t;
+typedef ipmi_lan_config_t config_t;
+#elif defined(TEST_SOLPARM)
+#include "../lib/solparm.c"
+#define PARM_NAME		"SOL"
+#define PARM_NETFN		IPMI_TRANSPORT_NETFN
+#define PARM_GET_CMD		IPMI_GET_SOL_CONFIGURATION_PARAMETERS
+#define PARM_SET_CMD		IPMI_SET_SOL_CONFIGURATION_PARAMETERS
+#define PARM_REQ_OFFSET		1 /* After the channel. */
+#define PARM_TABLE		solparms
+#define NUM_PARMS		NUM_SOLPARMS
+#define MAX_FETCH_WINDOW	MAX_SOLPARM_FETCH_WINDOW
+#define PARM_GET_CONFIG		ipmi_sol_get_config
+#define PARM_CLEAR_LOCK		ipmi_sol_clear_lock
+#define PARM_FREE_CONFIG	ipmi_sol_free_config
+#define PARM_DESTROY		ipmi_solparm_destroy
+typedef ipmi_solparm_t parm_t;
+typedef ipmi_sol_config_t config_t;
+#else
+#error "One of TEST_PEF, TEST_LANPARM or TEST_SOLPARM must be defined"
+#endif
+#include "../lib/opq.c"
+
+#include <OpenIPMI/ipmi_posix.h>
+#include <OpenIPMI/internal/ipmi_malloc.h>
+
+static int verbose;
+
+static void
+err_leave(int err, char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    if (err)
+	fprintf(stderr, "error: %s (%d)\n", strerror(err), err);
+    va_end(ap);
+    exit(1);
+}
+
+/***********************************************************************
+ *
+ * The fake domain and MC.
+ *
+ **********************************************************************/
+
+struct ipmi_domain_s
+{
+    int dummy;
+};
+
+struct ipmi_mc_s
+{
+    ipmi_domain_t *domain;
+};
+
+struct ipmi_domain_attr_s
+{
+    void                     *data;
+    ipmi_domain_attr_kill_cb destroy;
+    void                     *cb_data;
+};
+
+static ipmi_domain_t      test_domain;
+static ipmi_mc_t          test_mc = { &test_domain };
+static ipmi_domain_attr_t test_attr;
+static os_handler_t       *test_os_hnd;
+
+/* What the "connection" says it will keep outstanding, 0 for no
+   limit. */
+static unsigned int test_max_outstanding;
+
+void
+ipmi_log(enum ipmi_log_type_e log_type, const char *format, ...)
+{
+    va_list ap;
+
+    if (!verbose)
+	return;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+}
+
+unsigned int
+ipmi_get_uint16(const unsigned char *data)
+{
+    return (data[0]
+	    | (data[1] << 8));
+}
+
+void
+ipmi_set_uint16(unsigned char *data, int val)
+{
+    data[0] = val & 0xff;
+    data[1] = (val >> 8) & 0xff;
+}
+
+#ifdef IPMI_CHECK_LOCKS
+void
+i__ipmi_check_mc_lock(const ipmi_mc_t *mc)
+{
+}
+#endif
+
+const char *
+i_ipmi_mc_name(const ipmi_mc_t *mc)
+{
+    return "(test) ";
+}
+
+int
+ipmi_domain_register_attribute(ipmi_domain_t            *domain,
+			       char                     *name,
+			       ipmi_domain_attr_init_cb init,
+			       ipmi_domain_attr_kill_cb destroy,
+			       void                     *cb_data,
+			       ipmi_domain_attr_t       **attr)
+{
+    int rv;
+
+    if (!test_attr.data) {
+	if (init) {
+	    rv = init(domain, cb_data, &test_attr.data);
+	    if (rv)
+		return rv;
+	}
+	test_attr.destroy = destroy;
+	test_attr.cb_data = cb_data;
+    }
+    *attr = &test_attr;
+    return 0;
+}
+
+int
+ipmi_domain_find_attribute(ipmi_domain_t      *domain,
+			   char               *name,
+			   ipmi_domain_attr_t **attr)
+{
+    if (!test_attr.data)
+	return EINVAL;
+    *attr = &test_attr;
+    return 0;
+}
+
+int
+ipmi_domain_id_find_attribute(ipmi_domain_id_t   domain_id,
+			      char               *name,
+			      ipmi_domain_attr_t **attr)
+{
+    return ipmi_domain_find_attribute(domain_id.domain, name, attr);
+}
+
+void *
+ipmi_domain_attr_get_data(ipmi_domain_attr_t *attr)
+{
+    return attr->data;
+}
+
+void
+ipmi_domain_attr_put(ipmi_domain_attr_t *attr)
+{
+}
+
+ipmi_domain_id_t
+ipmi_domain_convert_to_id(ipmi_domain_t *domain)
+{
+    ipmi_domain_id_t id;
+
+    id.domain = domain;
+    return id;
+}
+
+int
+ipmi_domain_get_name(ipmi_domain_t *domain, char *name, int length)
+{
+    return snprintf(name, length, "test");
+}
+
+unsigned int
+ipmi_domain_get_unique_num(ipmi_domain_t *domain)
+{
+    return 0;
+}
+
+os_handler_t *
+ipmi_domain_get_os_hnd(ipmi_domain_t *domain)
+{
+    return test_os_hnd;
+}
+
+unsigned int
+i_ipmi_domain_get_max_outstanding_msgs(ipmi_domain_t *domain)
+{
+    return test_max_outstanding;
+}
+
+ipmi_mcid_t
+ipmi_mc_convert_to_id(ipmi_mc_t *mc)
+{
+    ipmi_mcid_t id;
+
+    memset(&id, 0, sizeof(id));
+    id.domain_id.domain = mc->domain;
+    id.mc_num = 0x20;
+    return id;
+}
+
+ipmi_domain_t *
+ipmi_mc_get_domain(ipmi_mc_t *mc)
+{
+    return mc->domain;
+}
+
+int
+ipmi_mc_pointer_cb(ipmi_mcid_t id, ipmi_mc_ptr_cb handler, void *cb_data)
+{
+    handler(&test_mc, cb_data);
+    return 0;
+}
+
+/***********************************************************************
+ *
+ * The fake BMC.  Commands are queued when sent and answered in random
+ * order by bmc_run().
+ *
+ **********************************************************************/
+
+#define MAX_QUEUED	64
+#define MAX_SEL		128
+#define MAX_BLOCK	16
+
+typedef struct bmc_cmd_s
+{
+    unsigned long              seq;
+    ipmi_mc_response_handler_t handler;
+    void                       *rsp_data;
+    unsigned char              netfn;
+    unsigned char              cmd;
+    unsigned char              data[MAX_IPMI_DATA_SIZE];
+    unsigned int               data_len;
+} bmc_cmd_t;
+
+static bmc_cmd_t     queued[MAX_QUEUED];
+static unsigned int  num_queued;
+static unsigned long next_seq;
+
+/* Set in progress state of the BMC. */
+static int bmc_locked;
+
+/* Get parameter requests seen, and the ones the fetch should make. */
+static unsigned char seen[NUM_PARMS][MAX_SEL][MAX_BLOCK];
+static unsigned char expected[NUM_PARMS][MAX_SEL][MAX_BLOCK];
+
+static unsigned int gets_outstanding;
+static unsigned int max_gets_outstanding;
+static unsigned int out_of_order;
+
+/* Fail the get of this parm and selector, -1 for no error. */
+static int          err_parm = -1;
+static unsigned int err_sel;
+static int          err_delivered;
+
+static int bmc_parm(unsigned int parm, unsigned int sel, unsigned int block,
+		    unsigned char *d, unsigned int *len);
+
+static void
+bmc_reset(void)
+{
+    memset(seen, 0, sizeof(seen));
+    memset(expected, 0, sizeof(expected));
+    gets_outstanding = 0;
+    max_gets_outstanding = 0;
+    out_of_order = 0;
+    err_parm = -1;
+    err_delivered = 0;
+}
+
+int
+ipmi_mc_send_command(ipmi_mc_t                  *mc,
+		     unsigned int               lun,
+		     const ipmi_msg_t           *msg,
+		     ipmi_mc_response_handler_t rsp_handler,
+		     void                       *rsp_data)
+{
+    bmc_cmd_t    *c;
+    unsigned int parm, sel, block;
+
+    if (num_queued >= MAX_QUEUED)
+	err_leave(0, "Too many commands queued to the BMC\n");
+    if (msg->data_len > MAX_IPMI_DATA_SIZE)
+	err_leave(0, "Command too long: %d\n", msg->data_len);
+
+    if ((msg->netfn == PARM_NETFN) && (msg->cmd == PARM_GET_CMD)) {
+	if (err_delivered)
+	    err_leave(0, "Get parm sent after the fetch failed\n");
+	parm = msg->data[PARM_REQ_OFFSET];
+	sel = msg->data[PARM_REQ_OFFSET+1];
+	block = msg->data[PARM_REQ_OFFSET+2];
+	if ((parm >= NUM_PARMS) || (sel >= MAX_SEL) || (block >= MAX_BLOCK))
+	    err_leave(0, "Bad get parm %d %d %d\n", parm, sel, block);
+	seen[parm][sel][block]++;
+	gets_outstanding++;
+	if (gets_outstanding > max_gets_outstanding)
+	    max_gets_outstanding = gets_outstanding;
+    }
+
+    c = &queued[num_queued++];
+    c->seq = next_seq++;
+    c->handler = rsp_handler;
+    c->rsp_data = rsp_data;
+    c->netfn = msg->netfn;
+    c->cmd = msg->cmd;
+    memcpy(c->data, msg->data, msg->data_len);
+    c->data_len = msg->data_len;
+    return 0;
+}
+
+static void
+bmc_respond(bmc_cmd_t *c)
+{
+    unsigned char rdata[MAX_IPMI_DATA_SIZE];
+    ipmi_msg_t    rsp;
+    unsigned int  parm, sel, block, len;
+
+    rsp.netfn = c->netfn | 1;
+    rsp.cmd = c->cmd;
+    rsp.data = rdata;
+    rsp.data_len = 1;
+    rdata[0] = 0;
+
+#ifdef TEST_PEF
+    if ((c->netfn == PARM_NETFN) && (c->cmd == IPMI_GET_PEF_CAPABILITIES_CMD)) {
+	rdata[1] = 0x51;
+	rdata[2] = 0x3f;
+	rdata[3] = 32;
+	rsp.data_len = 4;
+	goto out;
+    }
+#endif
+
+    if (c->netfn != PARM_NETFN)
+	err_leave(0, "Unexpected command %x:%x\n", c->netfn, c->cmd);
+
+    parm = c->data[PARM_REQ_OFFSET];
+    if (c->cmd == PARM_SET_CMD) {
+	if (parm != 0)
+	    err_leave(0, "Unexpected set of parm %d\n", parm);
+	switch (c->data[PARM_REQ_OFFSET+1] & 0x3) {
+	case 0:
+	    bmc_locked = 0;
+	    break;
+	case 1:
+	    if (bmc_locked)
+		rdata[0] = 0x81;
+	    else
+		bmc_locked = 1;
+	    break;
+	}
+    } else if (c->cmd == PARM_GET_CMD) {
+	sel = c->data[PARM_REQ_OFFSET+1];
+	block = c->data[PARM_REQ_OFFSET+2];
+	gets_outstanding--;
+	if (((int) parm == err_parm) && (sel == err_sel)) {
+	    rdata[0] = 0xc0;
+	    err_delivered = 1;
+	} else {
+	    len = 0;
+	    rdata[0] = bmc_parm(parm, sel, block, rdata + 2, &len);
+	    if (rdata[0] == 0) {
+		rdata[1] = 0x11; /* Revision */
+		rsp.data_len = len + 2;
+	    }
+	}
+    } else
+	err_leave(0, "Unexpected command %x:%x\n", c->netfn, c->cmd);
+
+#ifdef TEST_PEF
+ out:
+#endif
+    c->handler(&test_mc, &rsp, c->rsp_data);
+}
+
+/* Answer everything, including whatever gets sent while answering. */
+static void
+bmc_run(void)
+{
+    bmc_cmd_t    c;
+    unsigned int i, j;
+
+    while (num_queued) {
+	i = rand() % num_queued;
+	for (j = 0; j < num_queued; j++) {
+	    if (queued[j].seq < queued[i].seq) {
+		out_of_order++;
+		break;
+	    }
+	}
+	c = queued[i];
+	queued[i] = queued[--num_queued];
+	bmc_respond(&c);
+    }
+}
+
+/* Fill in the parameter data after the revision for the default
+   parameters, which just have their parm number repeated. */
+static void
+bmc_default_parm(unsigned int parm, unsigned char *d, unsigned int *len)
+{
+    *len = PARM_TABLE[parm].length;
+    memset(d, parm, *len);
+}
+
+/***********************************************************************
+ *
+ * The code specific to each parameter type.
+ *
+ **********************************************************************/
+
+#if defined(TEST_PEF)
+
+#define NUM_EFTS	20
+#define NUM_APTS	10
+#define NUM_STRINGS	6 /* Including the volatile string 0. */
+
+static unsigned int
+as_len(unsigned int sel)
+{
+    /* Make sure one ends right at the end of a block. */
+    if (sel == 3)
+	return 32;
+    return sel * 11;
+}
+
+static int
+bmc_parm(unsigned int parm, unsigned int sel, unsigned int block,
+	 unsigned char *d, unsigned int *len)
+{
+    unsigned int i, slen, left;
+
+    switch (parm) {
+    case IPMI_PEFPARM_NUM_EVENT_FILTERS:
+	d[0] = NUM_EFTS;
+	*len = 1;
+	break;
+
+    case IPMI_PEFPARM_NUM_ALERT_POLICIES:
+	d[0] = NUM_APTS;
+	*len = 1;
+	break;
+
+    case IPMI_PEFPARM_NUM_ALERT_STRINGS:
+	d[0] = NUM_STRINGS - 1;
+	*len = 1;
+	break;
+
+    case IPMI_PEFPARM_EVENT_FILTER_TABLE:
+    case IPMI_PEFPARM_ALERT_POLICY_TABLE:
+    case IPMI_PEFPARM_ALERT_STRING_KEY:
+	bmc_default_parm(parm, d, len);
+	d[0] = sel;
+	d[*len-1] = sel;
+	break;
+
+    case IPMI_PEFPARM_ALERT_STRING:
+	slen = as_len(sel);
+	d[0] = sel;
+	d[1] = block;
+	*len = 2;
+	left = slen - ((block - 1) * 16);
+	/* Blocks are always full, a short string is padded with nils. */
+	for (i = 0; i < 16; i++) {
+	    if (i < left)
+		d[(*len)++] = 'a' + ((sel + block + i) % 26);
+	    else
+		d[(*len)++] = '\0';
+	}
+	break;
+
+    default:
+	bmc_default_parm(parm, d, len);
+    }
+    return 0;
+}
+
+static void
+expect_gets(void)
+{
+    unsigned int parm, sel, block;
+
+    for (parm = 1; parm < NUM_PARMS; parm++) {
+	if (!PARM_TABLE[parm].valid)
+	    continue;
+	switch (parm) {
+	case IPMI_PEFPARM_EVENT_FILTER_TABLE:
+	    for (sel = 1; sel <= NUM_EFTS; sel++)
+		expected[parm][sel][0] = 1;
+	    break;
+
+	case IPMI_PEFPARM_ALERT_POLICY_TABLE:
+	    for (sel = 1; sel <= NUM_APTS; sel++)
+		expected[parm][sel][0] = 1;
+	    break;
+
+	case IPMI_PEFPARM_ALERT_STRING_KEY:
+	    for (sel = 0; sel < NUM_STRINGS; sel++)
+		expected[parm][sel][0] = 1;
+	    break;
+
+	case IPMI_PEFPARM_ALERT_STRING:
+	    for (sel = 0; sel < NUM_STRINGS; sel++) {
+		for (block = 1; block <= (as_len(sel) / 16) + 1; block++)
+		    expected[parm][sel][block] = 1;
+	    }
+	    break;
+
+	default:
+	    expected[parm][0][0] = 1;
+	}
+    }
+}
+
+static void
+check_config(ipmi_pef_config_t *pefc)
+{
+    unsigned int sel, block, i;
+    char         *s;
+
+    if (pefc->num_event_filters != NUM_EFTS)
+	err_leave(0, "Got %d event filters\n", pefc->num_event_filters);
+    for (sel = 1; sel <= NUM_EFTS; sel++) {
+	/* The last byte of the entry is data3_compare2. */
+	if (pefc->efts[sel-1].data3_compare2 != sel)
+	    err_leave(0, "Event filter %d is wrong\n", sel);
+    }
+
+    if (pefc->num_alert_policies != NUM_APTS)
+	err_leave(0, "Got %d alert policies\n", pefc->num_alert_policies);
+    for (sel = 1; sel <= NUM_APTS; sel++) {
+	if (pefc->apts[sel-1].alert_string_selector != sel)
+	    err_leave(0, "Alert policy %d is wrong\n", sel);
+    }
+
+    if (pefc->num_alert_strings != NUM_STRINGS)
+	err_leave(0, "Got %d alert strings\n", pefc->num_alert_strings);
+    for (sel = 0; sel < NUM_STRINGS; sel++) {
+	if (pefc->asks[sel].alert_string_set != (sel & 0x7f))
+	    err_leave(0, "Alert string key %d is wrong\n", sel);
+	s = pefc->alert_strings[sel];
+	if (!s)
+	    s = "";
+	if (strlen(s) != as_len(sel))
+	    err_leave(0, "Alert string %d is %d long, should be %d\n",
+		      sel, (int) strlen(s), as_len(sel));
+	for (i = 0; i < as_len(sel); i++) {
+	    block = (i / 16) + 1;
+	    if ((unsigned char) s[i] != 'a' + ((sel + block + (i % 16)) % 26))
+		err_leave(0, "Alert string %d is wrong at %d\n", sel, i);
+	}
+    }
+}
+
+/* Fail in the middle of the event filter table. */
+#define ERR_PARM	IPMI_PEFPARM_EVENT_FILTER_TABLE
+#define ERR_SEL		(NUM_EFTS / 2)
+
+static void
+pef_ready(ipmi_pef_t *pef, int err, void *cb_data)
+{
+    if (err)
+	err_leave(err, "PEF capabilities fetch failed\n");
+}
+
+static parm_t *
+test_alloc(void)
+{
+    ipmi_pef_t *pef;
+    int        rv;
+
+    rv = ipmi_pef_alloc(&test_mc, pef_ready, NULL, &pef);
+    if (rv)
+	err_leave(rv, "Unable to allocate PEF\n");
+    bmc_run();
+    return pef;
+}
+
+#elif defined(TEST_LANPARM)
+
+#define NUM_DESTS	8 /* Including the volatile destination 0. */
+#define NUM_CIPHERS	4
+
+static int
+bmc_parm(unsigned int parm, unsigned int sel, unsigned int block,
+	 unsigned char *d, unsigned int *len)
+{
+    switch (parm) {
+    case IPMI_LANPARM_NUM_DESTINATIONS:
+	d[0] = NUM_DESTS - 1;
+	*len = 1;
+	break;
+
+    case IPMI_LANPARM_NUM_CIPHER_SUITE_ENTRIES:
+	d[0] = NUM_CIPHERS - 1;
+	*len = 1;
+	break;
+
+    case IPMI_LANPARM_DEST_TYPE:
+	bmc_default_parm(parm, d, len);
+	d[0] = sel;
+	d[2] = sel; /* Retry interval */
+	break;
+
+    case IPMI_LANPARM_DEST_ADDR:
+	bmc_default_parm(parm, d, len);
+	d[0] = sel;
+	d[6] = sel; /* Last byte of the IP address */
+	break;
+
+    case IPMI_LANPARM_DEST_VLAN_TAG:
+	bmc_default_parm(parm, d, len);
+	d[0] = sel;
+	d[2] = sel;
+	d[3] = 0;
+	break;
+
+    default:
+	bmc_default_parm(parm, d, len);
+    }
+    return 0;
+}
+
+static void
+expect_gets(void)
+{
+    unsigned int parm, sel;
+
+    for (parm = 1; parm < NUM_PARMS; parm++) {
+	if (!PARM_TABLE[parm].valid)
+	    continue;
+	switch (parm) {
+	case IPMI_LANPARM_DEST_TYPE:
+	case IPMI_LANPARM_DEST_ADDR:
+	case IPMI_LANPARM_DEST_VLAN_TAG:
+	    for (sel = 0; sel < NUM_DESTS; sel++)
+		expected[parm][sel][0] = 1;
+	    break;
+
+	default:
+	    expected[parm][0][0] = 1;
+	}
+    }
+}
+
+static void
+check_config(ipmi_lan_config_t *lanc)
+{
+    unsigned int sel;
+
+    if (lanc->num_alert_destinations != NUM_DESTS)
+	err_leave(0, "Got %d destinations\n", lanc->num_alert_destinations);
+    if (!lanc->vlan_tag_supported)
+	err_leave(0, "VLAN tags not marked supported\n");
+    for (sel = 0; sel < NUM_DESTS; sel++) {
+	if (lanc->alert_dest_type[sel].alert_retry_interval != sel)
+	    err_leave(0, "Destination type %d is wrong\n", sel);
+	if (lanc->alert_dest_addr[sel].dest_ip_addr[3] != sel)
+	    err_leave(0, "Destination address %d is wrong\n", sel);
+	if (lanc->alert_dest_addr[sel].dest_vlan_tag != sel)
+	    err_leave(0, "Destination VLAN tag %d is wrong\n", sel);
+    }
+    if (lanc->num_cipher_suites != NUM_CIPHERS)
+	err_leave(0, "Got %d cipher suites\n", lanc->num_cipher_suites);
+    if (lanc->cipher_suite_entries[0] != IPMI_LANPARM_CIPHER_SUITE_ENTRY_SUPPORT)
+	err_leave(0, "Cipher suite entries are wrong\n");
+}
+
+/* Fail in the middle of the destination address table. */
+#define ERR_PARM	IPMI_LANPARM_DEST_ADDR
+#define ERR_SEL		(NUM_DESTS / 2)
+
+static parm_t *
+test_alloc(void)
+{
+    ipmi_lanparm_t *lanparm;
+    int            rv;
+
+    rv = ipmi_lanparm_alloc(&test_mc, 1, &lanparm);
+    if (rv)
+	err_leave(rv, "Unable to allocate LANPARM\n");
+    return lanparm;
+}
+
+#elif defined(TEST_SOLPARM)
+
+static int
+bmc_parm(unsigned int parm, unsigned int sel, unsigned int block,
+	 unsigned char *d, unsigned int *len)
+{
+    bmc_default_parm(parm, d, len);
+    return 0;
+}
+
+static void
+expect_gets(void)
+{
+    unsigned int parm;
+
+    for (parm = 1; parm < NUM_PARMS; parm++) {
+	if (PARM_TABLE[parm].valid)
+	    expected[parm][0][0] = 1;
+    }
+}
+
+static void
+check_config(ipmi_sol_config_t *solc)
+{
+    if (solc->retry_interval != IPMI_SOLPARM_RETRY)
+	err_leave(0, "Retry interval is wrong\n");
+    if (!solc->payload_channel_supported
+	|| (solc->payload_channel != IPMI_SOLPARM_PAYLOAD_CHANNEL))
+	err_leave(0, "Payload channel is wrong\n");
+    if (solc->port_number != ((IPMI_SOLPARM_PAYLOAD_PORT_NUMBER << 8)
+			      | IPMI_SOLPARM_PAYLOAD_PORT_NUMBER))
+	err_leave(0, "Port number is wrong\n");
+}
+
+/* SOL has no tables, just fail one in the middle. */
+#define ERR_PARM	IPMI_SOLPARM_RETRY
+#define ERR_SEL		0
+
+static parm_t *
+test_alloc(void)
+{
+    ipmi_solparm_t *solparm;
+    int            rv;
+
+    rv = ipmi_solparm_alloc(&test_mc, 1, &solparm);
+    if (rv)
+	err_leave(rv, "Unable to allocate SOLPARM\n");
+    return solparm;
+}
+
+#endif
+
+/***********************************************************************
+ *
+ * The tests.
+ *
+ **********************************************************************/
+
+static unsigned int done_count;
+static int          done_err;
+static int          done_locked;
+static config_t     *done_config;
+
+static void
+config_fetched(parm_t *p, int err, config_t *config, void *cb_data)
+{
+    done_count++;
+    done_err = err;
+    done_config = config;
+    done_locked = bmc_locked;
+}
+
+static void
+config_lock_cleared(parm_t *p, int err, void *cb_data)
+{
+    if (err)
+	err_leave(err, "Clearing the lock failed\n");
+    done_count++;
+}
+
+static void
+run_fetch(parm_t *p)
+{
+    int rv;
+
+    done_count = 0;
+    done_err = 0;
+    done_config = NULL;
+    rv = PARM_GET_CONFIG(p, config_fetched, NULL);
+    if (rv)
+	err_leave(rv, "Unable to start the config fetch\n");
+    bmc_run();
+    if (done_count != 1)
+	err_leave(0, "Fetch done called %d times\n", done_count);
+}
+
+static void
+test_fetch(parm_t *p, unsigned int window)
+{
+    unsigned int parm, sel, block;
+    int          rv;
+
+    bmc_reset();
+    expect_gets();
+    run_fetch(p);
+    if (done_err)
+	err_leave(done_err, "Fetch failed\n");
+    if (!done_config)
+	err_leave(0, "Fetch returned no config\n");
+    if (!done_locked)
+	err_leave(0, "Fetch finished without the lock held\n");
+
+    for (parm = 0; parm < NUM_PARMS; parm++) {
+	for (sel = 0; sel < MAX_SEL; sel++) {
+	    for (block = 0; block < MAX_BLOCK; block++) {
+		if (seen[parm][sel][block] != expected[parm][sel][block])
+		    err_leave(0, "Parm %d sel %d block %d fetched %d times,"
+			      " expected %d\n", parm, sel, block,
+			      seen[parm][sel][block],
+			      expected[parm][sel][block]);
+	    }
+	}
+    }
+    if (max_gets_outstanding > window)
+	err_leave(0, "%d gets outstanding, window is %d\n",
+		  max_gets_outstanding, window);
+    if ((window > 1) && (max_gets_outstanding < 2))
+	err_leave(0, "Gets were not overlapped with a window of %d\n",
+		  window);
+
+    check_config(done_config);
+
+    rv = PARM_CLEAR_LOCK(p, done_config, config_lock_cleared, NULL);
+    if (rv)
+	err_leave(rv, "Unable to clear the lock\n");
+    bmc_run();
+    if (done_count != 2)
+	err_leave(0, "Lock clear done not called\n");
+    if (bmc_locked)
+	err_leave(0, "Lock was not cleared\n");
+    PARM_FREE_CONFIG(done_config);
+}
+
+static void
+test_fetch_err(parm_t *p)
+{
+    unsigned int parm, sel, block;
+
+    bmc_reset();
+    err_parm = ERR_PARM;
+    err_sel = ERR_SEL;
+    run_fetch(p);
+    if (!err_delivered)
+	err_leave(0, "The error was never sent\n");
+    if (done_err != IPMI_IPMI_ERR_VAL(0xc0))
+	err_leave(done_err, "Fetch did not return the error\n");
+    if (done_config)
+	err_leave(0, "Failed fetch returned a config\n");
+    if (bmc_locked)
+	err_leave(0, "Failed fetch did not clear the lock\n");
+#ifndef TEST_PEF
+    if (p->locked)
+	err_leave(0, "Failed fetch left the parms marked locked\n");
+#endif
+
+    for (parm = 0; parm < NUM_PARMS; parm++) {
+	for (sel = 0; sel < MAX_SEL; sel++) {
+	    for (block = 0; block < MAX_BLOCK; block++) {
+		if (seen[parm][sel][block] > 1)
+		    err_leave(0, "Parm %d sel %d block %d fetched %d times\n",
+			      parm, sel, block, seen[parm][sel][block]);
+	    }
+	}
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    /* 0 is a connection that doesn't say, 16 is more than the code
+       will use. */
+    static unsigned int windows[] = { 1, 2, 3, 4, 5, 6, 7, 8, 16, 0 };
+    unsigned int        i, seed, window, reordered = 0;
+    parm_t              *p;
+
+    if ((argc > 1) && (strcmp(argv[1], "-v") == 0))
+	verbose = 1;
+
+    test_os_hnd = ipmi_posix_setup_os_handler();
+    if (!test_os_hnd)
+	err_leave(0, "Unable to allocate os handler\n");
+    ipmi_malloc_init(test_os_hnd);
+
+    fprintf(stderr, "*** Testing %s config fetch\n", PARM_NAME);
+
+    p = test_alloc();
+    for (i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+	test_max_outstanding = windows[i];
+	window = windows[i];
+	if ((window == 0) || (window > MAX_FETCH_WINDOW))
+	    window = MAX_FETCH_WINDOW;
+	for (seed = 1; seed <= 20; seed++) {
+	    srand(seed);
+	    test_fetch(p, window);
+	    if (window > 1)
+		reordered += out_of_order;
+	    srand(seed);
+	    test_fetch_err(p);
+	}
+    }
+    if (!reordered)
+	err_leave(0, "Responses never came back out of order\n");
+
+    PARM_DESTROY(p, NULL, NULL);
+    if (test_attr.destroy)
+	test_attr.destroy(test_attr.cb_data, test_attr.data);
+    ipmi_malloc_shutdown();
+    test_os_hnd->free_os_handler(test_os_hnd);
+
+    fprintf(stderr, "*** %s config fetch OK\n", PARM_NAME);
+    return 0;
+}
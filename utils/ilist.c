@@ -259,6 +259,12 @@ ilist_unpositioned(ilist_iter_t *iter)
     iter->curr = iter->list->head;
 }
 
+void
+ilist_position_at(ilist_iter_t *iter, ilist_item_t *entry)
+{
+    iter->curr = entry;
+}
+
 void *
 ilist_search_iter(ilist_iter_t *iter, ilist_search_cb cmp, void *cb_data)
 {